@@ -58,6 +58,7 @@ SOURCES += \
     src/denscalvalues.cpp \
     src/denscommand.cpp \
     src/densinterface.cpp \
+    src/displaymirrordialog.cpp \
     src/floatitemdelegate.cpp \
     src/gaincalibrationdialog.cpp \
     src/headlesstask.cpp \
@@ -69,6 +70,8 @@ SOURCES += \
     src/settingsexporter.cpp \
     src/settingsimportdialog.cpp \
     src/slopecalibrationdialog.cpp \
+    src/taskmonitordialog.cpp \
+    src/traceconverter.cpp \
     src/util.cpp \
     src/qsimplesignalaggregator.cpp
 
@@ -77,6 +80,7 @@ HEADERS += \
     src/denscalvalues.h \
     src/denscommand.h \
     src/densinterface.h \
+    src/displaymirrordialog.h \
     src/floatitemdelegate.h \
     src/gaincalibrationdialog.h \
     src/headlesstask.h \
@@ -87,18 +91,22 @@ HEADERS += \
     src/settingsexporter.h \
     src/settingsimportdialog.h \
     src/slopecalibrationdialog.h \
+    src/taskmonitordialog.h \
+    src/traceconverter.h \
     src/util.h \
     src/qsignalaggregator.h \
     src/qsimplesignalaggregator.h
 
 FORMS += \
     src/connectdialog.ui \
+    src/displaymirrordialog.ui \
     src/gaincalibrationdialog.ui \
     src/logwindow.ui \
     src/mainwindow.ui \
     src/remotecontroldialog.ui \
     src/settingsimportdialog.ui \
-    src/slopecalibrationdialog.ui
+    src/slopecalibrationdialog.ui \
+    src/taskmonitordialog.ui
 
 RESOURCES += \
     assets/densitometer.qrc
@@ -46,8 +46,9 @@ public:
 
     QString toString() const;
 
-private:
     static QStringList splitLine(const QByteArray &line);
+
+private:
     QSharedDataPointer<DensCommandData> d;
 };
 
@@ -5,6 +5,17 @@
 #include "denscommand.h"
 #include "util.h"
 
+namespace
+{
+// Layout of the device display buffer, as 8 rows of 16 tiles. Each tile
+// is 8 bytes, one per column, with each byte holding 8 vertical pixels.
+static const int DISPLAY_WIDTH = 128;
+static const int DISPLAY_HEIGHT = 64;
+static const int DISPLAY_TILE_ROWS = 8;
+static const int DISPLAY_TILE_COLUMNS = 16;
+static const int DISPLAY_TILE_SIZE = 8;
+}
+
 DensInterface::DensInterface(QObject *parent)
     : QObject(parent)
     , serialPort_(nullptr)
@@ -13,10 +24,14 @@ DensInterface::DensInterface(QObject *parent)
     , connected_(false)
     , deviceUnrecognized_(false)
     , remoteControlEnabled_(false)
+    , calAllChecked_(false)
+    , calAllSupported_(false)
+    , calAllSetPending_(false)
     , buildChecksum_(0)
     , freeRtosHeapSize_(0)
     , freeRtosHeapWatermark_(0)
     , freeRtosTaskCount_(0)
+    , displayBuffer_(DISPLAY_WIDTH * DISPLAY_HEIGHT / 8, '\0')
 {
 }
 
@@ -34,6 +49,9 @@ bool DensInterface::connectToDevice(QSerialPort *serialPort)
     connecting_ = true;
     deviceUnrecognized_ = false;
     remoteControlEnabled_ = false;
+    calAllChecked_ = false;
+    calAllSupported_ = false;
+    calAllSetPending_ = false;
 
     // Connect to signals for non-blocking command use
     serialPort_ = serialPort;
@@ -59,6 +77,7 @@ void DensInterface::disconnectFromDevice()
     connecting_ = false;
     connected_ = false;
     remoteControlEnabled_ = false;
+    calAllSetPending_ = false;
     if (notify) {
         emit connectionClosed();
     }
@@ -88,6 +107,12 @@ void DensInterface::sendGetSystemRtosInfo()
     sendCommand(command);
 }
 
+void DensInterface::sendGetSystemTasks()
+{
+    DensCommand command(DensCommand::TypeGet, DensCommand::CategorySystem, "TASKS");
+    sendCommand(command);
+}
+
 void DensInterface::sendGetSystemUID()
 {
     DensCommand command(DensCommand::TypeGet, DensCommand::CategorySystem, "UID");
@@ -153,7 +178,19 @@ void DensInterface::sendSetAllowUncalibratedMeasurements(bool allow)
 
 void DensInterface::sendGetDiagDisplayScreenshot()
 {
-    DensCommand command(DensCommand::TypeGet, DensCommand::CategoryDiagnostics, "DISP");
+    QStringList args;
+    args.append("B");
+
+    DensCommand command(DensCommand::TypeGet, DensCommand::CategoryDiagnostics, "DISP", args);
+    sendCommand(command);
+}
+
+void DensInterface::sendSetDiagDisplayMirror(bool enabled)
+{
+    QStringList args;
+    args.append(enabled ? "1" : "0");
+
+    DensCommand command(DensCommand::TypeSet, DensCommand::CategoryDiagnostics, "MIRROR", args);
     sendCommand(command);
 }
 
@@ -211,6 +248,20 @@ void DensInterface::sendSetDiagSensorConfig(int gain, int integration)
     sendCommand(command);
 }
 
+void DensInterface::sendSetDiagSensorFormat(DensInterface::SensorFormat format)
+{
+    QStringList args;
+    args.append("FMT");
+    if (format == SensorFormatBinary) {
+        args.append("B");
+    } else {
+        args.append("T");
+    }
+
+    DensCommand command(DensCommand::TypeSet, DensCommand::CategoryDiagnostics, "S", args);
+    sendCommand(command);
+}
+
 void DensInterface::sendInvokeDiagRead(DensInterface::SensorLight light, int gain, int integration)
 {
     QStringList args;
@@ -242,6 +293,35 @@ void DensInterface::sendSetDiagLoggingModeDebug()
     sendCommand(command);
 }
 
+void DensInterface::sendGetDiagSensorStats()
+{
+    // The counters response comes last, so it can signal that the
+    // histograms have already been updated
+    DensCommand i2cCommand(DensCommand::TypeGet, DensCommand::CategoryDiagnostics,
+                           "STAT", QStringList() << "I2C");
+    sendCommand(i2cCommand);
+
+    DensCommand latCommand(DensCommand::TypeGet, DensCommand::CategoryDiagnostics,
+                           "STAT", QStringList() << "LAT");
+    sendCommand(latCommand);
+
+    DensCommand command(DensCommand::TypeGet, DensCommand::CategoryDiagnostics, "STAT");
+    sendCommand(command);
+}
+
+void DensInterface::sendGetDiagTrace()
+{
+    DensCommand command(DensCommand::TypeGet, DensCommand::CategoryDiagnostics, "TRACE");
+    sendCommand(command);
+}
+
+void DensInterface::sendInvokeDiagSensorStatsReset()
+{
+    DensCommand command(DensCommand::TypeInvoke, DensCommand::CategoryDiagnostics,
+                        "STAT", QStringList() << "RESET");
+    sendCommand(command);
+}
+
 void DensInterface::sendInvokeCalGain()
 {
     DensCommand command(DensCommand::TypeInvoke, DensCommand::CategoryCalibration, "GAIN");
@@ -337,6 +417,116 @@ void DensInterface::sendSetCalTransmission(const DensCalTarget &calTarget)
     sendCommand(command);
 }
 
+void DensInterface::sendGetCalAll()
+{
+    DensCommand command(DensCommand::TypeGet, DensCommand::CategoryCalibration, "ALL");
+    sendCommand(command);
+}
+
+void DensInterface::sendSetCalAll(const DensCalGain &calGain, const DensCalSlope &calSlope,
+                                  const DensCalTarget &calReflection, const DensCalTarget &calTransmission)
+{
+    if (calAllChecked_) {
+        if (calAllSupported_) {
+            sendSetCalSnapshot(calGain, calSlope, calReflection, calTransmission);
+        } else {
+            sendSetCalValues(calGain, calSlope, calReflection, calTransmission);
+        }
+        return;
+    }
+
+    // Firmware that predates the snapshot commands NAKs every record,
+    // and the NAK does not say which record it was for. So hold the values
+    // until a GC ALL request shows which form of the commands to use.
+    pendingCalGain_ = calGain;
+    pendingCalSlope_ = calSlope;
+    pendingCalReflection_ = calReflection;
+    pendingCalTransmission_ = calTransmission;
+    if (!calAllSetPending_) {
+        calAllSetPending_ = true;
+        sendGetCalAll();
+    }
+}
+
+void DensInterface::sendSetCalValues(const DensCalGain &calGain, const DensCalSlope &calSlope,
+                                     const DensCalTarget &calReflection, const DensCalTarget &calTransmission)
+{
+    if (calGain.isValid()) {
+        sendSetCalGain(calGain);
+    }
+    if (calSlope.isValid()) {
+        sendSetCalSlope(calSlope);
+    }
+    if (calReflection.isValidReflection()) {
+        sendSetCalReflection(calReflection);
+    }
+    if (calTransmission.isValidTransmission()) {
+        sendSetCalTransmission(calTransmission);
+    }
+}
+
+void DensInterface::sendSetCalSnapshot(const DensCalGain &calGain, const DensCalSlope &calSlope,
+                                       const DensCalTarget &calReflection, const DensCalTarget &calTransmission)
+{
+    // Any values that are not valid are left out of the snapshot,
+    // so the device keeps its current values for them.
+    QList<QStringList> records;
+
+    if (calGain.isValid()) {
+        records.append(QStringList()
+                       << "G"
+                       << util::encode_f32(calGain.med0())
+                       << util::encode_f32(calGain.med1())
+                       << util::encode_f32(calGain.high0())
+                       << util::encode_f32(calGain.high1())
+                       << util::encode_f32(calGain.max0())
+                       << util::encode_f32(calGain.max1()));
+    }
+    if (calSlope.isValid()) {
+        records.append(QStringList()
+                       << "S"
+                       << util::encode_f32(calSlope.b0())
+                       << util::encode_f32(calSlope.b1())
+                       << util::encode_f32(calSlope.b2()));
+    }
+    if (calReflection.isValidReflection()) {
+        records.append(QStringList()
+                       << "R"
+                       << util::encode_f32(calReflection.loDensity())
+                       << util::encode_f32(calReflection.loReading())
+                       << util::encode_f32(calReflection.hiDensity())
+                       << util::encode_f32(calReflection.hiReading()));
+    }
+    if (calTransmission.isValidTransmission()) {
+        records.append(QStringList()
+                       << "T"
+                       << util::encode_f32(calTransmission.loDensity())
+                       << util::encode_f32(calTransmission.loReading())
+                       << util::encode_f32(calTransmission.hiDensity())
+                       << util::encode_f32(calTransmission.hiReading()));
+    }
+    if (records.isEmpty()) { return; }
+
+    // The records are sent back-to-back, and the device only saves them
+    // once the final checksum record has been verified.
+    QByteArray checksumData;
+    for (const QStringList &record : qAsConst(records)) {
+        checksumData.append(record.join(QLatin1Char(',')).toLatin1());
+        checksumData.append("\r\n");
+        DensCommand command(DensCommand::TypeSet, DensCommand::CategoryCalibration, "ALL", record);
+        sendCommand(command);
+    }
+
+    const uint16_t crc = util::crc16_ccitt(reinterpret_cast<const uint8_t *>(checksumData.constData()),
+                                           static_cast<size_t>(checksumData.size()));
+    QStringList args;
+    args.append("C");
+    args.append(QString("%1").arg(crc, 4, 16, QLatin1Char('0')).toUpper());
+
+    DensCommand command(DensCommand::TypeSet, DensCommand::CategoryCalibration, "ALL", args);
+    sendCommand(command);
+}
+
 bool DensInterface::connected() const { return connected_; }
 bool DensInterface::deviceUnrecognized() const { return deviceUnrecognized_; }
 bool DensInterface::remoteControlEnabled() const { return remoteControlEnabled_; }
@@ -356,6 +546,7 @@ QString DensInterface::freeRtosVersion() const { return freeRtosVersion_; }
 uint32_t DensInterface::freeRtosHeapSize() const { return freeRtosHeapSize_; }
 uint32_t DensInterface::freeRtosHeapWatermark() const { return freeRtosHeapWatermark_; }
 uint32_t DensInterface::freeRtosTaskCount() const { return freeRtosTaskCount_; }
+QList<DensInterface::TaskInfo> DensInterface::taskInfo() const { return taskInfo_; }
 
 QString DensInterface::uniqueId() const { return uniqueId_; }
 
@@ -369,9 +560,45 @@ DensCalSlope DensInterface::calSlope() const { return calSlope_; }
 DensCalTarget DensInterface::calReflection() const { return calReflection_; }
 DensCalTarget DensInterface::calTransmission() const { return calTransmission_; }
 
+DensInterface::SensorStats DensInterface::sensorStats() const { return sensorStats_; }
+
+QImage DensInterface::displayImage() const
+{
+    QImage image(DISPLAY_WIDTH, DISPLAY_HEIGHT, QImage::Format_Mono);
+    image.setColor(0, qRgb(0, 0, 0));
+    image.setColor(1, qRgb(255, 255, 255));
+
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(displayBuffer_.constData());
+    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+        for (int x = 0; x < DISPLAY_WIDTH; x++) {
+            const uint8_t value = data[((y / 8) * DISPLAY_WIDTH) + x];
+            image.setPixel(x, y, (value >> (y % 8)) & 0x01);
+        }
+    }
+
+    // The buffer is in the orientation of the display panel,
+    // which is mounted upside down
+    return image.mirrored(true, true);
+}
+
 void DensInterface::readData()
 {
-    while (serialPort_->canReadLine()) {
+    for (;;) {
+        // Binary frames start with a zero byte, which never appears
+        // within a normal response line
+        char ch;
+        if (serialPort_->peek(&ch, 1) == 1 && ch == '\0') {
+            if (readFrame()) {
+                continue;
+            } else {
+                break;
+            }
+        }
+
+        if (!serialPort_->canReadLine()) {
+            break;
+        }
+
         const QByteArray line = serialPort_->readLine();
         if (connecting_) {
             // In connecting mode we expect to only receive very specific
@@ -450,6 +677,12 @@ void DensInterface::readData()
 
             if (response.args().size() == 1 && response.args().at(0) == QLatin1String("NAK")) {
                 qWarning() << "Invalid command:" << response.toString();
+                if (response.category() == DensCommand::CategoryCalibration
+                        && response.type() == DensCommand::TypeGet
+                        && response.action() == QLatin1String("ALL")) {
+                    readCalAllSupport(false);
+                    emit calAllNotSupported();
+                }
             } else if (response.args().size() == 1 && response.args().at(0) == QLatin1String("[[")) {
                 multilineResponse_ = response;
                 multilineBuffer_.clear();
@@ -599,6 +832,23 @@ void DensInterface::readSystemResponse(const DensCommand &response)
                 freeRtosTaskCount_ = args.at(3).toUInt();
             }
             emit systemRtosResponse();
+        } else if (response.action() == QLatin1String("TASKS")) {
+            taskInfo_.clear();
+            const QList<QByteArray> lines = response.buffer().split('\n');
+            for (const QByteArray &line : lines) {
+                const QList<QByteArray> fields = line.trimmed().split(',');
+                if (fields.size() != 7) { continue; }
+                TaskInfo info;
+                info.name = QString::fromLatin1(fields.at(0));
+                info.number = fields.at(1).toInt();
+                info.state = fields.at(2).toInt();
+                info.priority = fields.at(3).toInt();
+                info.cpuUsage = fields.at(4).toInt() / 10.0F;
+                info.stackFree = fields.at(5).toUInt();
+                info.stackSize = fields.at(6).toUInt();
+                taskInfo_.append(info);
+            }
+            emit systemTasksResponse();
         } else if (response.action() == QLatin1String("UID")) {
             if (args.length() > 0) {
                 uniqueId_ = args.at(0);
@@ -651,7 +901,9 @@ void DensInterface::readCalibrationResponse(const DensCommand &response)
             if (!ok) { status = -1; }
             int param = response.args().size() > 2 ? response.args().at(2).toInt(&ok) : -1;
             if (!ok) { param = -1; }
-            emit calGainCalStatus(status, param);
+            int remaining = response.args().size() > 3 ? response.args().at(3).toInt(&ok) : -1;
+            if (!ok) { remaining = -1; }
+            emit calGainCalStatus(status, param, remaining);
         }
     } else if (response.type() == DensCommand::TypeGet
                && response.action() == QLatin1String("LIGHT")
@@ -704,9 +956,129 @@ void DensInterface::readCalibrationResponse(const DensCommand &response)
         emit calTransmissionResponse();
     } else if (isResponseSetOk(response, QLatin1String("TRAN"))) {
         emit calTransmissionSetComplete();
+    } else if (response.type() == DensCommand::TypeGet
+               && response.action() == QLatin1String("ALL")) {
+        readCalAllSupport(true);
+        if (readCalAllResponse(response.buffer())) {
+            emit calAllResponse();
+        } else {
+            qWarning() << "Invalid calibration snapshot";
+        }
+    } else if (response.type() == DensCommand::TypeSet
+               && response.action() == QLatin1String("ALL")
+               && response.args().length() == 2
+               && response.args().at(0) == QLatin1String("C")) {
+        if (response.args().at(1) == QLatin1String("OK")) {
+            emit calAllSetComplete();
+        } else {
+            qWarning() << "Calibration snapshot was not saved";
+        }
+    }
+}
+
+void DensInterface::readCalAllSupport(bool supported)
+{
+    calAllChecked_ = true;
+    calAllSupported_ = supported;
+
+    if (calAllSetPending_) {
+        calAllSetPending_ = false;
+        sendSetCalAll(pendingCalGain_, pendingCalSlope_, pendingCalReflection_, pendingCalTransmission_);
+        pendingCalGain_ = DensCalGain();
+        pendingCalSlope_ = DensCalSlope();
+        pendingCalReflection_ = DensCalTarget();
+        pendingCalTransmission_ = DensCalTarget();
     }
 }
 
+bool DensInterface::readCalAllResponse(const QByteArray &buffer)
+{
+    // Values are only applied once the checksum at the end
+    // of the snapshot has been verified
+    QString projectName;
+    QString version;
+    QDateTime buildDate;
+    QString buildDescribe;
+    uint32_t buildChecksum = 0;
+    QString uniqueId;
+    DensCalLight calLight = calLight_;
+    DensCalGain calGain = calGain_;
+    DensCalSlope calSlope = calSlope_;
+    DensCalTarget calReflection = calReflection_;
+    DensCalTarget calTransmission = calTransmission_;
+
+    int offset = 0;
+    while (offset < buffer.size()) {
+        int end = buffer.indexOf('\n', offset);
+        if (end < 0) { end = buffer.size() - 1; }
+        const QStringList args = DensCommand::splitLine(buffer.mid(offset, end - offset + 1));
+
+        if (!args.isEmpty() && args.at(0) == QLatin1String("C") && args.length() == 2) {
+            bool ok;
+            const uint16_t crc = static_cast<uint16_t>(args.at(1).toUInt(&ok, 16));
+            if (!ok || crc != util::crc16_ccitt(reinterpret_cast<const uint8_t *>(buffer.constData()),
+                                                static_cast<size_t>(offset))) {
+                return false;
+            }
+
+            projectName_ = projectName;
+            version_ = version;
+            buildDate_ = buildDate;
+            buildDescribe_ = buildDescribe;
+            buildChecksum_ = buildChecksum;
+            uniqueId_ = uniqueId;
+            calLight_ = calLight;
+            calGain_ = calGain;
+            calSlope_ = calSlope;
+            calReflection_ = calReflection;
+            calTransmission_ = calTransmission;
+            return true;
+        } else if (args.length() == 3 && args.at(0) == QLatin1String("V")) {
+            projectName = args.at(1);
+            version = args.at(2);
+        } else if (args.length() == 4 && args.at(0) == QLatin1String("B")) {
+            buildDate = QDateTime::fromString(args.at(1), "yyyy-MM-dd hh:mm");
+            buildDescribe = args.at(2);
+            bool ok;
+            buildChecksum = args.at(3).toUInt(&ok, 16);
+            if (!ok) { buildChecksum = 0; }
+        } else if (args.length() == 2 && args.at(0) == QLatin1String("U")) {
+            uniqueId = args.at(1);
+        } else if (args.length() == 3 && args.at(0) == QLatin1String("L")) {
+            calLight.setReflectionValue(args.at(1).toInt());
+            calLight.setTransmissionValue(args.at(2).toInt());
+        } else if (args.length() == 7 && args.at(0) == QLatin1String("G")) {
+            calGain.setLow0(1.0F);
+            calGain.setLow1(1.0F);
+            calGain.setMed0(util::decode_f32(args.at(1)));
+            calGain.setMed1(util::decode_f32(args.at(2)));
+            calGain.setHigh0(util::decode_f32(args.at(3)));
+            calGain.setHigh1(util::decode_f32(args.at(4)));
+            calGain.setMax0(util::decode_f32(args.at(5)));
+            calGain.setMax1(util::decode_f32(args.at(6)));
+        } else if (args.length() == 4 && args.at(0) == QLatin1String("S")) {
+            calSlope.setB0(util::decode_f32(args.at(1)));
+            calSlope.setB1(util::decode_f32(args.at(2)));
+            calSlope.setB2(util::decode_f32(args.at(3)));
+        } else if (args.length() == 5 && args.at(0) == QLatin1String("R")) {
+            calReflection.setLoDensity(util::decode_f32(args.at(1)));
+            calReflection.setLoReading(util::decode_f32(args.at(2)));
+            calReflection.setHiDensity(util::decode_f32(args.at(3)));
+            calReflection.setHiReading(util::decode_f32(args.at(4)));
+        } else if (args.length() == 5 && args.at(0) == QLatin1String("T")) {
+            calTransmission.setLoDensity(util::decode_f32(args.at(1)));
+            calTransmission.setLoReading(util::decode_f32(args.at(2)));
+            calTransmission.setHiDensity(util::decode_f32(args.at(3)));
+            calTransmission.setHiReading(util::decode_f32(args.at(4)));
+        }
+
+        offset = end + 1;
+    }
+
+    // Snapshot ended without a checksum record
+    return false;
+}
+
 bool DensInterface::isResponseSetOk(const DensCommand &response, QLatin1String action)
 {
     if (response.type() == DensCommand::TypeSet
@@ -723,8 +1095,13 @@ void DensInterface::readDiagnosticsResponse(const DensCommand &response)
 {
     if (response.type() == DensCommand::TypeGet
             && response.action() == QLatin1String("DISP")
-            && !response.buffer().isEmpty()) {
-        emit diagDisplayScreenshot(response.buffer());
+            && response.args().size() == 1
+            && response.args().at(0) == QLatin1String("OK")) {
+        // The display frames all arrive ahead of this response
+        emit diagDisplayScreenshot(displayImage());
+    } else if (response.type() == DensCommand::TypeGet
+               && response.action() == QLatin1String("TRACE")) {
+        emit diagTraceResponse(response.buffer());
     } else if (response.type() == DensCommand::TypeSet
                && response.action() == QLatin1String("LR")
                && response.args().size() == 1
@@ -757,6 +1134,36 @@ void DensInterface::readDiagnosticsResponse(const DensCommand &response)
         emit diagSensorInvokeReading(
                     response.args().at(0).toInt(),
                     response.args().at(1).toInt());
+    } else if (response.type() == DensCommand::TypeGet
+               && response.action() == QLatin1String("STAT")
+               && response.args().size() > 1
+               && (response.args().at(0) == QLatin1String("I2C")
+                   || response.args().at(0) == QLatin1String("LAT"))) {
+        QVector<uint32_t> histogram;
+        for (int i = 1; i < response.args().size(); i++) {
+            histogram.append(response.args().at(i).toUInt());
+        }
+        if (response.args().at(0) == QLatin1String("I2C")) {
+            sensorStats_.i2cHistogram = histogram;
+        } else {
+            sensorStats_.latencyHistogram = histogram;
+        }
+    } else if (response.type() == DensCommand::TypeGet
+               && response.action() == QLatin1String("STAT")
+               && response.args().size() == 6) {
+        sensorStats_.readings = response.args().at(0).toUInt();
+        sensorStats_.overwritten = response.args().at(1).toUInt();
+        sensorStats_.queueErrors = response.args().at(2).toUInt();
+        sensorStats_.discarded = response.args().at(3).toUInt();
+        sensorStats_.i2cErrors = response.args().at(4).toUInt();
+        sensorStats_.i2cTimeouts = response.args().at(5).toUInt();
+        emit diagSensorStatsResponse();
+    } else if (response.type() == DensCommand::TypeInvoke
+               && response.action() == QLatin1String("STAT")
+               && response.args().size() == 1
+               && response.args().at(0) == QLatin1String("OK")) {
+        sensorStats_ = SensorStats();
+        emit diagSensorStatsReset();
     } else if (response.type() == DensCommand::TypeGet
             && response.action() == QLatin1String("LOG")
             && response.args().size() == 1
@@ -767,6 +1174,104 @@ void DensInterface::readDiagnosticsResponse(const DensCommand &response)
     }
 }
 
+bool DensInterface::readFrame()
+{
+    // Frames are sent as: 0x00 <COBS encoded record> 0x00
+    const QByteArray pending = serialPort_->peek(serialPort_->bytesAvailable());
+    const int end = pending.indexOf('\0', 1);
+    if (end < 0) {
+        // Wait for the rest of the frame to arrive
+        return false;
+    }
+    if (end == 1) {
+        // Back-to-back delimiters, so discard the first one and treat
+        // the second one as the start of the next frame
+        serialPort_->read(1);
+        return true;
+    }
+    serialPort_->read(end + 1);
+
+    const QByteArray record = util::cobs_decode(pending.mid(1, end - 1));
+    if (record.size() < 3) {
+        qWarning() << "Invalid frame:" << pending.left(end + 1).toHex();
+        return true;
+    }
+
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(record.constData());
+    const size_t len = static_cast<size_t>(record.size());
+    const uint16_t crc = static_cast<uint16_t>(data[len - 2] << 8 | data[len - 1]);
+    if (util::crc16_ccitt(data, len - 2) != crc) {
+        qWarning() << "Frame checksum error:" << record.toHex();
+        return true;
+    }
+
+    if (record.at(0) == 'S') {
+        readSensorFrame(record);
+    } else if (record.at(0) == 'D') {
+        readDisplayFrame(record);
+    } else {
+        qWarning() << "Unrecognized frame:" << record.toHex();
+    }
+    return true;
+}
+
+void DensInterface::readSensorFrame(const QByteArray &record)
+{
+    // Older firmware sends 21 byte frames without the microsecond timestamps
+    if (record.size() != 21 && record.size() != 33) {
+        qWarning() << "Invalid sensor frame:" << record.toHex();
+        return;
+    }
+
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(record.constData());
+
+    SensorReading reading;
+    reading.ch0 = data[1] << 8 | data[2];
+    reading.ch1 = data[3] << 8 | data[4];
+    reading.gain = data[5];
+    reading.time = data[6];
+    reading.readingTicks = util::copy_to_u32(data + 7);
+    reading.lightTicks = util::copy_to_u32(data + 11);
+    reading.readingCount = util::copy_to_u32(data + 15);
+    if (record.size() >= 33) {
+        reading.readingUs = util::copy_to_u32(data + 19);
+        reading.lightUs = util::copy_to_u32(data + 23);
+        reading.dispatchUs = util::copy_to_u32(data + 27);
+    }
+
+    emit diagSensorRawReading(reading);
+    emit diagSensorGetReading(reading.ch0, reading.ch1);
+}
+
+void DensInterface::readDisplayFrame(const QByteArray &record)
+{
+    // Record: type, sequence, flags, tile row, first tile column,
+    // tile count, PackBits encoded tile data, CRC
+    if (record.size() < 9) {
+        qWarning() << "Invalid display frame:" << record.toHex();
+        return;
+    }
+
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(record.constData());
+    const int row = data[3];
+    const int column = data[4];
+    const int count = data[5];
+    if (row >= DISPLAY_TILE_ROWS || column + count > DISPLAY_TILE_COLUMNS) {
+        qWarning() << "Invalid display frame:" << record.toHex();
+        return;
+    }
+
+    const QByteArray tiles = util::packbits_decode(record.mid(6, record.size() - 8));
+    if (tiles.size() != count * DISPLAY_TILE_SIZE) {
+        qWarning() << "Invalid display frame:" << record.toHex();
+        return;
+    }
+
+    const int offset = ((row * DISPLAY_TILE_COLUMNS) + column) * DISPLAY_TILE_SIZE;
+    displayBuffer_.replace(offset, tiles.size(), tiles);
+    emit diagDisplayChanged();
+}
+
 bool DensInterface::sendCommand(const DensCommand &command)
 {
     if (!serialPort_ || !serialPort_->isOpen() || !command.isValid()) {
@@ -5,6 +5,8 @@
 #include <QObject>
 #include <QSerialPort>
 #include <QDateTime>
+#include <QVector>
+#include <QImage>
 #include "denscommand.h"
 #include "denscalvalues.h"
 
@@ -32,6 +34,46 @@ public:
     };
     Q_ENUM(SensorLight)
 
+    enum SensorFormat {
+        SensorFormatText,
+        SensorFormatBinary
+    };
+    Q_ENUM(SensorFormat)
+
+    struct SensorReading {
+        int ch0 = 0;
+        int ch1 = 0;
+        int gain = 0;
+        int time = 0;
+        uint32_t readingTicks = 0;
+        uint32_t lightTicks = 0;
+        uint32_t readingCount = 0;
+        uint32_t readingUs = 0;
+        uint32_t lightUs = 0;
+        uint32_t dispatchUs = 0;
+    };
+
+    struct TaskInfo {
+        QString name;
+        int number = 0;
+        int state = 0;
+        int priority = 0;
+        float cpuUsage = 0;
+        uint32_t stackFree = 0;
+        uint32_t stackSize = 0;
+    };
+
+    struct SensorStats {
+        uint32_t readings = 0;
+        uint32_t overwritten = 0;
+        uint32_t queueErrors = 0;
+        uint32_t discarded = 0;
+        uint32_t i2cErrors = 0;
+        uint32_t i2cTimeouts = 0;
+        QVector<uint32_t> i2cHistogram;
+        QVector<uint32_t> latencyHistogram;
+    };
+
     explicit DensInterface(QObject *parent = nullptr);
     bool connectToDevice(QSerialPort *serialPort);
     void disconnectFromDevice();
@@ -41,6 +83,7 @@ public slots:
     void sendGetSystemBuild();
     void sendGetSystemDeviceInfo();
     void sendGetSystemRtosInfo();
+    void sendGetSystemTasks();
     void sendGetSystemUID();
     void sendGetSystemInternalSensors();
     void sendInvokeSystemRemoteControl(bool enabled);
@@ -50,14 +93,19 @@ public slots:
     void sendSetAllowUncalibratedMeasurements(bool allow);
 
     void sendGetDiagDisplayScreenshot();
+    void sendSetDiagDisplayMirror(bool enabled);
     void sendSetDiagLightRefl(int value);
     void sendSetDiagLightTran(int value);
     void sendInvokeDiagSensorStart();
     void sendInvokeDiagSensorStop();
     void sendSetDiagSensorConfig(int gain, int integration);
+    void sendSetDiagSensorFormat(DensInterface::SensorFormat format);
     void sendInvokeDiagRead(DensInterface::SensorLight light, int gain, int integration);
     void sendSetDiagLoggingModeUsb();
     void sendSetDiagLoggingModeDebug();
+    void sendGetDiagSensorStats();
+    void sendGetDiagTrace();
+    void sendInvokeDiagSensorStatsReset();
 
     void sendInvokeCalGain();
     void sendGetCalLight();
@@ -70,6 +118,9 @@ public slots:
     void sendSetCalReflection(const DensCalTarget &calTarget);
     void sendGetCalTransmission();
     void sendSetCalTransmission(const DensCalTarget &calTarget);
+    void sendGetCalAll();
+    void sendSetCalAll(const DensCalGain &calGain, const DensCalSlope &calSlope,
+                       const DensCalTarget &calReflection, const DensCalTarget &calTransmission);
 
 public:
     bool connected() const;
@@ -92,6 +143,7 @@ public:
     uint32_t freeRtosHeapSize() const;
     uint32_t freeRtosHeapWatermark() const;
     uint32_t freeRtosTaskCount() const;
+    QList<DensInterface::TaskInfo> taskInfo() const;
 
     QString uniqueId() const;
 
@@ -105,6 +157,10 @@ public:
     DensCalTarget calReflection() const;
     DensCalTarget calTransmission() const;
 
+    SensorStats sensorStats() const;
+
+    QImage displayImage() const;
+
 signals:
     void connectionOpened();
     void connectionClosed();
@@ -118,22 +174,28 @@ signals:
     void systemBuildResponse();
     void systemDeviceResponse();
     void systemRtosResponse();
+    void systemTasksResponse();
     void systemUniqueId();
     void systemInternalSensors();
     void systemRemoteControl(bool enabled);
 
-    void diagDisplayScreenshot(const QByteArray &data);
+    void diagDisplayScreenshot(const QImage &image);
+    void diagDisplayChanged();
     void diagLightReflChanged();
     void diagLightTranChanged();
     void diagSensorInvoked();
     void diagSensorChanged();
     void diagSensorGetReading(int ch0, int ch1);
+    void diagSensorRawReading(const DensInterface::SensorReading &reading);
     void diagSensorInvokeReading(int ch0, int ch1);
     void diagLogLine(const QByteArray &data);
+    void diagSensorStatsResponse();
+    void diagSensorStatsReset();
+    void diagTraceResponse(const QByteArray &data);
 
     void calLightResponse();
     void calLightSetComplete();
-    void calGainCalStatus(int status, int param);
+    void calGainCalStatus(int status, int param, int remaining);
     void calGainCalFinished();
     void calGainCalError();
     void calGainResponse();
@@ -144,6 +206,9 @@ signals:
     void calReflectionSetComplete();
     void calTransmissionResponse();
     void calTransmissionSetComplete();
+    void calAllResponse();
+    void calAllSetComplete();
+    void calAllNotSupported();
 
 private slots:
     void readData();
@@ -151,11 +216,20 @@ private slots:
 
 private:
     static bool isLogLine(const QByteArray &line);
+    bool readFrame();
+    void readSensorFrame(const QByteArray &record);
+    void readDisplayFrame(const QByteArray &record);
     void readDensityResponse(const DensCommand &response);
     void readCommandResponse(const DensCommand &response);
     void readSystemResponse(const DensCommand &response);
     void readMeasurementResponse(const DensCommand &response);
     void readCalibrationResponse(const DensCommand &response);
+    bool readCalAllResponse(const QByteArray &buffer);
+    void readCalAllSupport(bool supported);
+    void sendSetCalValues(const DensCalGain &calGain, const DensCalSlope &calSlope,
+                          const DensCalTarget &calReflection, const DensCalTarget &calTransmission);
+    void sendSetCalSnapshot(const DensCalGain &calGain, const DensCalSlope &calSlope,
+                            const DensCalTarget &calReflection, const DensCalTarget &calTransmission);
     void readDiagnosticsResponse(const DensCommand &response);
     static bool isResponseSetOk(const DensCommand &response, QLatin1String action);
 
@@ -169,6 +243,9 @@ private:
     bool connected_;
     bool deviceUnrecognized_;
     bool remoteControlEnabled_;
+    bool calAllChecked_;
+    bool calAllSupported_;
+    bool calAllSetPending_;
 
     QString projectName_;
     QString version_;
@@ -183,6 +260,7 @@ private:
     uint32_t freeRtosHeapSize_;
     uint32_t freeRtosHeapWatermark_;
     uint32_t freeRtosTaskCount_;
+    QList<TaskInfo> taskInfo_;
     QString uniqueId_;
     QString mcuVdda_;
     QString mcuTemp_;
@@ -191,6 +269,14 @@ private:
     DensCalSlope calSlope_;
     DensCalTarget calReflection_;
     DensCalTarget calTransmission_;
+    DensCalGain pendingCalGain_;
+    DensCalSlope pendingCalSlope_;
+    DensCalTarget pendingCalReflection_;
+    DensCalTarget pendingCalTransmission_;
+    SensorStats sensorStats_;
+    QByteArray displayBuffer_;
 };
 
+Q_DECLARE_METATYPE(DensInterface::SensorReading)
+
 #endif // DENSINTERFACE_H
@@ -0,0 +1,85 @@
+#include "displaymirrordialog.h"
+#include "ui_displaymirrordialog.h"
+
+#include <QTimer>
+#include <QPushButton>
+#include <QFileDialog>
+#include <QPixmap>
+#include <QDebug>
+
+namespace
+{
+// Size of each device display pixel in the mirror
+static const int DISPLAY_SCALE = 4;
+}
+
+DisplayMirrorDialog::DisplayMirrorDialog(DensInterface *densInterface, QWidget *parent) :
+    QDialog(parent),
+    ui(new Ui::DisplayMirrorDialog),
+    densInterface_(densInterface)
+{
+    ui->setupUi(this);
+
+    QPushButton *saveButton = ui->buttonBox->addButton(tr("Save..."), QDialogButtonBox::ActionRole);
+    connect(saveButton, &QPushButton::clicked, this, &DisplayMirrorDialog::onSaveClicked);
+
+    connect(densInterface_, &DensInterface::diagDisplayChanged, this, &DisplayMirrorDialog::onDiagDisplayChanged);
+
+    onRefreshDisplay();
+}
+
+DisplayMirrorDialog::~DisplayMirrorDialog()
+{
+    delete ui;
+}
+
+void DisplayMirrorDialog::showEvent(QShowEvent *event)
+{
+    QDialog::showEvent(event);
+    if (densInterface_->connected()) {
+        // The device starts by sending the whole display
+        densInterface_->sendSetDiagDisplayMirror(true);
+    }
+}
+
+void DisplayMirrorDialog::hideEvent(QHideEvent *event)
+{
+    if (densInterface_->connected()) {
+        densInterface_->sendSetDiagDisplayMirror(false);
+    }
+    QDialog::hideEvent(event);
+}
+
+void DisplayMirrorDialog::onDiagDisplayChanged()
+{
+    // Each display update arrives as several frames, so wait until
+    // they have all been read before redrawing the mirror
+    if (!refreshPending_) {
+        refreshPending_ = true;
+        QTimer::singleShot(0, this, &DisplayMirrorDialog::onRefreshDisplay);
+    }
+}
+
+void DisplayMirrorDialog::onRefreshDisplay()
+{
+    refreshPending_ = false;
+    const QImage image = densInterface_->displayImage();
+    ui->displayLabel->setPixmap(QPixmap::fromImage(
+                                    image.scaled(image.size() * DISPLAY_SCALE,
+                                                 Qt::IgnoreAspectRatio, Qt::FastTransformation)));
+}
+
+void DisplayMirrorDialog::onSaveClicked()
+{
+    const QImage image = densInterface_->displayImage();
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save Screenshot"),
+                                                    "screenshot.png",
+                                                    tr("Images (*.png *.jpg)"));
+    if (!fileName.isEmpty()) {
+        if (image.save(fileName)) {
+            qDebug() << "Saved screenshot to:" << fileName;
+        } else {
+            qDebug() << "Error saving screenshot to:" << fileName;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef DISPLAYMIRRORDIALOG_H
+#define DISPLAYMIRRORDIALOG_H
+
+#include <QDialog>
+#include "densinterface.h"
+
+namespace Ui {
+class DisplayMirrorDialog;
+}
+
+class DisplayMirrorDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit DisplayMirrorDialog(DensInterface *densInterface, QWidget *parent = nullptr);
+    ~DisplayMirrorDialog();
+
+protected:
+    void showEvent(QShowEvent *event) override;
+    void hideEvent(QHideEvent *event) override;
+
+private slots:
+    void onDiagDisplayChanged();
+    void onRefreshDisplay();
+    void onSaveClicked();
+
+private:
+    Ui::DisplayMirrorDialog *ui;
+    DensInterface *densInterface_;
+    bool refreshPending_ = false;
+};
+
+#endif // DISPLAYMIRRORDIALOG_H
@@ -78,8 +78,14 @@ void GainCalibrationDialog::onSystemRemoteControl(bool enabled)
     }
 }
 
-void GainCalibrationDialog::onCalGainCalStatus(int status, int param)
+void GainCalibrationDialog::onCalGainCalStatus(int status, int param, int remaining)
 {
+    if (remaining >= 0) {
+        ui->groupBox->setTitle(tr("Estimated time remaining: %1:%2")
+                               .arg(remaining / 60)
+                               .arg(remaining % 60, 2, 10, QChar('0')));
+    }
+
     if (status == lastStatus_ && param == lastParam_) {
         return;
     }
@@ -135,6 +141,7 @@ QString GainCalibrationDialog::lightParamText(int param)
 
 void GainCalibrationDialog::onCalGainCalFinished()
 {
+    ui->groupBox->setTitle(QString());
     addText(tr("Gain calibration complete!"));
     running_ = false;
     success_ = true;
@@ -143,6 +150,7 @@ void GainCalibrationDialog::onCalGainCalFinished()
 
 void GainCalibrationDialog::onCalGainCalError()
 {
+    ui->groupBox->setTitle(QString());
     addText(tr("Gain calibration failed!"));
     running_ = false;
     success_ = false;
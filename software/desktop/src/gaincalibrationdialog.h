@@ -27,7 +27,7 @@ protected:
 
 private slots:
     void onSystemRemoteControl(bool enabled);
-    void onCalGainCalStatus(int status, int param);
+    void onCalGainCalStatus(int status, int param, int remaining);
     void onCalGainCalFinished();
     void onCalGainCalError();
 
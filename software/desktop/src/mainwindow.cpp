@@ -16,6 +16,9 @@
 #include "connectdialog.h"
 #include "densinterface.h"
 #include "remotecontroldialog.h"
+#include "taskmonitordialog.h"
+#include "displaymirrordialog.h"
+#include "traceconverter.h"
 #include "gaincalibrationdialog.h"
 #include "slopecalibrationdialog.h"
 #include "logwindow.h"
@@ -123,6 +126,9 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->actionImportSettings, &QAction::triggered, this, &MainWindow::onImportSettings);
     connect(ui->actionExportSettings, &QAction::triggered, this, &MainWindow::onExportSettings);
     connect(ui->actionLogger, &QAction::triggered, this, &MainWindow::onLogger);
+    connect(ui->actionTaskMonitor, &QAction::triggered, this, &MainWindow::onTaskMonitor);
+    connect(ui->actionDisplayMirror, &QAction::triggered, this, &MainWindow::onDisplayMirror);
+    connect(ui->actionExportTrace, &QAction::triggered, this, &MainWindow::onExportTrace);
     connect(ui->actionAbout, &QAction::triggered, this, &MainWindow::about);
 
     // Log window UI signals
@@ -165,12 +171,15 @@ MainWindow::MainWindow(QWidget *parent)
     connect(densInterface_, &DensInterface::systemUniqueId, this, &MainWindow::onSystemUniqueId);
     connect(densInterface_, &DensInterface::systemInternalSensors, this, &MainWindow::onSystemInternalSensors);
     connect(densInterface_, &DensInterface::diagDisplayScreenshot, this, &MainWindow::onDiagDisplayScreenshot);
+    connect(densInterface_, &DensInterface::diagTraceResponse, this, &MainWindow::onDiagTraceResponse);
     connect(densInterface_, &DensInterface::diagLogLine, logWindow_, &LogWindow::appendLogLine);
     connect(densInterface_, &DensInterface::calLightResponse, this, &MainWindow::onCalLightResponse);
     connect(densInterface_, &DensInterface::calGainResponse, this, &MainWindow::onCalGainResponse);
     connect(densInterface_, &DensInterface::calSlopeResponse, this, &MainWindow::onCalSlopeResponse);
     connect(densInterface_, &DensInterface::calReflectionResponse, this, &MainWindow::onCalReflectionResponse);
     connect(densInterface_, &DensInterface::calTransmissionResponse, this, &MainWindow::onCalTransmissionResponse);
+    connect(densInterface_, &DensInterface::calAllResponse, this, &MainWindow::onCalAllResponse);
+    connect(densInterface_, &DensInterface::calAllNotSupported, this, &MainWindow::onCalAllNotSupported);
 
     // Loop back the set-complete signals to refresh their associated values
     connect(densInterface_, &DensInterface::calLightSetComplete, densInterface_, &DensInterface::sendGetCalLight);
@@ -178,6 +187,7 @@ MainWindow::MainWindow(QWidget *parent)
     connect(densInterface_, &DensInterface::calSlopeSetComplete, densInterface_, &DensInterface::sendGetCalSlope);
     connect(densInterface_, &DensInterface::calReflectionSetComplete, densInterface_, &DensInterface::sendGetCalReflection);
     connect(densInterface_, &DensInterface::calTransmissionSetComplete, densInterface_, &DensInterface::sendGetCalTransmission);
+    connect(densInterface_, &DensInterface::calAllSetComplete, densInterface_, &DensInterface::sendGetCalAll);
 
     // Setup the measurement model
     measModel_ = new QStandardItemModel(MEAS_TABLE_ROWS, 2, this);
@@ -313,7 +323,6 @@ void MainWindow::onImportSettings()
 
                 if (messageBox.exec() == QMessageBox::Ok) {
                     importDialog.sendSelectedSettings(densInterface_);
-                    onCalGetAllValues();
                 }
             }
         }
@@ -384,6 +393,9 @@ void MainWindow::refreshButtonState()
     if (connected) {
         ui->actionImportSettings->setEnabled(true);
         ui->actionExportSettings->setEnabled(true);
+        ui->actionTaskMonitor->setEnabled(true);
+        ui->actionDisplayMirror->setEnabled(true);
+        ui->actionExportTrace->setEnabled(true);
         ui->refreshSensorsPushButton->setEnabled(true);
         ui->screenshotButton->setEnabled(true);
         ui->remotePushButton->setEnabled(true);
@@ -419,6 +431,9 @@ void MainWindow::refreshButtonState()
     } else {
         ui->actionImportSettings->setEnabled(false);
         ui->actionExportSettings->setEnabled(false);
+        ui->actionTaskMonitor->setEnabled(false);
+        ui->actionDisplayMirror->setEnabled(false);
+        ui->actionExportTrace->setEnabled(false);
         ui->refreshSensorsPushButton->setEnabled(false);
         ui->screenshotButton->setEnabled(false);
         ui->remotePushButton->setEnabled(false);
@@ -951,11 +966,7 @@ void MainWindow::onClearTableClicked()
 
 void MainWindow::onCalGetAllValues()
 {
-    densInterface_->sendGetCalLight();
-    densInterface_->sendGetCalGain();
-    densInterface_->sendGetCalSlope();
-    densInterface_->sendGetCalReflection();
-    densInterface_->sendGetCalTransmission();
+    densInterface_->sendGetCalAll();
 }
 
 void MainWindow::onCalLightSetClicked()
@@ -1243,14 +1254,10 @@ void MainWindow::onSystemInternalSensors()
     ui->mcuTempLabel->setText(tr("Temperature: %1").arg(densInterface_->mcuTemp()));
 }
 
-void MainWindow::onDiagDisplayScreenshot(const QByteArray &data)
+void MainWindow::onDiagDisplayScreenshot(const QImage &image)
 {
-    qDebug() << "Got screenshot:" << data.size();
-    QImage image = QImage::fromData(data, "XBM");
+    qDebug() << "Got screenshot:" << image.size();
     if (!image.isNull()) {
-        image = image.mirrored(true, true);
-        image.invertPixels();
-
         QString fileName = QFileDialog::getSaveFileName(this, tr("Save Screenshot"),
                                    "screenshot.png",
                                    tr("Images (*.png *.jpg)"));
@@ -1328,6 +1335,25 @@ void MainWindow::onCalTransmissionResponse()
     onCalTransmissionTextChanged();
 }
 
+void MainWindow::onCalAllNotSupported()
+{
+    // Older firmware only has the per-value commands
+    densInterface_->sendGetCalLight();
+    densInterface_->sendGetCalGain();
+    densInterface_->sendGetCalSlope();
+    densInterface_->sendGetCalReflection();
+    densInterface_->sendGetCalTransmission();
+}
+
+void MainWindow::onCalAllResponse()
+{
+    onCalLightResponse();
+    onCalGainResponse();
+    onCalSlopeResponse();
+    onCalReflectionResponse();
+    onCalTransmissionResponse();
+}
+
 void MainWindow::onRemoteControl()
 {
     if (!densInterface_->connected()) {
@@ -1348,6 +1374,84 @@ void MainWindow::onRemoteControlFinished()
     remoteDialog_ = nullptr;
 }
 
+void MainWindow::onTaskMonitor()
+{
+    if (!densInterface_->connected()) {
+        return;
+    }
+    if (taskMonitorDialog_) {
+        taskMonitorDialog_->setFocus();
+        return;
+    }
+    taskMonitorDialog_ = new TaskMonitorDialog(densInterface_, this);
+    connect(taskMonitorDialog_, &QDialog::finished, this, &MainWindow::onTaskMonitorFinished);
+    taskMonitorDialog_->show();
+}
+
+void MainWindow::onTaskMonitorFinished()
+{
+    taskMonitorDialog_->deleteLater();
+    taskMonitorDialog_ = nullptr;
+}
+
+void MainWindow::onDisplayMirror()
+{
+    if (!densInterface_->connected()) {
+        return;
+    }
+    if (displayMirrorDialog_) {
+        displayMirrorDialog_->setFocus();
+        return;
+    }
+    displayMirrorDialog_ = new DisplayMirrorDialog(densInterface_, this);
+    connect(displayMirrorDialog_, &QDialog::finished, this, &MainWindow::onDisplayMirrorFinished);
+    displayMirrorDialog_->show();
+}
+
+void MainWindow::onDisplayMirrorFinished()
+{
+    displayMirrorDialog_->deleteLater();
+    displayMirrorDialog_ = nullptr;
+}
+
+void MainWindow::onExportTrace()
+{
+    if (!densInterface_->connected()) {
+        return;
+    }
+    traceExportPending_ = true;
+    densInterface_->sendGetDiagTrace();
+}
+
+void MainWindow::onDiagTraceResponse(const QByteArray &data)
+{
+    if (!traceExportPending_) {
+        return;
+    }
+    traceExportPending_ = false;
+
+    TraceConverter converter;
+    if (!converter.parse(data)) {
+        QMessageBox::warning(this, tr("Error"), tr("No trace events were received from the device"));
+        return;
+    }
+    qDebug() << "Got trace events:" << converter.eventCount();
+
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save Event Trace"),
+                                                    "trace.json",
+                                                    tr("Trace Files (*.json)"));
+    if (!fileName.isEmpty()) {
+        QFile file(fileName);
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(converter.toChromeJson());
+            file.close();
+            qDebug() << "Saved trace to:" << fileName;
+        } else {
+            QMessageBox::warning(this, tr("Error"), tr("Unable to save trace file"));
+        }
+    }
+}
+
 void MainWindow::onSlopeCalibrationTool()
 {
     SlopeCalibrationDialog *dialog = new SlopeCalibrationDialog(densInterface_, this);
@@ -18,6 +18,8 @@ QT_END_NAMESPACE
 
 class LogWindow;
 class RemoteControlDialog;
+class TaskMonitorDialog;
+class DisplayMirrorDialog;
 
 class MainWindow : public QMainWindow
 {
@@ -77,17 +79,27 @@ private slots:
     void onSystemUniqueId();
     void onSystemInternalSensors();
 
-    void onDiagDisplayScreenshot(const QByteArray &data);
+    void onDiagDisplayScreenshot(const QImage &image);
 
     void onCalLightResponse();
     void onCalGainResponse();
     void onCalSlopeResponse();
     void onCalReflectionResponse();
     void onCalTransmissionResponse();
+    void onCalAllResponse();
+    void onCalAllNotSupported();
 
     void onRemoteControl();
     void onRemoteControlFinished();
 
+    void onTaskMonitor();
+    void onTaskMonitorFinished();
+    void onDisplayMirror();
+    void onDisplayMirrorFinished();
+
+    void onExportTrace();
+    void onDiagTraceResponse(const QByteArray &data);
+
     void onSlopeCalibrationTool();
     void onSlopeCalibrationToolFinished(int result);
 
@@ -110,6 +122,9 @@ private:
     LogWindow *logWindow_ = nullptr;
     QStandardItemModel *measModel_ = nullptr;
     RemoteControlDialog *remoteDialog_ = nullptr;
+    TaskMonitorDialog *taskMonitorDialog_ = nullptr;
+    DisplayMirrorDialog *displayMirrorDialog_ = nullptr;
+    bool traceExportPending_ = false;
     DensInterface::DensityType lastReadingType_ = DensInterface::DensityUnknown;
     float lastReadingDensity_ = qSNaN();
     float lastReadingOffset_ = qSNaN();
@@ -15,6 +15,9 @@ SettingsExporter::SettingsExporter(DensInterface *densInterface, QObject *parent
     connect(timer_, &QTimer::timeout, this, QOverload<>::of(&SettingsExporter::onPrepareTimeout));
 
     connect(densInterface_, &DensInterface::connectionClosed, this, &SettingsExporter::onConnectionClosed);
+    connect(densInterface_, &DensInterface::calAllResponse, this, &SettingsExporter::onCalAllResponse);
+    connect(densInterface_, &DensInterface::calAllNotSupported, this, &SettingsExporter::onCalAllNotSupported);
+
     connect(densInterface_, &DensInterface::systemVersionResponse, this, &SettingsExporter::onSystemVersionResponse);
     connect(densInterface_, &DensInterface::systemBuildResponse, this, &SettingsExporter::onSystemBuildResponse);
     connect(densInterface_, &DensInterface::systemUniqueId, this, &SettingsExporter::onSystemUniqueId);
@@ -27,14 +30,11 @@ SettingsExporter::SettingsExporter(DensInterface *densInterface, QObject *parent
 
 void SettingsExporter::prepareExport()
 {
+    // The device returns the system information and all the calibration
+    // values as a single checksummed snapshot. Older firmware NAKs this
+    // request, and the values are then requested one at a time.
     qDebug() << "Getting all settings for export";
-    densInterface_->sendGetSystemVersion();
-    densInterface_->sendGetSystemBuild();
-    densInterface_->sendGetSystemUID();
-    densInterface_->sendGetCalGain();
-    densInterface_->sendGetCalSlope();
-    densInterface_->sendGetCalReflection();
-    densInterface_->sendGetCalTransmission();
+    densInterface_->sendGetCalAll();
 
     timer_->start(5000);
 }
@@ -153,6 +153,32 @@ void SettingsExporter::onConnectionClosed()
     }
 }
 
+void SettingsExporter::onCalAllResponse()
+{
+    if (!hasAllData_ && !prepareFailed_ && !fallbackPending_) {
+        hasAllData_ = true;
+        timer_->stop();
+        emit exportReady();
+    }
+}
+
+void SettingsExporter::onCalAllNotSupported()
+{
+    if (hasAllData_ || prepareFailed_ || fallbackPending_) { return; }
+
+    qDebug() << "Getting settings individually for export";
+    fallbackPending_ = true;
+    densInterface_->sendGetSystemVersion();
+    densInterface_->sendGetSystemBuild();
+    densInterface_->sendGetSystemUID();
+    densInterface_->sendGetCalGain();
+    densInterface_->sendGetCalSlope();
+    densInterface_->sendGetCalReflection();
+    densInterface_->sendGetCalTransmission();
+
+    timer_->start(5000);
+}
+
 void SettingsExporter::onSystemVersionResponse()
 {
     hasSystemVersion_ = true;
@@ -197,6 +223,8 @@ void SettingsExporter::onCalTransmissionResponse()
 
 void SettingsExporter::checkResponses()
 {
+    if (!fallbackPending_ || hasAllData_ || prepareFailed_) { return; }
+
     if (hasSystemVersion_ && hasSystemBuild_ && hasSystemUid_
             && hasCalGain_ && hasCalSlope_
             && hasCalReflection_ && hasCalTransmission_) {
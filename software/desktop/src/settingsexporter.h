@@ -23,6 +23,8 @@ signals:
 private slots:
     void onPrepareTimeout();
     void onConnectionClosed();
+    void onCalAllResponse();
+    void onCalAllNotSupported();
     void onSystemVersionResponse();
     void onSystemBuildResponse();
     void onSystemUniqueId();
@@ -36,6 +38,7 @@ private:
 
     DensInterface *densInterface_;
     QTimer *timer_ = nullptr;
+    bool fallbackPending_ = false;
     bool hasSystemVersion_ = false;
     bool hasSystemBuild_ = false;
     bool hasSystemUid_ = false;
@@ -292,18 +292,13 @@ void SettingsImportDialog::sendSelectedSettings(DensInterface *densInterface)
 {
     if (!densInterface) { return; }
 
-    if (ui->importGainCheckBox->isChecked()) {
-        densInterface->sendSetCalGain(calGain_);
-    }
-    if (ui->importSlopeCheckBox->isChecked()) {
-        densInterface->sendSetCalSlope(calSlope_);
-    }
-    if (ui->importReflCheckBox->isChecked()) {
-        densInterface->sendSetCalReflection(calReflection_);
-    }
-    if (ui->importTranCheckBox->isChecked()) {
-        densInterface->sendSetCalTransmission(calTransmission_);
-    }
+    // Unselected values are left empty, so they are not sent. Devices
+    // without SC ALL are sent the values with the per-value commands.
+    densInterface->sendSetCalAll(
+                ui->importGainCheckBox->isChecked() ? calGain_ : DensCalGain(),
+                ui->importSlopeCheckBox->isChecked() ? calSlope_ : DensCalSlope(),
+                ui->importReflCheckBox->isChecked() ? calReflection_ : DensCalTarget(),
+                ui->importTranCheckBox->isChecked() ? calTransmission_ : DensCalTarget());
 }
 
 int SettingsImportDialog::parseInt(const QJsonValue &value)
@@ -0,0 +1,122 @@
+#include "taskmonitordialog.h"
+#include "ui_taskmonitordialog.h"
+
+#include <QTimer>
+#include <QDebug>
+
+namespace
+{
+// Interval between task list requests, which also sets the
+// period over which the device measures CPU usage
+static const int REFRESH_INTERVAL_MS = 1000;
+
+enum {
+    COLUMN_NAME = 0,
+    COLUMN_STATE,
+    COLUMN_PRIORITY,
+    COLUMN_CPU,
+    COLUMN_STACK_USED,
+    COLUMN_STACK_FREE,
+    COLUMN_STACK_SIZE,
+    COLUMN_COUNT
+};
+}
+
+TaskMonitorDialog::TaskMonitorDialog(DensInterface *densInterface, QWidget *parent) :
+    QDialog(parent),
+    ui(new Ui::TaskMonitorDialog),
+    densInterface_(densInterface),
+    timer_(new QTimer(this))
+{
+    ui->setupUi(this);
+
+    ui->tableWidget->setColumnCount(COLUMN_COUNT);
+    ui->tableWidget->setHorizontalHeaderLabels(QStringList()
+                                               << tr("Task") << tr("State") << tr("Priority")
+                                               << tr("CPU %") << tr("Stack Used")
+                                               << tr("Stack Free") << tr("Stack Size"));
+
+    timer_->setInterval(REFRESH_INTERVAL_MS);
+    connect(timer_, &QTimer::timeout, this, &TaskMonitorDialog::onRefreshTimeout);
+    connect(densInterface_, &DensInterface::systemTasksResponse, this, &TaskMonitorDialog::onSystemTasksResponse);
+    connect(densInterface_, &DensInterface::connectionClosed, this, &TaskMonitorDialog::onConnectionClosed);
+}
+
+TaskMonitorDialog::~TaskMonitorDialog()
+{
+    delete ui;
+}
+
+void TaskMonitorDialog::showEvent(QShowEvent *event)
+{
+    QDialog::showEvent(event);
+    if (densInterface_->connected()) {
+        // The first response only primes the device side CPU usage counters
+        densInterface_->sendGetSystemTasks();
+        timer_->start();
+    }
+}
+
+void TaskMonitorDialog::closeEvent(QCloseEvent *event)
+{
+    timer_->stop();
+    QDialog::closeEvent(event);
+}
+
+void TaskMonitorDialog::onRefreshTimeout()
+{
+    if (densInterface_->connected()) {
+        densInterface_->sendGetSystemTasks();
+    }
+}
+
+void TaskMonitorDialog::onSystemTasksResponse()
+{
+    const QList<DensInterface::TaskInfo> taskInfo = densInterface_->taskInfo();
+
+    ui->tableWidget->setRowCount(taskInfo.size());
+    for (int row = 0; row < taskInfo.size(); row++) {
+        const DensInterface::TaskInfo &info = taskInfo.at(row);
+        QStringList values;
+        values << info.name
+               << stateText(info.state)
+               << QString::number(info.priority)
+               << QString::number(info.cpuUsage, 'f', 1)
+               << (info.stackSize > 0 ? QString::number(info.stackSize - info.stackFree) : QString())
+               << QString::number(info.stackFree)
+               << (info.stackSize > 0 ? QString::number(info.stackSize) : QString());
+
+        for (int col = 0; col < values.size(); col++) {
+            QTableWidgetItem *item = ui->tableWidget->item(row, col);
+            if (!item) {
+                item = new QTableWidgetItem();
+                if (col != COLUMN_NAME && col != COLUMN_STATE) {
+                    item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+                }
+                ui->tableWidget->setItem(row, col, item);
+            }
+            item->setText(values.at(col));
+        }
+    }
+}
+
+void TaskMonitorDialog::onConnectionClosed()
+{
+    timer_->stop();
+}
+
+QString TaskMonitorDialog::stateText(int state)
+{
+    switch (state) {
+    case 0:
+        return tr("Running");
+    case 1:
+        return tr("Ready");
+    case 2:
+        return tr("Blocked");
+    case 3:
+        return tr("Suspended");
+    default:
+        return QString::number(state);
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef TASKMONITORDIALOG_H
+#define TASKMONITORDIALOG_H
+
+#include <QDialog>
+#include "densinterface.h"
+
+namespace Ui {
+class TaskMonitorDialog;
+}
+class QTimer;
+
+class TaskMonitorDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit TaskMonitorDialog(DensInterface *densInterface, QWidget *parent = nullptr);
+    ~TaskMonitorDialog();
+
+protected:
+    void showEvent(QShowEvent *event) override;
+    void closeEvent(QCloseEvent *event) override;
+
+private slots:
+    void onRefreshTimeout();
+    void onSystemTasksResponse();
+    void onConnectionClosed();
+
+private:
+    static QString stateText(int state);
+
+    Ui::TaskMonitorDialog *ui;
+    DensInterface *densInterface_;
+    QTimer *timer_;
+};
+
+#endif // TASKMONITORDIALOG_H
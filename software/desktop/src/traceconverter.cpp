@@ -0,0 +1,240 @@
+#include "traceconverter.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+#include "util.h"
+
+namespace
+{
+// Event types, matching trace_event_type_t in the firmware
+enum {
+    TRACE_EVENT_TASK_SWITCH = 1,
+    TRACE_EVENT_SENSOR_ISR,
+    TRACE_EVENT_SENSOR_CONTROL_BEGIN,
+    TRACE_EVENT_SENSOR_CONTROL_END,
+    TRACE_EVENT_I2C_BEGIN,
+    TRACE_EVENT_I2C_END,
+    TRACE_EVENT_CDC_WRITE,
+    TRACE_EVENT_DISPLAY_BEGIN,
+    TRACE_EVENT_DISPLAY_END
+};
+
+static const int TRACE_RECORD_SIZE = 8;
+static const int TRACE_PID = 1;
+static const int TRACE_CPU_TID = 0;
+}
+
+TraceConverter::TraceConverter()
+    : hasTimestamp_(false)
+    , lastRawTimestamp_(0)
+    , lastTimestamp_(0)
+{
+}
+
+bool TraceConverter::parse(const QByteArray &dump)
+{
+    taskNames_.clear();
+    events_.clear();
+    hasTimestamp_ = false;
+
+    const QList<QByteArray> lines = dump.split('\n');
+    for (const QByteArray &rawLine : lines) {
+        const QByteArray line = rawLine.trimmed();
+        if (line.startsWith("T,")) {
+            const QList<QByteArray> fields = line.split(',');
+            if (fields.size() == 3) {
+                taskNames_.insert(fields.at(1).toInt(), QString::fromLatin1(fields.at(2)));
+            }
+        } else if (line.startsWith("E,")) {
+            const QByteArray data = QByteArray::fromHex(line.mid(2));
+            if (data.size() % TRACE_RECORD_SIZE != 0) {
+                qWarning() << "Invalid trace line:" << line;
+                return false;
+            }
+            const uint8_t *records = reinterpret_cast<const uint8_t *>(data.constData());
+            for (int i = 0; i < data.size(); i += TRACE_RECORD_SIZE) {
+                addRecord(records + i);
+            }
+        }
+    }
+
+    return !events_.isEmpty();
+}
+
+int TraceConverter::eventCount() const
+{
+    return events_.size();
+}
+
+void TraceConverter::addRecord(const uint8_t *record)
+{
+    // Timestamps wrap around, so accumulate the differences between them
+    // to get a continuous timeline starting from the first event
+    const uint32_t rawTimestamp = util::copy_to_u32(record);
+    if (hasTimestamp_) {
+        lastTimestamp_ += static_cast<uint32_t>(rawTimestamp - lastRawTimestamp_);
+    } else {
+        lastTimestamp_ = 0;
+        hasTimestamp_ = true;
+    }
+    lastRawTimestamp_ = rawTimestamp;
+
+    Event event;
+    event.timestamp = lastTimestamp_;
+    event.type = record[4];
+    event.id = record[5];
+    event.arg = record[6] << 8 | record[7];
+    events_.append(event);
+}
+
+QByteArray TraceConverter::toChromeJson() const
+{
+    QJsonArray events;
+
+    // Name the process and tracks
+    QJsonObject processName;
+    processName["name"] = "process_name";
+    processName["ph"] = "M";
+    processName["pid"] = TRACE_PID;
+    processName["args"] = QJsonObject{{"name", "Densitometer"}};
+    events.append(processName);
+
+    QJsonObject cpuName;
+    cpuName["name"] = "thread_name";
+    cpuName["ph"] = "M";
+    cpuName["pid"] = TRACE_PID;
+    cpuName["tid"] = TRACE_CPU_TID;
+    cpuName["args"] = QJsonObject{{"name", "CPU"}};
+    events.append(cpuName);
+
+    for (auto it = taskNames_.constBegin(); it != taskNames_.constEnd(); ++it) {
+        QJsonObject threadName;
+        threadName["name"] = "thread_name";
+        threadName["ph"] = "M";
+        threadName["pid"] = TRACE_PID;
+        threadName["tid"] = it.key();
+        threadName["args"] = QJsonObject{{"name", it.value()}};
+        events.append(threadName);
+    }
+
+    // Spans are attributed to whichever task was running when they began
+    int currentTask = -1;
+    qint64 currentTaskStart = 0;
+    qint64 controlStart = -1;
+    int controlTask = -1;
+    qint64 i2cStart = -1;
+    int i2cTask = -1;
+    qint64 displayStart = -1;
+    int displayTask = -1;
+
+    for (const Event &event : events_) {
+        switch (event.type) {
+        case TRACE_EVENT_TASK_SWITCH:
+            if (currentTask >= 0 && event.id != currentTask) {
+                addSpan(events, taskNames_.value(currentTask, QString("Task %1").arg(currentTask)),
+                        TRACE_CPU_TID, currentTaskStart, event.timestamp);
+            }
+            if (event.id != currentTask) {
+                currentTask = event.id;
+                currentTaskStart = event.timestamp;
+            }
+            break;
+        case TRACE_EVENT_SENSOR_ISR:
+            addInstant(events, "Sensor ISR", TRACE_CPU_TID, event.timestamp, event.arg);
+            break;
+        case TRACE_EVENT_SENSOR_CONTROL_BEGIN:
+            controlStart = event.timestamp;
+            controlTask = currentTask;
+            break;
+        case TRACE_EVENT_SENSOR_CONTROL_END:
+            if (controlStart >= 0) {
+                addSpan(events, sensorControlName(event.id), controlTask, controlStart, event.timestamp);
+                controlStart = -1;
+            }
+            break;
+        case TRACE_EVENT_I2C_BEGIN:
+            i2cStart = event.timestamp;
+            i2cTask = currentTask;
+            break;
+        case TRACE_EVENT_I2C_END:
+            if (i2cStart >= 0) {
+                addSpan(events, "Sensor I2C read", i2cTask, i2cStart, event.timestamp);
+                i2cStart = -1;
+            }
+            break;
+        case TRACE_EVENT_CDC_WRITE:
+            addInstant(events, event.id ? "CDC write (queued)" : "CDC write",
+                       currentTask, event.timestamp, event.arg);
+            break;
+        case TRACE_EVENT_DISPLAY_BEGIN:
+            displayStart = event.timestamp;
+            displayTask = currentTask;
+            break;
+        case TRACE_EVENT_DISPLAY_END:
+            if (displayStart >= 0) {
+                addSpan(events, "Display flush", displayTask, displayStart, event.timestamp);
+                displayStart = -1;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Close off the task that was running at the end of the trace
+    if (currentTask >= 0 && !events_.isEmpty()) {
+        addSpan(events, taskNames_.value(currentTask, QString("Task %1").arg(currentTask)),
+                TRACE_CPU_TID, currentTaskStart, events_.last().timestamp);
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
+
+void TraceConverter::addSpan(QJsonArray &events, const QString &name, int tid, qint64 start, qint64 end) const
+{
+    QJsonObject event;
+    event["name"] = name;
+    event["ph"] = "X";
+    event["pid"] = TRACE_PID;
+    event["tid"] = (tid >= 0) ? tid : TRACE_CPU_TID;
+    event["ts"] = start;
+    event["dur"] = end - start;
+    events.append(event);
+}
+
+void TraceConverter::addInstant(QJsonArray &events, const QString &name, int tid, qint64 timestamp, int arg) const
+{
+    QJsonObject event;
+    event["name"] = name;
+    event["ph"] = "i";
+    event["s"] = "t";
+    event["pid"] = TRACE_PID;
+    event["tid"] = (tid >= 0) ? tid : TRACE_CPU_TID;
+    event["ts"] = timestamp;
+    event["args"] = QJsonObject{{"arg", arg}};
+    events.append(event);
+}
+
+QString TraceConverter::sensorControlName(int id)
+{
+    // Matches sensor_control_event_type_t in the firmware
+    static const char *names[] = {
+        "Sensor stop",
+        "Sensor start",
+        "Sensor set config",
+        "Sensor set light mode",
+        "Sensor run program",
+        "Sensor set threshold mode",
+        "Sensor batch",
+        "Sensor interrupt"
+    };
+    if (id >= 0 && id < static_cast<int>(sizeof(names) / sizeof(names[0]))) {
+        return QString::fromLatin1(names[id]);
+    }
+    return QString("Sensor control %1").arg(id);
+}
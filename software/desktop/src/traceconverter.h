@@ -0,0 +1,47 @@
+#ifndef TRACECONVERTER_H
+#define TRACECONVERTER_H
+
+#include <QByteArray>
+#include <QJsonArray>
+#include <QMap>
+#include <QString>
+
+/**
+ * Converts an event trace dump from the device into the Chrome trace
+ * event JSON format, which can be opened in Perfetto or chrome://tracing.
+ *
+ * The trace is laid out with a "CPU" track showing which task was running
+ * at any moment along with interrupts, and a track for each task showing
+ * the operations it recorded.
+ */
+class TraceConverter
+{
+public:
+    TraceConverter();
+
+    bool parse(const QByteArray &dump);
+    QByteArray toChromeJson() const;
+
+    int eventCount() const;
+
+private:
+    struct Event {
+        qint64 timestamp;
+        int type;
+        int id;
+        int arg;
+    };
+
+    void addRecord(const uint8_t *record);
+    void addSpan(QJsonArray &events, const QString &name, int tid, qint64 start, qint64 end) const;
+    void addInstant(QJsonArray &events, const QString &name, int tid, qint64 timestamp, int arg) const;
+    static QString sensorControlName(int id);
+
+    QMap<int, QString> taskNames_;
+    QList<Event> events_;
+    bool hasTimestamp_;
+    uint32_t lastRawTimestamp_;
+    qint64 lastTimestamp_;
+};
+
+#endif // TRACECONVERTER_H
@@ -52,6 +52,66 @@ float decode_f32(const QString &val)
     return copy_to_f32((const uint8_t *)bytes.data());
 }
 
+uint16_t crc16_ccitt(const uint8_t *buf, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= static_cast<uint16_t>(buf[i] << 8);
+        for (int j = 0; j < 8; j++) {
+            if (crc & 0x8000) {
+                crc = static_cast<uint16_t>((crc << 1) ^ 0x1021);
+            } else {
+                crc = static_cast<uint16_t>(crc << 1);
+            }
+        }
+    }
+    return crc;
+}
+
+QByteArray cobs_decode(const QByteArray &data)
+{
+    QByteArray result;
+    int i = 0;
+    while (i < data.size()) {
+        const uint8_t code = static_cast<uint8_t>(data.at(i++));
+        if (code == 0 || i + code - 1 > data.size()) {
+            // Zero bytes are not valid within an encoded block,
+            // and a block cannot extend past the end of the data
+            return QByteArray();
+        }
+        result.append(data.mid(i, code - 1));
+        i += code - 1;
+        if (code < 0xFF && i < data.size()) {
+            result.append('\0');
+        }
+    }
+    return result;
+}
+
+QByteArray packbits_decode(const QByteArray &data)
+{
+    QByteArray result;
+    int i = 0;
+    while (i < data.size()) {
+        const uint8_t header = static_cast<uint8_t>(data.at(i++));
+        if (header < 128) {
+            // Literal run of header + 1 bytes
+            if (i + header + 1 > data.size()) {
+                return QByteArray();
+            }
+            result.append(data.mid(i, header + 1));
+            i += header + 1;
+        } else if (header > 128) {
+            // Single byte repeated 257 - header times
+            if (i >= data.size()) {
+                return QByteArray();
+            }
+            result.append(257 - header, data.at(i++));
+        }
+    }
+    return result;
+}
+
 double **make2DArray(const size_t rows, const size_t cols)
 {
     double **array;
@@ -2,6 +2,7 @@
 #define UTIL_H
 
 #include <QString>
+#include <QByteArray>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -19,6 +20,10 @@ float copy_to_f32(const uint8_t *buf);
 QString encode_f32(float val);
 float decode_f32(const QString &val);
 
+uint16_t crc16_ccitt(const uint8_t *buf, size_t len);
+QByteArray cobs_decode(const QByteArray &data);
+QByteArray packbits_decode(const QByteArray &data);
+
 double **make2DArray(const size_t rows, const size_t cols);
 void free2DArray(double **array, const size_t rows);
 
@@ -45,6 +45,10 @@
 #if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
 #include <stdint.h>
 extern uint32_t SystemCoreClock;
+extern uint32_t timestamp_us_get();
+#ifdef EVENT_TRACE
+extern void trace_task_switched_in(uint32_t task_number);
+#endif
 #endif
 
 #define configENABLE_FPU                         0
@@ -59,7 +63,7 @@ extern uint32_t SystemCoreClock;
 #define configTICK_RATE_HZ                       ((TickType_t)1000)
 #define configMAX_PRIORITIES                     ( 56 )
 #define configMINIMAL_STACK_SIZE                 ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE                    ((size_t)9216)
+#define configTOTAL_HEAP_SIZE                    ((size_t)11264)
 #define configMAX_TASK_NAME_LEN                  ( 16 )
 #define configUSE_TRACE_FACILITY                 1
 #define configUSE_16_BIT_TICKS                   0
@@ -74,6 +78,20 @@ extern uint32_t SystemCoreClock;
 
 #define configRECORD_STACK_HIGH_ADDRESS          1
 
+/*
+ * Run time statistics are counted in microseconds, using the TIM7
+ * timestamp counter. That timer is started along with the other
+ * peripherals, before the scheduler, so it needs no configuration here.
+ */
+#define configGENERATE_RUN_TIME_STATS            1
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+#define portGET_RUN_TIME_COUNTER_VALUE()         timestamp_us_get()
+
+/* Task switches are recorded by the event trace, in builds that include it */
+#ifdef EVENT_TRACE
+#define traceTASK_SWITCHED_IN() trace_task_switched_in(pxCurrentTCB->uxTCBNumber)
+#endif
+
 /* Defaults to size_t for backward compatibility, but can be changed
    if lengths will always be less than the number of bytes in a size_t. */
 #define configMESSAGE_BUFFER_LENGTH_TYPE         size_t
@@ -107,6 +125,7 @@ extern uint32_t SystemCoreClock;
 #define INCLUDE_xQueueGetMutexHolder         1
 #define INCLUDE_uxTaskGetStackHighWaterMark  1
 #define INCLUDE_eTaskGetState                1
+#define INCLUDE_xTaskGetIdleTaskHandle       1
 
 /*
  * The CMSIS-RTOS V2 FreeRTOS wrapper is dependent on the heap implementation used
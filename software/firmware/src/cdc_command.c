@@ -0,0 +1,139 @@
+#include "cdc_command.h"
+
+#include <string.h>
+
+#ifndef MIN
+#define MIN(a, b)  (((a) < (b)) ? (a) : (b))
+#endif
+
+static uint32_t cdc_command_action_word(const char *action, size_t offset);
+static int cdc_command_compare(const char *action, cmd_type_t type, const cdc_command_entry_t *entry);
+
+bool cdc_command_parse(cdc_command_t *cmd, const char *buf, size_t len)
+{
+    cmd_type_t type;
+    cmd_category_t category;
+
+    if (!cmd || !buf || len < 2 || buf[0] == '\0') {
+        return false;
+    }
+
+    switch (buf[0]) {
+    case 'S':
+        type = CMD_TYPE_SET;
+        break;
+    case 'G':
+        type = CMD_TYPE_GET;
+        break;
+    case 'I':
+        type = CMD_TYPE_INVOKE;
+        break;
+    default:
+        return false;
+    }
+
+    switch (buf[1]) {
+    case 'S':
+        category = CMD_CATEGORY_SYSTEM;
+        break;
+    case 'M':
+        category = CMD_CATEGORY_MEASUREMENT;
+        break;
+    case 'C':
+        category = CMD_CATEGORY_CALIBRATION;
+        break;
+    case 'D':
+        category = CMD_CATEGORY_DIAGNOSTICS;
+        break;
+    default:
+        return false;
+    }
+
+    if (len > 2 && buf[2] != ' ') {
+        return false;
+    }
+
+    cmd->type = type;
+    cmd->category = category;
+
+    /*
+     * The command is already zero-filled, so only the characters of each
+     * field need to be copied, leaving the rest as padding and terminator.
+     */
+    if (len > 3) {
+        const char *p = memchr(buf + 3, ',', len - 3);
+        if (p) {
+            memcpy(cmd->action, buf + 3, MIN((size_t)(p - (buf + 3)), sizeof(cmd->action) - 1));
+            memcpy(cmd->args, p + 1, MIN(len - ((p + 1) - buf), sizeof(cmd->args) - 1));
+        } else {
+            memcpy(cmd->action, buf + 3, MIN(len - 3, sizeof(cmd->action) - 1));
+        }
+    }
+
+    return true;
+}
+
+uint32_t cdc_command_action_word(const char *action, size_t offset)
+{
+    const uint8_t *p = (const uint8_t *)action + offset;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+int cdc_command_compare(const char *action, cmd_type_t type, const cdc_command_entry_t *entry)
+{
+    /*
+     * Actions are compared as fixed-size zero-padded fields, loaded as
+     * big-endian words. This sorts the same way as strcmp(), but only
+     * takes a couple of integer comparisons instead of a library call.
+     */
+    for (size_t i = 0; i < sizeof(entry->action); i += 4) {
+        const uint32_t a = cdc_command_action_word(action, i);
+        const uint32_t b = cdc_command_action_word(entry->action, i);
+        if (a != b) {
+            return (a < b) ? -1 : 1;
+        }
+    }
+    return (int)type - (int)entry->type;
+}
+
+const cdc_command_entry_t *cdc_command_find(const cdc_command_entry_t *table, size_t count,
+    const cdc_command_t *cmd)
+{
+    const cdc_command_entry_t *entry = NULL;
+    size_t lo = 0;
+    size_t hi = count;
+
+    if (!table || !cmd) { return NULL; }
+
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) / 2);
+        int result = cdc_command_compare(cmd->action, cmd->type, &table[mid]);
+        if (result == 0) {
+            entry = &table[mid];
+            break;
+        } else if (result < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    if (!entry) { return NULL; }
+
+    if ((entry->args == CMD_ARGS_NONE && cmd->args[0] != '\0')
+        || (entry->args == CMD_ARGS_REQUIRED && cmd->args[0] == '\0')) {
+        return NULL;
+    }
+
+    return entry;
+}
+
+bool cdc_command_table_sorted(const cdc_command_entry_t *table, size_t count)
+{
+    for (size_t i = 1; i < count; i++) {
+        if (cdc_command_compare(table[i].action, table[i].type, &table[i - 1]) <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,107 @@
+/*
+ * Parsing and lookup of commands received over the USB CDC interface.
+ *
+ * Each command category has a static table of command descriptors,
+ * sorted by action name and command type, which is searched with a
+ * binary search instead of walking a chain of string comparisons.
+ * The tables exist to keep each command's type, arguments and
+ * availability rules in one place, rather than for speed, since the
+ * categories are too small for the search to save many comparisons.
+ *
+ * Nothing in here touches the hardware, so these functions can also be
+ * built and exercised on the host.
+ */
+#ifndef CDC_COMMAND_H
+#define CDC_COMMAND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    CMD_TYPE_SET,
+    CMD_TYPE_GET,
+    CMD_TYPE_INVOKE
+} cmd_type_t;
+
+typedef enum {
+    CMD_CATEGORY_SYSTEM,
+    CMD_CATEGORY_MEASUREMENT,
+    CMD_CATEGORY_CALIBRATION,
+    CMD_CATEGORY_DIAGNOSTICS,
+    CMD_CATEGORY_MAX
+} cmd_category_t;
+
+typedef struct {
+    cmd_type_t type;
+    cmd_category_t category;
+    char action[8];
+    char args[56];
+} cdc_command_t;
+
+/**
+ * Arguments accepted by a command, checked before its handler is called.
+ */
+typedef enum {
+    CMD_ARGS_NONE,     /*!< Command must not have any arguments */
+    CMD_ARGS_OPTIONAL, /*!< Command may or may not have arguments */
+    CMD_ARGS_REQUIRED  /*!< Command must have arguments */
+} cmd_args_t;
+
+/** Command is only available while remote control mode is active */
+#define CMD_FLAG_REMOTE       0x01
+/** Command is not available while the host is streaming sensor readings */
+#define CMD_FLAG_SENSOR_IDLE  0x02
+/** Command is queued as a job, and run outside of the CDC task */
+#define CMD_FLAG_JOB          0x04
+/** Command is not available while any jobs are queued or running */
+#define CMD_FLAG_EXCLUSIVE    0x08
+
+/**
+ * Command handler function.
+ *
+ * @return True if the command was handled, false to send a NAK
+ */
+typedef bool (*cdc_command_handler_t)(const cdc_command_t *cmd);
+
+typedef struct {
+    char action[8];
+    cmd_type_t type;
+    cmd_args_t args;
+    uint8_t flags;
+    cdc_command_handler_t handler;
+} cdc_command_entry_t;
+
+/**
+ * Parse a line of text into a command.
+ *
+ * @param cmd Command to populate, which must be zero-initialized
+ * @param buf Line of text, without the line ending
+ * @param len Length of the line
+ * @return True if the line contained a valid command prefix
+ */
+bool cdc_command_parse(cdc_command_t *cmd, const char *buf, size_t len);
+
+/**
+ * Find the descriptor for a command.
+ *
+ * The table must be sorted by action name, and then by command type.
+ * The returned descriptor has already had the command arguments checked
+ * against it, but its flags are left for the caller to check.
+ *
+ * @param table Command descriptor table for the command's category
+ * @param count Number of entries in the table
+ * @param cmd Command to look up
+ * @return Matching descriptor, or NULL if there was no valid match
+ */
+const cdc_command_entry_t *cdc_command_find(const cdc_command_entry_t *table, size_t count,
+    const cdc_command_t *cmd);
+
+/**
+ * Check that a command descriptor table is correctly sorted.
+ *
+ * @return True if the table can be used with cdc_command_find()
+ */
+bool cdc_command_table_sorted(const cdc_command_entry_t *table, size_t count);
+
+#endif /* CDC_COMMAND_H */
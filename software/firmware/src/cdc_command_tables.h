@@ -0,0 +1,182 @@
+/*
+ * Command descriptor tables for the USB CDC command interface.
+ *
+ * This file is included by cdc_handler.c, and by the dispatch bench in
+ * software/tools, so both are always built from the same tables. The
+ * includer must define CDC_COMMAND(action, type, args, flags, handler)
+ * to expand each entry into a cdc_command_entry_t initializer.
+ *
+ * There is no include guard, as this defines the tables themselves.
+ */
+#ifndef CDC_COMMAND
+#error "CDC_COMMAND must be defined before including cdc_command_tables.h"
+#endif
+
+/*
+ * Command descriptor tables, one per category.
+ *
+ * Each table is searched with a binary search, so its entries must be
+ * kept sorted by action name (as compared by strcmp), and then by
+ * command type in the order of cmd_type_t (SET, GET, INVOKE).
+ * The ordering is checked when the CDC task starts.
+ *
+ * Commands marked as jobs are long-running, and are handed off to the
+ * job task so the CDC task can keep serving other commands. Commands
+ * that would interfere with a job are marked as exclusive, and are
+ * refused until all pending jobs have completed.
+ */
+
+/*
+ * System Commands
+ * "GS V"    -> Get project name and version
+ * "GS B"    -> Get firmware build information
+ * "GS DEV"  -> Get device information (HAL version, MCU Rev ID, MCU Dev ID, SysClock)
+ * "GS RTOS" -> Get FreeRTOS information
+ * "GS TASKS" -> Get per-task CPU usage and stack information (multi-line response)
+ * "GS UID"  -> Get device unique ID
+ * "GS ISEN" -> Internal sensor readings
+ * "IS REMOTE,n" -> Invoke remote control mode (enable = 1, disable = 0)
+ * "SS DISP,text" -> Write text to the display [remote]
+ */
+static const cdc_command_entry_t cdc_commands_system[] = {
+    CDC_COMMAND("B",      CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                  cdc_system_get_build),
+    CDC_COMMAND("DEV",    CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                  cdc_system_get_device),
+    CDC_COMMAND("DISP",   CMD_TYPE_SET,    CMD_ARGS_OPTIONAL, CMD_FLAG_REMOTE,    cdc_system_set_display),
+    CDC_COMMAND("ISEN",   CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                  cdc_system_get_internal_sensors),
+    CDC_COMMAND("REMOTE", CMD_TYPE_INVOKE, CMD_ARGS_REQUIRED, CMD_FLAG_EXCLUSIVE, cdc_system_invoke_remote),
+    CDC_COMMAND("RTOS",   CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                  cdc_system_get_rtos),
+    CDC_COMMAND("TASKS",  CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                  cdc_system_get_tasks),
+    CDC_COMMAND("UID",    CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                  cdc_system_get_uid),
+    CDC_COMMAND("V",      CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                  cdc_system_get_version)
+};
+
+/*
+ * Measurement Commands
+ * "GM REFL" -> Get last reflection measurement
+ * "GM TRAN" -> Get last transmission measurement
+ * "SM FORMAT,x" -> Set measurement data format ("BASIC", "EXT")
+ * "SM UNCAL,x" -> Allow uncalibrated readings (0=false, 1=true)
+ * "GM SAMPLES" -> Get measurement sample count and outlier rejection method
+ * "SM SAMPLES,n,x" -> Set measurement sample count and outlier rejection method ("NONE", "SIGMA", "MEDIAN")
+ */
+static const cdc_command_entry_t cdc_commands_measurement[] = {
+    CDC_COMMAND("FORMAT",  CMD_TYPE_SET, CMD_ARGS_REQUIRED, 0, cdc_measurement_set_format),
+    CDC_COMMAND("REFL",    CMD_TYPE_GET, CMD_ARGS_NONE,     0, cdc_measurement_get_reflection),
+    CDC_COMMAND("SAMPLES", CMD_TYPE_SET, CMD_ARGS_REQUIRED, 0, cdc_measurement_set_samples),
+    CDC_COMMAND("SAMPLES", CMD_TYPE_GET, CMD_ARGS_NONE,     0, cdc_measurement_get_samples),
+    CDC_COMMAND("TRAN",    CMD_TYPE_GET, CMD_ARGS_NONE,     0, cdc_measurement_get_transmission),
+    CDC_COMMAND("UNCAL",   CMD_TYPE_SET, CMD_ARGS_REQUIRED, 0, cdc_measurement_set_uncalibrated)
+};
+
+/*
+ * Calibration Commands
+ * "GC ALL" -> Get a checksummed snapshot of all calibration values (multi-line response)
+ * "SC ALL,x,..." -> Stage one record of a calibration snapshot, or commit it with its checksum
+ * "IC GAIN" -> Invoke the sensor gain calibration process [remote, job]
+ * "IC LR" -> Invoke the reflection light drift calibration process [remote, job]
+ * "IC LT" -> Invoke the transmission light drift calibration process [remote, job]
+ * "GC LIGHT" -> Get measurement light calibration values
+ * "SC LIGHT" -> Set measurement light calibration values
+ * "GC GAIN" -> Get sensor gain calibration values
+ * "SC GAIN" -> Set sensor gain calibration values
+ * "GC SLOPE" -> Get sensor slope calibration values
+ * "SC SLOPE" -> Set sensor slope calibration values
+ * "GC DRIFT" -> Get measurement light drift calibration values
+ * "SC DRIFT" -> Set measurement light drift calibration values
+ * "GC REFL" -> Get reflection density calibration values
+ * "SC REFL" -> Set reflection density calibration values
+ * "GC TRAN" -> Get transmission density calibration values
+ * "SC TRAN" -> Set transmission density calibration values
+ */
+static const cdc_command_entry_t cdc_commands_calibration[] = {
+    CDC_COMMAND("ALL",   CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_EXCLUSIVE,             cdc_calibration_set_all),
+    CDC_COMMAND("ALL",   CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                              cdc_calibration_get_all),
+    CDC_COMMAND("DRIFT", CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_EXCLUSIVE,             cdc_calibration_set_drift),
+    CDC_COMMAND("DRIFT", CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                              cdc_calibration_get_drift),
+    CDC_COMMAND("GAIN",  CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_EXCLUSIVE,             cdc_calibration_set_gain),
+    CDC_COMMAND("GAIN",  CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                              cdc_calibration_get_gain),
+    CDC_COMMAND("GAIN",  CMD_TYPE_INVOKE, CMD_ARGS_NONE,     CMD_FLAG_REMOTE | CMD_FLAG_JOB, cdc_calibration_invoke_gain),
+    CDC_COMMAND("LIGHT", CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_EXCLUSIVE,             cdc_calibration_set_light),
+    CDC_COMMAND("LIGHT", CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                              cdc_calibration_get_light),
+    CDC_COMMAND("LR",    CMD_TYPE_INVOKE, CMD_ARGS_NONE,     CMD_FLAG_REMOTE | CMD_FLAG_JOB, cdc_calibration_invoke_light_reflection),
+    CDC_COMMAND("LT",    CMD_TYPE_INVOKE, CMD_ARGS_NONE,     CMD_FLAG_REMOTE | CMD_FLAG_JOB, cdc_calibration_invoke_light_transmission),
+    CDC_COMMAND("REFL",  CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_EXCLUSIVE,             cdc_calibration_set_reflection),
+    CDC_COMMAND("REFL",  CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                              cdc_calibration_get_reflection),
+    CDC_COMMAND("SLOPE", CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_EXCLUSIVE,             cdc_calibration_set_slope),
+    CDC_COMMAND("SLOPE", CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                              cdc_calibration_get_slope),
+    CDC_COMMAND("TRAN",  CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_EXCLUSIVE,             cdc_calibration_set_transmission),
+    CDC_COMMAND("TRAN",  CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                              cdc_calibration_get_transmission)
+};
+
+/*
+ * Diagnostics Commands
+ * "GD DISP" -> Get display screenshot (multi-line response)
+ * "GD DISP,B" -> Get display screenshot as run-length encoded binary frames
+ * "SD MIRROR,n" -> Send binary frames of display changes as they happen (enable = 1, disable = 0)
+ *
+ * "GD JOB" -> Get the running job ID and the number of pending jobs
+ *
+ * "SD LR,nnn" -> Set reflection light duty cycle (nnn/127) [remote]
+ * "SD LT,nnn" -> Set transmission light duty cycle (nnn/127) [remote]
+ *
+ * "ID S,START"   -> Invoke sensor start [remote]
+ * "ID S,STOP"    -> Invoke sensor stop [remote]
+ * "SD S,CFG,n,m" -> Set sensor gain (n = [0-3]) and integration time (m = [0-5]) [remote]
+ * "SD S,FMT,T"   -> Set sensor reading stream format to text (default) [remote]
+ * "SD S,FMT,B"   -> Set sensor reading stream format to binary frames [remote]
+ * "SD S,THRESH,nn" -> Set sensor threshold interrupt mode (nn = window %, 0 = off) [remote]
+ *
+ * "GD STAT"       -> Get sensor pipeline counters
+ * "GD STAT,I2C"   -> Get sensor I2C transaction duration histogram
+ * "GD STAT,LAT"   -> Get sensor interrupt latency histogram
+ * "GD STAT,CDC"   -> Get CDC transmit buffer usage
+ * "ID STAT,RESET" -> Reset sensor pipeline statistics
+ *
+ * "ID READ,L,n,m" -> Perform controlled sensor target read [remote, job]
+ *
+ * "GD SIM"          -> Get simulated sensor parameters [simulation builds]
+ * "SD SIM,d,n,s,r"  -> Set simulated sensor parameters [simulation builds]
+ * "ID BENCH"        -> Run the measurement latency benchmark (multi-line response) [remote, job, simulation builds]
+ * "ID BENCH,WARM"   -> Run the benchmark with the sensor kept running between measurements [remote, job, simulation builds]
+ *
+ * "GD TRACE"        -> Dump the event trace buffer (multi-line response) [event trace builds]
+ *
+ * "ID WIPE,UIDw2,CKSUM" -> Factory reset of configuration EEPROM [remote]
+ *
+ * "SD LOG,U" -> Set logging output to USB CDC device
+ * "SD LOG,D" -> Set logging output to debug port UART
+ */
+static const cdc_command_entry_t cdc_commands_diagnostics[] = {
+#ifdef SENSOR_SIMULATION
+    CDC_COMMAND("BENCH",  CMD_TYPE_INVOKE, CMD_ARGS_OPTIONAL, CMD_FLAG_REMOTE | CMD_FLAG_SENSOR_IDLE | CMD_FLAG_JOB, cdc_diagnostics_invoke_benchmark),
+#endif
+    CDC_COMMAND("DISP",   CMD_TYPE_GET,    CMD_ARGS_OPTIONAL, 0,                                                    cdc_diagnostics_get_display),
+    CDC_COMMAND("JOB",    CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                                                    cdc_diagnostics_get_job),
+    CDC_COMMAND("LOG",    CMD_TYPE_SET,    CMD_ARGS_REQUIRED, 0,                                                    cdc_diagnostics_set_log),
+    CDC_COMMAND("LR",     CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_REMOTE | CMD_FLAG_EXCLUSIVE,                 cdc_diagnostics_set_light_reflection),
+    CDC_COMMAND("LT",     CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_REMOTE | CMD_FLAG_EXCLUSIVE,                 cdc_diagnostics_set_light_transmission),
+    CDC_COMMAND("MIRROR", CMD_TYPE_SET,    CMD_ARGS_REQUIRED, 0,                                                    cdc_diagnostics_set_mirror),
+    CDC_COMMAND("READ",   CMD_TYPE_INVOKE, CMD_ARGS_REQUIRED, CMD_FLAG_REMOTE | CMD_FLAG_SENSOR_IDLE | CMD_FLAG_JOB, cdc_diagnostics_invoke_read),
+    CDC_COMMAND("S",      CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_REMOTE | CMD_FLAG_EXCLUSIVE,                 cdc_diagnostics_set_sensor),
+    CDC_COMMAND("S",      CMD_TYPE_INVOKE, CMD_ARGS_REQUIRED, CMD_FLAG_REMOTE | CMD_FLAG_EXCLUSIVE,                 cdc_diagnostics_invoke_sensor),
+#ifdef SENSOR_SIMULATION
+    CDC_COMMAND("SIM",    CMD_TYPE_SET,    CMD_ARGS_REQUIRED, CMD_FLAG_EXCLUSIVE,                                   cdc_diagnostics_set_simulation),
+    CDC_COMMAND("SIM",    CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                                                    cdc_diagnostics_get_simulation),
+#endif
+    CDC_COMMAND("STAT",   CMD_TYPE_GET,    CMD_ARGS_OPTIONAL, 0,                                                    cdc_diagnostics_get_stats),
+    CDC_COMMAND("STAT",   CMD_TYPE_INVOKE, CMD_ARGS_REQUIRED, 0,                                                    cdc_diagnostics_invoke_stats),
+#ifdef EVENT_TRACE
+    CDC_COMMAND("TRACE",  CMD_TYPE_GET,    CMD_ARGS_NONE,     0,                                                    cdc_diagnostics_get_trace),
+#endif
+    CDC_COMMAND("WIPE",   CMD_TYPE_INVOKE, CMD_ARGS_REQUIRED, CMD_FLAG_REMOTE | CMD_FLAG_EXCLUSIVE,                 cdc_diagnostics_invoke_wipe)
+};
+
+static const struct {
+    const cdc_command_entry_t *table;
+    size_t count;
+} cdc_command_tables[CMD_CATEGORY_MAX] = {
+    [CMD_CATEGORY_SYSTEM]      = { cdc_commands_system,      sizeof(cdc_commands_system) / sizeof(cdc_command_entry_t) },
+    [CMD_CATEGORY_MEASUREMENT] = { cdc_commands_measurement, sizeof(cdc_commands_measurement) / sizeof(cdc_command_entry_t) },
+    [CMD_CATEGORY_CALIBRATION] = { cdc_commands_calibration, sizeof(cdc_commands_calibration) / sizeof(cdc_command_entry_t) },
+    [CMD_CATEGORY_DIAGNOSTICS] = { cdc_commands_diagnostics, sizeof(cdc_commands_diagnostics) / sizeof(cdc_command_entry_t) }
+};
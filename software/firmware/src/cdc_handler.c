@@ -15,6 +15,7 @@
 #include <tusb.h>
 #include <cmsis_os.h>
 #include <FreeRTOS.h>
+#include <task.h>
 
 #include "settings.h"
 #include "display.h"
@@ -24,51 +25,119 @@
 #include "task_sensor.h"
 #include "adc_handler.h"
 #include "tsl2591.h"
+#include "tsl2591_sim.h"
 #include "densitometer.h"
 #include "app_descriptor.h"
 #include "util.h"
 #include "keypad.h"
+#include "trace.h"
+#include "cdc_command.h"
 
 #define CMD_DATA_SIZE 64
+#define CDC_RX_BUFFER_SIZE 128
 #define CDC_TX_TIMEOUT 200
 #define CDC_MIN_BIT_RATE 9600
+#define CDC_TX_BUFFER_SIZE 512 /* Must be a power of two */
+#define CDC_TASK_STATS_MAX 10
+#define CDC_JOB_QUEUE_SIZE 4
 
-typedef enum {
-    CMD_TYPE_SET,
-    CMD_TYPE_GET,
-    CMD_TYPE_INVOKE
-} cmd_type_t;
+/*
+ * Record tags used by the "GC ALL" and "SC ALL" calibration snapshot
+ * commands, in the order the records must appear within a transfer.
+ */
+#define CAL_ALL_TAGS "LGSDRT"
 
 typedef enum {
-    CMD_CATEGORY_SYSTEM,
-    CMD_CATEGORY_MEASUREMENT,
-    CMD_CATEGORY_CALIBRATION,
-    CMD_CATEGORY_DIAGNOSTICS
-} cmd_category_t;
+    CAL_ALL_LIGHT,
+    CAL_ALL_GAIN,
+    CAL_ALL_SLOPE,
+    CAL_ALL_DRIFT,
+    CAL_ALL_REFLECTION,
+    CAL_ALL_TRANSMISSION,
+    CAL_ALL_MAX
+} cdc_cal_all_record_t;
+
+typedef struct {
+    uint8_t received;
+    int8_t last;
+    uint16_t crc;
+    settings_cal_light_t light;
+    settings_cal_gain_t gain;
+    settings_cal_slope_t slope;
+    settings_cal_drift_t drift;
+    settings_cal_reflection_t reflection;
+    settings_cal_transmission_t transmission;
+} cdc_cal_all_t;
 
 typedef struct {
-    cmd_type_t type;
-    cmd_category_t category;
-    char action[8];
-    char args[56];
-} cdc_command_t;
+    uint8_t id;
+    cdc_command_handler_t handler;
+    cdc_command_t cmd;
+} cdc_job_t;
 
 typedef enum {
     READING_FORMAT_BASIC,
     READING_FORMAT_EXT
 } cdc_reading_format_t;
 
+typedef enum {
+    RAW_FORMAT_TEXT,
+    RAW_FORMAT_BINARY
+} cdc_raw_format_t;
+
+/*
+ * Size of a binary raw sensor record, prior to framing.
+ * The record contains a type byte, followed by the big-endian reading
+ * fields, followed by a CRC-16 of everything that came before it.
+ */
+#define RAW_RECORD_TYPE_SENSOR 'S'
+#define RAW_RECORD_SIZE 33
+
 static volatile bool cdc_initialized = false;
 static volatile bool cdc_host_connected = false;
 static volatile bool cdc_logging_redirected = false;
-static uint8_t cmd_buffer[CMD_DATA_SIZE];
-static size_t cmd_buffer_len = 0;
+
+/*
+ * Buffer that data is read into directly from the USB receive FIFO.
+ * Complete lines are processed where they sit in the buffer, and only
+ * a trailing partial line is carried over to the start of the buffer.
+ * Once a line grows past CMD_DATA_SIZE, only its start is kept and the
+ * rest is counted and discarded until its line break arrives.
+ */
+static char cdc_rx_buffer[CDC_RX_BUFFER_SIZE];
+static size_t cdc_rx_len = 0;
+static size_t cdc_rx_overflow = 0;
+
 static bool cdc_remote_enabled = false;
 static volatile bool cdc_remote_active = false;
 static volatile bool cdc_remote_sensor_active = false;
+static volatile bool cdc_remote_release_pending = false;
+static volatile bool cdc_display_mirror_active = false;
+static volatile bool cdc_display_update_pending = false;
 static cdc_reading_format_t reading_format = READING_FORMAT_BASIC;
-
-/* Semaphore used to unblock the task when new data is available */
+static cdc_raw_format_t raw_format = RAW_FORMAT_TEXT;
+
+/*
+ * Buffer for data queued by other tasks, to be sent by the CDC task.
+ * The head and tail are free-running counters, masked when indexing
+ * into the buffer.
+ */
+static uint8_t cdc_tx_buffer[CDC_TX_BUFFER_SIZE];
+static volatile size_t cdc_tx_head = 0;
+static volatile size_t cdc_tx_tail = 0;
+static volatile size_t cdc_tx_high_water = 0;
+static volatile uint32_t cdc_tx_dropped = 0;
+
+/*
+ * Task monitor state, only used by the CDC task. The status array is
+ * scratch space for task information requests, and the run time counters
+ * from the previous request are kept to report CPU usage since then.
+ */
+static TaskStatus_t cdc_task_status[CDC_TASK_STATS_MAX];
+static uint32_t cdc_prev_task_runtime[CDC_TASK_STATS_MAX + 1] = {0};
+static uint32_t cdc_prev_total_runtime = 0;
+
+/* Semaphore used to unblock the task when new data is available to receive or send */
 static osSemaphoreId_t cdc_rx_semaphore = NULL;
 static const osSemaphoreAttr_t cdc_rx_semaphore_attrs = {
     .name = "cdc_rx_semaphore"
@@ -80,6 +149,26 @@ static const osSemaphoreAttr_t cdc_tx_semaphore_attrs = {
     .name = "cdc_tx_semaphore"
 };
 
+/*
+ * Queue of long-running commands, waiting to be run by the job task.
+ * The pending count covers both the queued jobs and the running one,
+ * and is only modified from within a critical section.
+ */
+static osMessageQueueId_t cdc_job_queue = NULL;
+static const osMessageQueueAttr_t cdc_job_queue_attrs = {
+    .name = "cdc_job_queue"
+};
+static volatile uint8_t cdc_job_pending = 0;
+static volatile uint8_t cdc_job_active_id = 0;
+static uint8_t cdc_job_last_id = 0;
+
+/*
+ * Calibration records staged by "SC ALL", along with the running checksum
+ * of the transfer. Nothing is written to settings until the checksum
+ * record arrives and matches. Only used by the CDC task.
+ */
+static cdc_cal_all_t cdc_cal_all = { .last = -1, .crc = 0xFFFF };
+
 /* Mutex used to allow CDC writes from different tasks */
 static osMutexId_t cdc_mutex = NULL;
 static const osMutexAttr_t cdc_mutex_attrs = {
@@ -88,16 +177,91 @@ static const osMutexAttr_t cdc_mutex_attrs = {
 
 static void cdc_task_loop();
 static void cdc_set_connected(bool connected);
+static void cdc_release_remote();
+static void cdc_receive_commands();
+static void cdc_process_line(char *line, size_t len, size_t overflow);
 static void cdc_process_command(const char *buf, size_t len);
-static bool cdc_parse_command(cdc_command_t *cmd, const char *buf, size_t len);
-static bool cdc_process_command_system(const cdc_command_t *cmd);
-static bool cdc_process_command_measurement(const cdc_command_t *cmd);
-static bool cdc_process_command_calibration(const cdc_command_t *cmd);
-static bool cdc_invoke_gain_calibration_callback(sensor_gain_calibration_status_t status, int param, void *user_data);
-static bool cdc_process_command_diagnostics(const cdc_command_t *cmd);
+static bool cdc_check_command_tables();
+static bool cdc_queue_job(const cdc_command_entry_t *entry, const cdc_command_t *cmd);
+static bool cdc_job_busy();
+static void cdc_send_job_state(uint8_t id, const char *state);
+static bool cdc_system_get_build(const cdc_command_t *cmd);
+static bool cdc_system_get_device(const cdc_command_t *cmd);
+static bool cdc_system_set_display(const cdc_command_t *cmd);
+static bool cdc_system_get_internal_sensors(const cdc_command_t *cmd);
+static bool cdc_system_invoke_remote(const cdc_command_t *cmd);
+static bool cdc_system_get_rtos(const cdc_command_t *cmd);
+static bool cdc_system_get_tasks(const cdc_command_t *cmd);
+static bool cdc_system_get_uid(const cdc_command_t *cmd);
+static bool cdc_system_get_version(const cdc_command_t *cmd);
+static bool cdc_measurement_set_format(const cdc_command_t *cmd);
+static bool cdc_measurement_get_reflection(const cdc_command_t *cmd);
+static bool cdc_measurement_get_samples(const cdc_command_t *cmd);
+static bool cdc_measurement_set_samples(const cdc_command_t *cmd);
+static bool cdc_measurement_get_transmission(const cdc_command_t *cmd);
+static bool cdc_measurement_set_uncalibrated(const cdc_command_t *cmd);
+static bool cdc_calibration_set_all(const cdc_command_t *cmd);
+static bool cdc_calibration_get_all(const cdc_command_t *cmd);
+static bool cdc_calibration_get_drift(const cdc_command_t *cmd);
+static bool cdc_calibration_set_drift(const cdc_command_t *cmd);
+static bool cdc_calibration_get_gain(const cdc_command_t *cmd);
+static bool cdc_calibration_set_gain(const cdc_command_t *cmd);
+static bool cdc_calibration_invoke_gain(const cdc_command_t *cmd);
+static bool cdc_calibration_get_light(const cdc_command_t *cmd);
+static bool cdc_calibration_set_light(const cdc_command_t *cmd);
+static bool cdc_calibration_invoke_light_reflection(const cdc_command_t *cmd);
+static bool cdc_calibration_invoke_light_transmission(const cdc_command_t *cmd);
+static bool cdc_calibration_get_reflection(const cdc_command_t *cmd);
+static bool cdc_calibration_set_reflection(const cdc_command_t *cmd);
+static bool cdc_calibration_get_slope(const cdc_command_t *cmd);
+static bool cdc_calibration_set_slope(const cdc_command_t *cmd);
+static bool cdc_calibration_get_transmission(const cdc_command_t *cmd);
+static bool cdc_calibration_set_transmission(const cdc_command_t *cmd);
+static uint16_t cdc_send_cal_all_record(char *buf, uint16_t crc);
+static bool cdc_stage_cal_all_record(cdc_cal_all_record_t record, const char *values);
+static bool cdc_commit_cal_all(const char *checksum);
+static void cdc_clear_cal_all();
+static bool cdc_invoke_gain_calibration_callback(sensor_gain_calibration_status_t status, int param, uint32_t remaining_ms, void *user_data);
+#ifdef SENSOR_SIMULATION
+static bool cdc_diagnostics_invoke_benchmark(const cdc_command_t *cmd);
+#endif
+static bool cdc_diagnostics_get_display(const cdc_command_t *cmd);
+static bool cdc_diagnostics_get_job(const cdc_command_t *cmd);
+static bool cdc_diagnostics_set_log(const cdc_command_t *cmd);
+static bool cdc_diagnostics_set_light_reflection(const cdc_command_t *cmd);
+static bool cdc_diagnostics_set_light_transmission(const cdc_command_t *cmd);
+static bool cdc_diagnostics_set_mirror(const cdc_command_t *cmd);
+static bool cdc_diagnostics_invoke_read(const cdc_command_t *cmd);
+static bool cdc_diagnostics_set_sensor(const cdc_command_t *cmd);
+static bool cdc_diagnostics_invoke_sensor(const cdc_command_t *cmd);
+#ifdef SENSOR_SIMULATION
+static bool cdc_diagnostics_get_simulation(const cdc_command_t *cmd);
+static bool cdc_diagnostics_set_simulation(const cdc_command_t *cmd);
+#endif
+static bool cdc_diagnostics_get_stats(const cdc_command_t *cmd);
+static bool cdc_diagnostics_invoke_stats(const cdc_command_t *cmd);
+#ifdef EVENT_TRACE
+static bool cdc_diagnostics_get_trace(const cdc_command_t *cmd);
+#endif
+static bool cdc_diagnostics_invoke_wipe(const cdc_command_t *cmd);
+#ifdef SENSOR_SIMULATION
+static void cdc_run_benchmark(densitometer_t *densitometer, char light_ch, bool *first);
+#endif
 
+static void cdc_send_queued_data();
+static void cdc_clear_queued_data();
+static void cdc_log_output(const char *log, size_t size);
+static void cdc_send_raw_sensor_readings();
+static void cdc_send_raw_sensor_reading(const sensor_reading_t *reading);
+static void cdc_send_raw_sensor_frame(const sensor_reading_t *reading);
+static void cdc_send_display_updates();
+static void cdc_send_task_stats(const cdc_command_t *cmd);
+#ifdef EVENT_TRACE
+static void cdc_send_trace(const cdc_command_t *cmd);
+#endif
 static void cdc_send_response(const char *str);
 static void cdc_send_command_response(const cdc_command_t *cmd, const char *str);
+static size_t cdc_format_command_response(char *buf, size_t buf_size, const cdc_command_t *cmd, const char *str);
 
 static void encode_f32_array_response(char *buf, const float *array, size_t len);
 static size_t encode_f32(char *out, float value);
@@ -107,6 +271,14 @@ static size_t decode_f32_array_args(const char *args, float *elements, size_t le
 
 extern I2C_HandleTypeDef hi2c1;
 
+/*
+ * The command tables are kept in their own file, so the dispatch bench
+ * in software/tools is built from the same tables.
+ */
+#define CDC_COMMAND(action, type, args, flags, handler) { action, type, args, flags, handler }
+#include "cdc_command_tables.h"
+#undef CDC_COMMAND
+
 void task_cdc_run(void *argument)
 {
     osSemaphoreId_t task_start_semaphore = argument;
@@ -127,6 +299,13 @@ void task_cdc_run(void *argument)
         return;
     }
 
+    /* Create the queue for long-running commands */
+    cdc_job_queue = osMessageQueueNew(CDC_JOB_QUEUE_SIZE, sizeof(cdc_job_t), &cdc_job_queue_attrs);
+    if (!cdc_job_queue) {
+        log_e("Unable to create cdc_job_queue");
+        return;
+    }
+
     /* Create the CDC write mutex */
     cdc_mutex = osMutexNew(&cdc_mutex_attrs);
     if (!cdc_mutex) {
@@ -134,6 +313,9 @@ void task_cdc_run(void *argument)
         return;
     }
 
+    /* Make sure the command tables can be searched */
+    cdc_check_command_tables();
+
     cdc_initialized = true;
 
     /* Release the startup semaphore */
@@ -205,37 +387,95 @@ void cdc_task_loop()
      * if ( tud_cdc_connected() )
      */
 
-    if (tud_cdc_available()) {
-        /* Read data into local buffer */
-        char buf[64];
-        uint32_t count = tud_cdc_read(buf, sizeof(buf));
-
-        for (size_t i = 0; i < count; i++) {
-            /* Fill buffer as long as there is space */
-            if (cmd_buffer_len < CMD_DATA_SIZE) {
-                if (buf[i] >= 0x20 && buf[i] < 0x7F) {
-                    /* Only fill buffer with printable characters */
-                    cmd_buffer[cmd_buffer_len++] = buf[i];
-                } else if (buf[i] == 0x08 || buf[i] == 0x7F) {
-                    /* Handle backspace behavior */
-                    if (cmd_buffer_len > 0) {
-                        cmd_buffer_len--;
-                        cmd_buffer[cmd_buffer_len] = '\0';
-                    }
-                }
-            }
-            /* Accept command as soon as a line break is sent */
-            if ((buf[i] == '\r' || buf[i] == '\n') && cmd_buffer_len > 0) {
-                /* Accept command */
-                cmd_buffer[cmd_buffer_len] = '\0';
-                cdc_process_command((const char *)cmd_buffer, cmd_buffer_len);
-
-                /* Clear command buffer */
-                memset(cmd_buffer, 0, sizeof(cmd_buffer));
-                cmd_buffer_len = 0;
+    /* Send anything queued by other tasks before handling new commands */
+    cdc_send_queued_data();
+
+    /* Process any newly received commands */
+    cdc_receive_commands();
+
+    /* Send any raw sensor readings collected since the last pass */
+    cdc_send_raw_sensor_readings();
+
+    /* Send any display changes made since the last pass */
+    cdc_send_display_updates();
+
+    /* Send anything queued while commands were being processed */
+    cdc_send_queued_data();
+}
+
+void cdc_receive_commands()
+{
+    while (tud_cdc_available()) {
+        /* Read new data directly onto the end of any partial line */
+        uint32_t count = tud_cdc_read(cdc_rx_buffer + cdc_rx_len, sizeof(cdc_rx_buffer) - cdc_rx_len);
+        if (count == 0) { break; }
+
+        char *line = cdc_rx_buffer;
+        char *p = cdc_rx_buffer + cdc_rx_len;
+        char *end = p + count;
+
+        /* Process each complete line, in place */
+        for (; p < end; p++) {
+            if (*p == '\r' || *p == '\n') {
+                *p = '\0';
+                cdc_process_line(line, p - line, cdc_rx_overflow);
+                cdc_rx_overflow = 0;
+                line = p + 1;
             }
         }
+
+        /* Drop whatever no longer fits within the maximum line length */
+        size_t remaining = end - line;
+        if (remaining > CMD_DATA_SIZE) {
+            cdc_rx_overflow += remaining - CMD_DATA_SIZE;
+            remaining = CMD_DATA_SIZE;
+        }
+
+        /* Carry the partial line over to the start of the buffer */
+        if (line != cdc_rx_buffer && remaining > 0) {
+            memmove(cdc_rx_buffer, line, remaining);
+        }
+        cdc_rx_len = remaining;
+    }
+}
+
+void cdc_process_line(char *line, size_t len, size_t overflow)
+{
+    /*
+     * Strip out any non-printable characters, and apply the effect of
+     * any backspace characters, by compacting the line in place.
+     */
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] >= 0x20 && line[i] < 0x7F) {
+            line[n++] = line[i];
+        } else if ((line[i] == 0x08 || line[i] == 0x7F) && n > 0) {
+            n--;
+        }
+    }
+
+    if (n == 0) { return; }
+
+    if (n > CMD_DATA_SIZE) {
+        overflow += n - CMD_DATA_SIZE;
+        n = CMD_DATA_SIZE;
+    }
+    line[n] = '\0';
+
+    if (overflow > 0) {
+        /*
+         * Reply to the start of an over-long line as if it was a command,
+         * so the host can tell which of its commands was not processed.
+         */
+        cdc_command_t cmd = {0};
+        log_w("Line too long: %d bytes", (int)(n + overflow));
+        if (cdc_command_parse(&cmd, line, n)) {
+            cdc_send_command_response(&cmd, "NAK,LENGTH");
+        }
+        return;
     }
+
+    cdc_process_command(line, n);
 }
 
 void cdc_set_connected(bool connected)
@@ -246,18 +486,38 @@ void cdc_set_connected(bool connected)
             elog_set_text_color_enabled(true);
             cdc_logging_redirected = false;
             if (cdc_remote_enabled) {
-                task_main_force_state(STATE_HOME);
-                cdc_remote_enabled = false;
-                cdc_remote_active = false;
-                cdc_remote_sensor_active = false;
+                if (cdc_job_busy()) {
+                    /*
+                     * A running job may still be driving the sensor and
+                     * lights, so only leave remote mode once the job task
+                     * has worked through its queue.
+                     */
+                    cdc_remote_release_pending = true;
+                } else {
+                    cdc_release_remote();
+                }
             }
+            cdc_clear_queued_data();
+            cdc_display_mirror_active = false;
             reading_format = READING_FORMAT_BASIC;
+            raw_format = RAW_FORMAT_TEXT;
             densitometer_set_allow_uncalibrated_measurements(false);
+        } else {
+            /* Remote mode is kept as it was if the host returns before the jobs finish */
+            cdc_remote_release_pending = false;
         }
         cdc_host_connected = connected;
     }
 }
 
+void cdc_release_remote()
+{
+    task_main_force_state(STATE_HOME);
+    cdc_remote_enabled = false;
+    cdc_remote_active = false;
+    cdc_remote_sensor_active = false;
+}
+
 bool cdc_is_connected()
 {
     return cdc_host_connected;
@@ -271,663 +531,1305 @@ void cdc_process_command(const char *buf, size_t len)
         return;
     }
 
-    if (cdc_parse_command(&cmd, buf, len)) {
+    if (cdc_command_parse(&cmd, buf, len)) {
         bool result = false;
-        switch (cmd.category) {
-        case CMD_CATEGORY_SYSTEM:
-            result = cdc_process_command_system(&cmd);
-            break;
-        case CMD_CATEGORY_MEASUREMENT:
-            result = cdc_process_command_measurement(&cmd);
-            break;
-        case CMD_CATEGORY_CALIBRATION:
-            result = cdc_process_command_calibration(&cmd);
-            break;
-        case CMD_CATEGORY_DIAGNOSTICS:
-            result = cdc_process_command_diagnostics(&cmd);
-            break;
-        default:
-            break;
+
+        log_i("Command: [%c][%c] {%s},\"%s\"", buf[0], buf[1], cmd.action, cmd.args);
+
+        const cdc_command_entry_t *entry = cdc_command_find(
+            cdc_command_tables[cmd.category].table,
+            cdc_command_tables[cmd.category].count,
+            &cmd);
+
+        if (entry
+            && (!(entry->flags & CMD_FLAG_REMOTE) || cdc_remote_active)
+            && (!(entry->flags & CMD_FLAG_SENSOR_IDLE) || !cdc_remote_sensor_active)
+            && (!(entry->flags & CMD_FLAG_EXCLUSIVE) || !cdc_job_busy())) {
+            if (entry->flags & CMD_FLAG_JOB) {
+                result = cdc_queue_job(entry, &cmd);
+            } else {
+                result = entry->handler(&cmd);
+            }
         }
+
         if (!result) {
             cdc_send_command_response(&cmd, "NAK");
         }
     }
 }
 
-bool cdc_parse_command(cdc_command_t *cmd, const char *buf, size_t len)
+bool cdc_queue_job(const cdc_command_entry_t *entry, const cdc_command_t *cmd)
 {
-    cmd_type_t type;
-    cmd_category_t category;
+    cdc_job_t job = {
+        .handler = entry->handler,
+        .cmd = *cmd
+    };
 
-    if (!cmd || !buf || len < 2 || buf[0] == '\0') {
+    /*
+     * The CDC task is the only one adding jobs, so if there is space now
+     * the put cannot fail. The queued state is sent first, so it always
+     * reaches the host before anything sent by the job itself.
+     */
+    if (osMessageQueueGetSpace(cdc_job_queue) == 0) {
+        log_w("Job queue full");
         return false;
     }
 
-    switch (buf[0]) {
-    case 'S':
-        type = CMD_TYPE_SET;
-        break;
-    case 'G':
-        type = CMD_TYPE_GET;
-        break;
-    case 'I':
-        type = CMD_TYPE_INVOKE;
-        break;
-    default:
-        return false;
-    }
+    if (++cdc_job_last_id == 0) { cdc_job_last_id = 1; }
+    job.id = cdc_job_last_id;
 
-    switch (buf[1]) {
-    case 'S':
-        category = CMD_CATEGORY_SYSTEM;
-        break;
-    case 'M':
-        category = CMD_CATEGORY_MEASUREMENT;
-        break;
-    case 'C':
-        category = CMD_CATEGORY_CALIBRATION;
-        break;
-    case 'D':
-        category = CMD_CATEGORY_DIAGNOSTICS;
-        break;
-    default:
-        return false;
-    }
+    taskENTER_CRITICAL();
+    cdc_job_pending++;
+    taskEXIT_CRITICAL();
 
-    if (len > 2 && buf[2] != ' ') {
-        return false;
+    cdc_send_job_state(job.id, "QUEUED");
+    osMessageQueuePut(cdc_job_queue, &job, 0, 0);
+    return true;
+}
+
+bool cdc_job_busy()
+{
+    return cdc_job_pending > 0;
+}
+
+void cdc_send_job_state(uint8_t id, const char *state)
+{
+    const cdc_command_t cmd = {
+        .type = CMD_TYPE_INVOKE,
+        .category = CMD_CATEGORY_DIAGNOSTICS,
+        .action = "JOB"
+    };
+    char buf[16];
+    sprintf(buf, "%d,%s", id, state);
+    cdc_send_command_response(&cmd, buf);
+}
+
+void task_cdc_job_run(void *argument)
+{
+    osSemaphoreId_t task_start_semaphore = argument;
+    cdc_job_t job;
+
+    log_d("cdc_job_task start");
+
+    /* Release the startup semaphore */
+    if (osSemaphoreRelease(task_start_semaphore) != osOK) {
+        log_e("Unable to release task_start_semaphore");
+        return;
     }
 
-    cmd->type = type;
-    cmd->category = category;
+    while (1) {
+        if (osMessageQueueGet(cdc_job_queue, &job, NULL, portMAX_DELAY) != osOK) {
+            continue;
+        }
+
+        bool result = false;
+        if (cdc_host_connected) {
+            log_i("Job %d start: {%s},\"%s\"", job.id, job.cmd.action, job.cmd.args);
+            cdc_job_active_id = job.id;
+
+            result = job.handler(&job.cmd);
+            if (!result) {
+                cdc_send_command_response(&job.cmd, "NAK");
+            }
 
-    if (len > 3) {
-        char *p = strchr(buf + 3, ',');
-        if (p) {
-            strncpy(cmd->action, buf + 3, MIN(p - (buf + 3), sizeof(cmd->action) - 1));
-            strncpy(cmd->args, p + 1, MIN(len - ((p + 1) - buf), sizeof(cmd->args) - 1));
+            cdc_job_active_id = 0;
         } else {
-            strncpy(cmd->action, buf + 3, MIN(len - 3, sizeof(cmd->action) - 1));
-            bzero(cmd->args, sizeof(cmd->args));
+            /* Nobody is left to receive the results of jobs queued before a disconnect */
+            log_i("Job %d skipped", job.id);
         }
-    } else {
-        bzero(cmd->action, sizeof(cmd->action));
-        bzero(cmd->args, sizeof(cmd->args));
-    }
 
-    log_i("Command: [%c][%c] {%s},\"%s\"", buf[0], buf[1], cmd->action, cmd->args);
+        /*
+         * Remote mode release is deferred while jobs are pending, so finish
+         * it here once the last one is done. This is done under the mutex,
+         * so it cannot race with the disconnect handler.
+         */
+        osMutexAcquire(cdc_mutex, portMAX_DELAY);
+        taskENTER_CRITICAL();
+        cdc_job_pending--;
+        taskEXIT_CRITICAL();
+        if (cdc_job_pending == 0 && cdc_remote_release_pending) {
+            cdc_remote_release_pending = false;
+            cdc_release_remote();
+        }
+        osMutexRelease(cdc_mutex);
+
+        cdc_send_job_state(job.id, result ? "OK" : "NAK");
+    }
+}
 
-    return true;
+bool cdc_check_command_tables()
+{
+    bool result = true;
+    for (size_t i = 0; i < CMD_CATEGORY_MAX; i++) {
+        if (!cdc_command_table_sorted(cdc_command_tables[i].table, cdc_command_tables[i].count)) {
+            log_e("Command table %d is not sorted", (int)i);
+            result = false;
+        }
+    }
+    return result;
 }
 
-bool cdc_process_command_system(const cdc_command_t *cmd)
+bool cdc_system_get_build(const cdc_command_t *cmd)
 {
     /*
-     * System Commands
-     * "GS V"    -> Get project name and version
-     * "GS B"    -> Get firmware build information
-     * "GS DEV"  -> Get device information (HAL version, MCU Rev ID, MCU Dev ID, SysClock)
-     * "GS RTOS" -> Get FreeRTOS information
-     * "GS UID"  -> Get device unique ID
-     * "GS ISEN" -> Internal sensor readings
-     * "IS REMOTE,n" -> Invoke remote control mode (enable = 1, disable = 0)
-     * "SS DISP,text" -> Write text to the display [remote]
+     * Output format:
+     * Build date, Build describe, Checksum
      */
     const app_descriptor_t *app_descriptor = app_descriptor_get();
     char buf[128];
 
-    if (!cmd) { return false; }
+    sprintf(buf, "\"%s\",\"%s\",%08lX",
+        app_descriptor->build_date,
+        app_descriptor->build_describe,
+        __bswap32(app_descriptor->crc32));
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-    if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "V") == 0) {
-        /*
-         * Output format:
-         * Project name, Version
-         */
-        sprintf(buf, "\"%s\",\"%s\"", app_descriptor->project_name, app_descriptor->version);
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "B") == 0) {
-        /*
-         * Output format:
-         * Build date, Build describe, Checksum
-         */
-        sprintf(buf, "\"%s\",\"%s\",%08lX",
-            app_descriptor->build_date,
-            app_descriptor->build_describe,
-            __bswap32(app_descriptor->crc32));
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "DEV") == 0) {
-        /*
-         * Output format:
-         * HAL Version, MCU Device ID, MCU Revision ID, SysClock Frequency
-         */
-        uint32_t hal_ver = HAL_GetHalVersion();
-        uint8_t hal_ver_code = ((uint8_t)(hal_ver)) & 0x0F;
-
-        sprintf(buf, "%d.%d.%d%c,0x%lX,0x%lX,%ldMHz",
-            ((uint8_t)(hal_ver >> 24)) & 0x0F,
-            ((uint8_t)(hal_ver >> 16)) & 0x0F,
-            ((uint8_t)(hal_ver >> 8)) & 0x0F,
-            (hal_ver_code > 0 ? (char)hal_ver_code : ' '),
-            HAL_GetDEVID(),
-            HAL_GetREVID(),
-            HAL_RCC_GetSysClockFreq() / 1000000);
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "RTOS") == 0) {
-        /*
-         * Output format:
-         * FreeRTOS Version, Heap Free, Heap Watermark, Task Count
-         */
-        sprintf(buf, "%s,%d,%d,%ld",
-            tskKERNEL_VERSION_NUMBER,
-            xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(),
-            uxTaskGetNumberOfTasks());
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "UID") == 0) {
-        sprintf(buf, "%08lX%08lX%08lX",
-            __bswap32(HAL_GetUIDw0()),
-            __bswap32(HAL_GetUIDw1()),
-            __bswap32(HAL_GetUIDw2()));
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "ISEN") == 0) {
-        /*
-         * Output format:
-         * VDDA, Temperature
-         */
-        adc_readings_t readings;
-        if (adc_read(&readings) == osOK) {
-            sprintf_(buf, "%dmV,%.1fC", readings.vdda_mv, readings.temp_c);
-            cdc_send_command_response(cmd, buf);
-        } else {
-            cdc_send_command_response(cmd, "ERR");
-        }
-        return true;
-    } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "REMOTE") == 0) {
-        bool enable;
-        if (cmd->args[0] == '0' && cmd->args[1] == '\0') {
-            enable = false;
-        } else if (cmd->args[0] == '1' && cmd->args[1] == '\0') {
-            enable = true;
-        } else {
-            return false;
-        }
+bool cdc_system_get_device(const cdc_command_t *cmd)
+{
+    /*
+     * Output format:
+     * HAL Version, MCU Device ID, MCU Revision ID, SysClock Frequency
+     */
+    char buf[128];
+    uint32_t hal_ver = HAL_GetHalVersion();
+    uint8_t hal_ver_code = ((uint8_t)(hal_ver)) & 0x0F;
+
+    sprintf(buf, "%d.%d.%d%c,0x%lX,0x%lX,%ldMHz",
+        ((uint8_t)(hal_ver >> 24)) & 0x0F,
+        ((uint8_t)(hal_ver >> 16)) & 0x0F,
+        ((uint8_t)(hal_ver >> 8)) & 0x0F,
+        (hal_ver_code > 0 ? (char)hal_ver_code : ' '),
+        HAL_GetDEVID(),
+        HAL_GetREVID(),
+        HAL_RCC_GetSysClockFreq() / 1000000);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-        log_i("Set remote control mode: %d", enable);
-        if (enable) {
-            cdc_remote_enabled = true;
-            task_main_force_state(STATE_REMOTE);
-        } else {
-            task_main_force_state(STATE_HOME);
-            cdc_remote_enabled = false;
-        }
+bool cdc_system_set_display(const cdc_command_t *cmd)
+{
+    char buf[128];
 
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "DISP") == 0 && cdc_remote_active) {
-
-        bzero(buf, sizeof(buf));
-        uint8_t j = 0;
-        for (uint8_t i = 0; i < 56; i++) {
-            if (i < 55 && cmd->args[i] == '\\' && cmd->args[i + 1] == 'n') {
-                buf[j++] = '\n';
-                i++;
-            } else if (i < 55 && cmd->args[i] == '\\' && cmd->args[i + 1] == '\\') {
-                buf[j++] = '\\';
-                i++;
-            } else {
-                buf[j++] = cmd->args[i];
-            }
+    bzero(buf, sizeof(buf));
+    uint8_t j = 0;
+    for (uint8_t i = 0; i < 56; i++) {
+        if (i < 55 && cmd->args[i] == '\\' && cmd->args[i + 1] == 'n') {
+            buf[j++] = '\n';
+            i++;
+        } else if (i < 55 && cmd->args[i] == '\\' && cmd->args[i + 1] == '\\') {
+            buf[j++] = '\\';
+            i++;
+        } else {
+            buf[j++] = cmd->args[i];
         }
-
-        display_static_message(buf);
-        cdc_send_command_response(cmd, "OK");
-        return true;
-    } else {
-        return false;
     }
+
+    display_static_message(buf);
+    cdc_send_command_response(cmd, "OK");
+    return true;
 }
 
-bool cdc_process_command_measurement(const cdc_command_t *cmd)
+bool cdc_system_get_internal_sensors(const cdc_command_t *cmd)
 {
     /*
-     * Measurement Commands
-     * "GM REFL" -> Get last reflection measurement
-     * "GM TRAN" -> Get last transmission measurement
-     * "SM FORMAT,x" -> Set measurement data format ("BASIC", "EXT")
-     * "SM UNCAL,x" -> Allow uncalibrated readings (0=false, 1=true)
+     * Output format:
+     * VDDA, Temperature
      */
-    if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "REFL") == 0) {
-        char buf[32];
-        float reading = densitometer_get_display_d(densitometer_reflection());
-        encode_f32(buf, reading);
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "TRAN") == 0) {
-        char buf[32];
-        float reading = densitometer_get_display_d(densitometer_transmission());
-        encode_f32(buf, reading);
+    char buf[128];
+    adc_readings_t readings;
+    if (adc_read(&readings) == osOK) {
+        sprintf_(buf, "%dmV,%.1fC", readings.vdda_mv, readings.temp_c);
         cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "FORMAT") == 0) {
-        if (strcmp(cmd->args, "BASIC") == 0) {
-            reading_format = READING_FORMAT_BASIC;
-        } else if (strcmp(cmd->args, "EXT") == 0) {
-            reading_format = READING_FORMAT_EXT;
-        } else {
-            return false;
-        }
-        cdc_send_command_response(cmd, "OK");
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "UNCAL") == 0) {
-        if (strcmp(cmd->args, "0") == 0) {
-            densitometer_set_allow_uncalibrated_measurements(false);
-        } else if (strcmp(cmd->args, "1") == 0) {
-            densitometer_set_allow_uncalibrated_measurements(true);
-        } else {
-            return false;
-        }
-        cdc_send_command_response(cmd, "OK");
-        return true;
+    } else {
+        cdc_send_command_response(cmd, "ERR");
     }
-    return false;
+    return true;
 }
 
-bool cdc_process_command_calibration(const cdc_command_t *cmd)
+bool cdc_system_invoke_remote(const cdc_command_t *cmd)
 {
-    /*
-     * Calibration Commands
-     * "IC GAIN" -> Invoke the sensor gain calibration process [remote]
-     * "GC LIGHT" -> Get measurement light calibration values
-     * "SC LIGHT" -> Set measurement light calibration values
-     * "GC GAIN" -> Get sensor gain calibration values
-     * "SC GAIN" -> Set sensor gain calibration values
-     * "GC SLOPE" -> Get sensor slope calibration values
-     * "SC SLOPE" -> Set sensor slope calibration values
-     * "GC REFL" -> Get reflection density calibration values
-     * "SC REFL" -> Set reflection density calibration values
-     * "GC TRAN" -> Get transmission density calibration values
-     * "SC TRAN" -> Set transmission density calibration values
-     */
-    if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "GAIN") == 0 && cdc_remote_active) {
-        osStatus_t result = sensor_gain_calibration(cdc_invoke_gain_calibration_callback, (void *)cmd);
-        if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
-        } else {
-            cdc_send_command_response(cmd, "ERR");
-        }
-        return true;
+    bool enable;
+    if (cmd->args[0] == '0' && cmd->args[1] == '\0') {
+        enable = false;
+    } else if (cmd->args[0] == '1' && cmd->args[1] == '\0') {
+        enable = true;
+    } else {
+        return false;
     }
-#ifdef TEST_LIGHT_CAL
-    else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "LR") == 0 && cdc_remote_active) {
-        /* This command is only enabled for development and testing purposes */
-        osStatus_t result = sensor_light_calibration(SENSOR_LIGHT_REFLECTION, NULL, NULL);
-        if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
-        } else {
-            cdc_send_command_response(cmd, "ERR");
-        }
-        return true;
-    } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "LT") == 0 && cdc_remote_active) {
-        /* This command is only enabled for development and testing purposes */
-        osStatus_t result = sensor_light_calibration(SENSOR_LIGHT_TRANSMISSION, NULL, NULL);
-        if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
-        } else {
-            cdc_send_command_response(cmd, "ERR");
-        }
-        return true;
+
+    log_i("Set remote control mode: %d", enable);
+    if (enable) {
+        cdc_remote_enabled = true;
+        task_main_force_state(STATE_REMOTE);
+    } else {
+        task_main_force_state(STATE_HOME);
+        cdc_remote_enabled = false;
     }
-#endif
-    else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "LIGHT") == 0) {
-        char buf[64];
-        settings_cal_light_t cal_light;
 
-        settings_get_cal_light(&cal_light);
-        sprintf(buf, "%d,%d", cal_light.reflection, cal_light.transmission);
+    return true;
+}
 
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "LIGHT") == 0) {
-        char buf[8];
-        strncpy(buf, cmd->args, 8);
-        buf[7] = '\0';
-
-        char *p = strchr(buf, ',');
-        if (p && p != buf && *(p + 1) != '\0') {
-            *p = '\0';
-            int refl_value = atoi(buf);
-            int tran_value = atoi(p + 1);
-
-            if (refl_value >= 0 && refl_value <= 128
-                && tran_value >= 0 && tran_value <= 128) {
-                settings_cal_light_t cal_light = {0};
-                cal_light.reflection = (uint8_t)refl_value;
-                cal_light.transmission = (uint8_t)tran_value;
-
-                if (settings_set_cal_light(&cal_light)) {
-                    cdc_send_command_response(cmd, "OK");
-                } else {
-                    cdc_send_command_response(cmd, "ERR");
-                }
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
+bool cdc_system_get_rtos(const cdc_command_t *cmd)
+{
+    /*
+     * Output format:
+     * FreeRTOS Version, Heap Free, Heap Watermark, Task Count
+     */
+    char buf[128];
 
-        } else {
-            cdc_send_command_response(cmd, "ERR");
-        }
+    sprintf(buf, "%s,%d,%d,%ld",
+        tskKERNEL_VERSION_NUMBER,
+        xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(),
+        uxTaskGetNumberOfTasks());
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "GAIN") == 0) {
-        char buf[128];
-        float gain_val[8] = {0};
-        settings_cal_gain_t cal_gain;
+bool cdc_system_get_tasks(const cdc_command_t *cmd)
+{
+    cdc_send_task_stats(cmd);
+    return true;
+}
 
-        settings_get_cal_gain(&cal_gain);
+bool cdc_system_get_uid(const cdc_command_t *cmd)
+{
+    char buf[128];
 
-        gain_val[0] = 1.0F;
-        gain_val[1] = 1.0F;
-        gain_val[2] = cal_gain.ch0_medium;
-        gain_val[3] = cal_gain.ch1_medium;
-        gain_val[4] = cal_gain.ch0_high;
-        gain_val[5] = cal_gain.ch1_high;
-        gain_val[6] = cal_gain.ch0_maximum;
-        gain_val[7] = cal_gain.ch1_maximum;
+    sprintf(buf, "%08lX%08lX%08lX",
+        __bswap32(HAL_GetUIDw0()),
+        __bswap32(HAL_GetUIDw1()),
+        __bswap32(HAL_GetUIDw2()));
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-        encode_f32_array_response(buf, gain_val, 8);
+bool cdc_system_get_version(const cdc_command_t *cmd)
+{
+    /*
+     * Output format:
+     * Project name, Version
+     */
+    const app_descriptor_t *app_descriptor = app_descriptor_get();
+    char buf[128];
 
-        cdc_send_command_response(cmd, buf);
+    sprintf(buf, "\"%s\",\"%s\"", app_descriptor->project_name, app_descriptor->version);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_measurement_set_format(const cdc_command_t *cmd)
+{
+    if (strcmp(cmd->args, "BASIC") == 0) {
+        reading_format = READING_FORMAT_BASIC;
+    } else if (strcmp(cmd->args, "EXT") == 0) {
+        reading_format = READING_FORMAT_EXT;
+    } else {
+        return false;
+    }
+    cdc_send_command_response(cmd, "OK");
+    return true;
+}
+
+bool cdc_measurement_get_reflection(const cdc_command_t *cmd)
+{
+    char buf[32];
+    float reading = densitometer_get_display_d(densitometer_reflection());
+    encode_f32(buf, reading);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_measurement_get_samples(const cdc_command_t *cmd)
+{
+    char buf[32];
+    const char *reject_str;
+    settings_user_sampling_t sampling;
+    settings_get_user_sampling(&sampling);
+
+    if (sampling.reject == SETTING_SAMPLING_REJECT_SIGMA) {
+        reject_str = "SIGMA";
+    } else if (sampling.reject == SETTING_SAMPLING_REJECT_MEDIAN) {
+        reject_str = "MEDIAN";
+    } else {
+        reject_str = "NONE";
+    }
+
+    sprintf(buf, "%d,%s", sampling.count, reject_str);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_measurement_set_samples(const cdc_command_t *cmd)
+{
+    char buf[16];
+    strncpy(buf, cmd->args, sizeof(buf));
+    buf[sizeof(buf) - 1] = '\0';
+
+    char *p = strchr(buf, ',');
+    if (!p || p == buf || *(p + 1) == '\0') {
+        return false;
+    }
+    *p = '\0';
+
+    settings_user_sampling_t sampling = {0};
+    int count_value = atoi(buf);
+    if (count_value < SETTING_SAMPLING_COUNT_MIN || count_value > SETTING_SAMPLING_COUNT_MAX) {
+        return false;
+    }
+    sampling.count = (uint8_t)count_value;
+
+    if (strcmp(p + 1, "NONE") == 0) {
+        sampling.reject = SETTING_SAMPLING_REJECT_NONE;
+    } else if (strcmp(p + 1, "SIGMA") == 0) {
+        sampling.reject = SETTING_SAMPLING_REJECT_SIGMA;
+    } else if (strcmp(p + 1, "MEDIAN") == 0) {
+        sampling.reject = SETTING_SAMPLING_REJECT_MEDIAN;
+    } else {
+        return false;
+    }
+
+    if (settings_set_user_sampling(&sampling)) {
+        cdc_send_command_response(cmd, "OK");
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
+
+bool cdc_measurement_get_transmission(const cdc_command_t *cmd)
+{
+    char buf[32];
+    float reading = densitometer_get_display_d(densitometer_transmission());
+    encode_f32(buf, reading);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_measurement_set_uncalibrated(const cdc_command_t *cmd)
+{
+    if (strcmp(cmd->args, "0") == 0) {
+        densitometer_set_allow_uncalibrated_measurements(false);
+    } else if (strcmp(cmd->args, "1") == 0) {
+        densitometer_set_allow_uncalibrated_measurements(true);
+    } else {
+        return false;
+    }
+    cdc_send_command_response(cmd, "OK");
+    return true;
+}
+
+bool cdc_calibration_set_all(const cdc_command_t *cmd)
+{
+    char buf[8];
+    const char *tag = strchr(CAL_ALL_TAGS, cmd->args[0]);
+
+    if (cmd->args[1] != ',') {
+        cdc_clear_cal_all();
+        return false;
+    }
+
+    if (cmd->args[0] == 'C') {
+        if (cdc_commit_cal_all(cmd->args + 2)) {
+            cdc_send_command_response(cmd, "C,OK");
+        } else {
+            cdc_send_command_response(cmd, "C,ERR");
+        }
+        cdc_clear_cal_all();
         return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "GAIN") == 0) {
-        float gain_val[6] = {0};
-        size_t n = decode_f32_array_args(cmd->args, gain_val, 8);
-        if (n == 6) {
-            settings_cal_gain_t cal_gain = {0};
-            cal_gain.ch0_medium = gain_val[0];
-            cal_gain.ch1_medium = gain_val[1];
-            cal_gain.ch0_high = gain_val[2];
-            cal_gain.ch1_high = gain_val[3];
-            cal_gain.ch0_maximum = gain_val[4];
-            cal_gain.ch1_maximum = gain_val[5];
-
-            if (settings_set_cal_gain(&cal_gain)) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
+    }
 
-            return true;
+    if (!tag) {
+        cdc_clear_cal_all();
+        return false;
+    }
+
+    /*
+     * Records must arrive in tag order, so a record that does not follow
+     * the last one staged is the start of a new transfer. This discards
+     * anything left over from a transfer that was never committed.
+     */
+    cdc_cal_all_record_t record = (cdc_cal_all_record_t)(tag - CAL_ALL_TAGS);
+    if ((int8_t)record <= cdc_cal_all.last) {
+        cdc_clear_cal_all();
+    }
+
+    if (!cdc_stage_cal_all_record(record, cmd->args + 2)) {
+        cdc_clear_cal_all();
+        return false;
+    }
+
+    cdc_cal_all.crc = crc16_ccitt_update(cdc_cal_all.crc, (const uint8_t *)cmd->args, strlen(cmd->args));
+    cdc_cal_all.crc = crc16_ccitt_update(cdc_cal_all.crc, (const uint8_t *)"\r\n", 2);
+    cdc_cal_all.received |= (1U << record);
+    cdc_cal_all.last = (int8_t)record;
+
+    sprintf(buf, "%c,OK", cmd->args[0]);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_calibration_get_all(const cdc_command_t *cmd)
+{
+    /*
+     * Output format, one record per line:
+     * V,Project name,Version
+     * B,Build date,Build describe,Checksum
+     * U,Unique ID
+     * L,Reflection light,Transmission light
+     * G,Gain values (same as "SC GAIN")
+     * S,Slope values (same as "SC SLOPE")
+     * D,Drift values (same as "SC DRIFT")
+     * R,Reflection values (same as "SC REFL")
+     * T,Transmission values (same as "SC TRAN")
+     * C,CRC-16/CCITT-FALSE of all the preceding lines
+     */
+    const app_descriptor_t *app_descriptor = app_descriptor_get();
+    char buf[128];
+    float val[4];
+    uint16_t crc = 0xFFFF;
+    settings_cal_light_t cal_light;
+    settings_cal_gain_t cal_gain;
+    settings_cal_slope_t cal_slope;
+    settings_cal_drift_t cal_drift;
+    settings_cal_reflection_t cal_reflection;
+    settings_cal_transmission_t cal_transmission;
+
+    settings_get_cal_light(&cal_light);
+    settings_get_cal_gain(&cal_gain);
+    settings_get_cal_slope(&cal_slope);
+    settings_get_cal_drift(&cal_drift);
+    settings_get_cal_reflection(&cal_reflection);
+    settings_get_cal_transmission(&cal_transmission);
+
+    cdc_send_command_response(cmd, "[[");
+
+    sprintf(buf, "V,\"%s\",\"%s\"", app_descriptor->project_name, app_descriptor->version);
+    crc = cdc_send_cal_all_record(buf, crc);
+
+    sprintf(buf, "B,\"%s\",\"%s\",%08lX",
+        app_descriptor->build_date,
+        app_descriptor->build_describe,
+        __bswap32(app_descriptor->crc32));
+    crc = cdc_send_cal_all_record(buf, crc);
+
+    sprintf(buf, "U,%08lX%08lX%08lX",
+        __bswap32(HAL_GetUIDw0()),
+        __bswap32(HAL_GetUIDw1()),
+        __bswap32(HAL_GetUIDw2()));
+    crc = cdc_send_cal_all_record(buf, crc);
+
+    sprintf(buf, "L,%d,%d", cal_light.reflection, cal_light.transmission);
+    crc = cdc_send_cal_all_record(buf, crc);
+
+    float gain_val[6] = {
+        cal_gain.ch0_medium, cal_gain.ch1_medium,
+        cal_gain.ch0_high, cal_gain.ch1_high,
+        cal_gain.ch0_maximum, cal_gain.ch1_maximum
+    };
+    strcpy(buf, "G,");
+    encode_f32_array_response(buf + 2, gain_val, 6);
+    crc = cdc_send_cal_all_record(buf, crc);
+
+    val[0] = cal_slope.b0;
+    val[1] = cal_slope.b1;
+    val[2] = cal_slope.b2;
+    strcpy(buf, "S,");
+    encode_f32_array_response(buf + 2, val, 3);
+    crc = cdc_send_cal_all_record(buf, crc);
+
+    val[0] = cal_drift.reflection;
+    val[1] = cal_drift.transmission;
+    strcpy(buf, "D,");
+    encode_f32_array_response(buf + 2, val, 2);
+    crc = cdc_send_cal_all_record(buf, crc);
+
+    val[0] = cal_reflection.lo_d;
+    val[1] = cal_reflection.lo_value;
+    val[2] = cal_reflection.hi_d;
+    val[3] = cal_reflection.hi_value;
+    strcpy(buf, "R,");
+    encode_f32_array_response(buf + 2, val, 4);
+    crc = cdc_send_cal_all_record(buf, crc);
+
+    val[0] = 0.0F;
+    val[1] = cal_transmission.zero_value;
+    val[2] = cal_transmission.hi_d;
+    val[3] = cal_transmission.hi_value;
+    strcpy(buf, "T,");
+    encode_f32_array_response(buf + 2, val, 4);
+    crc = cdc_send_cal_all_record(buf, crc);
+
+    sprintf(buf, "C,%04X\r\n", crc);
+    cdc_send_response(buf);
+    cdc_send_response("]]\r\n");
+    return true;
+}
+
+uint16_t cdc_send_cal_all_record(char *buf, uint16_t crc)
+{
+    strcat(buf, "\r\n");
+    size_t len = strlen(buf);
+    cdc_write(buf, len);
+    return crc16_ccitt_update(crc, (const uint8_t *)buf, len);
+}
+
+bool cdc_stage_cal_all_record(cdc_cal_all_record_t record, const char *values)
+{
+    float val[7] = {0};
+    size_t n;
+
+    switch (record) {
+    case CAL_ALL_LIGHT: {
+        char *end;
+        long refl_value = strtol(values, &end, 10);
+        if (end == values || *end != ',') { return false; }
+        const char *p = end + 1;
+        long tran_value = strtol(p, &end, 10);
+        if (end == p || *end != '\0') { return false; }
+        if (refl_value < 0 || refl_value > 128 || tran_value < 0 || tran_value > 128) {
+            return false;
         }
+        cdc_cal_all.light.reflection = (uint8_t)refl_value;
+        cdc_cal_all.light.transmission = (uint8_t)tran_value;
+        return true;
+    }
+    case CAL_ALL_GAIN:
+        n = decode_f32_array_args(values, val, 7);
+        if (n != 6) { return false; }
+        cdc_cal_all.gain.ch0_medium = val[0];
+        cdc_cal_all.gain.ch1_medium = val[1];
+        cdc_cal_all.gain.ch0_high = val[2];
+        cdc_cal_all.gain.ch1_high = val[3];
+        cdc_cal_all.gain.ch0_maximum = val[4];
+        cdc_cal_all.gain.ch1_maximum = val[5];
+        return true;
+    case CAL_ALL_SLOPE:
+        n = decode_f32_array_args(values, val, 4);
+        if (n != 3) { return false; }
+        cdc_cal_all.slope.b0 = val[0];
+        cdc_cal_all.slope.b1 = val[1];
+        cdc_cal_all.slope.b2 = val[2];
+        return true;
+    case CAL_ALL_DRIFT:
+        n = decode_f32_array_args(values, val, 3);
+        if (n != 2) { return false; }
+        cdc_cal_all.drift.reflection = val[0];
+        cdc_cal_all.drift.transmission = val[1];
+        return true;
+    case CAL_ALL_REFLECTION:
+        n = decode_f32_array_args(values, val, 5);
+        if (n != 4) { return false; }
+        cdc_cal_all.reflection.lo_d = val[0];
+        cdc_cal_all.reflection.lo_value = val[1];
+        cdc_cal_all.reflection.hi_d = val[2];
+        cdc_cal_all.reflection.hi_value = val[3];
+        return true;
+    case CAL_ALL_TRANSMISSION:
+        n = decode_f32_array_args(values, val, 5);
+        if (n != 4 || !(val[0] < 0.001F)) { return false; }
+        cdc_cal_all.transmission.zero_value = val[1];
+        cdc_cal_all.transmission.hi_d = val[2];
+        cdc_cal_all.transmission.hi_value = val[3];
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool cdc_commit_cal_all(const char *checksum)
+{
+    char *end;
+    unsigned long crc = strtoul(checksum, &end, 16);
+    if (end - checksum != 4 || *end != '\0') {
+        log_w("Invalid calibration snapshot checksum");
+        return false;
     }
-    else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "SLOPE") == 0) {
-        char buf[64];
-        settings_cal_slope_t cal_slope;
-        float slope_val[3] = {0};
 
-        settings_get_cal_slope(&cal_slope);
-        slope_val[0] = cal_slope.b0;
-        slope_val[1] = cal_slope.b1;
-        slope_val[2] = cal_slope.b2;
-        encode_f32_array_response(buf, slope_val, 3);
+    if (cdc_cal_all.received == 0 || crc != cdc_cal_all.crc) {
+        log_w("Calibration snapshot checksum mismatch: %04lX != %04X", crc, cdc_cal_all.crc);
+        return false;
+    }
+
+    /*
+     * Validate every staged record before writing any of them, so that a
+     * bad snapshot cannot leave the device partially restored.
+     */
+    if (((cdc_cal_all.received & (1U << CAL_ALL_LIGHT)) && !settings_validate_cal_light(&cdc_cal_all.light))
+        || ((cdc_cal_all.received & (1U << CAL_ALL_GAIN)) && !settings_validate_cal_gain(&cdc_cal_all.gain))
+        || ((cdc_cal_all.received & (1U << CAL_ALL_SLOPE)) && !settings_validate_cal_slope(&cdc_cal_all.slope))
+        || ((cdc_cal_all.received & (1U << CAL_ALL_DRIFT)) && !settings_validate_cal_drift(&cdc_cal_all.drift))
+        || ((cdc_cal_all.received & (1U << CAL_ALL_REFLECTION)) && !settings_validate_cal_reflection(&cdc_cal_all.reflection))
+        || ((cdc_cal_all.received & (1U << CAL_ALL_TRANSMISSION)) && !settings_validate_cal_transmission(&cdc_cal_all.transmission))) {
+        log_w("Calibration snapshot contains invalid values");
+        return false;
+    }
+
+    if (((cdc_cal_all.received & (1U << CAL_ALL_LIGHT)) && !settings_set_cal_light(&cdc_cal_all.light))
+        || ((cdc_cal_all.received & (1U << CAL_ALL_GAIN)) && !settings_set_cal_gain(&cdc_cal_all.gain))
+        || ((cdc_cal_all.received & (1U << CAL_ALL_SLOPE)) && !settings_set_cal_slope(&cdc_cal_all.slope))
+        || ((cdc_cal_all.received & (1U << CAL_ALL_DRIFT)) && !settings_set_cal_drift(&cdc_cal_all.drift))
+        || ((cdc_cal_all.received & (1U << CAL_ALL_REFLECTION)) && !settings_set_cal_reflection(&cdc_cal_all.reflection))
+        || ((cdc_cal_all.received & (1U << CAL_ALL_TRANSMISSION)) && !settings_set_cal_transmission(&cdc_cal_all.transmission))) {
+        log_e("Unable to write calibration snapshot");
+        return false;
+    }
+
+    return true;
+}
+
+void cdc_clear_cal_all()
+{
+    memset(&cdc_cal_all, 0, sizeof(cdc_cal_all_t));
+    cdc_cal_all.last = -1;
+    cdc_cal_all.crc = 0xFFFF;
+}
+
+bool cdc_calibration_get_drift(const cdc_command_t *cmd)
+{
+    char buf[64];
+    settings_cal_drift_t cal_drift;
+    float drift_val[2] = {0};
+
+    settings_get_cal_drift(&cal_drift);
+    drift_val[0] = cal_drift.reflection;
+    drift_val[1] = cal_drift.transmission;
+    encode_f32_array_response(buf, drift_val, 2);
+
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_calibration_set_drift(const cdc_command_t *cmd)
+{
+    float drift_val[2] = {0};
+    size_t n = decode_f32_array_args(cmd->args, drift_val, 2);
+    if (n == 2) {
+        settings_cal_drift_t cal_drift = {0};
+        cal_drift.reflection = drift_val[0];
+        cal_drift.transmission = drift_val[1];
+
+        if (settings_validate_cal_drift(&cal_drift) && settings_set_cal_drift(&cal_drift)) {
+            cdc_send_command_response(cmd, "OK");
+        } else {
+            cdc_send_command_response(cmd, "ERR");
+        }
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
+
+bool cdc_calibration_get_gain(const cdc_command_t *cmd)
+{
+    char buf[128];
+    float gain_val[8] = {0};
+    settings_cal_gain_t cal_gain;
+
+    settings_get_cal_gain(&cal_gain);
+
+    gain_val[0] = 1.0F;
+    gain_val[1] = 1.0F;
+    gain_val[2] = cal_gain.ch0_medium;
+    gain_val[3] = cal_gain.ch1_medium;
+    gain_val[4] = cal_gain.ch0_high;
+    gain_val[5] = cal_gain.ch1_high;
+    gain_val[6] = cal_gain.ch0_maximum;
+    gain_val[7] = cal_gain.ch1_maximum;
+
+    encode_f32_array_response(buf, gain_val, 8);
+
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_calibration_set_gain(const cdc_command_t *cmd)
+{
+    float gain_val[8] = {0};
+    size_t n = decode_f32_array_args(cmd->args, gain_val, 8);
+    if (n == 6) {
+        settings_cal_gain_t cal_gain = {0};
+        cal_gain.ch0_medium = gain_val[0];
+        cal_gain.ch1_medium = gain_val[1];
+        cal_gain.ch0_high = gain_val[2];
+        cal_gain.ch1_high = gain_val[3];
+        cal_gain.ch0_maximum = gain_val[4];
+        cal_gain.ch1_maximum = gain_val[5];
+
+        if (settings_set_cal_gain(&cal_gain)) {
+            cdc_send_command_response(cmd, "OK");
+        } else {
+            cdc_send_command_response(cmd, "ERR");
+        }
 
-        cdc_send_command_response(cmd, buf);
         return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "SLOPE") == 0) {
-        float slope_val[3] = {0};
-        size_t n = decode_f32_array_args(cmd->args, slope_val, 3);
-        if (n == 3) {
-            settings_cal_slope_t cal_slope = {0};
-            cal_slope.b0 = slope_val[0];
-            cal_slope.b1 = slope_val[1];
-            cal_slope.b2 = slope_val[2];
-
-            if (settings_set_cal_slope(&cal_slope)) {
+    }
+    return false;
+}
+
+bool cdc_calibration_invoke_gain(const cdc_command_t *cmd)
+{
+    osStatus_t result = sensor_gain_calibration(cdc_invoke_gain_calibration_callback, (void *)cmd);
+    if (result == osOK) {
+        cdc_send_command_response(cmd, "OK");
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
+
+bool cdc_calibration_get_light(const cdc_command_t *cmd)
+{
+    char buf[64];
+    settings_cal_light_t cal_light;
+
+    settings_get_cal_light(&cal_light);
+    sprintf(buf, "%d,%d", cal_light.reflection, cal_light.transmission);
+
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_calibration_set_light(const cdc_command_t *cmd)
+{
+    char buf[8];
+    strncpy(buf, cmd->args, 8);
+    buf[7] = '\0';
+
+    char *p = strchr(buf, ',');
+    if (p && p != buf && *(p + 1) != '\0') {
+        *p = '\0';
+        int refl_value = atoi(buf);
+        int tran_value = atoi(p + 1);
+
+        if (refl_value >= 0 && refl_value <= 128
+            && tran_value >= 0 && tran_value <= 128) {
+            settings_cal_light_t cal_light = {0};
+            cal_light.reflection = (uint8_t)refl_value;
+            cal_light.transmission = (uint8_t)tran_value;
+
+            if (settings_set_cal_light(&cal_light)) {
                 cdc_send_command_response(cmd, "OK");
             } else {
                 cdc_send_command_response(cmd, "ERR");
             }
-            return true;
+        } else {
+            cdc_send_command_response(cmd, "ERR");
+        }
+
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+
+    return true;
+}
+
+bool cdc_calibration_invoke_light_reflection(const cdc_command_t *cmd)
+{
+    osStatus_t result = sensor_light_calibration(SENSOR_LIGHT_REFLECTION, NULL, NULL);
+    if (result == osOK) {
+        cdc_send_command_response(cmd, "OK");
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
+
+bool cdc_calibration_invoke_light_transmission(const cdc_command_t *cmd)
+{
+    osStatus_t result = sensor_light_calibration(SENSOR_LIGHT_TRANSMISSION, NULL, NULL);
+    if (result == osOK) {
+        cdc_send_command_response(cmd, "OK");
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
+
+bool cdc_calibration_get_reflection(const cdc_command_t *cmd)
+{
+    char buf[64];
+    settings_cal_reflection_t cal_reflection;
+    float refl_val[4] = {0};
+
+    settings_get_cal_reflection(&cal_reflection);
+    refl_val[0] = cal_reflection.lo_d;
+    refl_val[1] = cal_reflection.lo_value;
+    refl_val[2] = cal_reflection.hi_d;
+    refl_val[3] = cal_reflection.hi_value;
+
+    encode_f32_array_response(buf, refl_val, 4);
+
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_calibration_set_reflection(const cdc_command_t *cmd)
+{
+    float refl_val[4] = {0};
+    size_t n = decode_f32_array_args(cmd->args, refl_val, 4);
+    if (n == 4) {
+        settings_cal_reflection_t cal_reflection = {0};
+        cal_reflection.lo_d = refl_val[0];
+        cal_reflection.lo_value = refl_val[1];
+        cal_reflection.hi_d = refl_val[2];
+        cal_reflection.hi_value = refl_val[3];
+
+        if (settings_set_cal_reflection(&cal_reflection)) {
+            cdc_send_command_response(cmd, "OK");
+        } else {
+            cdc_send_command_response(cmd, "ERR");
+        }
+
+        return true;
+    }
+    return false;
+}
+
+bool cdc_calibration_get_slope(const cdc_command_t *cmd)
+{
+    char buf[64];
+    settings_cal_slope_t cal_slope;
+    float slope_val[3] = {0};
+
+    settings_get_cal_slope(&cal_slope);
+    slope_val[0] = cal_slope.b0;
+    slope_val[1] = cal_slope.b1;
+    slope_val[2] = cal_slope.b2;
+    encode_f32_array_response(buf, slope_val, 3);
+
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_calibration_set_slope(const cdc_command_t *cmd)
+{
+    float slope_val[3] = {0};
+    size_t n = decode_f32_array_args(cmd->args, slope_val, 3);
+    if (n == 3) {
+        settings_cal_slope_t cal_slope = {0};
+        cal_slope.b0 = slope_val[0];
+        cal_slope.b1 = slope_val[1];
+        cal_slope.b2 = slope_val[2];
+
+        if (settings_set_cal_slope(&cal_slope)) {
+            cdc_send_command_response(cmd, "OK");
+        } else {
+            cdc_send_command_response(cmd, "ERR");
+        }
+        return true;
+    }
+    return false;
+}
+
+bool cdc_calibration_get_transmission(const cdc_command_t *cmd)
+{
+    char buf[64];
+    settings_cal_transmission_t cal_transmission;
+    float tran_val[4] = {0};
+
+    settings_get_cal_transmission(&cal_transmission);
+    tran_val[0] = 0.0F;
+    tran_val[1] = cal_transmission.zero_value;
+    tran_val[2] = cal_transmission.hi_d;
+    tran_val[3] = cal_transmission.hi_value;
+
+    encode_f32_array_response(buf, tran_val, 4);
+
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_calibration_set_transmission(const cdc_command_t *cmd)
+{
+    float tran_val[4] = {0};
+    size_t n = decode_f32_array_args(cmd->args, tran_val, 4);
+    if (n == 4 && tran_val[0] < 0.001F) {
+        settings_cal_transmission_t cal_transmission = {0};
+        cal_transmission.zero_value = tran_val[1];
+        cal_transmission.hi_d = tran_val[2];
+        cal_transmission.hi_value = tran_val[3];
+
+        if (settings_set_cal_transmission(&cal_transmission)) {
+            cdc_send_command_response(cmd, "OK");
+        } else {
+            cdc_send_command_response(cmd, "ERR");
         }
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "REFL") == 0) {
-        char buf[64];
-        settings_cal_reflection_t cal_reflection;
-        float refl_val[4] = {0};
 
-        settings_get_cal_reflection(&cal_reflection);
-        refl_val[0] = cal_reflection.lo_d;
-        refl_val[1] = cal_reflection.lo_value;
-        refl_val[2] = cal_reflection.hi_d;
-        refl_val[3] = cal_reflection.hi_value;
+        return true;
+    }
+    return false;
+}
+
+bool cdc_invoke_gain_calibration_callback(sensor_gain_calibration_status_t status, int param, uint32_t remaining_ms, void *user_data)
+{
+    const cdc_command_t *cmd = (const cdc_command_t *)user_data;
+    char buf[32];
+    sprintf(buf, "STATUS,%d,%d,%lu", status, param, (remaining_ms + 999UL) / 1000UL);
+    cdc_send_command_response(cmd, buf);
+
+    return keypad_is_detect();
+}
+
+#ifdef SENSOR_SIMULATION
+bool cdc_diagnostics_invoke_benchmark(const cdc_command_t *cmd)
+{
+    tsl2591_sim_params_t params;
+    bool allow_uncalibrated = densitometer_get_allow_uncalibrated_measurements();
+    bool first = true;
+
+    tsl2591_sim_get_params(&params);
+    densitometer_set_allow_uncalibrated_measurements(true);
+    sensor_set_warm_mode(strcmp(cmd->args, "WARM") == 0);
+
+    cdc_send_command_response(cmd, "[[");
+    cdc_send_response("[\r\n");
+    cdc_run_benchmark(densitometer_reflection(), 'R', &first);
+    cdc_run_benchmark(densitometer_transmission(), 'T', &first);
+    cdc_send_response("\r\n]\r\n");
+    cdc_send_response("]]\r\n");
+
+    sensor_set_warm_mode(false);
+    densitometer_set_allow_uncalibrated_measurements(allow_uncalibrated);
+    tsl2591_sim_set_params(&params);
+    return true;
+}
+#endif
+
+bool cdc_diagnostics_get_display(const cdc_command_t *cmd)
+{
+    if (cmd->args[0] == '\0') {
+        cdc_send_command_response(cmd, "[[");
+        display_capture_screenshot();
+        cdc_send_response("]]\r\n");
+    } else if (strcmp(cmd->args, "B") == 0) {
+        display_send_updates(true);
+        cdc_send_command_response(cmd, "OK");
+    } else {
+        return false;
+    }
+    return true;
+}
 
-        encode_f32_array_response(buf, refl_val, 4);
+bool cdc_diagnostics_get_job(const cdc_command_t *cmd)
+{
+    char buf[16];
+    sprintf(buf, "%d,%d", cdc_job_active_id, cdc_job_pending);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-        cdc_send_command_response(cmd, buf);
+bool cdc_diagnostics_set_log(const cdc_command_t *cmd)
+{
+    if (strcmp(cmd->args, "U") == 0) {
+        cdc_send_command_response(cmd, "OK");
+        cdc_logging_redirected = true;
+        elog_set_text_color_enabled(false);
+        elog_port_redirect(cdc_log_output);
         return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "REFL") == 0) {
-        float refl_val[4] = {0};
-        size_t n = decode_f32_array_args(cmd->args, refl_val, 4);
-        if (n == 4) {
-            settings_cal_reflection_t cal_reflection = {0};
-            cal_reflection.lo_d = refl_val[0];
-            cal_reflection.lo_value = refl_val[1];
-            cal_reflection.hi_d = refl_val[2];
-            cal_reflection.hi_value = refl_val[3];
-
-            if (settings_set_cal_reflection(&cal_reflection)) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
+    } else if (strcmp(cmd->args, "D") == 0) {
+        cdc_send_command_response(cmd, "OK");
+        elog_port_redirect(NULL);
+        elog_set_text_color_enabled(true);
+        cdc_logging_redirected = false;
+        return true;
+    }
+    return false;
+}
 
-            return true;
-        }
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "TRAN") == 0) {
-        char buf[64];
-        settings_cal_transmission_t cal_transmission;
-        float tran_val[4] = {0};
+bool cdc_diagnostics_set_light_reflection(const cdc_command_t *cmd)
+{
+    uint8_t value = atoi(cmd->args);
+    if (value > 128) { value = 128; }
 
-        settings_get_cal_transmission(&cal_transmission);
-        tran_val[0] = 0.0F;
-        tran_val[1] = cal_transmission.zero_value;
-        tran_val[2] = cal_transmission.hi_d;
-        tran_val[3] = cal_transmission.hi_value;
+    osStatus_t result = sensor_set_light_mode(SENSOR_LIGHT_REFLECTION, false, value);
+    if (result == osOK) {
+        cdc_send_command_response(cmd, "OK");
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
 
-        encode_f32_array_response(buf, tran_val, 4);
+    return true;
+}
 
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "TRAN") == 0) {
-        float tran_val[4] = {0};
-        size_t n = decode_f32_array_args(cmd->args, tran_val, 4);
-        if (n == 4 && tran_val[0] < 0.001F) {
-            settings_cal_transmission_t cal_transmission = {0};
-            cal_transmission.zero_value = tran_val[1];
-            cal_transmission.hi_d = tran_val[2];
-            cal_transmission.hi_value = tran_val[3];
-
-            if (settings_set_cal_transmission(&cal_transmission)) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
+bool cdc_diagnostics_set_light_transmission(const cdc_command_t *cmd)
+{
+    uint8_t value = atoi(cmd->args);
+    if (value > 128) { value = 128; }
 
-            return true;
-        }
+    osStatus_t result = sensor_set_light_mode(SENSOR_LIGHT_TRANSMISSION, false, value);
+    if (result == osOK) {
+        cdc_send_command_response(cmd, "OK");
+    } else {
+        cdc_send_command_response(cmd, "ERR");
     }
 
-    return false;
+    return true;
 }
 
-bool cdc_invoke_gain_calibration_callback(sensor_gain_calibration_status_t status, int param, void *user_data)
+bool cdc_diagnostics_set_mirror(const cdc_command_t *cmd)
 {
-    const cdc_command_t *cmd = (const cdc_command_t *)user_data;
-    char buf[32];
-    sprintf(buf, "STATUS,%d,%d", status, param);
-    cdc_send_command_response(cmd, buf);
-
-    return keypad_is_detect();
+    if (strcmp(cmd->args, "1") == 0) {
+        /* Start with a complete copy of the display */
+        display_reset_updates();
+        cdc_display_update_pending = true;
+        cdc_display_mirror_active = true;
+    } else if (strcmp(cmd->args, "0") == 0) {
+        cdc_display_mirror_active = false;
+    } else {
+        return false;
+    }
+    cdc_send_command_response(cmd, "OK");
+    return true;
 }
 
-bool cdc_process_command_diagnostics(const cdc_command_t *cmd)
+bool cdc_diagnostics_invoke_read(const cdc_command_t *cmd)
 {
-    /*
-     * Diagnostics Commands
-     * "GD DISP" -> Get display screenshot (multi-line response)
-     *
-     * "SD LR,nnn" -> Set reflection light duty cycle (nnn/127) [remote]
-     * "SD LT,nnn" -> Set transmission light duty cycle (nnn/127) [remote]
-     *
-     * "ID S,START"   -> Invoke sensor start [remote]
-     * "ID S,STOP"    -> Invoke sensor stop [remote]
-     * "SD S,CFG,n,m" -> Set sensor gain (n = [0-3]) and integration time (m = [0-5]) [remote]
-     * "GD S,READING" -> Get next sensor reading [remote]
-     *
-     * "ID READ,L,n,m" -> Perform controlled sensor target read
-     *
-     * "ID WIPE,UIDw2,CKSUM" -> Factory reset of configuration EEPROM
-     *
-     * "SD LOG,U" -> Set logging output to USB CDC device
-     * "SD LOG,D" -> Set logging output to debug port UART
-     */
-
-    if (!cmd) { return false; }
+    if ((cmd->args[0] == '0' || cmd->args[0] == 'R' || cmd->args[0] == 'T')
+        && cmd->args[1] == ',' && isdigit((unsigned char)cmd->args[2])
+        && cmd->args[3] == ',' && isdigit((unsigned char)cmd->args[4])
+        && cmd->args[5] == '\0') {
+        sensor_light_t light_val;
+        tsl2591_gain_t gain_val = cmd->args[2] - '0';
+        tsl2591_time_t time_val = cmd->args[4] - '0';
+
+        if (cmd->args[0] == 'R') {
+            light_val = SENSOR_LIGHT_REFLECTION;
+        } else if (cmd->args[0] == 'T') {
+            light_val = SENSOR_LIGHT_TRANSMISSION;
+        } else {
+            light_val = SENSOR_LIGHT_OFF;
+        }
 
-    if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "DISP") == 0) {
-        cdc_send_command_response(cmd, "[[");
-        display_capture_screenshot();
-        cdc_send_response("]]\r\n");
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "LR") == 0 && cdc_remote_active) {
-        uint8_t value = atoi(cmd->args);
-        if (value > 128) { value = 128; }
+        uint16_t ch0_result;
+        uint16_t ch1_result;
+        osStatus_t result = sensor_read_target_raw(light_val, gain_val, time_val,
+            &ch0_result, &ch1_result);
 
-        osStatus_t result = sensor_set_light_mode(SENSOR_LIGHT_REFLECTION, false, value);
         if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
+            char buf[64];
+            sprintf(buf, "%d,%d", ch0_result, ch1_result);
+            cdc_send_command_response(cmd, buf);
         } else {
             cdc_send_command_response(cmd, "ERR");
         }
-
         return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "LT") == 0 && cdc_remote_active) {
-        uint8_t value = atoi(cmd->args);
-        if (value > 128) { value = 128; }
+    }
+    return false;
+}
 
-        osStatus_t result = sensor_set_light_mode(SENSOR_LIGHT_TRANSMISSION, false, value);
+bool cdc_diagnostics_set_sensor(const cdc_command_t *cmd)
+{
+    osStatus_t result;
+    if (strncmp(cmd->args, "CFG,", 4) == 0) {
+        if (isdigit((unsigned char)cmd->args[4]) && cmd->args[5] == ','
+            && isdigit((unsigned char)cmd->args[6]) && cmd->args[7] == '\0') {
+            tsl2591_gain_t gain_val = cmd->args[4] - '0';
+            tsl2591_time_t time_val = cmd->args[6] - '0';
+            if (gain_val <= TSL2591_GAIN_MAXIMUM && time_val <= TSL2591_TIME_600MS) {
+                result = sensor_set_config(gain_val, time_val);
+                if (result == osOK) {
+                    cdc_send_command_response(cmd, "OK");
+                } else {
+                    cdc_send_command_response(cmd, "ERR");
+                }
+            }
+        }
+    } else if (strcmp(cmd->args, "FMT,T") == 0) {
+        raw_format = RAW_FORMAT_TEXT;
+        cdc_send_command_response(cmd, "OK");
+    } else if (strcmp(cmd->args, "FMT,B") == 0) {
+        raw_format = RAW_FORMAT_BINARY;
+        cdc_send_command_response(cmd, "OK");
+    } else if (strncmp(cmd->args, "THRESH,", 7) == 0
+        && isdigit((unsigned char)cmd->args[7])) {
+        int margin = atoi(cmd->args + 7);
+        if (margin > 100) { margin = 100; }
+        result = sensor_set_threshold_mode(margin > 0, (uint8_t)margin);
         if (result == osOK) {
             cdc_send_command_response(cmd, "OK");
         } else {
             cdc_send_command_response(cmd, "ERR");
         }
+    }
+    return true;
+}
 
-        return true;
-    } else if (strcmp(cmd->action, "S") == 0 && cdc_remote_active) {
-        osStatus_t result;
-        if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->args, "START") == 0) {
-            cdc_remote_sensor_active = true;
-            result = sensor_start();
-            if (result == osOK) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
-            return true;
-        } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->args, "STOP") == 0) {
-            cdc_remote_sensor_active = false;
-            result = sensor_stop();
-            if (result == osOK) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
-            return true;
-        } else if (cmd->type == CMD_TYPE_SET && strncmp(cmd->args, "CFG,", 4) == 0) {
-            if (isdigit((unsigned char)cmd->args[4]) && cmd->args[5] == ','
-                && isdigit((unsigned char)cmd->args[6]) && cmd->args[7] == '\0') {
-                tsl2591_gain_t gain_val = cmd->args[4] - '0';
-                tsl2591_time_t time_val = cmd->args[6] - '0';
-                if (gain_val <= TSL2591_GAIN_MAXIMUM && time_val <= TSL2591_TIME_600MS) {
-                    result = sensor_set_config(gain_val, time_val);
-                    if (result == osOK) {
-                        cdc_send_command_response(cmd, "OK");
-                    } else {
-                        cdc_send_command_response(cmd, "ERR");
-                    }
-                    return true;
-                }
-            }
-        }
-        return true;
-    } else if (strcmp(cmd->action, "READ") == 0 && cdc_remote_active && !cdc_remote_sensor_active) {
-        if ((cmd->args[0] == '0' || cmd->args[0] == 'R' || cmd->args[0] == 'T')
-            && cmd->args[1] == ',' && isdigit((unsigned char)cmd->args[2])
-            && cmd->args[3] == ',' && isdigit((unsigned char)cmd->args[4])
-            && cmd->args[5] == '\0') {
-            sensor_light_t light_val;
-            tsl2591_gain_t gain_val = cmd->args[2] - '0';
-            tsl2591_time_t time_val = cmd->args[4] - '0';
-
-            if (cmd->args[0] == 'R') {
-                light_val = SENSOR_LIGHT_REFLECTION;
-            } else if (cmd->args[0] == 'T') {
-                light_val = SENSOR_LIGHT_TRANSMISSION;
-            } else {
-                light_val = SENSOR_LIGHT_OFF;
-            }
-
-            uint16_t ch0_result;
-            uint16_t ch1_result;
-            osStatus_t result = sensor_read_target_raw(light_val, gain_val, time_val,
-                &ch0_result, &ch1_result);
-
-            if (result == osOK) {
-                char buf[64];
-                sprintf(buf, "%d,%d", ch0_result, ch1_result);
-                cdc_send_command_response(cmd, buf);
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
-            return true;
-        }
-    } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "WIPE") == 0 && cdc_remote_active) {
-        char exp_buf[32];
-        const app_descriptor_t *app_descriptor = app_descriptor_get();
-        sprintf(exp_buf, "%08lX,%08lX",
-            __bswap32(HAL_GetUIDw2()),
-            __bswap32(app_descriptor->crc32));
-        if (strncasecmp(exp_buf, cmd->args, sizeof(exp_buf)) == 0) {
+bool cdc_diagnostics_invoke_sensor(const cdc_command_t *cmd)
+{
+    osStatus_t result;
+    if (strcmp(cmd->args, "START") == 0) {
+        cdc_remote_sensor_active = true;
+        result = sensor_start();
+        if (result == osOK) {
             cdc_send_command_response(cmd, "OK");
-            log_w("Factory EEPROM wipe requested");
-            settings_wipe();
-            osDelay(50);
-            NVIC_SystemReset();
         } else {
             cdc_send_command_response(cmd, "ERR");
         }
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "LOG") == 0) {
-        if (strcmp(cmd->args, "U") == 0) {
-            cdc_send_command_response(cmd, "OK");
-            cdc_logging_redirected = true;
-            elog_set_text_color_enabled(false);
-            elog_port_redirect(cdc_write);
-            return true;
-        } else if (strcmp(cmd->args, "D") == 0) {
+    } else if (strcmp(cmd->args, "STOP") == 0) {
+        cdc_remote_sensor_active = false;
+        result = sensor_stop();
+        if (result == osOK) {
             cdc_send_command_response(cmd, "OK");
-            elog_port_redirect(NULL);
-            elog_set_text_color_enabled(true);
-            cdc_logging_redirected = false;
-            return true;
+        } else {
+            cdc_send_command_response(cmd, "ERR");
         }
     }
+    return true;
+}
+
+#ifdef SENSOR_SIMULATION
+bool cdc_diagnostics_get_simulation(const cdc_command_t *cmd)
+{
+    char buf[64];
+    tsl2591_sim_params_t params;
+    float param_val[4];
+
+    tsl2591_sim_get_params(&params);
+    param_val[0] = params.target_d;
+    param_val[1] = params.noise;
+    param_val[2] = params.light_scale;
+    param_val[3] = params.ch1_ratio;
+    encode_f32_array_response(buf, param_val, 4);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+bool cdc_diagnostics_set_simulation(const cdc_command_t *cmd)
+{
+    float param_val[4] = {0};
+    size_t n = decode_f32_array_args(cmd->args, param_val, 4);
+    if (n == 4) {
+        tsl2591_sim_params_t params = {
+            .target_d = param_val[0],
+            .noise = param_val[1],
+            .light_scale = param_val[2],
+            .ch1_ratio = param_val[3]
+        };
+        tsl2591_sim_set_params(&params);
+        cdc_send_command_response(cmd, "OK");
+        return true;
+    }
+    return false;
+}
+#endif
+
+bool cdc_diagnostics_get_stats(const cdc_command_t *cmd)
+{
+    sensor_stats_t stats;
+    char buf[128];
+    const uint32_t *hist = NULL;
+
+    if (cmd->args[0] == '\0') {
+        sensor_get_stats(&stats);
+        sprintf(buf, "%lu,%lu,%lu,%lu,%lu,%lu",
+            stats.readings, stats.overwritten, stats.queue_errors,
+            stats.discarded, stats.i2c_errors, stats.i2c_timeouts);
+        cdc_send_command_response(cmd, buf);
+        return true;
+    } else if (strcmp(cmd->args, "CDC") == 0) {
+        size_t high_water;
+        uint32_t dropped;
+        cdc_get_tx_queue_stats(&high_water, &dropped);
+        sprintf(buf, "CDC,%lu,%lu", (uint32_t)high_water, dropped);
+        cdc_send_command_response(cmd, buf);
+        return true;
+    } else if (strcmp(cmd->args, "I2C") == 0) {
+        sensor_get_stats(&stats);
+        hist = stats.i2c_hist;
+    } else if (strcmp(cmd->args, "LAT") == 0) {
+        sensor_get_stats(&stats);
+        hist = stats.latency_hist;
+    } else {
+        return false;
+    }
+
+    size_t n = sprintf(buf, "%s", cmd->args);
+    for (uint8_t i = 0; i < SENSOR_STATS_HIST_BINS; i++) {
+        n += sprintf(buf + n, ",%lu", hist[i]);
+    }
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
+bool cdc_diagnostics_invoke_stats(const cdc_command_t *cmd)
+{
+    if (strcmp(cmd->args, "RESET") == 0) {
+        sensor_reset_stats();
+        cdc_send_command_response(cmd, "OK");
+        return true;
+    }
     return false;
 }
 
+#ifdef EVENT_TRACE
+bool cdc_diagnostics_get_trace(const cdc_command_t *cmd)
+{
+    cdc_send_trace(cmd);
+    return true;
+}
+#endif
+
+bool cdc_diagnostics_invoke_wipe(const cdc_command_t *cmd)
+{
+    char exp_buf[32];
+    const app_descriptor_t *app_descriptor = app_descriptor_get();
+    sprintf(exp_buf, "%08lX,%08lX",
+        __bswap32(HAL_GetUIDw2()),
+        __bswap32(app_descriptor->crc32));
+    if (strncasecmp(exp_buf, cmd->args, sizeof(exp_buf)) == 0) {
+        cdc_send_command_response(cmd, "OK");
+        log_w("Factory EEPROM wipe requested");
+        settings_wipe();
+        osDelay(50);
+        NVIC_SystemReset();
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
+
+#ifdef SENSOR_SIMULATION
+/**
+ * Measure a sweep of simulated target densities, and send the statistics
+ * for each measurement as a JSON object.
+ */
+void cdc_run_benchmark(densitometer_t *densitometer, char light_ch, bool *first)
+{
+    char buf[192];
+    tsl2591_sim_params_t params;
+    densitometer_stats_t stats;
+    float max_d = (light_ch == 'R') ? REFLECTION_MAX_D : TRANSMISSION_MAX_D;
+
+    tsl2591_sim_get_params(&params);
+
+    for (int i = 0; i * 25 <= lroundf(max_d * 100.0F); i++) {
+        params.target_d = (float)i * 0.25F;
+        tsl2591_sim_set_params(&params);
+
+        densitometer_result_t result = densitometer_measure(densitometer, NULL, NULL);
+        densitometer_get_last_stats(densitometer, &stats);
+
+        sprintf(buf, "%s{\"light\":\"%c\",\"target_d\":%.2f,\"result\":%d,\"d\":%.3f,"
+            "\"gain\":%d,\"time\":%d,\"warm\":%d,\"probe_cycles\":%d,\"read_cycles\":%d,\"discarded_cycles\":%d,",
+            (*first ? "" : ",\r\n"), light_ch, params.target_d, result,
+            densitometer_get_reading_d(densitometer),
+            stats.read.gain, stats.read.time, stats.read.warm_start,
+            stats.read.probe_cycles, stats.read.read_cycles, stats.read.discarded_cycles);
+        cdc_send_response(buf);
+
+        sprintf(buf, "\"total_us\":%lu,\"ranging_us\":%lu,\"reading_us\":%lu,\"conversion_us\":%lu,"
+            "\"slope_us\":%lu,\"density_us\":%lu,\"report_us\":%lu}",
+            stats.total_us, stats.read.ranging_us, stats.read.reading_us, stats.read.conversion_us,
+            stats.slope_us, stats.density_us, stats.report_us);
+        cdc_send_response(buf);
+
+        *first = false;
+    }
+}
+#endif
+
 void cdc_send_response(const char *str)
 {
     size_t len = strlen(str);
@@ -937,9 +1839,17 @@ void cdc_send_response(const char *str)
 void cdc_send_command_response(const cdc_command_t *cmd, const char *str)
 {
     char buf[128];
+    size_t n = cdc_format_command_response(buf, sizeof(buf), cmd, str);
+    if (n > 0) {
+        cdc_write(buf, n);
+    }
+}
+
+size_t cdc_format_command_response(char *buf, size_t buf_size, const cdc_command_t *cmd, const char *str)
+{
     char t_ch;
     char c_ch;
-    if (!cmd || !str) { return; }
+    if (!buf || !cmd || !str) { return 0; }
 
     switch (cmd->type) {
     case CMD_TYPE_SET:
@@ -952,7 +1862,7 @@ void cdc_send_command_response(const cdc_command_t *cmd, const char *str)
         t_ch = 'I';
         break;
     default:
-        return;
+        return 0;
     }
 
     switch (cmd->category) {
@@ -969,14 +1879,18 @@ void cdc_send_command_response(const cdc_command_t *cmd, const char *str)
         c_ch = 'D';
         break;
     default:
-        return;
+        return 0;
     }
 
-    size_t n = snprintf(buf, sizeof(buf), "%c%c %s,%s\r\n", t_ch, c_ch, cmd->action, str);
-    cdc_write(buf, n);
+    int n = snprintf(buf, buf_size, "%c%c %s,%s\r\n", t_ch, c_ch, cmd->action, str);
+    if (n < 0 || (size_t)n >= buf_size) {
+        return 0;
+    }
+    return (size_t)n;
 }
 
-void cdc_send_density_reading(char prefix, float d_value, float d_zero, float raw_value, float corr_value)
+void cdc_send_density_reading(char prefix, float d_value, float d_zero, float raw_value, float corr_value,
+    float raw_stddev, uint8_t sample_count, bool noisy)
 {
     float d_display;
     char buf[16];
@@ -1013,7 +1927,7 @@ void cdc_send_density_reading(char prefix, float d_value, float d_zero, float ra
     }
 
     if (reading_format == READING_FORMAT_EXT) {
-        char extbuf[48];
+        char extbuf[64];
         n -= 2;
         strncpy(extbuf, buf, n);
         extbuf[n++] = ',';
@@ -1024,12 +1938,55 @@ void cdc_send_density_reading(char prefix, float d_value, float d_zero, float ra
         n += encode_f32(extbuf + n, raw_value);
         extbuf[n++] = ',';
         n += encode_f32(extbuf + n, corr_value);
+        extbuf[n++] = ',';
+        n += encode_f32(extbuf + n, raw_stddev);
+        n += sprintf_(extbuf + n, ",%d,%d", sample_count, noisy ? 1 : 0);
         extbuf[n++] = '\r';
         extbuf[n++] = '\n';
         extbuf[n] = '\0';
-        cdc_write(extbuf, n);
+        cdc_write_async(extbuf, n);
     } else {
-        cdc_write(buf, n);
+        cdc_write_async(buf, n);
+    }
+}
+
+void cdc_notify_raw_sensor_reading()
+{
+    if (!cdc_initialized || !cdc_remote_sensor_active) { return; }
+    osSemaphoreRelease(cdc_rx_semaphore);
+}
+
+void cdc_notify_display_update()
+{
+    if (!cdc_initialized || !cdc_display_mirror_active) { return; }
+    cdc_display_update_pending = true;
+    osSemaphoreRelease(cdc_rx_semaphore);
+}
+
+void cdc_send_display_updates()
+{
+    if (!cdc_display_mirror_active || !cdc_display_update_pending) { return; }
+
+    /*
+     * Clear the flag before looking at the display, so an update that
+     * lands while tiles are being sent will cause another pass.
+     */
+    cdc_display_update_pending = false;
+    display_send_updates(false);
+}
+
+void cdc_send_raw_sensor_readings()
+{
+    sensor_reading_t reading;
+
+    if (!cdc_remote_sensor_active) { return; }
+
+    while (sensor_reader_get_next(SENSOR_READER_CDC, &reading, 0) == osOK) {
+        if (raw_format == RAW_FORMAT_BINARY) {
+            cdc_send_raw_sensor_frame(&reading);
+        } else {
+            cdc_send_raw_sensor_reading(&reading);
+        }
     }
 }
 
@@ -1049,6 +2006,149 @@ void cdc_send_raw_sensor_reading(const sensor_reading_t *reading)
     cdc_send_command_response(&cmd, buf);
 }
 
+void cdc_send_raw_sensor_frame(const sensor_reading_t *reading)
+{
+    /*
+     * Binary raw sensor frame format:
+     * 0x00 <COBS encoded record> 0x00
+     *
+     * Record format (all fields big-endian):
+     * [0]     Record type ('S')
+     * [1:2]   CH0 value
+     * [3:4]   CH1 value
+     * [5]     Gain
+     * [6]     Integration time
+     * [7:10]  Reading ticks
+     * [11:14] Light change ticks
+     * [15:18] Reading count
+     * [19:22] Reading timestamp, in microseconds
+     * [23:26] Light change timestamp, in microseconds
+     * [27:30] Interrupt dispatch latency, in microseconds
+     * [31:32] CRC-16/CCITT-FALSE of bytes [0:30]
+     *
+     * The leading delimiter lets the host tell a frame apart from a
+     * normal response line, since text responses never contain zeros.
+     */
+    uint8_t record[RAW_RECORD_SIZE];
+    uint8_t frame[RAW_RECORD_SIZE + 3];
+    size_t n;
+
+    if (!reading) { return; }
+
+    record[0] = RAW_RECORD_TYPE_SENSOR;
+    copy_from_u16(record + 1, reading->ch0_val);
+    copy_from_u16(record + 3, reading->ch1_val);
+    record[5] = (uint8_t)reading->gain;
+    record[6] = (uint8_t)reading->time;
+    copy_from_u32(record + 7, reading->reading_ticks);
+    copy_from_u32(record + 11, reading->light_ticks);
+    copy_from_u32(record + 15, reading->reading_count);
+    copy_from_u32(record + 19, reading->reading_us);
+    copy_from_u32(record + 23, reading->light_us);
+    copy_from_u32(record + 27, reading->dispatch_us);
+    copy_from_u16(record + RAW_RECORD_SIZE - 2, crc16_ccitt(record, RAW_RECORD_SIZE - 2));
+
+    frame[0] = 0x00;
+    n = cobs_encode(frame + 1, record, RAW_RECORD_SIZE) + 1;
+    frame[n++] = 0x00;
+
+    cdc_write((const char *)frame, n);
+}
+
+void cdc_send_task_stats(const cdc_command_t *cmd)
+{
+    /*
+     * Output format, one line per task:
+     * Name, Task number, State, Priority, CPU usage, Stack free, Stack size
+     *
+     * CPU usage is in tenths of a percent, over the time since the previous
+     * request, so that polling gives a live view regardless of how long
+     * the system has been running. Stack values are in bytes, with the
+     * free value being the lowest amount ever left unused.
+     */
+    uint32_t total_runtime = 0;
+    char buf[80];
+
+    TaskStatus_t *task_status = cdc_task_status;
+    const UBaseType_t task_count = uxTaskGetSystemState(task_status, CDC_TASK_STATS_MAX, &total_runtime);
+    const uint32_t elapsed = total_runtime - cdc_prev_total_runtime;
+    cdc_prev_total_runtime = total_runtime;
+
+    cdc_send_command_response(cmd, "[[");
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        const TaskStatus_t *status = &task_status[i];
+        uint32_t usage = 0;
+
+        /* Task numbers start at 1, and are never reused since tasks are not deleted */
+        if (status->xTaskNumber <= CDC_TASK_STATS_MAX) {
+            const uint32_t delta = status->ulRunTimeCounter - cdc_prev_task_runtime[status->xTaskNumber];
+            cdc_prev_task_runtime[status->xTaskNumber] = status->ulRunTimeCounter;
+            if (elapsed > 0) {
+                usage = (uint32_t)(((uint64_t)delta * 1000ULL) / elapsed);
+            }
+        }
+
+        sprintf(buf, "%s,%lu,%d,%lu,%lu,%lu,%lu\r\n",
+            status->pcTaskName,
+            status->xTaskNumber,
+            status->eCurrentState,
+            status->uxCurrentPriority,
+            usage,
+            (uint32_t)(status->usStackHighWaterMark * sizeof(StackType_t)),
+            task_main_get_stack_size(status->xHandle));
+        cdc_send_response(buf);
+    }
+    cdc_send_response("]]\r\n");
+}
+
+#ifdef EVENT_TRACE
+void cdc_send_trace(const cdc_command_t *cmd)
+{
+    /*
+     * Output format:
+     * "T,<Task number>,<Task name>" for each task, followed by
+     * "E,<Records>" with the trace records encoded as hex, oldest first.
+     *
+     * Recording is paused while the buffer is being sent, so the dump
+     * does not end up tracing itself, and the buffer is cleared afterwards.
+     */
+    uint8_t record[TRACE_RECORD_SIZE];
+    char buf[80];
+    size_t index = 0;
+    bool more = true;
+
+    trace_pause();
+
+    cdc_send_command_response(cmd, "[[");
+
+    const UBaseType_t task_count = uxTaskGetSystemState(cdc_task_status, CDC_TASK_STATS_MAX, NULL);
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        sprintf(buf, "T,%lu,%s\r\n", cdc_task_status[i].xTaskNumber, cdc_task_status[i].pcTaskName);
+        cdc_send_response(buf);
+    }
+
+    while (more) {
+        size_t n = sprintf(buf, "E,");
+        uint8_t count = 0;
+        while (count < 4 && (more = trace_get_record(index, record))) {
+            for (uint8_t j = 0; j < TRACE_RECORD_SIZE; j++) {
+                n += sprintf(buf + n, "%02X", record[j]);
+            }
+            index++;
+            count++;
+        }
+        if (count > 0) {
+            sprintf(buf + n, "\r\n");
+            cdc_send_response(buf);
+        }
+    }
+
+    cdc_send_response("]]\r\n");
+
+    trace_resume();
+}
+#endif
+
 void cdc_send_remote_state(bool enabled)
 {
     osMutexAcquire(cdc_mutex, portMAX_DELAY);
@@ -1060,11 +2160,14 @@ void cdc_send_remote_state(bool enabled)
         .category = CMD_CATEGORY_SYSTEM,
         .action = "REMOTE"
     };
-    cdc_send_command_response(&cmd, enabled ? "1" : "0");
+    char buf[32];
+    size_t n = cdc_format_command_response(buf, sizeof(buf), &cmd, enabled ? "1" : "0");
+    cdc_write_async(buf, n);
 }
 
 void cdc_write(const char *buf, size_t len)
 {
+    TRACE_EVENT(TRACE_EVENT_CDC_WRITE, 0, (uint16_t)len);
     osMutexAcquire(cdc_mutex, portMAX_DELAY);
     if (cdc_host_connected && len > 0) {
         uint32_t n = 0;
@@ -1094,6 +2197,88 @@ void cdc_write(const char *buf, size_t len)
     osMutexRelease(cdc_mutex);
 }
 
+bool cdc_write_async(const char *buf, size_t len)
+{
+    bool queued = false;
+
+    if (!cdc_initialized || !buf || len == 0) { return false; }
+
+    TRACE_EVENT(TRACE_EVENT_CDC_WRITE, 1, (uint16_t)len);
+
+    taskENTER_CRITICAL();
+    if (cdc_host_connected) {
+        size_t used = cdc_tx_head - cdc_tx_tail;
+        if (len <= CDC_TX_BUFFER_SIZE - used) {
+            /* Copy the data in, wrapping around the end of the buffer */
+            size_t offset = cdc_tx_head & (CDC_TX_BUFFER_SIZE - 1);
+            size_t first = MIN(len, CDC_TX_BUFFER_SIZE - offset);
+            memcpy(cdc_tx_buffer + offset, buf, first);
+            memcpy(cdc_tx_buffer, buf + first, len - first);
+            cdc_tx_head += len;
+
+            used += len;
+            if (used > cdc_tx_high_water) {
+                cdc_tx_high_water = used;
+            }
+            queued = true;
+        } else {
+            /* Drop the whole message rather than sending a partial line */
+            cdc_tx_dropped++;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if (queued) {
+        osSemaphoreRelease(cdc_rx_semaphore);
+    }
+    return queued;
+}
+
+void cdc_get_tx_queue_stats(size_t *high_water, uint32_t *dropped)
+{
+    if (high_water) {
+        *high_water = cdc_tx_high_water;
+    }
+    if (dropped) {
+        *dropped = cdc_tx_dropped;
+    }
+}
+
+void cdc_send_queued_data()
+{
+    for (;;) {
+        /*
+         * Only the CDC task advances the tail, so the data between the tail
+         * and the head can be sent without holding off other producers.
+         */
+        size_t tail = cdc_tx_tail;
+        size_t used = cdc_tx_head - tail;
+        if (used == 0) { break; }
+
+        size_t offset = tail & (CDC_TX_BUFFER_SIZE - 1);
+        size_t len = MIN(used, CDC_TX_BUFFER_SIZE - offset);
+        cdc_write((const char *)cdc_tx_buffer + offset, len);
+
+        taskENTER_CRITICAL();
+        if (cdc_tx_tail == tail) {
+            cdc_tx_tail = tail + len;
+        }
+        taskEXIT_CRITICAL();
+    }
+}
+
+void cdc_clear_queued_data()
+{
+    taskENTER_CRITICAL();
+    cdc_tx_tail = cdc_tx_head;
+    taskEXIT_CRITICAL();
+}
+
+void cdc_log_output(const char *log, size_t size)
+{
+    cdc_write_async(log, size);
+}
+
 void encode_f32_array_response(char *buf, const float *array, size_t len)
 {
     size_t offset = 0;
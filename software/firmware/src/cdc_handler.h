@@ -3,11 +3,20 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "sensor.h"
 
 void task_cdc_run(void *argument);
 
+/**
+ * Task that runs long-running commands queued by the CDC task.
+ *
+ * This keeps the CDC task free to serve other commands while
+ * calibration processes and controlled sensor reads are running.
+ */
+void task_cdc_job_run(void *argument);
+
 /**
  * Get whether the CDC device is currently connected to a host.
  *
@@ -29,15 +38,30 @@ bool cdc_is_connected();
  * @param d_zero The density "zero" offset
  * @param raw_value The raw sensor reading, in basic counts
  * @param corr_value The slope corrected sensor reading, in basic counts
+ * @param raw_stddev Standard deviation of the raw sensor readings, in basic counts
+ * @param sample_count Number of sensor readings included in the raw value
+ * @param noisy True if the sensor readings did not converge
+ */
+void cdc_send_density_reading(char prefix, float d_value, float d_zero, float raw_value, float corr_value,
+    float raw_stddev, uint8_t sample_count, bool noisy);
+
+/**
+ * Notify the CDC task that a new raw sensor reading is available.
+ *
+ * If raw sensor data is being streamed for diagnostic purposes, this will
+ * wake the CDC task so it can collect and send any new readings.
+ * This function does not block, and is safe to call from the sensor task.
  */
-void cdc_send_density_reading(char prefix, float d_value, float d_zero, float raw_value, float corr_value);
+void cdc_notify_raw_sensor_reading();
 
 /**
- * Send a message containing raw sensor data for diagnostic purposes
+ * Notify the CDC task that the display contents have been updated.
  *
- * @param reading Raw sensor reading data
+ * If the host has enabled display mirroring, this will wake the CDC task
+ * so it can send the tiles that have changed. This function does not
+ * block, and is safe to call from the main task.
  */
-void cdc_send_raw_sensor_reading(const sensor_reading_t *reading);
+void cdc_notify_display_update();
 
 /**
  * Send a message indicating the remote control state being changed
@@ -61,4 +85,28 @@ void cdc_send_remote_state(bool enabled);
  */
 void cdc_write(const char *buf, size_t len);
 
+/**
+ * Queue a message to be written out the CDC device.
+ *
+ * This function never blocks. The data is copied into a transmit buffer
+ * that is drained by the CDC task, so it is safe to call from tasks
+ * that must not be held up by a slow or stalled host.
+ *
+ * Messages are queued whole. If there is not enough space for the
+ * entire message, it will be dropped and counted as such.
+ *
+ * @param buf Data to send
+ * @param len Length of the data to send
+ * @return True if the data was queued, false if it was dropped
+ */
+bool cdc_write_async(const char *buf, size_t len);
+
+/**
+ * Get statistics on the usage of the CDC transmit buffer.
+ *
+ * @param high_water Largest number of bytes that have been waiting in the buffer
+ * @param dropped Number of messages dropped because the buffer was full
+ */
+void cdc_get_tx_queue_stats(size_t *high_water, uint32_t *dropped);
+
 #endif /* CDC_TASK_H */
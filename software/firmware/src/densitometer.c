@@ -3,6 +3,7 @@
 #define LOG_TAG "densitometer"
 
 #include <math.h>
+#include <string.h>
 #include <elog.h>
 #include <printf.h>
 
@@ -12,6 +13,7 @@
 #include "light.h"
 #include "cdc_handler.h"
 #include "hid_handler.h"
+#include "fixmath.h"
 #include "util.h"
 
 static densitometer_result_t reflection_measure(densitometer_t *densitometer, sensor_read_callback_t callback, void *user_data);
@@ -23,6 +25,7 @@ struct __densitometer_t {
     const float max_d;
     const sensor_light_t read_light;
     const densitometer_result_t (*measure_func)(densitometer_t *densitometer, sensor_read_callback_t callback, void *user_data);
+    densitometer_stats_t stats;
 };
 
 static densitometer_t reflection_data = {
@@ -48,6 +51,11 @@ void densitometer_set_allow_uncalibrated_measurements(bool allow)
     densitometer_allow_uncalibrated = allow;
 }
 
+bool densitometer_get_allow_uncalibrated_measurements()
+{
+    return densitometer_allow_uncalibrated;
+}
+
 densitometer_t *densitometer_reflection()
 {
     return &reflection_data;
@@ -62,7 +70,21 @@ densitometer_result_t densitometer_measure(densitometer_t *densitometer, sensor_
 {
     if (!densitometer) { return DENSITOMETER_CAL_ERROR; }
 
-    return densitometer->measure_func(densitometer, callback, user_data);
+    memset(&densitometer->stats, 0, sizeof(densitometer_stats_t));
+    uint32_t start_cycles = cycle_count_get();
+
+    densitometer_result_t result = densitometer->measure_func(densitometer, callback, user_data);
+
+    densitometer->stats.total_us = cycle_count_to_us(cycle_count_get() - start_cycles);
+    sensor_get_last_read_stats(&densitometer->stats.read);
+
+    return result;
+}
+
+void densitometer_get_last_stats(const densitometer_t *densitometer, densitometer_stats_t *stats)
+{
+    if (!densitometer || !stats) { return; }
+    memcpy(stats, &densitometer->stats, sizeof(densitometer_stats_t));
 }
 
 void densitometer_set_idle_light(const densitometer_t *densitometer, bool enabled)
@@ -109,14 +131,20 @@ densitometer_result_t reflection_measure(densitometer_t *densitometer, sensor_re
         return DENSITOMETER_SENSOR_ERROR;
     }
 
+    sensor_read_stats_t read_stats;
+    sensor_get_last_read_stats(&read_stats);
+
     /* Combine and correct the basic reading */
+    uint32_t stage_cycles = cycle_count_get();
     float corr_value = sensor_apply_slope_calibration(ch0_basic);
+    densitometer->stats.slope_us = cycle_count_to_us(cycle_count_get() - stage_cycles);
+    stage_cycles = cycle_count_get();
 
     if (use_target_cal) {
         /* Convert all values into log units */
-        float meas_ll = log10f(corr_value);
-        float cal_hi_ll = log10f(cal_reflection.hi_value);
-        float cal_lo_ll = log10f(cal_reflection.lo_value);
+        float meas_ll = fixmath_log10f(corr_value);
+        float cal_hi_ll = fixmath_log10f(cal_reflection.hi_value);
+        float cal_lo_ll = fixmath_log10f(cal_reflection.lo_value);
 
         /* Calculate the slope of the line */
         float m = (cal_reflection.hi_d - cal_reflection.lo_d) / (cal_hi_ll - cal_lo_ll);
@@ -139,14 +167,19 @@ densitometer_result_t reflection_measure(densitometer_t *densitometer, sensor_re
         densitometer->last_d = 0.0F;
     }
 
+    densitometer->stats.density_us = cycle_count_to_us(cycle_count_get() - stage_cycles);
+
     /* Set light back to idle */
     densitometer_set_idle_light(densitometer, true);
 
+    stage_cycles = cycle_count_get();
     if (cdc_is_connected()) {
-        cdc_send_density_reading('R', densitometer->last_d, densitometer->zero_d, ch0_basic, corr_value);
+        cdc_send_density_reading('R', densitometer->last_d, densitometer->zero_d, ch0_basic, corr_value,
+            read_stats.ch0_stddev, read_stats.sample_count, read_stats.noisy);
     } else {
         hid_send_density_reading('R', densitometer->last_d, densitometer->zero_d);
     }
+    densitometer->stats.report_us = cycle_count_to_us(cycle_count_get() - stage_cycles);
 
     return DENSITOMETER_OK;
 }
@@ -173,15 +206,21 @@ densitometer_result_t transmission_measure(densitometer_t *densitometer, sensor_
         return DENSITOMETER_SENSOR_ERROR;
     }
 
+    sensor_read_stats_t read_stats;
+    sensor_get_last_read_stats(&read_stats);
+
     /* Combine and correct the basic reading */
+    uint32_t stage_cycles = cycle_count_get();
     float corr_value = sensor_apply_slope_calibration(ch0_basic);
+    densitometer->stats.slope_us = cycle_count_to_us(cycle_count_get() - stage_cycles);
+    stage_cycles = cycle_count_get();
 
     if (use_target_cal) {
         /* Calculate the measured CAL-HI density relative to the zero value */
-        float cal_hi_meas_d = -1.0F * log10f(cal_transmission.hi_value / cal_transmission.zero_value);
+        float cal_hi_meas_d = -1.0F * fixmath_log10f(cal_transmission.hi_value / cal_transmission.zero_value);
 
         /* Calculate the measured target density relative to the zero value */
-        float meas_d = -1.0F * log10f(corr_value / cal_transmission.zero_value);
+        float meas_d = -1.0F * fixmath_log10f(corr_value / cal_transmission.zero_value);
 
         /* Calculate the adjustment factor */
         float adj_factor = cal_transmission.hi_d / cal_hi_meas_d;
@@ -204,14 +243,19 @@ densitometer_result_t transmission_measure(densitometer_t *densitometer, sensor_
         densitometer->last_d = 0.0F;
     }
 
+    densitometer->stats.density_us = cycle_count_to_us(cycle_count_get() - stage_cycles);
+
     /* Set light back to idle */
     densitometer_set_idle_light(densitometer, true);
 
+    stage_cycles = cycle_count_get();
     if (cdc_is_connected()) {
-        cdc_send_density_reading('T', densitometer->last_d, densitometer->zero_d, ch0_basic, corr_value);
+        cdc_send_density_reading('T', densitometer->last_d, densitometer->zero_d, ch0_basic, corr_value,
+            read_stats.ch0_stddev, read_stats.sample_count, read_stats.noisy);
     } else {
         hid_send_density_reading('T', densitometer->last_d, densitometer->zero_d);
     }
+    densitometer->stats.report_us = cycle_count_to_us(cycle_count_get() - stage_cycles);
 
     return DENSITOMETER_OK;
 }
@@ -22,6 +22,17 @@ typedef enum {
 
 typedef struct __densitometer_t densitometer_t;
 
+/**
+ * Statistics describing the process of the last density measurement.
+ */
+typedef struct {
+    sensor_read_stats_t read; /*!< Statistics from the sensor target read */
+    uint32_t total_us;        /*!< Time for the whole measurement, from start until the result was reported */
+    uint32_t slope_us;        /*!< Time spent applying slope correction */
+    uint32_t density_us;      /*!< Time spent calculating density from the corrected reading */
+    uint32_t report_us;       /*!< Time spent sending the result to the USB host */
+} densitometer_stats_t;
+
 /**
  * Set a global flag to allow uncalibrated measurements
  *
@@ -31,6 +42,11 @@ typedef struct __densitometer_t densitometer_t;
  */
 void densitometer_set_allow_uncalibrated_measurements(bool allow);
 
+/**
+ * Get the global flag to allow uncalibrated measurements
+ */
+bool densitometer_get_allow_uncalibrated_measurements();
+
 /**
  * Get the densitometer instance for measuring reflection density
  */
@@ -52,6 +68,16 @@ densitometer_t *densitometer_transmission();
  */
 densitometer_result_t densitometer_measure(densitometer_t *densitometer, sensor_read_callback_t callback, void *user_data);
 
+/**
+ * Get statistics on the process of the last density measurement.
+ *
+ * These are mostly useful for measuring the performance of the
+ * measurement process, and are populated even if it failed.
+ *
+ * @param stats Structure to populate with the statistics
+ */
+void densitometer_get_last_stats(const densitometer_t *densitometer, densitometer_stats_t *stats);
+
 /**
  * Measure a calibration target.
  *
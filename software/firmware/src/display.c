@@ -11,6 +11,7 @@
 #include "keypad.h"
 #include "cdc_handler.h"
 #include "util.h"
+#include "trace.h"
 
 static u8g2_t u8g2;
 static uint8_t display_contrast = 0x7F;
@@ -18,10 +19,43 @@ static bool menu_event_timeout = false;
 
 #define MENU_TIMEOUT_MS 30000
 
+/*
+ * Layout of the display buffer, as 8 rows of 16 tiles. Each tile is
+ * 8 bytes, one per column, with each byte holding 8 vertical pixels.
+ */
+#define DISPLAY_TILE_ROWS 8
+#define DISPLAY_TILE_COLUMNS 16
+#define DISPLAY_TILE_SIZE 8
+#define DISPLAY_ROW_SIZE (DISPLAY_TILE_COLUMNS * DISPLAY_TILE_SIZE)
+
+/*
+ * Binary display update record, prior to framing.
+ * The record contains a header, followed by the PackBits encoded
+ * contents of a run of tiles, followed by a CRC-16 of everything
+ * that came before it.
+ */
+#define DISPLAY_RECORD_TYPE 'D'
+#define DISPLAY_RECORD_HEADER_SIZE 6
+#define DISPLAY_RECORD_MAX_SIZE (DISPLAY_RECORD_HEADER_SIZE + DISPLAY_ROW_SIZE + 1 + 2)
+#define DISPLAY_RECORD_FLAG_FULL 0x01
+
+/*
+ * Checksums of each tile as it was last sent to the host, used to
+ * only send the tiles that have changed. These, and the scratch space
+ * for building update records, are only used by the CDC task.
+ */
+static uint16_t display_tile_crc[DISPLAY_TILE_ROWS * DISPLAY_TILE_COLUMNS];
+static bool display_tile_crc_valid = false;
+static uint8_t display_update_sequence = 0;
+static uint8_t display_record[DISPLAY_RECORD_MAX_SIZE];
+static uint8_t display_frame[DISPLAY_RECORD_MAX_SIZE + 3];
+
 /* Library function declarations */
 void u8g2_DrawSelectionList(u8g2_t *u8g2, u8sl_t *u8sl, u8g2_uint_t y, const char *s);
 
 static void display_set_freq(uint8_t value);
+static void display_send_buffer();
+static void display_send_tile_record(const uint8_t *row_buf, uint8_t flags, uint8_t row, uint8_t column, uint8_t count);
 
 HAL_StatusTypeDef display_init(SPI_HandleTypeDef *hspi)
 {
@@ -56,10 +90,21 @@ void display_set_freq(uint8_t value)
     u8x8_cad_EndTransfer(u8x8);
 }
 
+/**
+ * Send the drawing buffer out to the display.
+ */
+void display_send_buffer()
+{
+    TRACE_EVENT(TRACE_EVENT_DISPLAY_BEGIN, 0, 0);
+    u8g2_SendBuffer(&u8g2);
+    TRACE_EVENT(TRACE_EVENT_DISPLAY_END, 0, 0);
+    cdc_notify_display_update();
+}
+
 void display_clear()
 {
     u8g2_ClearBuffer(&u8g2);
-    u8g2_SendBuffer(&u8g2);
+    display_send_buffer();
 }
 
 void display_enable(bool enabled)
@@ -92,6 +137,107 @@ void display_capture_screenshot()
     u8g2_WriteBufferXBM(&u8g2, display_capture_screenshot_callback);
 }
 
+void display_reset_updates()
+{
+    display_tile_crc_valid = false;
+}
+
+bool display_send_updates(bool full)
+{
+    const uint8_t *buf = u8g2_GetBufferPtr(&u8g2);
+    uint8_t row_buf[DISPLAY_ROW_SIZE];
+    bool sent = false;
+
+    if (!display_tile_crc_valid) {
+        full = true;
+    }
+
+    if (full) {
+        display_update_sequence++;
+    }
+
+    for (uint8_t row = 0; row < DISPLAY_TILE_ROWS; row++) {
+        uint16_t changed = 0;
+
+        /*
+         * Work from a copy of the row, so the checksums always match what
+         * was sent even if the main task starts drawing the next screen.
+         * Anything it changes will be picked up by the update that follows.
+         */
+        memcpy(row_buf, buf + (row * DISPLAY_ROW_SIZE), DISPLAY_ROW_SIZE);
+
+        for (uint8_t column = 0; column < DISPLAY_TILE_COLUMNS; column++) {
+            uint16_t *tile_crc = &display_tile_crc[(row * DISPLAY_TILE_COLUMNS) + column];
+            uint16_t crc = crc16_ccitt(row_buf + (column * DISPLAY_TILE_SIZE), DISPLAY_TILE_SIZE);
+            if (full || crc != *tile_crc) {
+                *tile_crc = crc;
+                changed |= (1U << column);
+            }
+        }
+
+        /* Send each run of changed tiles as its own record */
+        uint8_t column = 0;
+        while (changed != 0) {
+            while (!(changed & (1U << column))) {
+                column++;
+            }
+
+            uint8_t count = 0;
+            while (column + count < DISPLAY_TILE_COLUMNS && (changed & (1U << (column + count)))) {
+                changed &= ~(1U << (column + count));
+                count++;
+            }
+
+            if (!sent && !full) {
+                display_update_sequence++;
+            }
+            display_send_tile_record(row_buf, full ? DISPLAY_RECORD_FLAG_FULL : 0, row, column, count);
+            column += count;
+            sent = true;
+        }
+    }
+
+    display_tile_crc_valid = true;
+    return sent;
+}
+
+void display_send_tile_record(const uint8_t *row_buf, uint8_t flags, uint8_t row, uint8_t column, uint8_t count)
+{
+    /*
+     * Binary display update frame format:
+     * 0x00 <COBS encoded record> 0x00
+     *
+     * Record format:
+     * [0]     Record type ('D')
+     * [1]     Update sequence number
+     * [2]     Flags (0x01 = part of a full update)
+     * [3]     Tile row
+     * [4]     First tile column
+     * [5]     Number of tiles
+     * [6:n-3] PackBits encoded tile data
+     * [n-2:n-1] CRC-16/CCITT-FALSE of bytes [0:n-3]
+     */
+    size_t len;
+    size_t n;
+
+    display_record[0] = DISPLAY_RECORD_TYPE;
+    display_record[1] = display_update_sequence;
+    display_record[2] = flags;
+    display_record[3] = row;
+    display_record[4] = column;
+    display_record[5] = count;
+    len = DISPLAY_RECORD_HEADER_SIZE;
+    len += packbits_encode(display_record + len, row_buf + (column * DISPLAY_TILE_SIZE), count * DISPLAY_TILE_SIZE);
+    copy_from_u16(display_record + len, crc16_ccitt(display_record, len));
+    len += 2;
+
+    display_frame[0] = 0x00;
+    n = cobs_encode(display_frame + 1, display_record, len) + 1;
+    display_frame[n++] = 0x00;
+
+    cdc_write((const char *)display_frame, n);
+}
+
 void display_draw_test_pattern(bool mode)
 {
     u8g2_ClearBuffer(&u8g2);
@@ -111,7 +257,7 @@ void display_draw_test_pattern(bool mode)
         draw = !draw;
     }
 
-    u8g2_SendBuffer(&u8g2);
+    display_send_buffer();
 }
 
 static void display_prepare_menu_font()
@@ -202,7 +348,7 @@ void display_static_list(const char *title, const char *list)
     }
     u8g2_DrawSelectionList(&u8g2, &u8sl, yy, list);
 
-    u8g2_SendBuffer(&u8g2);
+    display_send_buffer();
 }
 
 void display_static_message(const char *msg)
@@ -240,7 +386,7 @@ void display_static_message(const char *msg)
     /* Draw the text */
     u8g2_ClearBuffer(&u8g2);
     u8g2_DrawUTF8Lines(&u8g2, 0, y, u8g2_GetDisplayWidth(&u8g2), line_height, msg);
-    u8g2_SendBuffer(&u8g2);
+    display_send_buffer();
 }
 
 uint8_t display_selection_list(const char *title, uint8_t start_pos, const char *list)
@@ -353,7 +499,7 @@ uint8_t display_input_value_f1_2(const char *title, const char *pre, uint16_t *v
         xx += u8g2_DrawUTF8(&u8g2, xx, yy, pre);
         xx += u8g2_DrawUTF8(&u8g2, xx, yy, display_f1_2toa(local_value));
         u8g2_DrawUTF8(&u8g2, xx, yy, post);
-        u8g2_SendBuffer(&u8g2);
+        display_send_buffer();
 
         for(;;) {
             event = u8x8_GetMenuEvent(u8g2_GetU8x8(&u8g2));
@@ -474,5 +620,5 @@ void display_draw_main_elements(const display_main_elements_t *elements)
             asset.width, asset.height, asset.bits);
     }
 
-    u8g2_SendBuffer(&u8g2);
+    display_send_buffer();
 }
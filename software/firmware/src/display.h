@@ -26,6 +26,23 @@ uint8_t display_get_contrast();
 
 void display_capture_screenshot();
 
+/**
+ * Forget which display tiles have been sent to the host, so that the
+ * next call to display_send_updates() sends the complete display.
+ */
+void display_reset_updates();
+
+/**
+ * Send the display tiles that changed since the last update out the CDC
+ * device, as run-length encoded binary frames.
+ *
+ * This must only be called from the CDC task.
+ *
+ * @param full True to send every tile, whether or not it has changed
+ * @return True if any tiles were sent
+ */
+bool display_send_updates(bool full);
+
 void display_draw_test_pattern(bool mode);
 void display_static_list(const char *title, const char *list);
 void display_static_message(const char *msg);
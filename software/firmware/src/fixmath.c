@@ -0,0 +1,148 @@
+#include "fixmath.h"
+
+#include <math.h>
+#include <string.h>
+
+/* Number of bits used to index the lookup tables */
+#define FIXMATH_TABLE_BITS 6
+
+/* log2(10) in Q16.16 */
+#define FIXMATH_LOG2_10_Q16 (3.321928095F * 65536.0F)
+
+/* log10(2) divided by the Q16.16 scale */
+#define FIXMATH_LOG10_2_Q16 (0.301029996F / 65536.0F)
+
+/* log2(1 + k/64) in Q16.16 */
+static const uint32_t fixmath_log2_table[(1 << FIXMATH_TABLE_BITS) + 1] = {
+    0, 1466, 2909, 4331, 5732, 7112, 8473, 9814,
+    11136, 12440, 13727, 14996, 16248, 17484, 18704, 19909,
+    21098, 22272, 23433, 24579, 25711, 26830, 27936, 29029,
+    30109, 31178, 32234, 33279, 34312, 35334, 36346, 37346,
+    38336, 39316, 40286, 41246, 42196, 43137, 44068, 44990,
+    45904, 46809, 47705, 48593, 49472, 50344, 51207, 52063,
+    52911, 53751, 54584, 55410, 56229, 57040, 57845, 58643,
+    59434, 60219, 60997, 61769, 62534, 63294, 64047, 64794,
+    65536
+};
+
+/* (2^(k/64) - 1) in Q23, matching the float mantissa */
+static const uint32_t fixmath_exp2_table[(1 << FIXMATH_TABLE_BITS) + 1] = {
+    0, 91346, 183687, 277033, 371395, 466786, 563215, 660693,
+    759234, 858847, 959546, 1061340, 1164243, 1268267, 1373424, 1479725,
+    1587184, 1695814, 1805626, 1916634, 2028850, 2142289, 2256963, 2372886,
+    2490071, 2608532, 2728283, 2849338, 2971711, 3095417, 3220470, 3346884,
+    3474675, 3603858, 3734447, 3866459, 3999908, 4134810, 4271181, 4409037,
+    4548394, 4689269, 4831678, 4975637, 5121164, 5268276, 5416990, 5567323,
+    5719293, 5872918, 6028216, 6185205, 6343903, 6504329, 6666503, 6830442,
+    6996167, 7163696, 7333050, 7504247, 7677309, 7852255, 8029107, 8207884,
+    8388608
+};
+
+static int32_t fixmath_log2_mantissa(uint32_t mantissa);
+
+/**
+ * Interpolated log2 of a 23-bit mantissa, representing a value in [1, 2).
+ *
+ * @param mantissa Fractional part of the value, in Q23
+ * @return log2(1 + mantissa) in Q16.16
+ */
+int32_t fixmath_log2_mantissa(uint32_t mantissa)
+{
+    const uint32_t index = mantissa >> (23 - FIXMATH_TABLE_BITS);
+    const uint32_t frac = mantissa & ((1UL << (23 - FIXMATH_TABLE_BITS)) - 1);
+    const uint32_t base = fixmath_log2_table[index];
+    const uint32_t delta = fixmath_log2_table[index + 1] - base;
+
+    return (int32_t)(base + ((delta * frac) >> (23 - FIXMATH_TABLE_BITS)));
+}
+
+int32_t fixmath_log2_u32(uint32_t x)
+{
+    if (x == 0) {
+        return INT32_MIN;
+    }
+
+    /* Find the position of the leading one, which is the integer part */
+    int32_t n = 31 - __builtin_clz(x);
+
+    /* Normalize the remaining bits into a Q23 mantissa */
+    uint32_t mantissa;
+    if (n > 23) {
+        mantissa = (x >> (n - 23)) & 0x7FFFFFUL;
+    } else {
+        mantissa = (x << (23 - n)) & 0x7FFFFFUL;
+    }
+
+    return (n << 16) + fixmath_log2_mantissa(mantissa);
+}
+
+int32_t fixmath_log2_f32(float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    /* Reject zero, negative, subnormal, infinite, and NaN values */
+    int32_t exponent = (int32_t)((bits >> 23) & 0xFF);
+    if ((bits & 0x80000000UL) || exponent == 0 || exponent == 0xFF) {
+        return INT32_MIN;
+    }
+
+    return ((exponent - 127) << 16) + fixmath_log2_mantissa(bits & 0x7FFFFFUL);
+}
+
+float fixmath_exp2_q16(int32_t y)
+{
+    /* Split into integer and fractional parts, rounding towards negative infinity */
+    int32_t n = y >> 16;
+    uint32_t f = (uint32_t)y & 0xFFFFUL;
+
+    if (n < -126) {
+        return 0.0F;
+    } else if (n > 127) {
+        return INFINITY;
+    }
+
+    const uint32_t index = f >> (16 - FIXMATH_TABLE_BITS);
+    const uint32_t frac = f & ((1UL << (16 - FIXMATH_TABLE_BITS)) - 1);
+    const uint32_t base = fixmath_exp2_table[index];
+    const uint32_t delta = fixmath_exp2_table[index + 1] - base;
+    uint32_t mantissa = base + ((delta * frac) >> (16 - FIXMATH_TABLE_BITS));
+
+    /* Assemble the result directly as a float */
+    uint32_t bits = ((uint32_t)(n + 127) << 23) | (mantissa & 0x7FFFFFUL);
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+float fixmath_log10f(float x)
+{
+    if (x == 0.0F) {
+        return -INFINITY;
+    } else if (isinf(x) && x > 0.0F) {
+        return INFINITY;
+    }
+
+    int32_t y = fixmath_log2_f32(x);
+    if (y == INT32_MIN) {
+        return NAN;
+    }
+
+    return (float)y * FIXMATH_LOG10_2_Q16;
+}
+
+float fixmath_exp10f(float x)
+{
+    if (isnan(x)) {
+        return NAN;
+    }
+
+    /* Clamp to a range that cannot overflow the Q16.16 exponent */
+    if (x < -40.0F) {
+        return 0.0F;
+    } else if (x > 40.0F) {
+        return INFINITY;
+    }
+
+    return fixmath_exp2_q16((int32_t)lroundf(x * FIXMATH_LOG2_10_Q16));
+}
@@ -0,0 +1,67 @@
+/*
+ * Fixed-point logarithm and exponent functions.
+ *
+ * The density calculations are all done in terms of logarithms, and the
+ * soft-float implementations of log10f() and powf() are very slow on a
+ * microcontroller without an FPU. These functions use small interpolated
+ * lookup tables instead, with all intermediate math done in integers.
+ *
+ * Logarithm values are base-2 in Q16.16 format, unless otherwise noted.
+ *
+ * Accuracy is limited by the linear interpolation between table entries.
+ * The worst case error of fixmath_log10f() is under 2e-5, and the worst
+ * case relative error of fixmath_exp10f() is under 5e-5. This is orders
+ * of magnitude below the 0.005D resolution of any displayed reading,
+ * even after several functions are chained together.
+ */
+#ifndef FIXMATH_H
+#define FIXMATH_H
+
+#include <stdint.h>
+
+/**
+ * Fixed-point base-2 logarithm of an unsigned integer.
+ *
+ * @param x Input value, which must be greater than zero
+ * @return log2(x) in Q16.16 format, or INT32_MIN if the input is zero
+ */
+int32_t fixmath_log2_u32(uint32_t x);
+
+/**
+ * Fixed-point base-2 logarithm of a positive float.
+ *
+ * @param x Input value, which must be a finite value greater than zero
+ * @return log2(x) in Q16.16 format, or INT32_MIN if the input is invalid
+ */
+int32_t fixmath_log2_f32(float x);
+
+/**
+ * Base-2 exponent of a fixed-point value.
+ *
+ * @param y Exponent in Q16.16 format
+ * @return 2^y, saturating to zero or infinity if out of range
+ */
+float fixmath_exp2_q16(int32_t y);
+
+/**
+ * Base-10 logarithm of a positive float.
+ *
+ * This is a drop-in replacement for log10f() within the density pipeline.
+ *
+ * @param x Input value
+ * @return log10(x), -INFINITY if x is zero, or NAN if x is negative or invalid
+ */
+float fixmath_log10f(float x);
+
+/**
+ * Base-10 exponent of a float.
+ *
+ * This is a drop-in replacement for powf(10.0F, x) within the
+ * density pipeline.
+ *
+ * @param x Exponent value
+ * @return 10^x, saturating to zero or infinity if out of range
+ */
+float fixmath_exp10f(float x);
+
+#endif /* FIXMATH_H */
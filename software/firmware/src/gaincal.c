@@ -0,0 +1,131 @@
+#include "gaincal.h"
+
+#include <math.h>
+
+/* Time constant of the LED cooling curve */
+#define GAINCAL_THERMAL_TAU_MS (2000.0F)
+
+bool gaincal_search_brightness(uint8_t min_brightness, uint8_t max_brightness,
+    bool start_high, float target, bool below_target,
+    gaincal_measure_func_t measure, void *user_data,
+    uint8_t *result)
+{
+    /*
+     * The bracket is made up of the highest brightness known to read at
+     * or below the target, and the lowest brightness known to read above
+     * the target or to saturate.
+     */
+    bool has_lo = false;
+    uint8_t lo = 0;
+    float lo_value = 0;
+    bool has_hi = false;
+    uint8_t hi = 0;
+    float hi_value = 0;
+
+    int prev_width = (int)max_brightness - (int)min_brightness + 1;
+    uint8_t brightness = start_high ? max_brightness : min_brightness;
+
+    if (result) { *result = 0; }
+
+    if (!measure || min_brightness == 0 || min_brightness > max_brightness) {
+        return false;
+    }
+
+    for (int i = 0; i < GAINCAL_SEARCH_MAX_TESTS; i++) {
+        float value;
+        if (!measure(brightness, &value, user_data)) {
+            return false;
+        }
+
+        if (!isnanf(value) && value <= target) {
+            if (!has_lo || brightness > lo) {
+                lo = brightness;
+                lo_value = value;
+                has_lo = true;
+            }
+        } else {
+            if (!has_hi || brightness < hi) {
+                hi = brightness;
+                hi_value = value;
+                has_hi = true;
+            }
+        }
+
+        /* Find the untested range remaining within the bracket */
+        const int lower = has_lo ? (int)lo + 1 : (int)min_brightness;
+        const int upper = has_hi ? (int)hi - 1 : (int)max_brightness;
+        if (lower > upper) {
+            break;
+        }
+
+        /* Fall back to bisection if the last guess did not narrow things down enough */
+        const int width = upper - lower + 1;
+        const bool bisect = (i > 0) && (width * 2 > prev_width);
+        prev_width = width;
+
+        float guess;
+        if (!bisect && has_lo && has_hi && !isnanf(hi_value) && hi_value > lo_value) {
+            /* Interpolate between both sides of the bracket */
+            guess = (float)lo + ((target - lo_value) * (float)(hi - lo) / (hi_value - lo_value));
+        } else if (!bisect && has_lo && lo_value > 0) {
+            /* Extrapolate upward, assuming the reading is proportional to brightness */
+            guess = (float)lo * target / lo_value;
+        } else if (!bisect && !has_lo && has_hi && !isnanf(hi_value) && hi_value > 0) {
+            /* Extrapolate downward, assuming the reading is proportional to brightness */
+            guess = (float)hi * target / hi_value;
+        } else {
+            guess = (float)(lower + upper) / 2.0F;
+        }
+
+        long next = lroundf(guess);
+        if (next < lower) { next = lower; }
+        if (next > upper) { next = upper; }
+        brightness = (uint8_t)next;
+    }
+
+    if (result) {
+        if (below_target) {
+            *result = has_lo ? lo : 0;
+        } else if (has_lo && has_hi && !isnanf(hi_value)) {
+            *result = (fabsf(hi_value - target) < fabsf(target - lo_value)) ? hi : lo;
+        } else if (has_lo) {
+            *result = lo;
+        } else if (has_hi && !isnanf(hi_value)) {
+            *result = hi;
+        }
+    }
+
+    return true;
+}
+
+static float gaincal_thermal_load(const gaincal_thermal_t *thermal, uint32_t ticks)
+{
+    const uint32_t elapsed = ticks - thermal->ticks;
+    return thermal->load * expf(-(float)elapsed / GAINCAL_THERMAL_TAU_MS);
+}
+
+void gaincal_thermal_init(gaincal_thermal_t *thermal, uint32_t ticks)
+{
+    if (!thermal) { return; }
+    thermal->load = 0;
+    thermal->ticks = ticks;
+}
+
+void gaincal_thermal_add(gaincal_thermal_t *thermal, uint32_t ticks, uint8_t brightness, uint32_t on_ms)
+{
+    if (!thermal) { return; }
+    thermal->load = gaincal_thermal_load(thermal, ticks)
+        + (((float)brightness / 128.0F) * ((float)on_ms / 1000.0F));
+    thermal->ticks = ticks;
+}
+
+uint32_t gaincal_thermal_cooldown_ms(const gaincal_thermal_t *thermal, uint32_t ticks, float limit)
+{
+    if (!thermal || !(limit > 0)) { return 0; }
+
+    const float load = gaincal_thermal_load(thermal, ticks);
+    if (load <= limit) {
+        return 0;
+    }
+    return (uint32_t)lroundf(GAINCAL_THERMAL_TAU_MS * logf(load / limit));
+}
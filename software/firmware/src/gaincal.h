@@ -0,0 +1,111 @@
+/*
+ * Search and timing helpers for the sensor gain calibration process.
+ *
+ * The gain calibration spends most of its time testing LED brightness
+ * values and waiting for the LED to cool down between measurements.
+ * These helpers replace the linear brightness sweep with a bracketing
+ * search, and the fixed cooldown delays with a simple thermal model of
+ * the LED, so both can be kept as short as the measurements allow.
+ *
+ * Nothing in here touches the hardware, so these functions can also be
+ * built and exercised on the host.
+ */
+#ifndef GAINCAL_H
+#define GAINCAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Maximum number of brightness values tested by a single search.
+ */
+#define GAINCAL_SEARCH_MAX_TESTS 12
+
+/**
+ * Thermal load remaining at which the LED is considered cool enough
+ * for the next brightness test within a search.
+ */
+#define GAINCAL_THERMAL_TEST_LIMIT  (0.25F)
+
+/**
+ * Thermal load remaining at which the LED is considered cool enough
+ * to start the next phase of the calibration process.
+ */
+#define GAINCAL_THERMAL_PHASE_LIMIT (0.35F)
+
+/**
+ * Callback used by the brightness search to take a measurement.
+ *
+ * @param brightness LED brightness to measure at
+ * @param ch0_value Measured CH0 value, or NAN if the sensor saturated
+ * @param user_data Value passed through from the search call
+ * @return True on success, false to abort the search
+ */
+typedef bool (*gaincal_measure_func_t)(uint8_t brightness, float *ch0_value, void *user_data);
+
+/**
+ * Find the LED brightness that produces a reading closest to a target.
+ *
+ * Readings are assumed to increase with brightness, roughly in
+ * proportion to it. The search starts from one end of the range, then
+ * uses each result to predict where the target will be reached,
+ * narrowing a bracket around it with interpolated guesses. If an
+ * interpolated guess fails to narrow the bracket by at least half,
+ * the next guess is made by bisection instead.
+ *
+ * @param min_brightness Lowest brightness to consider
+ * @param max_brightness Highest brightness to consider
+ * @param start_high True to start from the highest brightness, false for the lowest
+ * @param target Target CH0 reading
+ * @param below_target True to only accept a reading at or below the target,
+ *                     false to accept the closest reading on either side
+ * @param measure Callback to take each measurement
+ * @param user_data Value to pass through to the callback
+ * @param result Selected brightness, or 0 if no usable brightness was found
+ * @return True if the search completed, false if a measurement failed
+ */
+bool gaincal_search_brightness(uint8_t min_brightness, uint8_t max_brightness,
+    bool start_high, float target, bool below_target,
+    gaincal_measure_func_t measure, void *user_data,
+    uint8_t *result);
+
+/**
+ * Simple first-order thermal model of the measurement LED.
+ *
+ * The load is the LED on-time weighted by brightness, in full-brightness
+ * seconds, decaying exponentially as the LED cools.
+ */
+typedef struct {
+    float load;
+    uint32_t ticks;
+} gaincal_thermal_t;
+
+/**
+ * Reset the thermal model to a cool LED.
+ *
+ * @param thermal Model to reset
+ * @param ticks Current time, in milliseconds
+ */
+void gaincal_thermal_init(gaincal_thermal_t *thermal, uint32_t ticks);
+
+/**
+ * Add a period of LED on-time to the thermal model.
+ *
+ * @param thermal Model to update
+ * @param ticks Time at which the LED was turned off, in milliseconds
+ * @param brightness LED brightness, out of 128
+ * @param on_ms Length of time the LED was on, in milliseconds
+ */
+void gaincal_thermal_add(gaincal_thermal_t *thermal, uint32_t ticks, uint8_t brightness, uint32_t on_ms);
+
+/**
+ * Get the remaining time until the LED has cooled down to a given load.
+ *
+ * @param thermal Model to query
+ * @param ticks Current time, in milliseconds
+ * @param limit Load at which the LED is considered cool enough
+ * @return Time to wait, in milliseconds
+ */
+uint32_t gaincal_thermal_cooldown_ms(const gaincal_thermal_t *thermal, uint32_t ticks, float limit);
+
+#endif /* GAINCAL_H */
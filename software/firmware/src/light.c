@@ -28,3 +28,13 @@ void light_set_transmission(uint8_t val)
 {
     __HAL_TIM_SET_COMPARE(light_htim, light_t_channel, val);
 }
+
+uint8_t light_get_reflection()
+{
+    return (uint8_t)__HAL_TIM_GET_COMPARE(light_htim, light_r_channel);
+}
+
+uint8_t light_get_transmission()
+{
+    return (uint8_t)__HAL_TIM_GET_COMPARE(light_htim, light_t_channel);
+}
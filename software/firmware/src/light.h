@@ -8,4 +8,7 @@ void light_init(TIM_HandleTypeDef *htim, uint32_t r_channel, uint32_t t_channel)
 void light_set_reflection(uint8_t val);
 void light_set_transmission(uint8_t val);
 
+uint8_t light_get_reflection();
+uint8_t light_get_transmission();
+
 #endif /* LIGHT_H */
@@ -29,6 +29,7 @@ DMA_HandleTypeDef hdma_adc;
 I2C_HandleTypeDef hi2c1;
 SPI_HandleTypeDef hspi1;
 TIM_HandleTypeDef htim2;
+TIM_HandleTypeDef htim7;
 UART_HandleTypeDef huart1;
 
 static uint32_t startup_bkp0r = 0;
@@ -40,7 +41,9 @@ static void usart1_uart_init(void);
 static void logger_init(void);
 static void gpio_init(void);
 static void i2c1_init(void);
+static HAL_StatusTypeDef i2c1_config(void);
 static void tim2_init(void);
+static void tim7_init(void);
 static void spi1_init(void);
 static void crc_init(void);
 static void dma_init(void);
@@ -296,19 +299,34 @@ void i2c1_init(void)
     hi2c1.Init.GeneralCallMode = I2C_GENERALCALL_DISABLE;
     hi2c1.Init.NoStretchMode = I2C_NOSTRETCH_DISABLE;
 
-    if (HAL_I2C_Init(&hi2c1) != HAL_OK) {
+    if (i2c1_config() != HAL_OK) {
         error_handler();
     }
+}
+
+HAL_StatusTypeDef i2c1_config(void)
+{
+    HAL_StatusTypeDef ret;
+
+    ret = HAL_I2C_Init(&hi2c1);
+    if (ret != HAL_OK) {
+        return ret;
+    }
 
     /* Configure analog filter */
-    if (HAL_I2CEx_ConfigAnalogFilter(&hi2c1, I2C_ANALOGFILTER_ENABLE) != HAL_OK) {
-        error_handler();
+    ret = HAL_I2CEx_ConfigAnalogFilter(&hi2c1, I2C_ANALOGFILTER_ENABLE);
+    if (ret != HAL_OK) {
+        return ret;
     }
 
     /* Configure digital filter */
-    if (HAL_I2CEx_ConfigDigitalFilter(&hi2c1, 0) != HAL_OK) {
-        error_handler();
-    }
+    return HAL_I2CEx_ConfigDigitalFilter(&hi2c1, 0);
+}
+
+HAL_StatusTypeDef i2c1_reset(void)
+{
+    HAL_I2C_DeInit(&hi2c1);
+    return i2c1_config();
 }
 
 void tim2_init(void)
@@ -362,6 +380,38 @@ void tim2_init(void)
     HAL_TIM_MspPostInit(&htim2);
 }
 
+void tim7_init(void)
+{
+    /*
+     * Free-running 1MHz counter for microsecond timestamps.
+     * The update interrupt on each overflow of the 16-bit counter
+     * extends it to the 32-bit value returned by timestamp_us_get().
+     */
+    TIM_MasterConfigTypeDef sMasterConfig = {0};
+
+    htim7.Instance = TIM7;
+    htim7.Init.Prescaler = (HAL_RCC_GetPCLK1Freq() / 1000000U) - 1U;
+    htim7.Init.CounterMode = TIM_COUNTERMODE_UP;
+    htim7.Init.Period = 0xFFFF;
+    htim7.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+    if (HAL_TIM_Base_Init(&htim7) != HAL_OK) {
+        error_handler();
+    }
+
+    sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+    sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+    if (HAL_TIMEx_MasterConfigSynchronization(&htim7, &sMasterConfig) != HAL_OK) {
+        error_handler();
+    }
+
+    /* Clear the update flag set by loading the prescaler, so it is not counted as an overflow */
+    __HAL_TIM_CLEAR_FLAG(&htim7, TIM_FLAG_UPDATE);
+
+    if (HAL_TIM_Base_Start_IT(&htim7) != HAL_OK) {
+        error_handler();
+    }
+}
+
 void spi1_init(void)
 {
     hspi1.Instance = SPI1;
@@ -548,6 +598,7 @@ int main(void)
     gpio_init();
     i2c1_init();
     tim2_init();
+    tim7_init();
     spi1_init();
     crc_init();
     dma_init();
@@ -595,6 +646,20 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
     }
 }
 
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c->Instance == I2C1) {
+        sensor_i2c_completion_handler(HAL_OK);
+    }
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c->Instance == I2C1) {
+        sensor_i2c_completion_handler(HAL_ERROR);
+    }
+}
+
 void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
 {
     UNUSED(hadc);
@@ -606,6 +671,7 @@ void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
   * @note   This function is called  when TIM6 interrupt took place, inside
   * HAL_TIM_IRQHandler(). It makes a direct call to HAL_IncTick() to increment
   * a global variable "uwTick" used as application time base.
+  * It is also called on each overflow of the TIM7 timestamp counter.
   * @param  htim : TIM handle
   * @retval None
   */
@@ -613,6 +679,8 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
     if (htim->Instance == TIM6) {
         HAL_IncTick();
+    } else if (htim->Instance == TIM7) {
+        timestamp_us_overflow();
     }
 }
 
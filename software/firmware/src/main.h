@@ -1,8 +1,18 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#include "stm32l0xx_hal.h"
+
 void system_clock_config(void);
 void gpio_button_config(void);
 void gpio_button_unconfig(void);
 
+/**
+ * Reset the sensor I2C peripheral, reapplying its full configuration.
+ *
+ * This is used to recover from a stuck transfer, and must only be called
+ * while nothing else is using the peripheral.
+ */
+HAL_StatusTypeDef i2c1_reset(void);
+
 #endif /* MAIN_H */
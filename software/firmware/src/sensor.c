@@ -6,21 +6,84 @@
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 #include <cmsis_os.h>
 #include <FreeRTOS.h>
 #include <queue.h>
+#include <task.h>
 
 #include "stm32l0xx_hal.h"
 #include "settings.h"
 #include "task_sensor.h"
 #include "tsl2591.h"
 #include "light.h"
+#include "fixmath.h"
+#include "gaincal.h"
 #include "util.h"
 
 #define SENSOR_TARGET_READ_ITERATIONS 2
+
+/*
+ * Additional readings the target read may take, beyond the configured
+ * sample count, while waiting for the readings to converge.
+ */
+#define SENSOR_TARGET_READ_EXTRA_ITERATIONS 3
+
+/* Upper bound on the number of readings kept by the target read */
+#define SENSOR_TARGET_READ_MAX_SAMPLES SETTING_SAMPLING_COUNT_MAX
+
+/* Minimum number of readings from which an outlier can be identified */
+#define SENSOR_REJECT_MIN_SAMPLES     3
+
+/*
+ * Two-sided 99% critical values of the Student's t-distribution, indexed
+ * by degrees of freedom. Sigma rejection compares each reading against
+ * the mean and standard deviation of the other readings, and that
+ * distance follows this distribution with (count - 2) degrees of freedom.
+ */
+static const float sensor_reject_sigma_limit[SENSOR_TARGET_READ_MAX_SAMPLES - 1] = {
+    0.0F,   63.657F, 9.925F, 5.841F, 4.604F, 4.032F, 3.707F, 3.499F,
+    3.355F, 3.250F,  3.169F, 3.106F, 3.055F, 3.012F, 2.977F
+};
+
+/* Distance from the median, in scaled median absolute deviations, beyond which median rejection drops a reading */
+#define SENSOR_REJECT_MAD_LIMIT       (3.0F)
+#define SENSOR_REJECT_MAD_SCALE       (1.4826F)
+
+/*
+ * Relative standard error of the mean at which target readings are
+ * considered converged. Densities are reported with a resolution of
+ * 0.01D, and a 0.5% error works out to about 0.002D, so tightening this
+ * further only costs extra cycles without changing the reported result.
+ */
+#define SENSOR_TARGET_READ_CONVERGENCE (0.005F)
+
+/* Fraction of the saturation point that predicted target readings must stay under */
+#define SENSOR_TARGET_HEADROOM        (0.80F)
+
+/*
+ * Integration time used for target readings. The slope calibration is
+ * fitted to readings taken at this setting, and integration time itself
+ * is not calibrated, so only the gain is chosen for each target.
+ */
+#define SENSOR_TARGET_READ_TIME       TSL2591_TIME_200MS
 #define SENSOR_GAIN_CAL_READ_ITERATIONS 5
 #define SENSOR_GAIN_LED_CHECK_READ_ITERATIONS 2
 
+/* Number of phases in the gain calibration process, used for progress estimation */
+#define GAIN_CAL_PHASE_COUNT 10
+
+/* Typical number of brightness tests taken by each brightness search */
+#define GAIN_CAL_SEARCH_TYPICAL_TESTS 5
+
+/* Thermal model of the transmission LED, used to size cooldown periods */
+static gaincal_thermal_t gain_cal_thermal = {0};
+
+/* Estimated duration of each gain calibration phase, in milliseconds */
+static uint32_t gain_cal_phase_ms[GAIN_CAL_PHASE_COUNT] = {0};
+static uint8_t gain_cal_phase = 0;
+static uint32_t gain_cal_phase_ticks = 0;
+
 /* These constants are for the matte white stage plate */
 #define GAIN_CAL_BRIGHTNESS_LOW_MED   128
 #define GAIN_CAL_BRIGHTNESS_MED_HIGH  128  /* actual value determined dynamically */
@@ -32,13 +95,52 @@
 /* Number of iterations to use for light source calibration */
 #define LIGHT_CAL_ITERATIONS 600
 
+#define SENSOR_GAIN_COUNT (TSL2591_GAIN_MAXIMUM + 1)
+#define SENSOR_TIME_COUNT (TSL2591_TIME_600MS + 1)
+
+/**
+ * Values derived from the calibration settings, which are needed
+ * whenever a sensor reading is processed.
+ */
+typedef struct {
+    uint32_t generation;
+    float ch0_cpl_inv[SENSOR_GAIN_COUNT][SENSOR_TIME_COUNT];
+    float ch1_cpl_inv[SENSOR_GAIN_COUNT][SENSOR_TIME_COUNT];
+    settings_cal_slope_t cal_slope;
+    bool cal_slope_valid;
+    settings_cal_drift_t cal_drift;
+} sensor_cal_context_t;
+
+static sensor_cal_context_t sensor_cal_context = {0};
+
+static sensor_read_stats_t sensor_last_read_stats = {0};
+
+/*
+ * Threshold window used while the sensor is kept running between target
+ * reads, as a percentage of the idle reading.
+ */
+#define SENSOR_WARM_THRESHOLD_MARGIN 25
+
+/*
+ * Thread flag used to wait for asynchronous sensor control batches.
+ * This is kept clear of the bits used for state change notifications.
+ */
+#define SENSOR_BATCH_THREAD_FLAG 0x01000000UL
+
+/* State for keeping the sensor running between target reads */
+static bool sensor_warm_mode = false;
+static bool sensor_warm_active = false;
+
 static osStatus_t sensor_gain_calibration_loop(
     tsl2591_gain_t gain0, tsl2591_gain_t gain1, tsl2591_time_t time,
     uint8_t led_brightness,
     float *gain_ch0, float *gain_ch1,
     sensor_gain_calibration_status_t callback_status,
     sensor_gain_calibration_callback_t callback, void *user_data);
-static bool sensor_gain_calibration_cooldown(sensor_gain_calibration_callback_t callback, void *user_data);
+static bool sensor_gain_calibration_cooldown(float limit, sensor_gain_calibration_callback_t callback, void *user_data);
+static void sensor_gain_calibration_phase(uint8_t phase, uint32_t estimate_ms);
+static uint32_t sensor_gain_calibration_remaining_ms();
+static bool sensor_find_gain_brightness_measure(uint8_t brightness, float *ch0_value, void *user_data);
 static osStatus_t sensor_find_gain_brightness(uint8_t *led_brightness,
     tsl2591_gain_t gain, tsl2591_time_t time,
     uint8_t start_brightness, uint8_t end_brightness,
@@ -48,17 +150,28 @@ static bool gain_status_callback(
     sensor_gain_calibration_callback_t callback,
     sensor_gain_calibration_status_t status, int param,
     void *user_data);
-static osStatus_t sensor_raw_read_loop(uint8_t count, float *ch0_avg, float *ch1_avg);
+static osStatus_t sensor_run_program_wait(const sensor_program_step_t *steps, uint8_t step_count,
+    sensor_program_result_t *results);
+static void sensor_program_result_average(const sensor_program_result_t *result, float *ch0_avg, float *ch1_avg);
+static osStatus_t sensor_warm_probe(sensor_light_t light_source, uint8_t light_value,
+    sensor_reading_t *reading, sensor_read_stats_t *stats);
+static uint8_t sensor_reject_outliers(float *ch0_samples, float *ch1_samples, uint8_t count,
+    setting_sampling_reject_t reject);
+static uint8_t sensor_reject_outliers_sigma(float *ch0_samples, float *ch1_samples, uint8_t count);
+static float sensor_sort_median(float *values, uint8_t count);
+static void sensor_predict_target_config(const sensor_reading_t *probe,
+    tsl2591_gain_t *target_gain, tsl2591_time_t *target_time);
 static uint8_t sensor_get_read_brightness(sensor_light_t light_source);
+static const sensor_cal_context_t *sensor_get_cal_context();
 
 osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback, void *user_data)
 {
     /*
-     * The sensor gain calibration process currently uses hand-picked
-     * values for the integration time and transmission LED brightness.
-     * Eventually, some mechanism for auto-ranging on the ideal LED
-     * brightness for each step should be implemented, but the current
-     * approach is likely good enough for now.
+     * The sensor gain calibration process uses hand-picked values for
+     * the integration time, and searches for the transmission LED
+     * brightness to use for the high and maximum gain steps.
+     * Cooldown periods are sized from a simple thermal model of the LED,
+     * rather than being fixed delays.
      */
 
     osStatus_t ret = osOK;
@@ -72,10 +185,30 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
     float gain_max_ch0 = NAN;
     float gain_max_ch1 = NAN;
 
+    const uint32_t start_ticks = osKernelGetTickCount();
+
     settings_get_cal_light(&cal_light);
 
     log_i("Starting gain calibration");
 
+    /* Initial estimates for each phase, used to report the remaining time */
+    const uint16_t search_ms = GAIN_CAL_SEARCH_TYPICAL_TESTS
+        * (((1 + 1 + SENSOR_GAIN_LED_CHECK_READ_ITERATIONS + 1) * 200) + 500);
+    const uint16_t cooldown_ms = 3000;
+    gain_cal_phase_ms[0] = 1000;
+    gain_cal_phase_ms[1] = search_ms;
+    gain_cal_phase_ms[2] = cooldown_ms;
+    gain_cal_phase_ms[3] = (2 * (SENSOR_GAIN_CAL_READ_ITERATIONS + 2) * 600) + cooldown_ms;
+    gain_cal_phase_ms[4] = cooldown_ms;
+    gain_cal_phase_ms[5] = (2 * (SENSOR_GAIN_CAL_READ_ITERATIONS + 2) * 200) + cooldown_ms;
+    gain_cal_phase_ms[6] = cooldown_ms;
+    gain_cal_phase_ms[7] = search_ms;
+    gain_cal_phase_ms[8] = cooldown_ms;
+    gain_cal_phase_ms[9] = (2 * (SENSOR_GAIN_CAL_READ_ITERATIONS + 2) * 200) + cooldown_ms;
+    gain_cal_phase = 0;
+    gain_cal_phase_ticks = start_ticks;
+    gaincal_thermal_init(&gain_cal_thermal, start_ticks);
+
     if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_INIT, 0, user_data)) { return osError; }
 
     /* Set lights to initial state */
@@ -92,6 +225,7 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
         osDelay(1000);
 
         /* Find the ideal measurement brightness, which should not saturate at high gain */
+        sensor_gain_calibration_phase(1, 0);
         ret = sensor_find_gain_brightness(&measurement_led_brightness,
             TSL2591_GAIN_HIGH, TSL2591_TIME_200MS,
             128, 64, LIGHT_CAL_CH0_TARGET_FACTOR,
@@ -99,13 +233,16 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
         if (ret != osOK || measurement_led_brightness == 0) { break; }
 
         /* Wait for LED cool down */
-        if (!sensor_gain_calibration_cooldown(callback, user_data)) {
+        sensor_gain_calibration_phase(2,
+            gaincal_thermal_cooldown_ms(&gain_cal_thermal, osKernelGetTickCount(), GAINCAL_THERMAL_PHASE_LIMIT));
+        if (!sensor_gain_calibration_cooldown(GAINCAL_THERMAL_PHASE_LIMIT, callback, user_data)) {
             ret = osError;
             break;
         }
 
         /* Calibrate the value for medium gain */
         log_i("Medium gain calibration");
+        sensor_gain_calibration_phase(3, 0);
         ret = sensor_gain_calibration_loop(
             TSL2591_GAIN_LOW, TSL2591_GAIN_MEDIUM, TSL2591_TIME_600MS,
             GAIN_CAL_BRIGHTNESS_LOW_MED, &gain_med_ch0, &gain_med_ch1,
@@ -124,13 +261,16 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
         }
 
         /* Wait for LED cool down */
-        if (!sensor_gain_calibration_cooldown(callback, user_data)) {
+        sensor_gain_calibration_phase(4,
+            gaincal_thermal_cooldown_ms(&gain_cal_thermal, osKernelGetTickCount(), GAINCAL_THERMAL_PHASE_LIMIT));
+        if (!sensor_gain_calibration_cooldown(GAINCAL_THERMAL_PHASE_LIMIT, callback, user_data)) {
             ret = osError;
             break;
         }
 
         /* Calibrate the value for high gain, using the calibrated measurement brightness */
         log_i("High gain calibration");
+        sensor_gain_calibration_phase(5, 0);
         ret = sensor_gain_calibration_loop(
             TSL2591_GAIN_MEDIUM, TSL2591_GAIN_HIGH, TSL2591_TIME_200MS,
             measurement_led_brightness, &gain_high_ch0, &gain_high_ch1,
@@ -152,12 +292,15 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
         }
 
         /* Wait for LED cool down */
-        if (!sensor_gain_calibration_cooldown(callback, user_data)) {
+        sensor_gain_calibration_phase(6,
+            gaincal_thermal_cooldown_ms(&gain_cal_thermal, osKernelGetTickCount(), GAINCAL_THERMAL_PHASE_LIMIT));
+        if (!sensor_gain_calibration_cooldown(GAINCAL_THERMAL_PHASE_LIMIT, callback, user_data)) {
             ret = osError;
             break;
         }
 
         /* Find the ideal brightness for testing maximum gain */
+        sensor_gain_calibration_phase(7, 0);
         ret = sensor_find_gain_brightness(&max_gain_led_brightness,
             TSL2591_GAIN_MAXIMUM, TSL2591_TIME_200MS,
             4, 16, GAIN_CAL_CH0_TARGET_FACTOR,
@@ -165,13 +308,16 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
         if (ret != osOK || max_gain_led_brightness == 0) { break; }
 
         /* Wait for LED cool down */
-        if (!sensor_gain_calibration_cooldown(callback, user_data)) {
+        sensor_gain_calibration_phase(8,
+            gaincal_thermal_cooldown_ms(&gain_cal_thermal, osKernelGetTickCount(), GAINCAL_THERMAL_PHASE_LIMIT));
+        if (!sensor_gain_calibration_cooldown(GAINCAL_THERMAL_PHASE_LIMIT, callback, user_data)) {
             ret = osError;
             break;
         }
 
         /* Calibrate the value for maximum gain */
         log_i("Maximum gain calibration");
+        sensor_gain_calibration_phase(9, 0);
         ret = sensor_gain_calibration_loop(
             TSL2591_GAIN_HIGH, TSL2591_GAIN_MAXIMUM, TSL2591_TIME_200MS,
             max_gain_led_brightness, &gain_max_ch0, &gain_max_ch1,
@@ -205,6 +351,8 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
     /* Turn off the lights */
     sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
 
+    log_i("Gain calibration time: %lums", osKernelGetTickCount() - start_ticks);
+
     if (ret == osOK) {
         log_i("Gain calibration complete");
 
@@ -238,7 +386,6 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
     return ret;
 }
 
-#ifdef TEST_LIGHT_CAL
 osStatus_t sensor_light_calibration(sensor_light_t light_source, sensor_light_calibration_callback_t callback, void *user_data)
 {
     osStatus_t ret = osOK;
@@ -261,12 +408,16 @@ osStatus_t sensor_light_calibration(sensor_light_t light_source, sensor_light_ca
     double slope = 0.0;
     double intercept = 0.0;
     double drop_factor = 0.0;
+    uint8_t light_value;
 
     /* Parameter validation */
     if (light_source != SENSOR_LIGHT_REFLECTION && light_source != SENSOR_LIGHT_TRANSMISSION) {
         return osErrorParameter;
     }
 
+    /* Calibrate at the brightness used for target measurements */
+    light_value = sensor_get_read_brightness(light_source);
+
     log_i("Starting LED brightness calibration");
 
     do {
@@ -287,15 +438,19 @@ osStatus_t sensor_light_calibration(sensor_light_t light_source, sensor_light_ca
         ret = sensor_get_next_reading(&reading, 2000);
         if (ret != osOK) { break; }
 
-        /* Set LED to full brightness at the next cycle */
-        ret = sensor_set_light_mode(light_source, /*next_cycle*/true, 128);
+        /* Set LED to measurement brightness at the next cycle */
+        ret = sensor_set_light_mode(light_source, /*next_cycle*/true, light_value);
         if (ret != osOK) { break; }
 
         /* Wait for another cycle which will trigger the LED on */
         ret = sensor_get_next_reading(&reading, 2000);
         if (ret != osOK) { break; }
 
-        ticks_start = reading.reading_ticks;
+        /*
+         * Measure time from the point the LED was turned on, the same way
+         * the drift compensation does for target readings.
+         */
+        ticks_start = reading.light_ticks;
 
         if (callback) {
             if (!callback(0, user_data)) { ret = osError; break; }
@@ -362,14 +517,26 @@ osStatus_t sensor_light_calibration(sensor_light_t light_source, sensor_light_ca
     log_d("Intercept = %f", intercept);
     log_d("Drop factor = %f", drop_factor);
 
-    /*
-     * Correction formula is:
-     * ch_val - (ch_val * (drop_factor * log(elapsed_ticks)))
-     */
+    if (drop_factor < -SETTING_CAL_DRIFT_LIMIT) {
+        log_e("Drop factor out of range");
+        return osError;
+    }
+
+    /* Save the drop factor for the calibrated light source */
+    settings_cal_drift_t cal_drift;
+    settings_get_cal_drift(&cal_drift);
+    if (light_source == SENSOR_LIGHT_REFLECTION) {
+        cal_drift.reflection = (float)drop_factor;
+    } else {
+        cal_drift.transmission = (float)drop_factor;
+    }
+    if (!settings_set_cal_drift(&cal_drift)) {
+        log_e("Unable to save drop factor");
+        return osError;
+    }
 
-    return os_to_hal_status(ret);
+    return ret;
 }
-#endif
 
 osStatus_t sensor_read_target(sensor_light_t light_source,
     float *ch0_result, float *ch1_result,
@@ -379,10 +546,21 @@ osStatus_t sensor_read_target(sensor_light_t light_source,
     uint8_t light_value = 0;
     sensor_reading_t reading;
     tsl2591_gain_t target_read_gain;
-    float ch0_sum = 0;
-    float ch1_sum = 0;
+    tsl2591_time_t target_read_time;
+    uint32_t expected_count;
+    settings_user_sampling_t sampling;
+    uint8_t min_count;
+    uint8_t max_count;
+    uint8_t count = 0;
+    float ch0_samples[SENSOR_TARGET_READ_MAX_SAMPLES];
+    float ch1_samples[SENSOR_TARGET_READ_MAX_SAMPLES];
+    float ch0_mean = 0;
+    float ch1_mean = 0;
+    float ch0_m2 = 0;
     float ch0_avg = NAN;
     float ch1_avg = NAN;
+    sensor_read_stats_t stats = {0};
+    uint32_t start_cycles;
 
     if (light_source != SENSOR_LIGHT_REFLECTION && light_source != SENSOR_LIGHT_TRANSMISSION) {
         return osErrorParameter;
@@ -390,54 +568,110 @@ osStatus_t sensor_read_target(sensor_light_t light_source,
 
     light_value = sensor_get_read_brightness(light_source);
 
+    settings_get_user_sampling(&sampling);
+    min_count = sampling.count;
+    if (sampling.reject != SETTING_SAMPLING_REJECT_NONE) {
+        /* An outlier cannot be picked out of fewer readings than this */
+        min_count = MAX(min_count, SENSOR_REJECT_MIN_SAMPLES);
+    }
+    max_count = MIN(min_count + SENSOR_TARGET_READ_EXTRA_ITERATIONS, SENSOR_TARGET_READ_MAX_SAMPLES);
+
     log_i("Starting sensor target read (light=%d)", light_value);
 
-    do {
-        /* Put the sensor and light into a known initial state, with maximum gain */
-        ret = sensor_set_config(TSL2591_GAIN_MAXIMUM, TSL2591_TIME_100MS);
-        if (ret != osOK) { break; }
+    start_cycles = cycle_count_get();
 
-        /* Activate light source synchronized with sensor cycle */
-        ret = sensor_set_light_mode(light_source, /*next_cycle*/true, light_value);
-        if (ret != osOK) { break; }
+    do {
+        if (sensor_warm_active && sensor_is_running()) {
+            /* The sensor is still running from the last read, so just switch the light on */
+            stats.warm_start = true;
+            ret = sensor_warm_probe(light_source, light_value, &reading, &stats);
+            if (ret != osOK) { break; }
+        } else {
+            sensor_warm_active = false;
+
+            /*
+             * Put the sensor into a known initial state with maximum gain,
+             * activate the light source synchronized with the sensor cycle,
+             * and start the sensor, all in a single request.
+             */
+            sensor_op_t start_ops[] = {
+                { .type = SENSOR_OP_SET_CONFIG, .config = { TSL2591_GAIN_MAXIMUM, TSL2591_TIME_100MS } },
+                { .type = SENSOR_OP_SET_LIGHT_MODE, .light_mode = { light_source, /*next_cycle*/true, light_value } },
+                { .type = SENSOR_OP_START }
+            };
+            ret = sensor_control_batch(start_ops, 3);
+            if (ret != osOK) { break; }
 
-        /* Start the sensor */
-        ret = sensor_start();
-        if (ret != osOK) { break; }
+            /* Starting the sensor causes its first cycle to be discarded */
+            stats.discarded_cycles++;
 
-        /* Do initial read to detect gain */
-        ret = sensor_get_next_reading(&reading, 1000);
-        if (ret != osOK) { break; }
-        log_v("TSL2591[%d]: CH0=%d, CH1=%d", reading.reading_count, reading.ch0_val, reading.ch1_val);
+            /* Do initial read to detect gain */
+            ret = sensor_get_next_reading(&reading, 1000);
+            if (ret != osOK) { break; }
+            log_v("TSL2591[%d]: CH0=%d, CH1=%d", reading.reading_count, reading.ch0_val, reading.ch1_val);
+            stats.probe_cycles++;
+        }
 
         /* Invoke the progress callback */
         if (callback) { callback(user_data); }
 
         /*
-         * Pick target gain based on previous result.
-         * Since the measurement integration time will be approximately
-         * double the initialization integration time, this detection
-         * needs to be at a point slightly less than half the saturation
-         * point for measurement readings.
-         * The regular saturation detection won't work here, because
-         * the 100ms saturation point is slightly greater than half-way.
+         * If the probe saturated, then it can't be used to predict anything.
+         * Step the gain down and probe again until it no longer saturates.
          */
-        if (reading.ch0_val > 32700 || reading.ch1_val > 32700) {
-            target_read_gain = TSL2591_GAIN_HIGH;
+        while (sensor_is_reading_saturated(&reading) && reading.gain > TSL2591_GAIN_LOW) {
+            ret = sensor_set_config(reading.gain - 1, TSL2591_TIME_100MS);
+            if (ret != osOK) { break; }
+            stats.discarded_cycles++;
+
+            ret = sensor_get_next_reading(&reading, 1000);
+            if (ret != osOK) { break; }
+            log_v("TSL2591[%d]: CH0=%d, CH1=%d", reading.reading_count, reading.ch0_val, reading.ch1_val);
+            stats.probe_cycles++;
+
+            if (callback) { callback(user_data); }
+        }
+        if (ret != osOK) { break; }
+
+        if (sensor_is_reading_saturated(&reading)) {
+            log_e("Unexpected sensor saturation");
+            ret = osError;
+            break;
+        }
+
+        /* Pick the target gain and integration time based on the probe result */
+        sensor_predict_target_config(&reading, &target_read_gain, &target_read_time);
+        log_d("Target read config: gain=%d, time=%d", target_read_gain, target_read_time);
+
+        /*
+         * Switch to the target read gain and integration time, if different.
+         * Changing the configuration causes the next cycle to be discarded.
+         */
+        if (target_read_gain != reading.gain || target_read_time != reading.time) {
+            ret = sensor_set_config(target_read_gain, target_read_time);
+            if (ret != osOK) { break; }
+            expected_count = reading.reading_count + 2;
+            stats.discarded_cycles++;
         } else {
-            target_read_gain = TSL2591_GAIN_MAXIMUM;
+            expected_count = reading.reading_count + 1;
         }
+        stats.gain = target_read_gain;
+        stats.time = target_read_time;
 
-        /* Switch to the target read gain and integration time */
-        ret = sensor_set_config(target_read_gain, TSL2591_TIME_200MS);
-        if (ret != osOK) { break; }
+        uint32_t ranging_end_cycles = cycle_count_get();
+        stats.ranging_us = cycle_count_to_us(ranging_end_cycles - start_cycles);
+        start_cycles = ranging_end_cycles;
 
-        /* Take the actual target measurement readings */
-        for (int i = 0; i < SENSOR_TARGET_READ_ITERATIONS; i++) {
+        /*
+         * Take the actual target measurement readings, keeping a running
+         * mean and variance, until at least the configured number of
+         * readings have been taken and the mean has converged.
+         */
+        for (count = 0; count < max_count; ) {
             float ch0_basic = 0;
             float ch1_basic = 0;
 
-            ret = sensor_get_next_reading(&reading, 500);
+            ret = sensor_get_next_reading(&reading, 1000);
             if (ret != osOK) { break; }
             log_v("TSL2591[%d]: CH0=%d, CH1=%d", reading.reading_count, reading.ch0_val, reading.ch1_val);
 
@@ -445,7 +679,7 @@ osStatus_t sensor_read_target(sensor_light_t light_source,
             if (callback) { callback(user_data); }
 
             /* Make sure we're consistent with our read cycles */
-            if (reading.reading_count != i + 4) {
+            if (reading.reading_count != expected_count + count) {
                 log_e("Unexpected read cycle count: %d", reading.reading_count);
                 ret = osError;
                 break;
@@ -458,19 +692,84 @@ osStatus_t sensor_read_target(sensor_light_t light_source,
                 break;
             }
 
+            uint32_t conversion_cycles = cycle_count_get();
             sensor_convert_to_basic_counts(&reading, &ch0_basic, &ch1_basic);
-            ch0_sum += ch0_basic;
-            ch1_sum += ch1_basic;
+            sensor_apply_drift_compensation(light_source, &reading, &ch0_basic, &ch1_basic);
+            stats.conversion_us += cycle_count_to_us(cycle_count_get() - conversion_cycles);
+
+            ch0_samples[count] = ch0_basic;
+            ch1_samples[count] = ch1_basic;
+
+            count++;
+            float ch0_delta = ch0_basic - ch0_mean;
+            ch0_mean += ch0_delta / (float)count;
+            ch0_m2 += ch0_delta * (ch0_basic - ch0_mean);
+
+            if (count >= min_count) {
+                float ch0_sem = sqrtf(ch0_m2 / (float)((count - 1) * count));
+                if (ch0_sem <= ch0_mean * SENSOR_TARGET_READ_CONVERGENCE) {
+                    break;
+                }
+            }
         }
         if (ret != osOK) { break; }
+        stats.read_cycles = count;
+
+        /* Drop any outlying readings, then recalculate the final statistics */
+        uint8_t kept = sensor_reject_outliers(ch0_samples, ch1_samples, count, sampling.reject);
+
+        ch0_mean = 0;
+        ch0_m2 = 0;
+        for (uint8_t i = 0; i < kept; i++) {
+            float ch0_delta = ch0_samples[i] - ch0_mean;
+            ch0_mean += ch0_delta / (float)(i + 1);
+            ch0_m2 += ch0_delta * (ch0_samples[i] - ch0_mean);
+            ch1_mean += (ch1_samples[i] - ch1_mean) / (float)(i + 1);
+        }
 
-        ch0_avg = (ch0_sum / (float)SENSOR_TARGET_READ_ITERATIONS);
-        ch1_avg = (ch1_sum / (float)SENSOR_TARGET_READ_ITERATIONS);
+        stats.sample_count = kept;
+        stats.rejected_count = count - kept;
+        stats.ch0_stddev = (kept > 1) ? sqrtf(ch0_m2 / (float)(kept - 1)) : 0.0F;
+        stats.noisy = (kept < 2)
+            || (stats.ch0_stddev / sqrtf((float)kept)) > (ch0_mean * SENSOR_TARGET_READ_CONVERGENCE);
+
+        if (stats.noisy) {
+            log_w("Target read did not converge: n=%d, rejected=%d, stddev=%f",
+                kept, stats.rejected_count, stats.ch0_stddev);
+        } else {
+            log_d("Target read converged: n=%d, rejected=%d, stddev=%f",
+                kept, stats.rejected_count, stats.ch0_stddev);
+        }
+        ch0_avg = ch0_mean;
+        ch1_avg = ch1_mean;
+
+        stats.reading_us = cycle_count_to_us(cycle_count_get() - start_cycles);
     } while (0);
 
-    /* Turn off the sensor */
-    sensor_stop();
-    sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+    /*
+     * Turn off the light, then either leave the sensor running for the
+     * next read or turn it off. When left running, the sensor only wakes
+     * up for significant changes in the idle reading while waiting for
+     * the next read, instead of on every integration cycle.
+     * This is submitted without waiting, so it can overlap with the
+     * remaining bookkeeping below.
+     */
+    sensor_op_t stop_ops[] = {
+        { .type = SENSOR_OP_SET_LIGHT_MODE, .light_mode = { SENSOR_LIGHT_OFF, false, 0 } },
+        { .type = SENSOR_OP_STOP }
+    };
+    if (sensor_warm_mode && ret == osOK) {
+        sensor_warm_active = true;
+        stop_ops[1].type = SENSOR_OP_SET_THRESHOLD_MODE;
+        stop_ops[1].threshold.enabled = true;
+        stop_ops[1].threshold.margin_percent = SENSOR_WARM_THRESHOLD_MARGIN;
+    } else {
+        sensor_warm_active = false;
+    }
+    osThreadFlagsClear(SENSOR_BATCH_THREAD_FLAG);
+    osStatus_t stop_ret = sensor_control_batch_async(stop_ops, 2, SENSOR_BATCH_THREAD_FLAG);
+
+    memcpy(&sensor_last_read_stats, &stats, sizeof(sensor_read_stats_t));
 
     if (ret == osOK) {
         log_i("Sensor read complete");
@@ -482,9 +781,257 @@ osStatus_t sensor_read_target(sensor_light_t light_source,
             ret = osError;
         }
     }
+
+    /* Wait for the sensor shutdown to finish, so the next caller finds it in a known state */
+    if (stop_ret == osOK) {
+        osThreadFlagsWait(SENSOR_BATCH_THREAD_FLAG, osFlagsWaitAny, osWaitForever);
+        if (stop_ops[1].result != osOK) {
+            log_w("Sensor shutdown failed: %d", stop_ops[1].result);
+        }
+    } else {
+        sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+        sensor_stop();
+        sensor_warm_active = false;
+    }
+    return ret;
+}
+
+/**
+ * Take the probe reading for a target read, with the sensor already running.
+ *
+ * The probe keeps the gain and integration time from the previous target
+ * read, which is usually close to what the next target needs, so the
+ * sensor is not reconfigured and no cycle is discarded. It only has to be
+ * taken out of the threshold mode it was left in by the previous read.
+ * Any readings taken before the light source was turned on, and the
+ * partial cycle in which it was turned on, are skipped.
+ */
+osStatus_t sensor_warm_probe(sensor_light_t light_source, uint8_t light_value,
+    sensor_reading_t *reading, sensor_read_stats_t *stats)
+{
+    osStatus_t ret = osOK;
+
+    do {
+        /* Return to per-cycle readings, and activate light source synchronized with sensor cycle */
+        const uint32_t light_request_ticks = osKernelGetTickCount();
+        sensor_op_t probe_ops[] = {
+            { .type = SENSOR_OP_SET_THRESHOLD_MODE, .threshold = { .enabled = false } },
+            { .type = SENSOR_OP_SET_LIGHT_MODE, .light_mode = { light_source, /*next_cycle*/true, light_value } }
+        };
+        ret = sensor_control_batch(probe_ops, 2);
+        if (ret != osOK) { break; }
+
+        /* Drop anything that accumulated while the sensor was idle */
+        sensor_reader_flush(SENSOR_READER_MEASUREMENT);
+
+        /*
+         * The light change is applied by the same interrupt that finishes
+         * an integration cycle, so the reading from that cycle has matching
+         * light and reading tick values. The first reading taken entirely
+         * with the light on is the one that follows it.
+         */
+        for (;;) {
+            ret = sensor_get_next_reading(reading, 1000);
+            if (ret != osOK) { break; }
+            log_v("TSL2591[%d]: CH0=%d, CH1=%d", reading->reading_count, reading->ch0_val, reading->ch1_val);
+
+            if ((int32_t)(reading->light_ticks - light_request_ticks) >= 0
+                && reading->reading_ticks != reading->light_ticks) {
+                break;
+            }
+            stats->discarded_cycles++;
+        }
+        if (ret != osOK) { break; }
+
+        stats->probe_cycles++;
+    } while (0);
+
     return ret;
 }
 
+void sensor_set_warm_mode(bool enabled)
+{
+    if (sensor_warm_mode == enabled) { return; }
+    log_d("Sensor warm mode: %d", enabled);
+
+    sensor_warm_mode = enabled;
+    if (!enabled && sensor_warm_active) {
+        sensor_warm_active = false;
+        if (sensor_is_running()) {
+            sensor_stop();
+        }
+    }
+}
+
+void sensor_get_last_read_stats(sensor_read_stats_t *stats)
+{
+    if (!stats) { return; }
+    memcpy(stats, &sensor_last_read_stats, sizeof(sensor_read_stats_t));
+}
+
+/**
+ * Remove outlying readings from a set of target read samples.
+ *
+ * Rejection is based on the channel 0 values, and the matching channel 1
+ * values are removed along with them. The remaining samples are packed
+ * at the start of the arrays, in their original order.
+ *
+ * @return Number of samples remaining
+ */
+uint8_t sensor_reject_outliers(float *ch0_samples, float *ch1_samples, uint8_t count,
+    setting_sampling_reject_t reject)
+{
+    float center;
+    float limit;
+
+    if (count < SENSOR_REJECT_MIN_SAMPLES) {
+        return count;
+    }
+
+    if (reject == SETTING_SAMPLING_REJECT_SIGMA) {
+        return sensor_reject_outliers_sigma(ch0_samples, ch1_samples, count);
+    } else if (reject == SETTING_SAMPLING_REJECT_MEDIAN) {
+        /* Reject readings too far from the median, in median absolute deviations */
+        float scratch[SENSOR_TARGET_READ_MAX_SAMPLES];
+        memcpy(scratch, ch0_samples, sizeof(float) * count);
+        center = sensor_sort_median(scratch, count);
+
+        for (uint8_t i = 0; i < count; i++) {
+            scratch[i] = fabsf(ch0_samples[i] - center);
+        }
+        limit = SENSOR_REJECT_MAD_LIMIT * SENSOR_REJECT_MAD_SCALE * sensor_sort_median(scratch, count);
+    } else {
+        return count;
+    }
+
+    /* A zero spread means the readings are all effectively identical */
+    if (!(limit > 0.0F)) {
+        return count;
+    }
+
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (fabsf(ch0_samples[i] - center) <= limit) {
+            ch0_samples[kept] = ch0_samples[i];
+            ch1_samples[kept] = ch1_samples[i];
+            kept++;
+        } else {
+            log_d("Rejecting reading: %f", ch0_samples[i]);
+        }
+    }
+    return kept;
+}
+
+/**
+ * Remove readings that are too far from the mean of the other readings.
+ *
+ * Each reading is compared against the mean and standard deviation of
+ * all the other readings, so that an outlier cannot inflate the spread
+ * it is being measured against. With only a few readings, the standard
+ * deviation of all of them can never get far enough from any one reading
+ * for it to be rejected.
+ *
+ * @return Number of samples remaining
+ */
+uint8_t sensor_reject_outliers_sigma(float *ch0_samples, float *ch1_samples, uint8_t count)
+{
+    bool reject[SENSOR_TARGET_READ_MAX_SAMPLES] = {0};
+    const float limit = sensor_reject_sigma_limit[count - 2];
+
+    for (uint8_t i = 0; i < count; i++) {
+        float mean = 0;
+        float m2 = 0;
+        uint8_t n = 0;
+        for (uint8_t j = 0; j < count; j++) {
+            if (j == i) { continue; }
+            n++;
+            float delta = ch0_samples[j] - mean;
+            mean += delta / (float)n;
+            m2 += delta * (ch0_samples[j] - mean);
+        }
+
+        /* Spread of the difference between a new reading and the mean of the others */
+        const float spread = sqrtf(m2 / (float)(n - 1)) * sqrtf(1.0F + 1.0F / (float)n);
+        if (spread > 0.0F) {
+            reject[i] = fabsf(ch0_samples[i] - mean) > limit * spread;
+        }
+    }
+
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (!reject[i]) {
+            ch0_samples[kept] = ch0_samples[i];
+            ch1_samples[kept] = ch1_samples[i];
+            kept++;
+        } else {
+            log_d("Rejecting reading: %f", ch0_samples[i]);
+        }
+    }
+    return kept;
+}
+
+/**
+ * Sort a small array of values in place, and return its median.
+ */
+float sensor_sort_median(float *values, uint8_t count)
+{
+    for (uint8_t i = 1; i < count; i++) {
+        float value = values[i];
+        uint8_t j = i;
+        while (j > 0 && values[j - 1] > value) {
+            values[j] = values[j - 1];
+            j--;
+        }
+        values[j] = value;
+    }
+
+    if (count & 1) {
+        return values[count / 2];
+    } else {
+        return (values[(count / 2) - 1] + values[count / 2]) / 2.0F;
+    }
+}
+
+/**
+ * Choose the sensor settings for a target measurement.
+ *
+ * The counts from the probe reading are scaled by the calibrated gain
+ * ratios and the integration time ratio to predict the counts at every
+ * gain at the target read integration time. The highest gain that stays
+ * safely clear of saturation is chosen, or the lowest gain if none do.
+ *
+ * @param probe Unsaturated reading to make predictions from
+ * @param target_gain Chosen sensor gain
+ * @param target_time Chosen sensor integration time
+ */
+void sensor_predict_target_config(const sensor_reading_t *probe,
+    tsl2591_gain_t *target_gain, tsl2591_time_t *target_time)
+{
+    const tsl2591_time_t time = SENSOR_TARGET_READ_TIME;
+    const float limit = SENSOR_TARGET_HEADROOM * (float)((time == TSL2591_TIME_100MS)
+        ? TSL2591_ANALOG_SATURATION : TSL2591_DIGITAL_SATURATION);
+    float ch0_basic;
+    float ch1_basic;
+
+    *target_gain = TSL2591_GAIN_LOW;
+    *target_time = time;
+
+    sensor_convert_to_basic_counts(probe, &ch0_basic, &ch1_basic);
+
+    vTaskSuspendAll();
+    const sensor_cal_context_t *context = sensor_get_cal_context();
+
+    for (int gain = TSL2591_GAIN_MAXIMUM; gain >= TSL2591_GAIN_LOW; gain--) {
+        const float ch0_count = ch0_basic / context->ch0_cpl_inv[gain][time];
+        const float ch1_count = ch1_basic / context->ch1_cpl_inv[gain][time];
+        if (ch0_count < limit && ch1_count < limit) {
+            *target_gain = gain;
+            break;
+        }
+    }
+    xTaskResumeAll();
+}
+
 osStatus_t sensor_read_target_raw(sensor_light_t light_source,
     tsl2591_gain_t gain, tsl2591_time_t time,
     uint16_t *ch0_result, uint16_t *ch1_result)
@@ -515,16 +1062,16 @@ osStatus_t sensor_read_target_raw(sensor_light_t light_source,
     log_i("Starting sensor raw target read (light=%d)", light_value);
 
     do {
-        /* Put the sensor into the configured state */
-        ret = sensor_set_config(gain, time);
-        if (ret != osOK) { break; }
-
-        /* Activate light source synchronized with sensor cycle */
-        ret = sensor_set_light_mode(light_source, /*next_cycle*/true, light_value);
-        if (ret != osOK) { break; }
-
-        /* Start the sensor */
-        ret = sensor_start();
+        /*
+         * Put the sensor into the configured state, activate the light
+         * source synchronized with the sensor cycle, and start the sensor.
+         */
+        sensor_op_t start_ops[] = {
+            { .type = SENSOR_OP_SET_CONFIG, .config = { gain, time } },
+            { .type = SENSOR_OP_SET_LIGHT_MODE, .light_mode = { light_source, /*next_cycle*/true, light_value } },
+            { .type = SENSOR_OP_START }
+        };
+        ret = sensor_control_batch(start_ops, 3);
         if (ret != osOK) { break; }
 
         /* Take the target measurement readings */
@@ -557,9 +1104,12 @@ osStatus_t sensor_read_target_raw(sensor_light_t light_source,
         ch1_avg = (ch1_sum / (float)SENSOR_TARGET_READ_ITERATIONS);
     } while (0);
 
-    /* Turn off the sensor */
-    sensor_stop();
-    sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+    /* Turn off the light and the sensor */
+    sensor_op_t stop_ops[] = {
+        { .type = SENSOR_OP_SET_LIGHT_MODE, .light_mode = { SENSOR_LIGHT_OFF, false, 0 } },
+        { .type = SENSOR_OP_STOP }
+    };
+    sensor_control_batch(stop_ops, 2);
 
     if (ret == osOK) {
         log_i("Sensor read complete");
@@ -580,61 +1130,52 @@ osStatus_t sensor_read_target_raw(sensor_light_t light_source,
 }
 
 /**
- * Sensor read loop used for internal calibration purposes.
- *
- * Assumes the sensor is already running and configured, and returns the
- * geometric mean of a series of raw sensor readings.
- * No corrections are performed, so the results from this function should
- * only be compared to results from a similar run under the same conditions.
- *
- * @param count Number of values to average
- * @param ch0_avg Average reading of Channel 0
- * @param ch1_avg Average reading of Channel 1
+ * Run a sensor program, waiting long enough for all of its steps to finish.
  */
-osStatus_t sensor_raw_read_loop(uint8_t count, float *ch0_avg, float *ch1_avg)
+osStatus_t sensor_run_program_wait(const sensor_program_step_t *steps, uint8_t step_count,
+    sensor_program_result_t *results)
 {
-    osStatus_t ret = osOK;
-    sensor_reading_t reading;
-    float ch0_sum = 0;
-    float ch1_sum = 0;
-    bool saturation = false;
-
-    if (count == 0) {
-        return osErrorParameter;
+    /* Allow for the current cycle, and a settings change on every step */
+    uint32_t timeout = 1000;
+    for (uint8_t i = 0; i < step_count; i++) {
+        timeout += (uint32_t)tsl2591_get_time_value_ms(steps[i].time)
+            * (steps[i].settle_cycles + steps[i].read_cycles + 2);
     }
 
-    /* Loop over measurements */
-    for (uint8_t i = 0; i < count; i++) {
-        /* Wait for the next reading */
-        ret = sensor_get_next_reading(&reading, 2000);
-        if (ret != osOK) {
-            log_e("sensor_get_next_reading error: %d", ret);
-            break;
-        }
-
-        /* Accumulate the results */
-        log_v("TSL2591[%d]: CH0=%d, CH1=%d", i, reading.ch0_val, reading.ch1_val);
-        if (sensor_is_reading_saturated(&reading)) {
-            log_w("Sensor value indicates saturation");
-            saturation = true;
-            break;
-        }
-        ch0_sum += logf(reading.ch0_val);
-        ch1_sum += logf(reading.ch1_val);
+    osStatus_t ret = sensor_run_program(steps, step_count, results, timeout);
+    if (ret != osOK) {
+        log_e("sensor_run_program error: %d", ret);
     }
+    return ret;
+}
 
-    if (ret == osOK) {
-        if (ch0_avg) {
-            *ch0_avg = saturation ? NAN : expf(ch0_sum / (float)count);
-        }
-        if (ch1_avg) {
-            *ch1_avg = saturation ? NAN : expf(ch1_sum / (float)count);
-        }
+/**
+ * Get the geometric mean of the readings collected by a sensor program step.
+ *
+ * Results are set to NAN if any of the readings were saturated.
+ * No corrections are performed, so these results should only be compared
+ * to results from a similar run under the same conditions.
+ */
+void sensor_program_result_average(const sensor_program_result_t *result, float *ch0_avg, float *ch1_avg)
+{
+    float ch0_result;
+    float ch1_result;
+
+    if (result->saturated) {
+        log_w("Sensor value indicates saturation");
+        ch0_result = NAN;
+        ch1_result = NAN;
+    } else if (result->count == 0) {
+        log_w("No readings collected");
+        ch0_result = NAN;
+        ch1_result = NAN;
     } else {
-        log_e("Sensor error during read loop: %d", ret);
+        ch0_result = result->ch0_zero ? 0.0F : fixmath_exp2_q16(result->ch0_log2_sum / result->count);
+        ch1_result = result->ch1_zero ? 0.0F : fixmath_exp2_q16(result->ch1_log2_sum / result->count);
     }
 
-    return ret;
+    if (ch0_avg) { *ch0_avg = ch0_result; }
+    if (ch1_avg) { *ch1_avg = ch1_result; }
 }
 
 /**
@@ -655,7 +1196,7 @@ osStatus_t sensor_gain_calibration_loop(
     sensor_gain_calibration_callback_t callback, void *user_data)
 {
     osStatus_t ret = osOK;
-    sensor_reading_t discard_reading;
+    sensor_program_result_t results[2];
     float ch0_avg_high;
     float ch1_avg_high;
     float ch0_avg_low;
@@ -665,62 +1206,59 @@ osStatus_t sensor_gain_calibration_loop(
         return osErrorParameter;
     }
 
+    /*
+     * Each half of the measurement switches to the new sensor settings
+     * with the LED off, then turns the LED on at the following cycle
+     * boundary and collects the readings.
+     */
+    sensor_program_step_t steps[2] = {
+        {
+            .light = SENSOR_LIGHT_OFF,
+            .gain = gain_high,
+            .time = time
+        },
+        {
+            .light = SENSOR_LIGHT_TRANSMISSION,
+            .light_value = led_brightness,
+            .gain = gain_high,
+            .time = time,
+            .read_cycles = SENSOR_GAIN_CAL_READ_ITERATIONS
+        }
+    };
+    const uint32_t led_on_ms = SENSOR_GAIN_CAL_READ_ITERATIONS * tsl2591_get_time_value_ms(time);
+
     do {
         if (!gain_status_callback(callback, callback_status, 0, user_data)) { ret = osError; break; }
 
-        /* Setup for high gain measurement */
-        ret = sensor_set_config(gain_high, time);
-        if (ret != osOK) { break; }
-
-        /* Wait for the first reading at the new settings to come through */
-        ret = sensor_get_next_reading(&discard_reading, 2000);
-        if (ret != osOK) { break; }
-
-        /* Set the LED to target brightness on the next cycle */
-        sensor_set_light_mode(SENSOR_LIGHT_TRANSMISSION, /*next_cycle*/true, led_brightness);
-
-        /* Wait for the next cycle which will turn the LED on */
-        ret = sensor_get_next_reading(&discard_reading, 2000);
-        if (ret != osOK) { break; }
-
         /* Do the high gain read loop */
         log_d("Higher gain loop...");
-        ret = sensor_raw_read_loop(SENSOR_GAIN_CAL_READ_ITERATIONS, &ch0_avg_high, &ch1_avg_high);
+        ret = sensor_run_program_wait(steps, 2, results);
         if (ret != osOK) { break; }
+        sensor_program_result_average(&results[1], &ch0_avg_high, &ch1_avg_high);
 
         log_d("TSL2591[Higher]: CH0=%d, CH1=%d", lroundf(ch0_avg_high), lroundf(ch1_avg_high));
 
         /* Turn off the LED and wait for it to cool down */
         sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
-        if (!sensor_gain_calibration_cooldown(callback, user_data)) {
+        gaincal_thermal_add(&gain_cal_thermal, osKernelGetTickCount(), led_brightness, led_on_ms);
+        if (!sensor_gain_calibration_cooldown(GAINCAL_THERMAL_PHASE_LIMIT, callback, user_data)) {
             ret = osError;
             break;
         }
 
         if (!gain_status_callback(callback, callback_status, 1, user_data)) { ret = osError; break; }
 
-        /* Setup for low gain measurement */
-        ret = sensor_set_config(gain_low, time);
-        if (ret != osOK) { break; }
-
-        /* Wait for the first reading at the new settings to come through */
-        ret = sensor_get_next_reading(&discard_reading, 2000);
-        if (ret != osOK) { break; }
-
-        /* Set the LED to target brightness on the next cycle */
-        sensor_set_light_mode(SENSOR_LIGHT_TRANSMISSION, /*next_cycle*/true, led_brightness);
-
-        /* Wait for the next cycle which will turn the LED on */
-        ret = sensor_get_next_reading(&discard_reading, 2000);
-        if (ret != osOK) { break; }
-
         /* Do the low gain read loop */
         log_d("Lower gain loop...");
-        ret = sensor_raw_read_loop(SENSOR_GAIN_CAL_READ_ITERATIONS, &ch0_avg_low, &ch1_avg_low);
+        steps[0].gain = gain_low;
+        steps[1].gain = gain_low;
+        ret = sensor_run_program_wait(steps, 2, results);
         if (ret != osOK) { break; }
+        sensor_program_result_average(&results[1], &ch0_avg_low, &ch1_avg_low);
 
         /* Turn off the LED */
         sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+        gaincal_thermal_add(&gain_cal_thermal, osKernelGetTickCount(), led_brightness, led_on_ms);
 
         log_d("TSL2591[Lower]: CH0=%d, CH1=%d", lroundf(ch0_avg_low), lroundf(ch1_avg_low));
     } while (0);
@@ -745,40 +1283,110 @@ osStatus_t sensor_gain_calibration_loop(
     return ret;
 }
 
-bool sensor_gain_calibration_cooldown(sensor_gain_calibration_callback_t callback, void *user_data)
+/**
+ * Wait for the LED to cool down, based on its recent on-time.
+ *
+ * @param limit Thermal load at which the LED is considered cool enough
+ */
+bool sensor_gain_calibration_cooldown(float limit, sensor_gain_calibration_callback_t callback, void *user_data)
 {
-    log_i("Waiting for cool down");
-    for (int i = 0; i < 5; i++) {
+    uint32_t remaining_ms = gaincal_thermal_cooldown_ms(&gain_cal_thermal, osKernelGetTickCount(), limit);
+    int i = 0;
+
+    log_i("Waiting for cool down: %lums", remaining_ms);
+    do {
         if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_COOLDOWN, i, user_data)) { return false; }
 
-        osDelay(1000);
-    }
+        const uint32_t delay_ms = (remaining_ms > 1000) ? 1000 : remaining_ms;
+        if (delay_ms > 0) {
+            osDelay(delay_ms);
+        }
+        remaining_ms -= delay_ms;
+        i++;
+    } while (remaining_ms > 0);
     return true;
 }
 
+/**
+ * Mark the start of a gain calibration phase.
+ *
+ * @param phase Index of the phase being started
+ * @param estimate_ms Updated estimate for the phase duration, or 0 to keep the initial estimate
+ */
+void sensor_gain_calibration_phase(uint8_t phase, uint32_t estimate_ms)
+{
+    if (phase >= GAIN_CAL_PHASE_COUNT) { return; }
+    gain_cal_phase = phase;
+    gain_cal_phase_ticks = osKernelGetTickCount();
+    if (estimate_ms > 0) {
+        gain_cal_phase_ms[phase] = estimate_ms;
+    }
+}
+
+/**
+ * Estimate the time remaining in the gain calibration process.
+ *
+ * This is the remaining estimate for the current phase, plus the
+ * estimates for all the phases that follow it.
+ */
+uint32_t sensor_gain_calibration_remaining_ms()
+{
+    uint32_t remaining_ms = 0;
+    const uint32_t elapsed_ms = osKernelGetTickCount() - gain_cal_phase_ticks;
+
+    if (gain_cal_phase_ms[gain_cal_phase] > elapsed_ms) {
+        remaining_ms += gain_cal_phase_ms[gain_cal_phase] - elapsed_ms;
+    }
+    for (uint8_t i = gain_cal_phase + 1; i < GAIN_CAL_PHASE_COUNT; i++) {
+        remaining_ms += gain_cal_phase_ms[i];
+    }
+    return remaining_ms;
+}
+
 bool gain_status_callback(
     sensor_gain_calibration_callback_t callback,
     sensor_gain_calibration_status_t status, int param,
     void *user_data)
 {
     if (callback) {
-        return callback(status, param, user_data);
+        uint32_t remaining_ms;
+        if (status == SENSOR_GAIN_CALIBRATION_STATUS_DONE || status == SENSOR_GAIN_CALIBRATION_STATUS_FAILED) {
+            remaining_ms = 0;
+        } else {
+            remaining_ms = sensor_gain_calibration_remaining_ms();
+        }
+        return callback(status, param, remaining_ms, user_data);
     } else {
         return true;
     }
 }
 
+typedef struct {
+    sensor_program_step_t steps[2];
+    uint16_t time_ms;
+    osStatus_t ret;
+    sensor_gain_calibration_callback_t callback;
+    void *user_data;
+} sensor_find_gain_brightness_context_t;
+
 /**
  * Find the ideal LED brightness for measuring gain at a particular gain setting.
  *
- * This routine counts upward and is intended to select a brightness near
- * the bottom of the brightness range without coming too close to saturation.
+ * When counting upward, this routine is intended to select a brightness
+ * near the bottom of the brightness range without coming too close to
+ * saturation. When counting downward, it selects the highest brightness
+ * that does not exceed the target reading.
+ *
+ * Rather than testing every brightness value in the range, the
+ * brightness is found with a bracketing search that predicts the
+ * location of the target from each reading. The cooldown before each
+ * test is sized from the thermal model of the LED.
  *
  * @param led_brightness Brightness to use for further measurements
  * @param gain Gain setting for measurements
  * @param time Integration time for measurements
  * @param start_brightness Starting brightness value, inclusive
- * @param end_brightness Ending brightness value, inclusive
+ * @param end_brightness Ending brightness value, exclusive
  * @param target_factor Multiplier to determine how close to saturation is allowed
  */
 static osStatus_t sensor_find_gain_brightness(uint8_t *led_brightness,
@@ -789,11 +1397,8 @@ static osStatus_t sensor_find_gain_brightness(uint8_t *led_brightness,
 {
     osStatus_t ret = osOK;
     bool count_upward;
-    sensor_reading_t discard_reading;
     float target_ch0;
-    float ch0_avg;
-    float closest_ch0 = NAN;
-    uint8_t closest_led = 0;
+    uint8_t selected_led = 0;
 
     /* Basic parameter validation */
     if (start_brightness == 0 || start_brightness == end_brightness
@@ -812,91 +1417,101 @@ static osStatus_t sensor_find_gain_brightness(uint8_t *led_brightness,
     count_upward = start_brightness < end_brightness;
 
     if (count_upward) {
-        log_d("Counting upward from %d to %d", start_brightness, end_brightness);
+        log_d("Searching upward from %d to %d", start_brightness, end_brightness);
     } else {
-        log_d("Counting downward from %d to %d", start_brightness, end_brightness);
+        log_d("Searching downward from %d to %d", start_brightness, end_brightness);
     }
 
     if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_LED, 0, user_data)) { return osError; }
 
-    do {
-        /* Setup for sensor configuration */
-        ret = sensor_set_config(gain, time);
-        if (ret != osOK) { break; }
-
-        /* Wait for the first reading at the new settings to come through */
-        ret = sensor_get_next_reading(&discard_reading, 2000);
-        if (ret != osOK) { break; }
-
-        if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_LED, start_brightness, user_data)) { return osError; }
+    /*
+     * Each brightness test waits out the cooldown from the previous test
+     * with the LED off, then turns the LED on and lets it settle for one
+     * cycle before collecting the readings.
+     */
+    sensor_find_gain_brightness_context_t context = {
+        .steps = {
+            {
+                .light = SENSOR_LIGHT_OFF,
+                .gain = gain,
+                .time = time
+            },
+            {
+                .light = SENSOR_LIGHT_TRANSMISSION,
+                .gain = gain,
+                .time = time,
+                .settle_cycles = 1,
+                .read_cycles = SENSOR_GAIN_LED_CHECK_READ_ITERATIONS
+            }
+        },
+        .time_ms = tsl2591_get_time_value_ms(time),
+        .ret = osOK,
+        .callback = callback,
+        .user_data = user_data
+    };
+
+    bool result;
+    if (count_upward) {
+        result = gaincal_search_brightness(start_brightness, end_brightness - 1,
+            false, target_ch0, false,
+            sensor_find_gain_brightness_measure, &context, &selected_led);
+    } else {
+        result = gaincal_search_brightness(end_brightness + 1, start_brightness,
+            true, target_ch0, true,
+            sensor_find_gain_brightness_measure, &context, &selected_led);
+    }
+    if (!result) {
+        ret = (context.ret != osOK) ? context.ret : osError;
+    }
 
-        uint8_t i = start_brightness;
-        while (i != end_brightness) {
-            log_d("Testing brightness: %d", i);
+    /* Turn off the LED */
+    sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
 
-            /* Set the LED to target brightness on the next cycle */
-            sensor_set_light_mode(SENSOR_LIGHT_TRANSMISSION, /*next_cycle*/true, i);
+    if (ret == osOK) {
+        if (led_brightness) {
+            *led_brightness = selected_led;
+        }
+        log_d("Selected brightness: %d", selected_led);
+    }
 
-            /* Wait for the next cycle which will turn the LED on */
-            ret = sensor_get_next_reading(&discard_reading, 2000);
-            if (ret != osOK) { break; }
+    return ret;
+}
 
-            /* Wait for the next cycle which will turn the LED on */
-            ret = sensor_get_next_reading(&discard_reading, 2000);
-            if (ret != osOK) { break; }
+/**
+ * Take a single brightness test measurement for the brightness search.
+ */
+bool sensor_find_gain_brightness_measure(uint8_t brightness, float *ch0_value, void *user_data)
+{
+    sensor_find_gain_brightness_context_t *context = user_data;
+    sensor_program_result_t results[2];
 
-            ret = sensor_raw_read_loop(SENSOR_GAIN_LED_CHECK_READ_ITERATIONS, &ch0_avg, NULL);
-            if (ret != osOK) { break; }
-            log_d("Value: %f", ch0_avg);
-
-            if (count_upward) {
-                /* Break if we've saturated */
-                if (isnanf(ch0_avg)) { break; }
-
-                if (closest_led == 0) {
-                    closest_ch0 = ch0_avg;
-                    closest_led = i;
-                } else {
-                    float cur_diff = fabsf(target_ch0 - ch0_avg);
-                    float last_diff = fabsf(target_ch0 - closest_ch0);
-                    if (cur_diff < last_diff) {
-                        closest_ch0 = ch0_avg;
-                        closest_led = i;
-                    } else {
-                        break;
-                    }
-                }
-                i++;
-            } else {
-                /* Check if we got a usable reading */
-                if (!isnanf(ch0_avg) && ch0_avg <= target_ch0) {
-                    closest_ch0 = ch0_avg;
-                    closest_led = i;
-                    break;
-                }
-                i--;
-            }
+    if (!gain_status_callback(context->callback, SENSOR_GAIN_CALIBRATION_STATUS_LED, brightness, context->user_data)) {
+        context->ret = osError;
+        return false;
+    }
 
-            /* Turn off the LED and wait for a minimal cooldown period */
-            sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+    log_d("Testing brightness: %d", brightness);
 
-            if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_LED, i, user_data)) { return osError; }
+    /* Wait out any remaining cooldown with the LED off, rounded up to whole cycles */
+    const uint32_t cooldown_ms = gaincal_thermal_cooldown_ms(&gain_cal_thermal,
+        osKernelGetTickCount(), GAINCAL_THERMAL_TEST_LIMIT);
+    const uint32_t cooldown_cycles = (cooldown_ms + context->time_ms - 1) / context->time_ms;
+    context->steps[0].settle_cycles = (cooldown_cycles > UINT8_MAX) ? UINT8_MAX : cooldown_cycles;
+    context->steps[1].light_value = brightness;
 
-            osDelay((i < 64) ? 1000 : 2000);
-        }
-    } while (0);
+    context->ret = sensor_run_program_wait(context->steps, 2, results);
 
-    /* Turn off the LED */
+    /* Turn off the LED as soon as the test is complete */
     sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+    gaincal_thermal_add(&gain_cal_thermal, osKernelGetTickCount(), brightness,
+        (1 + SENSOR_GAIN_LED_CHECK_READ_ITERATIONS) * context->time_ms);
 
-    if (ret == osOK) {
-        if (led_brightness) {
-            *led_brightness = closest_led;
-        }
-        log_d("Selected brightness: %d (%f)", closest_led, closest_ch0);
-    }
+    if (context->ret != osOK) { return false; }
 
-    return ret;
+    sensor_program_result_average(&results[1], ch0_value, NULL);
+    log_d("Value: %f", *ch0_value);
+
+    return true;
 }
 
 bool sensor_is_reading_saturated(const sensor_reading_t *reading)
@@ -918,45 +1533,130 @@ bool sensor_is_reading_saturated(const sensor_reading_t *reading)
     }
 }
 
-void sensor_convert_to_basic_counts(const sensor_reading_t *reading, float *ch0_basic, float *ch1_basic)
+/**
+ * Get the values derived from the current calibration settings.
+ *
+ * The context is recalculated whenever the calibration settings have
+ * changed since it was last built, so that the per-reading conversion
+ * functions only need to do table lookups.
+ *
+ * Any task may rebuild the context in place, so the scheduler must be
+ * suspended from before this is called until the caller has finished
+ * reading from the context.
+ */
+const sensor_cal_context_t *sensor_get_cal_context()
 {
+    sensor_cal_context_t *context = &sensor_cal_context;
+    const uint32_t generation = settings_get_cal_generation();
+
+    if (context->generation == generation) {
+        return context;
+    }
+
     settings_cal_gain_t cal_gain;
-    float ch0_gain;
-    float ch1_gain;
-    float atime_ms;
+    settings_get_cal_gain(&cal_gain);
 
-    if (!reading) {
+    for (int gain = 0; gain < SENSOR_GAIN_COUNT; gain++) {
+        float ch0_gain;
+        float ch1_gain;
+        settings_get_cal_gain_fields(&cal_gain, gain, &ch0_gain, &ch1_gain);
+
+        for (int time = 0; time < SENSOR_TIME_COUNT; time++) {
+            /*
+             * Integration time is uncalibrated, due to the assumption that all
+             * target measurements will be done at the same setting.
+             */
+            float atime_ms = tsl2591_get_time_value_ms(time);
+
+            context->ch0_cpl_inv[gain][time] = (TSL2591_LUX_GA * TSL2591_LUX_DF) / (atime_ms * ch0_gain);
+            context->ch1_cpl_inv[gain][time] = (TSL2591_LUX_GA * TSL2591_LUX_DF) / (atime_ms * ch1_gain);
+        }
+    }
+
+    context->cal_slope_valid = settings_get_cal_slope(&context->cal_slope);
+    settings_get_cal_drift(&context->cal_drift);
+
+    context->generation = generation;
+
+    return context;
+}
+
+void sensor_convert_to_basic_counts(const sensor_reading_t *reading, float *ch0_basic, float *ch1_basic)
+{
+    if (!reading
+        || reading->gain < TSL2591_GAIN_LOW || reading->gain > TSL2591_GAIN_MAXIMUM
+        || reading->time < TSL2591_TIME_100MS || reading->time > TSL2591_TIME_600MS) {
         if (ch0_basic) { *ch0_basic = NAN; }
         if (ch1_basic) { *ch1_basic = NAN; }
         return;
     }
 
-    /* Get the gain value from sensor calibration */
-    settings_get_cal_gain(&cal_gain);
-    settings_get_cal_gain_fields(&cal_gain, reading->gain, &ch0_gain, &ch1_gain);
+    vTaskSuspendAll();
+    const sensor_cal_context_t *context = sensor_get_cal_context();
+    const float ch0_cpl_inv = context->ch0_cpl_inv[reading->gain][reading->time];
+    const float ch1_cpl_inv = context->ch1_cpl_inv[reading->gain][reading->time];
+    xTaskResumeAll();
+
+    if (ch0_basic) {
+        *ch0_basic = (float)reading->ch0_val * ch0_cpl_inv;
+    }
+    if (ch1_basic) {
+        *ch1_basic = (float)reading->ch1_val * ch1_cpl_inv;
+    }
+}
+
+void sensor_apply_drift_compensation(sensor_light_t light_source, const sensor_reading_t *reading,
+    float *ch0_basic, float *ch1_basic)
+{
+    if (!reading) { return; }
+
+    settings_cal_drift_t cal_drift;
+    float drop_factor;
+
+    vTaskSuspendAll();
+    cal_drift = sensor_get_cal_context()->cal_drift;
+    xTaskResumeAll();
+
+    if (light_source == SENSOR_LIGHT_REFLECTION) {
+        drop_factor = cal_drift.reflection;
+    } else if (light_source == SENSOR_LIGHT_TRANSMISSION) {
+        drop_factor = cal_drift.transmission;
+    } else {
+        return;
+    }
+    if (drop_factor == 0.0F) { return; }
 
     /*
-     * Integration time is uncalibrated, due to the assumption that all
-     * target measurements will be done at the same setting.
+     * The light is turned on by the same interrupt that ends an
+     * integration cycle, so the elapsed ticks match the x values
+     * used by the light calibration regression.
      */
-    atime_ms = tsl2591_get_time_value_ms(reading->time);
+    uint32_t elapsed_ticks = reading->reading_ticks - reading->light_ticks;
+    if (elapsed_ticks < 1) { elapsed_ticks = 1; }
 
-    float ch0_cpl = (atime_ms * ch0_gain) / (TSL2591_LUX_GA * TSL2591_LUX_DF);
-    float ch1_cpl = (atime_ms * ch1_gain) / (TSL2591_LUX_GA * TSL2591_LUX_DF);
+    /* Natural log of the elapsed time, via the fixed-point log2 */
+    const float elapsed_log = (float)fixmath_log2_u32(elapsed_ticks) * (float)(M_LN2 / 65536.0);
 
-    if (ch0_basic) {
-        *ch0_basic = (float)reading->ch0_val / ch0_cpl;
-    }
-    if (ch1_basic) {
-        *ch1_basic = (float)reading->ch1_val / ch1_cpl;
+    const float factor = 1.0F + (drop_factor * elapsed_log);
+    if (factor <= 0.5F) {
+        /* The model is being used well outside of its calibrated range */
+        return;
     }
+
+    if (ch0_basic) { *ch0_basic /= factor; }
+    if (ch1_basic) { *ch1_basic /= factor; }
 }
 
 float sensor_apply_slope_calibration(float basic_reading)
 {
     settings_cal_slope_t cal_slope;
+    bool valid;
 
-    bool valid = settings_get_cal_slope(&cal_slope);
+    vTaskSuspendAll();
+    const sensor_cal_context_t *context = sensor_get_cal_context();
+    cal_slope = context->cal_slope;
+    valid = context->cal_slope_valid;
+    xTaskResumeAll();
 
     if (isnanf(basic_reading) || isinff(basic_reading) || basic_reading <= 0.0F) {
         log_w("Cannot apply slope correction to invalid reading: %f", basic_reading);
@@ -968,9 +1668,9 @@ float sensor_apply_slope_calibration(float basic_reading)
         return basic_reading;
     }
 
-    float l_reading = log10f(basic_reading);
-    float l_expected = cal_slope.b0 + (cal_slope.b1 * l_reading) + (cal_slope.b2 * powf(l_reading, 2.0F));
-    float corr_reading = powf(10.0F, l_expected);
+    float l_reading = fixmath_log10f(basic_reading);
+    float l_expected = cal_slope.b0 + (cal_slope.b1 * l_reading) + (cal_slope.b2 * l_reading * l_reading);
+    float corr_reading = fixmath_exp10f(l_expected);
 
     return corr_reading;
 }
@@ -42,10 +42,45 @@ typedef struct {
     uint32_t reading_ticks; /*!< Tick time when the integration cycle finished */
     uint32_t light_ticks;   /*!< Tick time when the light state last changed */
     uint32_t reading_count; /*!< Number of integration cycles since the sensor was enabled */
+    uint32_t reading_us;    /*!< Microsecond timestamp of the sensor interrupt */
+    uint32_t light_us;      /*!< Microsecond timestamp of the last light state change */
+    uint32_t dispatch_us;   /*!< Time from the sensor interrupt until the sensor task handled it */
 } sensor_reading_t;
 
-typedef bool (*sensor_gain_calibration_callback_t)(sensor_gain_calibration_status_t status, int param, void *user_data);
+/**
+ * Statistics describing the process of the last target read.
+ *
+ * Each integration cycle is counted in only one of the cycle counts,
+ * so together they add up to the total cycles taken by the read.
+ */
+typedef struct {
+    tsl2591_gain_t gain;      /*!< Sensor ADC gain used for the target readings */
+    tsl2591_time_t time;      /*!< Sensor ADC integration time used for the target readings */
+    uint8_t probe_cycles;     /*!< Integration cycles used to choose the sensor settings */
+    uint8_t read_cycles;      /*!< Integration cycles used for the target readings */
+    uint8_t discarded_cycles; /*!< Integration cycles discarded due to sensor setting or light changes */
+    uint32_t ranging_us;      /*!< Time spent choosing the sensor settings */
+    uint32_t reading_us;      /*!< Time spent taking the target readings */
+    uint32_t conversion_us;   /*!< Time spent converting readings into basic counts */
+    uint8_t sample_count;     /*!< Target readings included in the result */
+    uint8_t rejected_count;   /*!< Target readings dropped as outliers */
+    float ch0_stddev;         /*!< Standard deviation of the included CH0 readings, in basic counts */
+    bool noisy;               /*!< True if the included readings failed to converge */
+    bool warm_start;          /*!< True if the sensor was already running from a previous target read */
+} sensor_read_stats_t;
+
+/**
+ * Callback for monitoring the progress of the gain calibration process.
+ *
+ * @param status Current step of the calibration process
+ * @param param Progress within the current step
+ * @param remaining_ms Estimated time remaining in the whole process, in milliseconds
+ * @param user_data Value passed through from the calibration call
+ * @return True to continue, false to abort the calibration
+ */
+typedef bool (*sensor_gain_calibration_callback_t)(sensor_gain_calibration_status_t status, int param, uint32_t remaining_ms, void *user_data);
 typedef bool (*sensor_time_calibration_callback_t)(tsl2591_time_t time, void *user_data);
+typedef bool (*sensor_light_calibration_callback_t)(uint8_t progress, void *user_data);
 typedef void (*sensor_read_callback_t)(void *user_data);
 
 /**
@@ -61,20 +96,20 @@ typedef void (*sensor_read_callback_t)(void *user_data);
  */
 osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback, void *user_data);
 
-#ifdef TEST_LIGHT_CAL
 /**
  * Run the sensor light source calibration process.
  *
  * This function will turn on the selected LED and keep the sensor at constant
  * settings. It will then measure the intensity of the light over time, run a
  * logarithmic regression on the results, and save the resulting drop factor.
+ * The drop factor is used to compensate target readings for the drift in
+ * light output while the LED is on.
  *
  * @param light_source Light source to calibrate
  * @param callback Callback to monitor progress of the calibration
  * @return osOK on success
  */
 osStatus_t sensor_light_calibration(sensor_light_t light_source, sensor_light_calibration_callback_t callback, void *user_data);
-#endif
 
 /**
  * Perform a target reading with the sensor.
@@ -83,6 +118,13 @@ osStatus_t sensor_light_calibration(sensor_light_t light_source, sensor_light_ca
  * using automatic gain adjustment to arrive at a result in basic counts
  * from which target density can be calculated.
  *
+ * An initial probe reading is used to predict the best gain for the target,
+ * with the integration time kept at the setting the slope calibration was
+ * fitted at. At least the number of readings configured in the
+ * sampling user settings are then taken, continuing until their running
+ * mean converges or an iteration limit is reached. Outlying readings are
+ * then dropped according to the configured rejection method.
+ *
  * @param light_source Light source to use for target measurement
  * @param ch0_result Channel 0 result, in basic counts
  * @param ch1_result Channel 1 result, in basic counts
@@ -115,6 +157,29 @@ osStatus_t sensor_read_target_raw(sensor_light_t light_source,
     tsl2591_gain_t gain, tsl2591_time_t time,
     uint16_t *ch0_result, uint16_t *ch1_result);
 
+/**
+ * Enable or disable keeping the sensor running between target reads.
+ *
+ * While enabled, sensor_read_target() leaves the sensor running when it
+ * finishes, and the next call picks up from the gain of the previous
+ * read instead of powering the sensor up from scratch. This avoids the
+ * power-up and discarded integration cycles that would otherwise be part
+ * of every target read.
+ *
+ * Disabling this mode will stop the sensor, if it was left running
+ * by a target read.
+ *
+ * @param enabled True to enable, false to disable
+ */
+void sensor_set_warm_mode(bool enabled);
+
+/**
+ * Get statistics on the process of the last call to sensor_read_target().
+ *
+ * @param stats Structure to populate with the statistics
+ */
+void sensor_get_last_read_stats(sensor_read_stats_t *stats);
+
 /**
  * Check the sensor reading to see if the sensor is saturated.
  *
@@ -137,6 +202,26 @@ bool sensor_is_reading_saturated(const sensor_reading_t *reading);
  */
 void sensor_convert_to_basic_counts(const sensor_reading_t *reading, float *ch0_basic, float *ch1_basic);
 
+/**
+ * Compensate a converted sensor reading for measurement light drift.
+ *
+ * The output of the measurement lights drops as they warm up, roughly
+ * in proportion to the log of the time they have been on. This uses the
+ * calibrated drop factor for the light source, and the time between the
+ * light being turned on and the end of the reading's integration cycle,
+ * to scale the reading back to the initial light output.
+ *
+ * If no drop factor has been calibrated for the light source, then the
+ * values will be left unmodified.
+ *
+ * @param light_source Light source that was on for the reading
+ * @param reading Reading the values were converted from
+ * @param ch0_basic Channel 0 value, in basic counts, to compensate in place
+ * @param ch1_basic Channel 1 value, in basic counts, to compensate in place
+ */
+void sensor_apply_drift_compensation(sensor_light_t light_source, const sensor_reading_t *reading,
+    float *ch0_basic, float *ch1_basic);
+
 /**
  * Apply the configured slope correction formula to a sensor reading.
  *
@@ -6,6 +6,8 @@
 #include <string.h>
 #include <math.h>
 #include <elog.h>
+#include <FreeRTOS.h>
+#include <task.h>
 
 #include "util.h"
 
@@ -20,6 +22,7 @@ static bool settings_init_cal_target(bool force_clear);
 static bool settings_clear_cal_target();
 static bool settings_init_user_settings(bool force_clear);
 static bool settings_clear_user_settings();
+static void settings_cal_update(void *setting, const void *value, size_t size);
 
 
 static void settings_set_cal_light_defaults(settings_cal_light_t *cal_light);
@@ -28,6 +31,8 @@ static void settings_set_cal_gain_defaults(settings_cal_gain_t *cal_gain);
 static bool settings_load_cal_gain();
 static void settings_set_cal_slope_defaults(settings_cal_slope_t *cal_slope);
 static bool settings_load_cal_slope();
+static void settings_set_cal_drift_defaults(settings_cal_drift_t *cal_drift);
+static bool settings_load_cal_drift();
 static void settings_set_cal_reflection_defaults(settings_cal_reflection_t *cal_reflection);
 static bool settings_load_cal_reflection();
 static void settings_set_cal_transmission_defaults(settings_cal_transmission_t *cal_transmission);
@@ -36,6 +41,8 @@ static void settings_set_user_usb_key_defaults(settings_user_usb_key_t *usb_key)
 static bool settings_load_user_usb_key();
 static void settings_set_user_idle_light_defaults(settings_user_idle_light_t *idle_light);
 static bool settings_load_user_idle_light();
+static void settings_set_user_sampling_defaults(settings_user_sampling_t *sampling);
+static bool settings_load_user_sampling();
 
 static HAL_StatusTypeDef settings_read_buffer(uint32_t address, uint8_t *data, size_t data_len);
 static HAL_StatusTypeDef settings_write_buffer(uint32_t address, const uint8_t *data, size_t data_len);
@@ -79,6 +86,9 @@ static HAL_StatusTypeDef settings_write_uint32(uint32_t address, uint32_t val);
 #define CONFIG_CAL_LIGHT            (PAGE_CAL_SENSOR + 48U)
 #define CONFIG_CAL_LIGHT_SIZE       (12U)
 
+#define CONFIG_CAL_DRIFT            (PAGE_CAL_SENSOR + 60U)
+#define CONFIG_CAL_DRIFT_SIZE       (12U)
+
 /*
  * Target Calibration Data (128b)
  * This page contains data specific to calibration against reference targets
@@ -102,7 +112,7 @@ static HAL_StatusTypeDef settings_write_uint32(uint32_t address, uint32_t val);
  */
 #define PAGE_USER_SETTINGS         (DATA_EEPROM_BASE + 0x0180UL)
 #define PAGE_USER_SETTINGS_SIZE    (128)
-#define PAGE_USER_SETTINGS_VERSION 2UL
+#define PAGE_USER_SETTINGS_VERSION 3UL
 
 #define CONFIG_USER_USB_KEY        (PAGE_USER_SETTINGS + 4U)
 #define CONFIG_USER_USB_KEY_SIZE   (12U)
@@ -110,13 +120,21 @@ static HAL_StatusTypeDef settings_write_uint32(uint32_t address, uint32_t val);
 #define CONFIG_USER_IDLE_LIGHT      (PAGE_USER_SETTINGS + 16U)
 #define CONFIG_USER_IDLE_LIGHT_SIZE (12U)
 
+#define CONFIG_USER_SAMPLING        (PAGE_USER_SETTINGS + 28U)
+#define CONFIG_USER_SAMPLING_SIZE   (8U)
+
 static settings_cal_light_t setting_cal_light = {0};
 static settings_cal_gain_t setting_cal_gain = {0};
 static settings_cal_slope_t setting_cal_slope = {0};
+static settings_cal_drift_t setting_cal_drift = {0};
 static settings_cal_reflection_t setting_cal_reflection = {0};
 static settings_cal_transmission_t setting_cal_transmission = {0};
 static settings_user_usb_key_t setting_user_usb_key = {0};
 static settings_user_idle_light_t setting_user_idle_light = {0};
+static settings_user_sampling_t setting_user_sampling = {0};
+
+/* Incremented whenever any calibration setting is changed */
+static volatile uint32_t setting_cal_generation = 1;
 
 HAL_StatusTypeDef settings_init()
 {
@@ -153,12 +171,38 @@ HAL_StatusTypeDef settings_init()
 
     } while (0);
 
+    /* Loaded calibration values replace anything derived from the defaults */
+    settings_cal_update(NULL, NULL, 0);
+
     /* Return watchdog to normal window */
     watchdog_normal();
 
     return ret;
 }
 
+/*
+ * Replace a calibration setting value, and move on to the next calibration
+ * generation.
+ *
+ * The scheduler is suspended, so a task rebuilding values derived from
+ * the calibration settings never sees a partly copied value, and the
+ * generation counter is never updated from two tasks at once.
+ */
+void settings_cal_update(void *setting, const void *value, size_t size)
+{
+    vTaskSuspendAll();
+    if (setting && value) {
+        memcpy(setting, value, size);
+    }
+    setting_cal_generation++;
+    xTaskResumeAll();
+}
+
+uint32_t settings_get_cal_generation()
+{
+    return setting_cal_generation;
+}
+
 HAL_StatusTypeDef settings_wipe()
 {
     HAL_StatusTypeDef ret = HAL_OK;
@@ -267,6 +311,7 @@ bool settings_init_cal_sensor(bool force_clear)
     settings_set_cal_light_defaults(&setting_cal_light);
     settings_set_cal_gain_defaults(&setting_cal_gain);
     settings_set_cal_slope_defaults(&setting_cal_slope);
+    settings_set_cal_drift_defaults(&setting_cal_drift);
 
     /* Load settings if the version matches */
     uint32_t version = force_clear ? 0 : settings_read_uint32(PAGE_CAL_SENSOR);
@@ -275,6 +320,7 @@ bool settings_init_cal_sensor(bool force_clear)
         settings_load_cal_light();
         settings_load_cal_gain();
         settings_load_cal_slope();
+        settings_load_cal_drift();
         result = true;
     } else {
         /* Version is bad, initialize a blank page */
@@ -309,6 +355,13 @@ bool settings_clear_cal_sensor()
         return false;
     }
 
+    /* Write an empty drift cal struct */
+    settings_cal_drift_t cal_drift;
+    settings_set_cal_drift_defaults(&cal_drift);
+    if (!settings_set_cal_drift(&cal_drift)) {
+        return false;
+    }
+
     /* Write the page version */
     if (settings_write_uint32(PAGE_CAL_SENSOR, PAGE_CAL_SENSOR_VERSION) != HAL_OK) {
         return false;
@@ -379,6 +432,7 @@ bool settings_init_user_settings(bool force_clear)
     /* Initialize all fields to their default values */
     settings_set_user_usb_key_defaults(&setting_user_usb_key);
     settings_set_user_idle_light_defaults(&setting_user_idle_light);
+    settings_set_user_sampling_defaults(&setting_user_sampling);
 
     /* Load settings if the version matches */
     uint32_t version = force_clear ? 0 : settings_read_uint32(PAGE_USER_SETTINGS);
@@ -386,18 +440,29 @@ bool settings_init_user_settings(bool force_clear)
         /* Version is good, load data with per-field validation */
         settings_load_user_usb_key();
         settings_load_user_idle_light();
+        settings_load_user_sampling();
         result = true;
-    } else if (version == 1) {
-        log_i("Migrating user settings from 1->2");
-        /* Handle the migration from version 1->2 */
+    } else if (version == 1 || version == 2) {
+        log_i("Migrating user settings from %d->%d", version, PAGE_USER_SETTINGS_VERSION);
+        /* Handle the migration from version 1->3 or 2->3 */
         do {
             /* Load unchanged settings */
             settings_load_user_usb_key();
 
             /* Set defaults for new settings */
-            settings_user_idle_light_t idle_light;
-            settings_set_user_idle_light_defaults(&idle_light);
-            if (!settings_set_user_idle_light(&idle_light)) {
+            if (version == 1) {
+                settings_user_idle_light_t idle_light;
+                settings_set_user_idle_light_defaults(&idle_light);
+                if (!settings_set_user_idle_light(&idle_light)) {
+                    break;
+                }
+            } else {
+                settings_load_user_idle_light();
+            }
+
+            settings_user_sampling_t sampling;
+            settings_set_user_sampling_defaults(&sampling);
+            if (!settings_set_user_sampling(&sampling)) {
                 break;
             }
 
@@ -440,6 +505,13 @@ bool settings_clear_user_settings()
         return false;
     }
 
+    /* Write an empty sampling user settings struct */
+    settings_user_sampling_t sampling;
+    settings_set_user_sampling_defaults(&sampling);
+    if (!settings_set_user_sampling(&sampling)) {
+        return false;
+    }
+
     /* Write the page version */
     if (settings_write_uint32(PAGE_USER_SETTINGS, PAGE_USER_SETTINGS_VERSION) != HAL_OK) {
         return false;
@@ -471,7 +543,7 @@ bool settings_set_cal_light(const settings_cal_light_t *cal_light)
     ret = settings_write_buffer(CONFIG_CAL_LIGHT, buf, sizeof(buf));
 
     if (ret == HAL_OK) {
-        memcpy(&setting_cal_light, cal_light, sizeof(settings_cal_light_t));
+        settings_cal_update(&setting_cal_light, cal_light, sizeof(settings_cal_light_t));
         return true;
     } else {
         return false;
@@ -561,7 +633,7 @@ bool settings_set_cal_gain(const settings_cal_gain_t *cal_gain)
     ret = settings_write_buffer(CONFIG_CAL_GAIN, buf, sizeof(buf));
 
     if (ret == HAL_OK) {
-        memcpy(&setting_cal_gain, cal_gain, sizeof(settings_cal_gain_t));
+        settings_cal_update(&setting_cal_gain, cal_gain, sizeof(settings_cal_gain_t));
         return true;
     } else {
         return false;
@@ -698,7 +770,7 @@ bool settings_set_cal_slope(const settings_cal_slope_t *cal_slope)
     ret = settings_write_buffer(CONFIG_CAL_SLOPE, buf, sizeof(buf));
 
     if (ret == HAL_OK) {
-        memcpy(&setting_cal_slope, cal_slope, sizeof(settings_cal_slope_t));
+        settings_cal_update(&setting_cal_slope, cal_slope, sizeof(settings_cal_slope_t));
         return true;
     } else {
         return false;
@@ -761,6 +833,117 @@ bool settings_validate_cal_slope(const settings_cal_slope_t *cal_slope)
     return true;
 }
 
+void settings_set_cal_drift_defaults(settings_cal_drift_t *cal_drift)
+{
+    if (!cal_drift) { return; }
+    memset(cal_drift, 0, sizeof(settings_cal_drift_t));
+}
+
+bool settings_set_cal_drift(const settings_cal_drift_t *cal_drift)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    if (!cal_drift) { return false; }
+
+    uint8_t buf[CONFIG_CAL_DRIFT_SIZE];
+    copy_from_f32(&buf[0], cal_drift->reflection);
+    copy_from_f32(&buf[4], cal_drift->transmission);
+
+    uint32_t crc = HAL_CRC_Calculate(&hcrc, (uint32_t *)buf, 2);
+    copy_from_u32(&buf[8], crc);
+
+    ret = settings_write_buffer(CONFIG_CAL_DRIFT, buf, sizeof(buf));
+
+    if (ret == HAL_OK) {
+        const settings_cal_drift_t prev_drift = setting_cal_drift;
+        settings_cal_update(&setting_cal_drift, cal_drift, sizeof(settings_cal_drift_t));
+
+        /*
+         * Target calibration readings are taken with drift compensation
+         * applied, so they no longer match measurements once the value
+         * for their light has changed.
+         */
+        if (prev_drift.reflection != cal_drift->reflection) {
+            settings_cal_reflection_t cal_reflection;
+            log_w("Reflection drift changed, clearing reflection calibration");
+            settings_set_cal_reflection_defaults(&cal_reflection);
+            if (!settings_set_cal_reflection(&cal_reflection)) {
+                return false;
+            }
+        }
+        if (prev_drift.transmission != cal_drift->transmission) {
+            settings_cal_transmission_t cal_transmission;
+            log_w("Transmission drift changed, clearing transmission calibration");
+            settings_set_cal_transmission_defaults(&cal_transmission);
+            if (!settings_set_cal_transmission(&cal_transmission)) {
+                return false;
+            }
+        }
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool settings_load_cal_drift()
+{
+    uint8_t buf[CONFIG_CAL_DRIFT_SIZE];
+
+    if (settings_read_buffer(CONFIG_CAL_DRIFT, buf, sizeof(buf)) != HAL_OK) {
+        return false;
+    }
+
+    uint32_t crc = copy_to_u32(&buf[8]);
+    uint32_t calculated_crc = HAL_CRC_Calculate(&hcrc, (uint32_t *)buf, 2);
+
+    if (crc != calculated_crc) {
+        log_w("Invalid cal drift CRC: %08X != %08X", crc, calculated_crc);
+        return false;
+    } else {
+        setting_cal_drift.reflection = copy_to_f32(&buf[0]);
+        setting_cal_drift.transmission = copy_to_f32(&buf[4]);
+        return true;
+    }
+}
+
+bool settings_get_cal_drift(settings_cal_drift_t *cal_drift)
+{
+    if (!cal_drift) { return false; }
+
+    /* Copy over the settings values */
+    memcpy(cal_drift, &setting_cal_drift, sizeof(settings_cal_drift_t));
+
+    /* Set default values if validation fails */
+    if (!settings_validate_cal_drift(cal_drift)) {
+        settings_set_cal_drift_defaults(cal_drift);
+        return false;
+    } else {
+        return true;
+    }
+}
+
+bool settings_validate_cal_drift(const settings_cal_drift_t *cal_drift)
+{
+    if (!cal_drift) { return false; }
+
+    /* Validate field numeric properties */
+    if (isnanf(cal_drift->reflection) || isinff(cal_drift->reflection)) {
+        return false;
+    }
+    if (isnanf(cal_drift->transmission) || isinff(cal_drift->transmission)) {
+        return false;
+    }
+
+    /* Validate field ranges */
+    if (cal_drift->reflection > 0.0F || cal_drift->reflection < -SETTING_CAL_DRIFT_LIMIT) {
+        return false;
+    }
+    if (cal_drift->transmission > 0.0F || cal_drift->transmission < -SETTING_CAL_DRIFT_LIMIT) {
+        return false;
+    }
+
+    return true;
+}
+
 void settings_set_cal_reflection_defaults(settings_cal_reflection_t *cal_reflection)
 {
     if (!cal_reflection) { return; }
@@ -788,7 +971,7 @@ bool settings_set_cal_reflection(const settings_cal_reflection_t *cal_reflection
     ret = settings_write_buffer(CONFIG_CAL_REFLECTION, buf, sizeof(buf));
 
     if (ret == HAL_OK) {
-        memcpy(&setting_cal_reflection, cal_reflection, sizeof(settings_cal_reflection_t));
+        settings_cal_update(&setting_cal_reflection, cal_reflection, sizeof(settings_cal_reflection_t));
         return true;
     } else {
         return false;
@@ -889,7 +1072,7 @@ bool settings_set_cal_transmission(const settings_cal_transmission_t *cal_transm
     ret = settings_write_buffer(CONFIG_CAL_TRANSMISSION, buf, sizeof(buf));
 
     if (ret == HAL_OK) {
-        memcpy(&setting_cal_transmission, cal_transmission, sizeof(settings_cal_transmission_t));
+        settings_cal_update(&setting_cal_transmission, cal_transmission, sizeof(settings_cal_transmission_t));
         return true;
     } else {
         return false;
@@ -1084,6 +1267,65 @@ bool settings_get_user_idle_light(settings_user_idle_light_t *idle_light)
     }
 }
 
+void settings_set_user_sampling_defaults(settings_user_sampling_t *sampling)
+{
+    if (!sampling) { return; }
+    memset(sampling, 0, sizeof(settings_user_sampling_t));
+    sampling->count = SETTING_SAMPLING_COUNT_DEFAULT;
+    sampling->reject = SETTING_SAMPLING_REJECT_NONE;
+}
+
+bool settings_set_user_sampling(const settings_user_sampling_t *sampling)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    if (!sampling) { return false; }
+
+    uint8_t buf[CONFIG_USER_SAMPLING_SIZE];
+    copy_from_u32(&buf[0], (uint32_t)sampling->count);
+    copy_from_u32(&buf[4], (uint32_t)sampling->reject);
+
+    ret = settings_write_buffer(CONFIG_USER_SAMPLING, buf, sizeof(buf));
+
+    if (ret == HAL_OK) {
+        memcpy(&setting_user_sampling, sampling, sizeof(settings_user_sampling_t));
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool settings_load_user_sampling()
+{
+    uint8_t buf[CONFIG_USER_SAMPLING_SIZE];
+
+    if (settings_read_buffer(CONFIG_USER_SAMPLING, buf, sizeof(buf)) != HAL_OK) {
+        return false;
+    }
+
+    setting_user_sampling.count = (uint8_t)copy_to_u32(&buf[0]);
+    setting_user_sampling.reject = (setting_sampling_reject_t)copy_to_u32(&buf[4]);
+    return true;
+}
+
+bool settings_get_user_sampling(settings_user_sampling_t *sampling)
+{
+    if (!sampling) { return false; }
+
+    /* Copy over the settings values */
+    memcpy(sampling, &setting_user_sampling, sizeof(settings_user_sampling_t));
+
+    /* Set default values if validation fails */
+    if (sampling->count < SETTING_SAMPLING_COUNT_MIN
+        || sampling->count > SETTING_SAMPLING_COUNT_MAX
+        || sampling->reject >= SETTING_SAMPLING_REJECT_MAX) {
+        log_w("Invalid sampling user settings values");
+        settings_set_user_sampling_defaults(sampling);
+        return false;
+    } else {
+        return true;
+    }
+}
+
 HAL_StatusTypeDef settings_read_buffer(uint32_t address, uint8_t *data, size_t data_len)
 {
     if (!IS_FLASH_DATA_ADDRESS(address)) {
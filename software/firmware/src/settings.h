@@ -41,6 +41,16 @@ typedef struct {
     float b2;
 } settings_cal_slope_t;
 
+/*
+ * Limit on the magnitude of the measurement light drift factors
+ */
+#define SETTING_CAL_DRIFT_LIMIT (0.05F)
+
+typedef struct {
+    float reflection;
+    float transmission;
+} settings_cal_drift_t;
+
 typedef struct {
     float lo_d;
     float lo_value;
@@ -81,8 +91,38 @@ typedef struct {
     uint8_t timeout;
 } settings_user_idle_light_t;
 
+/*
+ * Limits and defaults for the measurement sampling user settings
+ */
+#define SETTING_SAMPLING_COUNT_MIN      2
+#define SETTING_SAMPLING_COUNT_MAX     16
+#define SETTING_SAMPLING_COUNT_DEFAULT  2
+
+typedef enum {
+    SETTING_SAMPLING_REJECT_NONE = 0,
+    SETTING_SAMPLING_REJECT_SIGMA,
+    SETTING_SAMPLING_REJECT_MEDIAN,
+    SETTING_SAMPLING_REJECT_MAX
+} setting_sampling_reject_t;
+
+typedef struct {
+    uint8_t count;
+    setting_sampling_reject_t reject;
+} settings_user_sampling_t;
+
 HAL_StatusTypeDef settings_init();
 
+/**
+ * Get the calibration generation counter.
+ *
+ * This value changes every time any calibration setting is changed,
+ * so it can be used to know when values derived from the calibration
+ * settings need to be recalculated.
+ *
+ * @return Current calibration generation
+ */
+uint32_t settings_get_cal_generation();
+
 HAL_StatusTypeDef settings_wipe();
 
 /**
@@ -169,6 +209,40 @@ bool settings_get_cal_slope(settings_cal_slope_t *cal_slope);
  */
 bool settings_validate_cal_slope(const settings_cal_slope_t *cal_slope);
 
+/**
+ * Set the measurement light drift calibration values.
+ *
+ * Each value is the relative change in light output per unit of the
+ * natural log of the time the light has been on, in milliseconds.
+ * These are expected to be negative, as LED output drops while it
+ * warms up, and a value of zero disables compensation for that light.
+ *
+ * Changing the value for a light also clears the target calibration
+ * for that light, as it was taken with the previous compensation.
+ *
+ * @param cal_drift Struct populated with values to save
+ * @return True if saved, false on error
+ */
+bool settings_set_cal_drift(const settings_cal_drift_t *cal_drift);
+
+/**
+ * Get the measurement light drift calibration values.
+ * If a valid set of values are not available, but the provided struct is
+ * usable, it will be initialized to zero.
+ *
+ * @param cal_drift Struct to be populated with saved values
+ * @return True if valid values are returned, false otherwise.
+ */
+bool settings_get_cal_drift(settings_cal_drift_t *cal_drift);
+
+/**
+ * Check if the measurement light drift calibration values are valid
+ *
+ * @param cal_drift Struct to validate
+ * @return True if valid, false if invalid
+ */
+bool settings_validate_cal_drift(const settings_cal_drift_t *cal_drift);
+
 /**
  * Set the reflection density calibration values.
  *
@@ -253,4 +327,20 @@ bool settings_set_user_idle_light(const settings_user_idle_light_t *idle_light);
  */
 bool settings_get_user_idle_light(settings_user_idle_light_t *idle_light);
 
+/**
+ * Set the user settings for measurement sampling
+ *
+ * @param sampling Struct populated with the values to save
+ * @return True if saved, false on error
+ */
+bool settings_set_user_sampling(const settings_user_sampling_t *sampling);
+
+/**
+ * Get the user settings for measurement sampling
+ *
+ * @param sampling Struct to be populated with saved values
+ * @return True if valid values are returned, false otherwise.
+ */
+bool settings_get_user_sampling(settings_user_sampling_t *sampling);
+
 #endif /* SETTINGS_H */
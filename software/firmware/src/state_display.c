@@ -37,12 +37,13 @@ static void state_reflection_display_entry(state_t *state_base, state_controller
 static void state_transmission_display_entry(state_t *state_base, state_controller_t *controller, state_identifier_t prev_state);
 
 static void state_display_process(state_t *state_base, state_controller_t *controller);
+static void state_display_exit(state_t *state_base, state_controller_t *controller, state_identifier_t next_state);
 
 static state_display_t state_reflection_display_data = {
     .base = {
         .state_entry = state_reflection_display_entry,
         .state_process = state_display_process,
-        .state_exit = NULL
+        .state_exit = state_display_exit
     },
     .display_dirty = true,
     .light_dirty = true,
@@ -64,7 +65,7 @@ static state_display_t state_transmission_display_data = {
     .base = {
         .state_entry = state_transmission_display_entry,
         .state_process = state_display_process,
-        .state_exit = NULL
+        .state_exit = state_display_exit
     },
     .display_dirty = true,
     .light_dirty = true,
@@ -110,6 +111,9 @@ void state_display_entry(state_t *state_base, state_controller_t *controller, st
     state->light_idle_timeout = 1000UL * idle_light.timeout;
 
     state_controller_set_home_state(controller, state_controller_get_current_state(controller));
+
+    /* Keep the sensor running between consecutive measurements */
+    sensor_set_warm_mode(true);
 }
 
 void state_reflection_display_entry(state_t *state_base, state_controller_t *controller, state_identifier_t prev_state)
@@ -152,6 +156,15 @@ void state_transmission_display_entry(state_t *state_base, state_controller_t *c
     }
 }
 
+void state_display_exit(state_t *state_base, state_controller_t *controller, state_identifier_t next_state)
+{
+    /* Stop the sensor when leaving the measurement and display states */
+    if (next_state != STATE_REFLECTION_DISPLAY && next_state != STATE_REFLECTION_MEASURE
+        && next_state != STATE_TRANSMISSION_DISPLAY && next_state != STATE_TRANSMISSION_MEASURE) {
+        sensor_set_warm_mode(false);
+    }
+}
+
 void state_display_process(state_t *state_base, state_controller_t *controller)
 {
     state_display_t *state = (state_display_t *)state_base;
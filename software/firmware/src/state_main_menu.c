@@ -783,7 +783,7 @@ void main_menu_settings_diagnostics(state_main_menu_t *state, state_controller_t
         ret = sensor_start();
         if (ret != osOK) { break; }
 
-        ret = sensor_get_next_reading(&reading, 2000);
+        ret = sensor_reader_get_next(SENSOR_READER_DIAGNOSTICS, &reading, 2000);
         if (ret != osOK) { break; }
     } while (0);
 
@@ -881,7 +881,7 @@ void main_menu_settings_diagnostics(state_main_menu_t *state, state_controller_t
             settings_changed = false;
         }
 
-        if (sensor_get_next_reading(&reading, 1000) == osOK) {
+        if (sensor_reader_get_next(SENSOR_READER_DIAGNOSTICS, &reading, 1000) == osOK) {
             bool is_detect = keypad_is_detect();
             if (display_mode) {
                 sensor_convert_to_basic_counts(&reading, &ch0_basic, &ch1_basic);
@@ -33,6 +33,7 @@ state_t *state_remote()
 void state_remote_entry(state_t *state_base, state_controller_t *controller, state_identifier_t prev_state)
 {
     log_i("Entering remote control state");
+    sensor_set_warm_mode(false);
     sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
     display_static_message("Remote\nControl");
     cdc_send_remote_state(true);
@@ -59,6 +59,7 @@ void state_suspend_entry(state_t *state_base, state_controller_t *controller, st
     log_i("Entering suspend state");
 
     /* Turn off all the external devices */
+    sensor_set_warm_mode(false);
     sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
     sensor_stop();
     display_enable(false);
@@ -70,8 +71,9 @@ void state_suspend_entry(state_t *state_base, state_controller_t *controller, st
     /* Reconfigure external button GPIO pins to analog */
     gpio_button_unconfig();
 
-    /* Disable PWM timers */
+    /* Disable PWM and timestamp timers */
     __HAL_RCC_TIM2_CLK_DISABLE();
+    __HAL_RCC_TIM7_CLK_DISABLE();
 
     /* Disable HAL and FreeRTOS tick timers */
     SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;
@@ -153,8 +155,9 @@ void state_suspend_exit(state_t *state, state_controller_t *controller, state_id
     HAL_NVIC_EnableIRQ(EXTI0_1_IRQn);
     HAL_NVIC_EnableIRQ(EXTI4_15_IRQn);
 
-    /* Enable PWM timers */
+    /* Enable PWM and timestamp timers */
     __HAL_RCC_TIM2_CLK_ENABLE();
+    __HAL_RCC_TIM7_CLK_ENABLE();
 
     /* Turn on all the external devices */
     display_enable(true);
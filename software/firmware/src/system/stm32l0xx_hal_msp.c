@@ -109,6 +109,10 @@ void HAL_I2C_MspInit(I2C_HandleTypeDef* hi2c)
 
         /* Peripheral clock enable */
         __HAL_RCC_I2C1_CLK_ENABLE();
+
+        /* I2C1 interrupt Init */
+        HAL_NVIC_SetPriority(I2C1_IRQn, 3, 0);
+        HAL_NVIC_EnableIRQ(I2C1_IRQn);
     }
 }
 
@@ -131,6 +135,9 @@ void HAL_I2C_MspDeInit(I2C_HandleTypeDef* hi2c)
         HAL_GPIO_DeInit(GPIOB, GPIO_PIN_6);
 
         HAL_GPIO_DeInit(GPIOB, GPIO_PIN_7);
+
+        /* I2C1 interrupt DeInit */
+        HAL_NVIC_DisableIRQ(I2C1_IRQn);
     }
 }
 
@@ -224,6 +231,17 @@ void HAL_TIM_Base_MspInit(TIM_HandleTypeDef* htim_base)
     if (htim_base->Instance == TIM2) {
         /* Peripheral clock enable */
         __HAL_RCC_TIM2_CLK_ENABLE();
+    } else if (htim_base->Instance == TIM7) {
+        /* Peripheral clock enable */
+        __HAL_RCC_TIM7_CLK_ENABLE();
+
+        /*
+         * TIM7 interrupt Init
+         * This runs at the highest priority, so nothing can read the
+         * timestamp between the overflow flag being cleared and counted.
+         */
+        HAL_NVIC_SetPriority(TIM7_IRQn, 0, 0);
+        HAL_NVIC_EnableIRQ(TIM7_IRQn);
     }
 }
 
@@ -266,6 +284,12 @@ void HAL_TIM_Base_MspDeInit(TIM_HandleTypeDef* htim_base)
     if (htim_base->Instance == TIM2) {
         /* Peripheral clock disable */
         __HAL_RCC_TIM2_CLK_DISABLE();
+    } else if (htim_base->Instance == TIM7) {
+        /* Peripheral clock disable */
+        __HAL_RCC_TIM7_CLK_DISABLE();
+
+        /* TIM7 interrupt DeInit */
+        HAL_NVIC_DisableIRQ(TIM7_IRQn);
     }
 }
 
@@ -23,8 +23,10 @@
 #include "state_suspend.h"
 
 extern DMA_HandleTypeDef hdma_adc;
+extern I2C_HandleTypeDef hi2c1;
 extern RTC_HandleTypeDef hrtc;
 extern TIM_HandleTypeDef htim6;
+extern TIM_HandleTypeDef htim7;
 
 /******************************************************************************/
 /*           Cortex-M0+ Processor Interruption and Exception Handlers          */
@@ -170,6 +172,18 @@ void DMA1_Channel1_IRQHandler(void)
     HAL_DMA_IRQHandler(&hdma_adc);
 }
 
+/**
+ * Handles the I2C1 event and error interrupts through EXTI line 23.
+ */
+void I2C1_IRQHandler(void)
+{
+    if (hi2c1.Instance->ISR & (I2C_FLAG_BERR | I2C_FLAG_ARLO | I2C_FLAG_OVR)) {
+        HAL_I2C_ER_IRQHandler(&hi2c1);
+    } else {
+        HAL_I2C_EV_IRQHandler(&hi2c1);
+    }
+}
+
 /**
  * Handles the TIM6 global interrupt and DAC1/DAC2 underrun error interrupts.
  */
@@ -178,6 +192,14 @@ void TIM6_DAC_IRQHandler(void)
     HAL_TIM_IRQHandler(&htim6);
 }
 
+/**
+ * Handles the TIM7 global interrupt.
+ */
+void TIM7_IRQHandler(void)
+{
+    HAL_TIM_IRQHandler(&htim7);
+}
+
 /**
  * Handles the USB event/wake-up interrupt through EXTI line 18.
  */
@@ -29,7 +29,9 @@ void RTC_IRQHandler(void);
 void EXTI0_1_IRQHandler(void);
 void EXTI4_15_IRQHandler(void);
 void DMA1_Channel1_IRQHandler(void);
+void I2C1_IRQHandler(void);
 void TIM6_DAC_IRQHandler(void);
+void TIM7_IRQHandler(void);
 void USB_IRQHandler(void);
 
 #ifdef __cplusplus
@@ -2,6 +2,9 @@
 
 #include "stm32l0xx_hal.h"
 #include <cmsis_os.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <timers.h>
 #include <tusb.h>
 
 #define LOG_TAG "task_main"
@@ -38,6 +41,7 @@ static const osSemaphoreAttr_t task_start_semaphore_attributes = {
 #define TASK_MAIN_STACK_SIZE (2048U)
 #define TASK_USBD_STACK_SIZE (1024U)
 #define TASK_CDC_STACK_SIZE (1536U)
+#define TASK_CDC_JOB_STACK_SIZE (1536U)
 
 #ifdef KEYPAD_DEBUG
 #define TASK_KEYPAD_STACK_SIZE (768U)
@@ -72,6 +76,14 @@ static task_params_t task_list[] = {
             .priority = osPriorityNormal1 // example uses max-2
         }
     },
+    {
+        .task_func = task_cdc_job_run,
+        .task_attrs = {
+            .name = "cdc_job",
+            .stack_size = TASK_CDC_JOB_STACK_SIZE,
+            .priority = osPriorityNormal
+        }
+    },
     {
         .task_func = task_keypad_run,
         .task_attrs = {
@@ -160,6 +172,27 @@ void task_main_run(void *argument)
     state_controller_loop();
 }
 
+uint32_t task_main_get_stack_size(osThreadId_t thread)
+{
+    const uint8_t task_count = sizeof(task_list) / sizeof(task_params_t);
+
+    if (!thread) { return 0; }
+
+    for (uint8_t i = 0; i < task_count; i++) {
+        if (task_list[i].task_handle == thread) {
+            return task_list[i].task_attrs.stack_size;
+        }
+    }
+
+    if ((TaskHandle_t)thread == xTaskGetIdleTaskHandle()) {
+        return configMINIMAL_STACK_SIZE * sizeof(StackType_t);
+    } else if ((TaskHandle_t)thread == xTimerGetTimerDaemonTaskHandle()) {
+        return configTIMER_TASK_STACK_DEPTH * sizeof(StackType_t);
+    }
+
+    return 0;
+}
+
 osStatus_t task_main_force_state(state_identifier_t next_state)
 {
     if (next_state >= STATE_MAX) { return osErrorParameter; }
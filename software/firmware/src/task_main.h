@@ -28,4 +28,15 @@ bool task_main_is_running();
  */
 osStatus_t task_main_force_state(state_identifier_t next_state);
 
+/**
+ * Gets the stack size a task was created with.
+ *
+ * This covers the application tasks along with the RTOS idle and
+ * timer service tasks.
+ *
+ * @param thread Task to look up
+ * @return Stack size in bytes, or 0 if the task is not recognized
+ */
+uint32_t task_main_get_stack_size(osThreadId_t thread);
+
 #endif /* TASK_MAIN_H */
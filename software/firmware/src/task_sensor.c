@@ -4,9 +4,9 @@
 #include <elog.h>
 
 #include <math.h>
+#include <string.h>
 #include <cmsis_os.h>
 #include <FreeRTOS.h>
-#include <queue.h>
 
 #include "stm32l0xx_hal.h"
 #include "settings.h"
@@ -14,7 +14,10 @@
 #include "sensor.h"
 #include "light.h"
 #include "util.h"
+#include "fixmath.h"
 #include "cdc_handler.h"
+#include "trace.h"
+#include "main.h"
 
 /**
  * Sensor control event types.
@@ -24,6 +27,9 @@ typedef enum {
     SENSOR_CONTROL_START,
     SENSOR_CONTROL_SET_CONFIG,
     SENSOR_CONTROL_SET_LIGHT_MODE,
+    SENSOR_CONTROL_RUN_PROGRAM,
+    SENSOR_CONTROL_SET_THRESHOLD_MODE,
+    SENSOR_CONTROL_BATCH,
     SENSOR_CONTROL_INTERRUPT
 } sensor_control_event_type_t;
 
@@ -38,10 +44,34 @@ typedef struct {
     uint8_t value;
 } sensor_control_light_mode_params_t;
 
+typedef struct {
+    const sensor_program_step_t *steps;
+    uint8_t step_count;
+} sensor_control_program_params_t;
+
+typedef struct {
+    bool enabled;
+    uint8_t margin_percent;
+} sensor_control_threshold_params_t;
+
+typedef struct {
+    sensor_op_t *ops;
+    uint8_t op_count;
+    osThreadId_t notify_thread; /* Thread to notify on completion, or NULL for a synchronous batch */
+    uint32_t notify_flags;
+} sensor_control_batch_params_t;
+
 typedef struct {
     uint32_t sensor_ticks;
     uint32_t light_ticks;
+    uint32_t sensor_us;
+    uint32_t light_us;
     uint32_t reading_count;
+    uint8_t program_step;   /* Program step the finished cycle was part of */
+    uint8_t program_cycle;  /* Index of the finished cycle within its program step */
+    uint8_t program_next;   /* Program step started at the end of the finished cycle */
+    bool program_done;      /* Program finished at the end of the finished cycle */
+    uint8_t program_generation; /* Program the above fields refer to */
 } sensor_control_interrupt_params_t;
 
 /**
@@ -53,34 +83,139 @@ typedef struct {
     union {
         sensor_control_config_params_t config;
         sensor_control_light_mode_params_t light_mode;
+        sensor_control_program_params_t program;
+        sensor_control_threshold_params_t threshold;
+        sensor_control_batch_params_t batch;
         sensor_control_interrupt_params_t interrupt;
     };
 } sensor_control_event_t;
 
+/**
+ * Number of slots in the sensor reading ring buffer.
+ * This must be a power of two.
+ */
+#define SENSOR_READING_SLOTS 8
+
+/**
+ * Timeout for interrupt-driven sensor I2C transfers.
+ * A full status and data read takes well under a millisecond at 400kHz.
+ */
+#define SENSOR_I2C_TIMEOUT 10
+
+/**
+ * Smallest half-width of the threshold mode window, in raw counts,
+ * so that sensor noise on dim readings does not keep crossing it.
+ */
+#define SENSOR_THRESHOLD_MIN_MARGIN 16
+
+/**
+ * Marker for interrupt events that are not part of a sensor program step.
+ */
+#define SENSOR_PROGRAM_STEP_NONE 0xFF
+
+/**
+ * Sensor program execution states.
+ */
+typedef enum {
+    SENSOR_PROGRAM_IDLE = 0,
+    SENSOR_PROGRAM_PENDING,
+    SENSOR_PROGRAM_RUNNING
+} sensor_program_state_t;
+
+/**
+ * Sensor reading ring buffer slot.
+ *
+ * The sequence field is cleared while the slot is being written, and set
+ * to the sequence number of the reading once the write is complete.
+ * This allows readers to detect when a slot was overwritten while they
+ * were copying it out.
+ */
+typedef struct {
+    volatile uint32_t sequence;
+    sensor_reading_t reading;
+} sensor_reading_slot_t;
+
 /* Global I2C handle for the sensor */
 extern I2C_HandleTypeDef hi2c1;
 
 static volatile bool sensor_initialized = false;
 static volatile uint32_t pending_int_light_change = 0;
 static volatile uint32_t light_change_ticks = 0;
+static volatile uint32_t light_change_us = 0;
 static volatile uint32_t reading_count = 0;
 
 /* Sensor task state variables */
-static bool sensor_running = false;
+static volatile bool sensor_running = false;
 static tsl2591_gain_t sensor_gain = TSL2591_GAIN_LOW;
 static tsl2591_time_t sensor_time = TSL2591_TIME_100MS;
 static bool sensor_discard_next_reading = false;
 
+/* Threshold interrupt mode state, only touched by the sensor task */
+static bool sensor_threshold_active = false;
+static bool sensor_threshold_pending = false;
+static uint8_t sensor_threshold_margin = 0;
+
 /* Queue for low level sensor control events */
 static osMessageQueueId_t sensor_control_queue = NULL;
 static const osMessageQueueAttr_t sensor_control_queue_attrs = {
     .name = "sensor_control_queue"
 };
 
-/* Queue to hold the latest sensor reading */
-static osMessageQueueId_t sensor_reading_queue = NULL;
-static const osMessageQueueAttr_t sensor_reading_queue_attrs = {
-    .name = "sensor_reading_queue"
+/*
+ * Ring buffer holding the most recent sensor readings.
+ * Readings are only ever published by the sensor task, while each reader
+ * tracks its own position and may consume readings at its own pace.
+ * Sequence numbers start at 1, so a zero sequence denotes an empty slot.
+ */
+static sensor_reading_slot_t reading_slots[SENSOR_READING_SLOTS] = {0};
+static volatile uint32_t reading_head_sequence = 0;
+static volatile uint32_t reading_base_sequence = 0;
+static uint32_t reader_next_sequence[SENSOR_READER_MAX] = {0};
+static volatile uint32_t reader_overruns[SENSOR_READER_MAX] = {0};
+
+/*
+ * Sensor pipeline statistics.
+ * Everything but the queue error count is only updated by the sensor task.
+ */
+static sensor_stats_t sensor_stats = {0};
+static volatile uint32_t sensor_stats_queue_errors = 0;
+
+/* Event flags used to wake readers when a new reading is published */
+static osEventFlagsId_t sensor_reading_flags = NULL;
+static const osEventFlagsAttr_t sensor_reading_flags_attrs = {
+    .name = "sensor_reading_flags"
+};
+
+/* Semaphore to signal completion of interrupt-driven I2C transfers */
+static osSemaphoreId_t sensor_i2c_semaphore = NULL;
+static const osSemaphoreAttr_t sensor_i2c_semaphore_attrs = {
+    .name = "sensor_i2c_semaphore"
+};
+static volatile HAL_StatusTypeDef sensor_i2c_result = HAL_OK;
+static uint8_t sensor_i2c_buffer[TSL2591_STATUS_CHANNEL_DATA_SIZE];
+
+/*
+ * Sensor program state.
+ * The step list and results are only touched by the sensor task, while
+ * the light values, cycle counts, and position are stepped through by
+ * the sensor interrupt.
+ */
+static sensor_program_step_t program_steps[SENSOR_PROGRAM_MAX_STEPS];
+static sensor_program_result_t program_results[SENSOR_PROGRAM_MAX_STEPS];
+static uint32_t program_step_light[SENSOR_PROGRAM_MAX_STEPS];
+static uint16_t program_step_cycles[SENSOR_PROGRAM_MAX_STEPS];
+static volatile uint8_t program_step_count = 0;
+static volatile sensor_program_state_t program_state = SENSOR_PROGRAM_IDLE;
+static volatile uint8_t program_step = 0;
+static volatile uint16_t program_cycle = 0;
+static volatile uint8_t program_generation = 0;
+static bool program_aborted = false;
+static osStatus_t program_status = osOK;
+
+/* Semaphore to signal completion of a sensor program */
+static osSemaphoreId_t sensor_program_semaphore = NULL;
+static const osSemaphoreAttr_t sensor_program_semaphore_attrs = {
+    .name = "sensor_program_semaphore"
 };
 
 /* Semaphore to synchronize sensor control calls */
@@ -94,7 +229,23 @@ static osStatus_t sensor_control_start();
 static osStatus_t sensor_control_stop();
 static osStatus_t sensor_control_set_config(const sensor_control_config_params_t *params);
 static osStatus_t sensor_control_set_light_mode(const sensor_control_light_mode_params_t *params);
+static osStatus_t sensor_control_run_program(const sensor_control_program_params_t *params);
+static osStatus_t sensor_control_set_threshold_mode(const sensor_control_threshold_params_t *params);
+static osStatus_t sensor_control_batch_run(const sensor_control_batch_params_t *params);
+static HAL_StatusTypeDef sensor_threshold_exit();
+static HAL_StatusTypeDef sensor_threshold_center(uint16_t ch0_val);
+static uint32_t sensor_light_pending_value(sensor_light_t light, uint8_t value);
+static bool sensor_program_collect(const sensor_control_interrupt_params_t *params, const sensor_reading_t *reading);
 static osStatus_t sensor_control_interrupt(const sensor_control_interrupt_params_t *params);
+static HAL_StatusTypeDef sensor_read_status_channel_data(uint8_t *status, uint16_t *ch0_val, uint16_t *ch1_val);
+
+/* Sensor reading ring buffer functions */
+static void sensor_reading_publish(const sensor_reading_t *reading);
+static void sensor_reading_reset();
+
+/* Sensor statistics functions */
+static void sensor_stats_hist_add(uint32_t *hist, uint32_t value_us);
+static void sensor_stats_i2c_result(HAL_StatusTypeDef ret);
 
 void task_sensor_run(void *argument)
 {
@@ -111,10 +262,24 @@ void task_sensor_run(void *argument)
         return;
     }
 
-    /* Create the one-element queue to hold the latest sensor reading */
-    sensor_reading_queue = osMessageQueueNew(1, sizeof(sensor_reading_t), &sensor_reading_queue_attrs);
-    if (!sensor_reading_queue) {
-        log_e("Unable to create reading queue");
+    /* Create the event flags used to signal new sensor readings */
+    sensor_reading_flags = osEventFlagsNew(&sensor_reading_flags_attrs);
+    if (!sensor_reading_flags) {
+        log_e("Unable to create reading flags");
+        return;
+    }
+
+    /* Create the semaphore used to signal I2C transfer completion */
+    sensor_i2c_semaphore = osSemaphoreNew(1, 0, &sensor_i2c_semaphore_attrs);
+    if (!sensor_i2c_semaphore) {
+        log_e("sensor_i2c_semaphore create error");
+        return;
+    }
+
+    /* Create the semaphore used to signal sensor program completion */
+    sensor_program_semaphore = osSemaphoreNew(1, 0, &sensor_program_semaphore_attrs);
+    if (!sensor_program_semaphore) {
+        log_e("sensor_program_semaphore create error");
         return;
     }
 
@@ -144,6 +309,7 @@ void task_sensor_run(void *argument)
     for (;;) {
         if(osMessageQueueGet(sensor_control_queue, &control_event, NULL, portMAX_DELAY) == osOK) {
             osStatus_t ret = osOK;
+            TRACE_EVENT(TRACE_EVENT_SENSOR_CONTROL_BEGIN, (uint8_t)control_event.event_type, 0);
             switch (control_event.event_type) {
             case SENSOR_CONTROL_STOP:
                 ret = sensor_control_stop();
@@ -157,15 +323,30 @@ void task_sensor_run(void *argument)
             case SENSOR_CONTROL_SET_LIGHT_MODE:
                 ret = sensor_control_set_light_mode(&control_event.light_mode);
                 break;
+            case SENSOR_CONTROL_RUN_PROGRAM:
+                ret = sensor_control_run_program(&control_event.program);
+                break;
+            case SENSOR_CONTROL_SET_THRESHOLD_MODE:
+                ret = sensor_control_set_threshold_mode(&control_event.threshold);
+                break;
+            case SENSOR_CONTROL_BATCH:
+                ret = sensor_control_batch_run(&control_event.batch);
+                break;
             case SENSOR_CONTROL_INTERRUPT:
                 ret = sensor_control_interrupt(&control_event.interrupt);
                 break;
             default:
                 break;
             }
+            TRACE_EVENT(TRACE_EVENT_SENSOR_CONTROL_END, (uint8_t)control_event.event_type, (uint16_t)ret);
 
             /* Handle all external commands by propagating their completion */
-            if (control_event.event_type != SENSOR_CONTROL_INTERRUPT) {
+            if (control_event.event_type == SENSOR_CONTROL_BATCH && control_event.batch.notify_thread) {
+                /* Asynchronous batches report their results through the operations */
+                if ((int32_t)osThreadFlagsSet(control_event.batch.notify_thread, control_event.batch.notify_flags) < 0) {
+                    log_e("Unable to notify batch completion");
+                }
+            } else if (control_event.event_type != SENSOR_CONTROL_INTERRUPT) {
                 if (control_event.result) {
                     *(control_event.result) = ret;
                 }
@@ -207,9 +388,11 @@ osStatus_t sensor_control_start()
         if (ret != HAL_OK) { break; }
 
         sensor_running = false;
+        sensor_threshold_active = false;
+        sensor_threshold_pending = false;
 
         /* Clear any pending interrupt flags */
-        tsl2591_clear_als_int(&hi2c1);
+        ret = tsl2591_clear_all_int(&hi2c1);
         if (ret != HAL_OK) { break; }
 
         /* Power on the sensor */
@@ -225,7 +408,7 @@ osStatus_t sensor_control_start()
         if (ret != HAL_OK) { break; }
 
         /* Clear out any old sensor readings */
-        osMessageQueueReset(sensor_reading_queue);
+        sensor_reading_reset();
         reading_count = 0;
 
         /* Enable ALS with interrupts */
@@ -262,11 +445,31 @@ osStatus_t sensor_control_stop()
         ret = tsl2591_set_enable(&hi2c1, 0x00);
         if (ret != HAL_OK) { break; }
         sensor_running = false;
+        sensor_threshold_active = false;
+        sensor_threshold_pending = false;
+
+        /* Wake up anything waiting on a program that can no longer finish */
+        taskENTER_CRITICAL();
+        const bool program_active = program_state != SENSOR_PROGRAM_IDLE;
+        program_state = SENSOR_PROGRAM_IDLE;
+        program_generation++;
+        taskEXIT_CRITICAL();
+        if (program_active) {
+            log_d("Sensor program aborted on stop");
+            program_aborted = true;
+            program_status = osErrorResource;
+            osSemaphoreRelease(sensor_program_semaphore);
+        }
     } while (0);
 
     return hal_to_os_status(ret);
 }
 
+bool sensor_is_running()
+{
+    return sensor_running;
+}
+
 osStatus_t sensor_set_config(tsl2591_gain_t gain, tsl2591_time_t time)
 {
     if (!sensor_initialized) { return osErrorResource; }
@@ -291,12 +494,17 @@ osStatus_t sensor_control_set_config(const sensor_control_config_params_t *param
     log_d("sensor_control_set_config: %d, %d", params->gain, params->time);
 
     if (sensor_running) {
+        ret = sensor_threshold_exit();
+        if (ret != HAL_OK) {
+            return hal_to_os_status(ret);
+        }
+
         ret = tsl2591_set_config(&hi2c1, params->gain, params->time);
         if (ret == HAL_OK) {
             sensor_gain = params->gain;
             sensor_time = params->time;
             sensor_discard_next_reading = true;
-            osMessageQueueReset(sensor_reading_queue);
+            sensor_reading_reset();
         }
     } else {
         sensor_gain = params->gain;
@@ -329,75 +537,588 @@ osStatus_t sensor_control_set_light_mode(const sensor_control_light_mode_params_
 {
     //log_d("sensor_set_light_mode: %d, %d, %d", params->light, params->next_cycle, params->value);
 
+    /* Convert the parameters into pending values for the LEDs */
+    const uint32_t pending_value = sensor_light_pending_value(params->light, params->value);
+
+    taskENTER_CRITICAL();
+    if (params->next_cycle) {
+        /* Schedule the change for the next ISR invocation */
+        pending_int_light_change = pending_value;
+    } else {
+        /* Apply the change immediately */
+        light_set_reflection(pending_value & 0x000000FF);
+        light_set_transmission((pending_value & 0x0000FF00) >> 8);
+        light_change_ticks = osKernelGetTickCount();
+        light_change_us = timestamp_us_get();
+        pending_int_light_change = 0;
+    }
+    taskEXIT_CRITICAL();
+
+    return osOK;
+}
+
+/**
+ * Convert a light selection into the packed form used for pending light
+ * changes, with the reflection value in the low byte, the transmission
+ * value in the next byte, and the top bit set.
+ */
+uint32_t sensor_light_pending_value(sensor_light_t light, uint8_t value)
+{
     uint8_t pending_reflection;
     uint8_t pending_transmission;
 
-    /* Convert the parameters into pending values for the LEDs */
-    if (params->light == SENSOR_LIGHT_OFF || params->value == 0) {
+    if (light == SENSOR_LIGHT_OFF || value == 0) {
         pending_reflection = 0;
         pending_transmission = 0;
-    } else if (params->light == SENSOR_LIGHT_REFLECTION) {
-        pending_reflection = params->value;
+    } else if (light == SENSOR_LIGHT_REFLECTION) {
+        pending_reflection = value;
         pending_transmission = 0;
-    } else if (params->light == SENSOR_LIGHT_TRANSMISSION) {
+    } else if (light == SENSOR_LIGHT_TRANSMISSION) {
         pending_reflection = 0;
-        pending_transmission = params->value;
+        pending_transmission = value;
     } else {
         pending_reflection = 0;
         pending_transmission = 0;
     }
 
-    taskENTER_CRITICAL();
-    if (params->next_cycle) {
-        /* Schedule the change for the next ISR invocation */
-        pending_int_light_change = 0x80000000 | pending_reflection | (pending_transmission << 8);
-    } else {
-        /* Apply the change immediately */
-        light_set_reflection(pending_reflection);
-        light_set_transmission(pending_transmission);
-        light_change_ticks = osKernelGetTickCount();
+    return 0x80000000 | pending_reflection | (pending_transmission << 8);
+}
+
+osStatus_t sensor_control_batch(sensor_op_t *ops, uint8_t op_count)
+{
+    if (!sensor_initialized) { return osErrorResource; }
+
+    if (!ops || op_count == 0 || op_count > SENSOR_BATCH_MAX_OPS) {
+        return osErrorParameter;
+    }
+
+    osStatus_t result = osOK;
+    sensor_control_event_t control_event = {
+        .event_type = SENSOR_CONTROL_BATCH,
+        .result = &result,
+        .batch = {
+            .ops = ops,
+            .op_count = op_count,
+            .notify_thread = NULL,
+            .notify_flags = 0
+        }
+    };
+    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
+    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
+    return result;
+}
+
+osStatus_t sensor_control_batch_async(sensor_op_t *ops, uint8_t op_count, uint32_t notify_flags)
+{
+    if (!sensor_initialized) { return osErrorResource; }
+
+    if (!ops || op_count == 0 || op_count > SENSOR_BATCH_MAX_OPS || notify_flags == 0) {
+        return osErrorParameter;
+    }
+
+    osThreadId_t thread = osThreadGetId();
+    if (!thread) { return osErrorISR; }
+
+    sensor_control_event_t control_event = {
+        .event_type = SENSOR_CONTROL_BATCH,
+        .result = NULL,
+        .batch = {
+            .ops = ops,
+            .op_count = op_count,
+            .notify_thread = thread,
+            .notify_flags = notify_flags
+        }
+    };
+    return osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
+}
+
+osStatus_t sensor_control_batch_run(const sensor_control_batch_params_t *params)
+{
+    osStatus_t ret = osOK;
+
+    log_d("sensor_control_batch: %d ops", params->op_count);
+
+    for (uint8_t i = 0; i < params->op_count; i++) {
+        sensor_op_t *op = &params->ops[i];
+
+        if (ret != osOK) {
+            op->result = osErrorResource;
+            continue;
+        }
+
+        switch (op->type) {
+        case SENSOR_OP_START:
+            op->result = sensor_control_start();
+            break;
+        case SENSOR_OP_STOP:
+            op->result = sensor_control_stop();
+            break;
+        case SENSOR_OP_SET_CONFIG: {
+            const sensor_control_config_params_t config_params = {
+                .gain = op->config.gain,
+                .time = op->config.time
+            };
+            op->result = sensor_control_set_config(&config_params);
+            break;
+        }
+        case SENSOR_OP_SET_LIGHT_MODE: {
+            const sensor_control_light_mode_params_t light_mode_params = {
+                .light = op->light_mode.light,
+                .next_cycle = op->light_mode.next_cycle,
+                .value = op->light_mode.value
+            };
+            op->result = sensor_control_set_light_mode(&light_mode_params);
+            break;
+        }
+        case SENSOR_OP_SET_THRESHOLD_MODE: {
+            const sensor_control_threshold_params_t threshold_params = {
+                .enabled = op->threshold.enabled,
+                .margin_percent = op->threshold.margin_percent
+            };
+            op->result = sensor_control_set_threshold_mode(&threshold_params);
+            break;
+        }
+        default:
+            op->result = osErrorParameter;
+            break;
+        }
+
+        ret = op->result;
+    }
+
+    return ret;
+}
+
+osStatus_t sensor_run_program(const sensor_program_step_t *steps, uint8_t step_count,
+    sensor_program_result_t *results, uint32_t timeout)
+{
+    if (!sensor_initialized) { return osErrorResource; }
+
+    if (!steps || !results || step_count == 0 || step_count > SENSOR_PROGRAM_MAX_STEPS) {
+        return osErrorParameter;
+    }
+
+    osStatus_t result = osOK;
+    sensor_control_event_t control_event = {
+        .event_type = SENSOR_CONTROL_RUN_PROGRAM,
+        .result = &result,
+        .program = {
+            .steps = steps,
+            .step_count = step_count
+        }
+    };
+    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
+    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
+    if (result != osOK) {
+        return result;
+    }
+
+    if (osSemaphoreAcquire(sensor_program_semaphore, timeout) != osOK) {
+        log_w("Sensor program timeout");
+
+        /* Cancel the program, so it does not keep changing the sensor state */
+        control_event.program.steps = NULL;
+        control_event.program.step_count = 0;
+        osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
+        osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
+        return osErrorTimeout;
+    }
+
+    if (program_status != osOK) {
+        return program_status;
+    }
+
+    memcpy(results, program_results, sizeof(sensor_program_result_t) * step_count);
+    return osOK;
+}
+
+osStatus_t sensor_control_run_program(const sensor_control_program_params_t *params)
+{
+    if (params->step_count == 0) {
+        log_d("sensor_control_run_program: cancel");
+        taskENTER_CRITICAL();
+        program_state = SENSOR_PROGRAM_IDLE;
+        program_generation++;
         pending_int_light_change = 0;
+        taskEXIT_CRITICAL();
+        return osOK;
+    }
+
+    log_d("sensor_control_run_program: %d steps", params->step_count);
+
+    if (!sensor_running || program_state != SENSOR_PROGRAM_IDLE) {
+        return osErrorResource;
     }
+
+    if (sensor_threshold_exit() != HAL_OK) {
+        return osError;
+    }
+
+    /* Clear any stale completion signal from a cancelled program */
+    osSemaphoreAcquire(sensor_program_semaphore, 0);
+
+    memcpy(program_steps, params->steps, sizeof(sensor_program_step_t) * params->step_count);
+    memset(program_results, 0, sizeof(program_results));
+    program_aborted = false;
+    program_status = osOK;
+
+    /*
+     * Work out the full length of each step, which includes an extra
+     * discarded cycle whenever the step changes the sensor configuration.
+     */
+    tsl2591_gain_t prev_gain = sensor_gain;
+    tsl2591_time_t prev_time = sensor_time;
+    for (uint8_t i = 0; i < params->step_count; i++) {
+        const sensor_program_step_t *step = &program_steps[i];
+        program_step_light[i] = sensor_light_pending_value(step->light, step->light_value);
+        program_step_cycles[i] = step->settle_cycles + step->read_cycles;
+        if (step->gain != prev_gain || step->time != prev_time) {
+            program_step_cycles[i]++;
+        }
+        if (program_step_cycles[i] == 0) {
+            program_step_cycles[i] = 1;
+        }
+        prev_gain = step->gain;
+        prev_time = step->time;
+    }
+
+    /* Let the sensor interrupt start the program at the next cycle boundary */
+    taskENTER_CRITICAL();
+    program_step_count = params->step_count;
+    program_step = 0;
+    program_cycle = 0;
+    program_state = SENSOR_PROGRAM_PENDING;
+    program_generation++;
+    pending_int_light_change = 0;
     taskEXIT_CRITICAL();
 
     return osOK;
 }
 
+osStatus_t sensor_set_threshold_mode(bool enabled, uint8_t margin_percent)
+{
+    if (!sensor_initialized) { return osErrorResource; }
+
+    osStatus_t result = osOK;
+    sensor_control_event_t control_event = {
+        .event_type = SENSOR_CONTROL_SET_THRESHOLD_MODE,
+        .result = &result,
+        .threshold = {
+            .enabled = enabled,
+            .margin_percent = margin_percent
+        }
+    };
+    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
+    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
+    return result;
+}
+
+osStatus_t sensor_control_set_threshold_mode(const sensor_control_threshold_params_t *params)
+{
+    log_d("sensor_control_set_threshold_mode: %d, %d", params->enabled, params->margin_percent);
+
+    if (!params->enabled) {
+        return hal_to_os_status(sensor_threshold_exit());
+    }
+
+    if (!sensor_running || program_state != SENSOR_PROGRAM_IDLE) {
+        return osErrorResource;
+    }
+
+    /*
+     * Keep the per-cycle interrupts running until the next reading,
+     * which the window will then be centered on.
+     */
+    sensor_threshold_margin = params->margin_percent;
+    sensor_threshold_pending = true;
+
+    return osOK;
+}
+
+/**
+ * Switch the sensor back to interrupting at the end of every cycle.
+ */
+HAL_StatusTypeDef sensor_threshold_exit()
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    sensor_threshold_pending = false;
+    if (!sensor_threshold_active) {
+        return HAL_OK;
+    }
+
+    do {
+        /*
+         * Clear the interrupt flags first, so the next interrupt comes
+         * from the end of the next integration cycle rather than from
+         * a stale flag set while the ALS interrupt was disabled.
+         */
+        ret = tsl2591_clear_all_int(&hi2c1);
+        if (ret != HAL_OK) { break; }
+
+        ret = tsl2591_set_enable(&hi2c1, TSL2591_ENABLE_PON | TSL2591_ENABLE_AEN | TSL2591_ENABLE_AIEN);
+        if (ret != HAL_OK) { break; }
+
+        sensor_threshold_active = false;
+        log_d("Threshold mode disabled");
+    } while (0);
+
+    return ret;
+}
+
+/**
+ * Center the threshold window on a reading, and make sure the sensor
+ * is only interrupting on threshold crossings.
+ */
+HAL_StatusTypeDef sensor_threshold_center(uint16_t ch0_val)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    const uint32_t limit = ((sensor_time == TSL2591_TIME_100MS)
+        ? TSL2591_ANALOG_SATURATION : TSL2591_DIGITAL_SATURATION) - 1;
+    uint32_t margin = ((uint32_t)ch0_val * sensor_threshold_margin) / 100;
+    if (margin < SENSOR_THRESHOLD_MIN_MARGIN) {
+        margin = SENSOR_THRESHOLD_MIN_MARGIN;
+    }
+    const uint16_t low = (ch0_val > margin) ? ch0_val - margin : 0;
+    const uint16_t high = (ch0_val + margin < limit) ? ch0_val + margin : limit;
+
+    do {
+        ret = tsl2591_set_no_persist_int_thresholds(&hi2c1, low, high);
+        if (ret != HAL_OK) { break; }
+
+        if (!sensor_threshold_active) {
+            ret = tsl2591_set_enable(&hi2c1, TSL2591_ENABLE_PON | TSL2591_ENABLE_AEN | TSL2591_ENABLE_NPIEN);
+            if (ret != HAL_OK) { break; }
+            sensor_threshold_active = true;
+        }
+
+        log_d("Threshold window: %d..%d", low, high);
+    } while (0);
+
+    return ret;
+}
+
 osStatus_t sensor_get_next_reading(sensor_reading_t *reading, uint32_t timeout)
+{
+    return sensor_reader_get_next(SENSOR_READER_MEASUREMENT, reading, timeout);
+}
+
+osStatus_t sensor_reader_get_next(sensor_reader_t reader, sensor_reading_t *reading, uint32_t timeout)
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    if (!reading) {
+    if (reader >= SENSOR_READER_MAX || !reading) {
         return osErrorParameter;
     }
 
-    return osMessageQueueGet(sensor_reading_queue, reading, NULL, timeout);
+    const uint32_t reader_flag = 1UL << reader;
+    const uint32_t start_ticks = osKernelGetTickCount();
+    uint32_t next = reader_next_sequence[reader];
+
+    for (;;) {
+        const uint32_t head = reading_head_sequence;
+        const uint32_t base = reading_base_sequence;
+
+        /* Skip anything that was discarded by a reset of the buffer */
+        if (next <= base) {
+            next = base + 1;
+        }
+
+        if (next > head) {
+            /* Nothing new yet, so wait for the next published reading */
+            uint32_t elapsed = osKernelGetTickCount() - start_ticks;
+            if (timeout != osWaitForever && elapsed >= timeout) {
+                reader_next_sequence[reader] = next;
+                return (timeout == 0) ? osErrorResource : osErrorTimeout;
+            }
+            uint32_t remaining = (timeout == osWaitForever) ? osWaitForever : (timeout - elapsed);
+            osEventFlagsWait(sensor_reading_flags, reader_flag, osFlagsWaitAny, remaining);
+            continue;
+        }
+
+        /* Skip ahead if the reader has fallen behind the buffer */
+        if (head - next >= SENSOR_READING_SLOTS) {
+            reader_overruns[reader] += head - next - SENSOR_READING_SLOTS + 1;
+            next = head - SENSOR_READING_SLOTS + 1;
+        }
+
+        const sensor_reading_slot_t *slot = &reading_slots[next & (SENSOR_READING_SLOTS - 1)];
+        if (slot->sequence != next) {
+            /*
+             * The slot is in the middle of being overwritten, so give the
+             * sensor task a chance to finish before trying again.
+             */
+            osDelay(1);
+            continue;
+        }
+        __DMB();
+        memcpy(reading, &slot->reading, sizeof(sensor_reading_t));
+        __DMB();
+        if (slot->sequence != next) {
+            /* The slot was overwritten while it was being copied */
+            continue;
+        }
+
+        reader_next_sequence[reader] = next + 1;
+        return osOK;
+    }
+}
+
+void sensor_reader_flush(sensor_reader_t reader)
+{
+    if (reader >= SENSOR_READER_MAX) { return; }
+    reader_next_sequence[reader] = reading_head_sequence + 1;
+}
+
+uint32_t sensor_reader_get_overruns(sensor_reader_t reader)
+{
+    if (reader >= SENSOR_READER_MAX) { return 0; }
+    return reader_overruns[reader];
+}
+
+void sensor_get_stats(sensor_stats_t *stats)
+{
+    if (!stats) { return; }
+
+    taskENTER_CRITICAL();
+    memcpy(stats, &sensor_stats, sizeof(sensor_stats_t));
+    stats->queue_errors = sensor_stats_queue_errors;
+    stats->overwritten = 0;
+    for (uint8_t i = 0; i < SENSOR_READER_MAX; i++) {
+        stats->overwritten += reader_overruns[i];
+    }
+    taskEXIT_CRITICAL();
+}
+
+void sensor_reset_stats()
+{
+    taskENTER_CRITICAL();
+    memset(&sensor_stats, 0, sizeof(sensor_stats_t));
+    sensor_stats_queue_errors = 0;
+    for (uint8_t i = 0; i < SENSOR_READER_MAX; i++) {
+        reader_overruns[i] = 0;
+    }
+    taskEXIT_CRITICAL();
+}
+
+/**
+ * Add a duration to one of the statistics histograms.
+ */
+void sensor_stats_hist_add(uint32_t *hist, uint32_t value_us)
+{
+    uint8_t bin = 0;
+    uint32_t limit = SENSOR_STATS_HIST_BASE_US;
+
+    while (bin < SENSOR_STATS_HIST_BINS - 1 && value_us >= limit) {
+        bin++;
+        limit <<= 1;
+    }
+
+    taskENTER_CRITICAL();
+    hist[bin]++;
+    taskEXIT_CRITICAL();
+}
+
+/**
+ * Count the result of a sensor I2C transaction, if it failed.
+ */
+void sensor_stats_i2c_result(HAL_StatusTypeDef ret)
+{
+    if (ret == HAL_OK) { return; }
+
+    taskENTER_CRITICAL();
+    if (ret == HAL_TIMEOUT) {
+        sensor_stats.i2c_timeouts++;
+    } else {
+        sensor_stats.i2c_errors++;
+    }
+    taskEXIT_CRITICAL();
+}
+
+void sensor_reading_publish(const sensor_reading_t *reading)
+{
+    const uint32_t next = reading_head_sequence + 1;
+    sensor_reading_slot_t *slot = &reading_slots[next & (SENSOR_READING_SLOTS - 1)];
+
+    slot->sequence = 0;
+    __DMB();
+    memcpy(&slot->reading, reading, sizeof(sensor_reading_t));
+    __DMB();
+    slot->sequence = next;
+    __DMB();
+    reading_head_sequence = next;
+    sensor_stats.readings++;
+
+    osEventFlagsSet(sensor_reading_flags, (1UL << SENSOR_READER_MAX) - 1);
+}
+
+void sensor_reading_reset()
+{
+    reading_base_sequence = reading_head_sequence;
 }
 
 void sensor_int_handler()
 {
+    /* Sample the timestamp first, so it is as close to the interrupt as possible */
+    const uint32_t sensor_us = timestamp_us_get();
+
+    TRACE_EVENT(TRACE_EVENT_SENSOR_ISR, 0, (uint16_t)(reading_count + 1));
+
     if (!sensor_initialized) { return; }
 
     sensor_control_event_t control_event = {
         .event_type = SENSOR_CONTROL_INTERRUPT,
         .interrupt = {
-            .sensor_ticks = osKernelGetTickCount()
+            .sensor_ticks = osKernelGetTickCount(),
+            .sensor_us = sensor_us
         }
     };
 
-    /* Apply any pending light change values */
+    control_event.interrupt.program_step = SENSOR_PROGRAM_STEP_NONE;
+    control_event.interrupt.program_next = SENSOR_PROGRAM_STEP_NONE;
+    control_event.interrupt.program_done = false;
+
     UBaseType_t interrupt_status = taskENTER_CRITICAL_FROM_ISR();
+
+    control_event.interrupt.program_generation = program_generation;
+
+    /* Advance any running sensor program to its next cycle */
+    if (program_state == SENSOR_PROGRAM_RUNNING) {
+        control_event.interrupt.program_step = program_step;
+        control_event.interrupt.program_cycle = program_cycle;
+        if (++program_cycle >= program_step_cycles[program_step]) {
+            program_cycle = 0;
+            if (++program_step < program_step_count) {
+                control_event.interrupt.program_next = program_step;
+                pending_int_light_change = program_step_light[program_step];
+            } else {
+                control_event.interrupt.program_done = true;
+                program_state = SENSOR_PROGRAM_IDLE;
+            }
+        }
+    } else if (program_state == SENSOR_PROGRAM_PENDING) {
+        program_state = SENSOR_PROGRAM_RUNNING;
+        control_event.interrupt.program_next = 0;
+        pending_int_light_change = program_step_light[0];
+    }
+
+    /* Apply any pending light change values */
     if ((pending_int_light_change & 0x80000000) == 0x80000000) {
         light_set_reflection(pending_int_light_change & 0x000000FF);
         light_set_transmission((pending_int_light_change & 0x0000FF00) >> 8);
         light_change_ticks = osKernelGetTickCount();
+        light_change_us = timestamp_us_get();
         pending_int_light_change = 0;
     }
     control_event.interrupt.light_ticks = light_change_ticks;
+    control_event.interrupt.light_us = light_change_us;
     control_event.interrupt.reading_count = ++reading_count;
     taskEXIT_CRITICAL_FROM_ISR(interrupt_status);
 
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, 0);
+    if (osMessageQueuePut(sensor_control_queue, &control_event, 0, 0) != osOK) {
+        sensor_stats_queue_errors++;
+    }
 }
 
 osStatus_t sensor_control_interrupt(const sensor_control_interrupt_params_t *params)
@@ -406,42 +1127,61 @@ osStatus_t sensor_control_interrupt(const sensor_control_interrupt_params_t *par
     uint8_t status = 0;
     sensor_reading_t reading = {0};
     bool has_channel_data = false;
+    const uint32_t dispatch_us = timestamp_us_get() - params->sensor_us;
+    sensor_control_interrupt_params_t current;
 
     //log_d("sensor_control_interrupt");
 
+    /*
+     * Events already queued when a program was cancelled or replaced
+     * still refer to its steps, so treat them as outside of any program.
+     */
+    if (params->program_generation != program_generation) {
+        current = *params;
+        current.program_step = SENSOR_PROGRAM_STEP_NONE;
+        current.program_next = SENSOR_PROGRAM_STEP_NONE;
+        current.program_done = false;
+        params = &current;
+    }
+
+    sensor_stats_hist_add(sensor_stats.latency_hist, dispatch_us);
+
     if (!sensor_running) {
         log_w("Unexpected sensor interrupt!");
     }
 
     do {
-        /* Get the status register */
-        ret = tsl2591_get_status(&hi2c1, &status);
+        /* Get the status register and full channel data */
+        TRACE_EVENT(TRACE_EVENT_I2C_BEGIN, 0, 0);
+        ret = sensor_read_status_channel_data(&status, &reading.ch0_val, &reading.ch1_val);
+        TRACE_EVENT(TRACE_EVENT_I2C_END, 0, (uint16_t)ret);
         if (ret != HAL_OK) { break; }
 
-        /* Make sure we actually triggered the ALS interrupt */
-        if ((status & TSL2591_STATUS_AINT) == 0) {
+        /* Make sure we actually triggered the ALS or no-persist interrupt */
+        if ((status & (TSL2591_STATUS_AINT | TSL2591_STATUS_NPINTR)) == 0) {
             break;
         }
 
-        /* Clear the ALS interrupt */
-        ret = tsl2591_clear_als_int(&hi2c1);
+        /* Clear both interrupts, as either may be set in threshold mode */
+        ret = tsl2591_clear_all_int(&hi2c1);
+        sensor_stats_i2c_result(ret);
         if (ret != HAL_OK) { break; }
 
         if (sensor_discard_next_reading) {
             sensor_discard_next_reading = false;
+            sensor_stats.discarded++;
             break;
         }
 
-        /* Read full channel data */
-        ret = tsl2591_get_full_channel_data(&hi2c1, &reading.ch0_val, &reading.ch1_val);
-        if (ret != HAL_OK) { break; }
-
         /* Fill out other reading fields */
         reading.gain = sensor_gain;
         reading.time = sensor_time;
         reading.reading_ticks = params->sensor_ticks;
         reading.light_ticks = params->light_ticks;
         reading.reading_count = params->reading_count;
+        reading.reading_us = params->sensor_us;
+        reading.light_us = params->light_us;
+        reading.dispatch_us = dispatch_us;
 
         has_channel_data = true;
     } while (0);
@@ -452,11 +1192,132 @@ osStatus_t sensor_control_interrupt(const sensor_control_interrupt_params_t *par
             reading.ch0_val, reading.ch1_val,
             sensor_gain, tsl2591_get_time_value_ms(sensor_time));
 
-        cdc_send_raw_sensor_reading(&reading);
+        if (sensor_program_collect(params, &reading)) {
+            /* Stop a program as soon as one of its readings saturates */
+            log_d("Sensor program aborted on saturation");
+            taskENTER_CRITICAL();
+            program_state = SENSOR_PROGRAM_IDLE;
+            program_generation++;
+            pending_int_light_change = 0;
+            taskEXIT_CRITICAL();
+            program_aborted = true;
+            osSemaphoreRelease(sensor_program_semaphore);
+        }
 
-        QueueHandle_t queue = (QueueHandle_t)sensor_reading_queue;
-        xQueueOverwrite(queue, &reading);
+        sensor_reading_publish(&reading);
+
+        cdc_notify_raw_sensor_reading();
+
+        /* Move the threshold window to follow the latest reading */
+        if (sensor_threshold_active || sensor_threshold_pending) {
+            sensor_threshold_pending = false;
+            if (sensor_threshold_center(reading.ch0_val) != HAL_OK) {
+                log_e("Unable to set threshold window");
+            }
+        }
+    }
+
+    /* Apply the sensor configuration for a newly started program step */
+    if (params->program_next != SENSOR_PROGRAM_STEP_NONE && !program_aborted) {
+        const sensor_program_step_t *step = &program_steps[params->program_next];
+        if (step->gain != sensor_gain || step->time != sensor_time) {
+            const sensor_control_config_params_t config_params = {
+                .gain = step->gain,
+                .time = step->time
+            };
+            if (sensor_control_set_config(&config_params) != osOK) {
+                log_e("Unable to set program step config");
+            }
+        }
+    }
+
+    if (params->program_done && !program_aborted) {
+        log_d("Sensor program complete");
+        osSemaphoreRelease(sensor_program_semaphore);
     }
 
     return hal_to_os_status(ret);
 }
+
+/**
+ * Add a reading to the result for its sensor program step, if it falls
+ * within the collected part of that step.
+ *
+ * @return True if the collected reading was saturated
+ */
+bool sensor_program_collect(const sensor_control_interrupt_params_t *params, const sensor_reading_t *reading)
+{
+    if (params->program_step >= program_step_count || program_aborted) { return false; }
+
+    const sensor_program_step_t *step = &program_steps[params->program_step];
+    if (params->program_cycle < program_step_cycles[params->program_step] - step->read_cycles) {
+        return false;
+    }
+
+    sensor_program_result_t *result = &program_results[params->program_step];
+    result->count++;
+    result->ch0_sum += reading->ch0_val;
+    result->ch1_sum += reading->ch1_val;
+    if (reading->ch0_val == 0) {
+        result->ch0_zero = true;
+    } else {
+        result->ch0_log2_sum += fixmath_log2_u32(reading->ch0_val);
+    }
+    if (reading->ch1_val == 0) {
+        result->ch1_zero = true;
+    } else {
+        result->ch1_log2_sum += fixmath_log2_u32(reading->ch1_val);
+    }
+    if (sensor_is_reading_saturated(reading)) {
+        result->saturated = true;
+        return true;
+    }
+    return false;
+}
+
+HAL_StatusTypeDef sensor_read_status_channel_data(uint8_t *status, uint16_t *ch0_val, uint16_t *ch1_val)
+{
+    HAL_StatusTypeDef ret;
+
+    /* Make sure there is no stale completion signal */
+    osSemaphoreAcquire(sensor_i2c_semaphore, 0);
+    sensor_i2c_result = HAL_OK;
+
+    const uint32_t start_us = timestamp_us_get();
+    ret = tsl2591_get_status_channel_data_it(&hi2c1, sensor_i2c_buffer);
+    if (ret != HAL_OK) {
+        log_e("Unable to start sensor read: %d", ret);
+        sensor_stats_i2c_result(ret);
+        return ret;
+    }
+
+    /* Block until the transfer completes, letting other tasks run */
+    if (osSemaphoreAcquire(sensor_i2c_semaphore, SENSOR_I2C_TIMEOUT) != osOK) {
+        log_e("Sensor read timeout");
+        sensor_stats_i2c_result(HAL_TIMEOUT);
+
+        /* Reset the peripheral, so the stuck transfer does not block future ones */
+        if (i2c1_reset() != HAL_OK) {
+            log_e("Unable to reset sensor I2C");
+        }
+        return HAL_TIMEOUT;
+    }
+    sensor_stats_hist_add(sensor_stats.i2c_hist, timestamp_us_get() - start_us);
+
+    if (sensor_i2c_result != HAL_OK) {
+        log_e("Sensor read error: %d", sensor_i2c_result);
+        sensor_stats_i2c_result(sensor_i2c_result);
+        return sensor_i2c_result;
+    }
+
+    tsl2591_parse_status_channel_data(sensor_i2c_buffer, status, ch0_val, ch1_val);
+    return HAL_OK;
+}
+
+void sensor_i2c_completion_handler(HAL_StatusTypeDef result)
+{
+    if (!sensor_i2c_semaphore) { return; }
+
+    sensor_i2c_result = result;
+    osSemaphoreRelease(sensor_i2c_semaphore);
+}
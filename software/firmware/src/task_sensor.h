@@ -12,6 +12,122 @@
 #include "tsl2591.h"
 #include "sensor.h"
 
+/**
+ * Consumers of sensor readings.
+ *
+ * Each reader keeps its own position within the sensor reading buffer,
+ * so readings can be consumed at different rates without one reader
+ * taking them away from another.
+ */
+typedef enum {
+    SENSOR_READER_MEASUREMENT = 0, /*!< Measurement and calibration routines */
+    SENSOR_READER_DIAGNOSTICS,     /*!< On-device sensor diagnostics menu */
+    SENSOR_READER_CDC,             /*!< Raw reading stream to the USB host */
+    SENSOR_READER_MAX
+} sensor_reader_t;
+
+/**
+ * Number of bins in each sensor statistics histogram.
+ */
+#define SENSOR_STATS_HIST_BINS 8
+
+/**
+ * Upper bound of the first sensor statistics histogram bin, in microseconds.
+ * Each following bin is twice as wide as the one before it, and the last
+ * bin collects everything that does not fit into the others.
+ */
+#define SENSOR_STATS_HIST_BASE_US 64
+
+/**
+ * Counters describing the health of the sensor reading pipeline.
+ */
+typedef struct {
+    uint32_t readings;             /*!< Readings published to the reading buffer */
+    uint32_t overwritten;          /*!< Readings overwritten before all readers consumed them */
+    uint32_t queue_errors;         /*!< Interrupt events dropped because the control queue was full */
+    uint32_t discarded;            /*!< Readings discarded following a sensor start or config change */
+    uint32_t i2c_errors;           /*!< Failed sensor I2C transactions */
+    uint32_t i2c_timeouts;         /*!< Sensor I2C transactions that timed out */
+    uint32_t i2c_hist[SENSOR_STATS_HIST_BINS];     /*!< Histogram of sensor read transaction durations */
+    uint32_t latency_hist[SENSOR_STATS_HIST_BINS]; /*!< Histogram of interrupt to sensor task latency */
+} sensor_stats_t;
+
+/**
+ * Maximum number of operations in a sensor control batch.
+ */
+#define SENSOR_BATCH_MAX_OPS 8
+
+/**
+ * Sensor control batch operation types.
+ */
+typedef enum {
+    SENSOR_OP_START = 0,         /*!< Equivalent to sensor_start() */
+    SENSOR_OP_STOP,              /*!< Equivalent to sensor_stop() */
+    SENSOR_OP_SET_CONFIG,        /*!< Equivalent to sensor_set_config() */
+    SENSOR_OP_SET_LIGHT_MODE,    /*!< Equivalent to sensor_set_light_mode() */
+    SENSOR_OP_SET_THRESHOLD_MODE /*!< Equivalent to sensor_set_threshold_mode() */
+} sensor_op_type_t;
+
+/**
+ * A single operation within a sensor control batch.
+ */
+typedef struct {
+    sensor_op_type_t type;   /*!< Operation to perform */
+    union {
+        struct {
+            tsl2591_gain_t gain;
+            tsl2591_time_t time;
+        } config;            /*!< Parameters for SENSOR_OP_SET_CONFIG */
+        struct {
+            sensor_light_t light;
+            bool next_cycle;
+            uint8_t value;
+        } light_mode;        /*!< Parameters for SENSOR_OP_SET_LIGHT_MODE */
+        struct {
+            bool enabled;
+            uint8_t margin_percent;
+        } threshold;         /*!< Parameters for SENSOR_OP_SET_THRESHOLD_MODE */
+    };
+    osStatus_t result;       /*!< Result of the operation, set when the batch completes */
+} sensor_op_t;
+
+/**
+ * Maximum number of steps in a sensor program.
+ */
+#define SENSOR_PROGRAM_MAX_STEPS 8
+
+/**
+ * A single step of a sensor program.
+ *
+ * Each step begins at the end of an integration cycle, at which point
+ * its light setting is applied from the sensor interrupt and its gain
+ * and integration time are applied by the sensor task. If the gain or
+ * integration time differ from the previous step, then the first cycle
+ * of the step is automatically discarded and not counted below.
+ */
+typedef struct {
+    sensor_light_t light;    /*!< Light source to turn on, or SENSOR_LIGHT_OFF */
+    uint8_t light_value;     /*!< Brightness of the light source */
+    tsl2591_gain_t gain;     /*!< Sensor ADC gain */
+    tsl2591_time_t time;     /*!< Sensor ADC integration time */
+    uint8_t settle_cycles;   /*!< Cycles to wait before collecting readings */
+    uint8_t read_cycles;     /*!< Cycles whose readings are collected into the step result */
+} sensor_program_step_t;
+
+/**
+ * Readings collected during a single step of a sensor program.
+ */
+typedef struct {
+    uint8_t count;           /*!< Number of readings collected */
+    bool saturated;          /*!< True if any collected reading was saturated */
+    bool ch0_zero;           /*!< True if any collected CH0 reading was zero */
+    bool ch1_zero;           /*!< True if any collected CH1 reading was zero */
+    uint32_t ch0_sum;        /*!< Sum of the CH0 readings */
+    uint32_t ch1_sum;        /*!< Sum of the CH1 readings */
+    int32_t ch0_log2_sum;    /*!< Sum of log2 of the non-zero CH0 readings, in Q16.16 */
+    int32_t ch1_log2_sum;    /*!< Sum of log2 of the non-zero CH1 readings, in Q16.16 */
+} sensor_program_result_t;
+
 /**
  * Start the sensor task.
  *
@@ -34,6 +150,11 @@ osStatus_t sensor_start();
  */
 osStatus_t sensor_stop();
 
+/**
+ * Check if the sensor is currently enabled and taking readings.
+ */
+bool sensor_is_running();
+
 /**
  * Set the sensor configuration.
  * If called with the sensor enabled, any pending or future sensor readings
@@ -46,6 +167,31 @@ osStatus_t sensor_stop();
  */
 osStatus_t sensor_set_config(tsl2591_gain_t gain, tsl2591_time_t time);
 
+/**
+ * Switch the sensor between per-cycle and threshold interrupts.
+ *
+ * Normally the sensor interrupts at the end of every integration cycle,
+ * and every reading is fetched and published. In threshold mode, the
+ * sensor only interrupts when the CH0 reading leaves a window centered
+ * on the last published reading, using the no-persist interrupt. Each
+ * such reading is published as usual, and the window is then re-centered
+ * on it. The upper edge of the window never goes above the saturation
+ * point, so saturation always produces a reading.
+ *
+ * This is intended for monitoring the sensor while idle, such as
+ * detecting a target being placed or removed, without waking up and
+ * using the I2C bus on every integration cycle.
+ *
+ * The window is centered on the first reading taken after threshold
+ * mode is enabled. Changing the sensor configuration, or running a
+ * sensor program, automatically switches back to per-cycle interrupts.
+ * The sensor must already be running.
+ *
+ * @param enabled True to enable threshold mode, false for per-cycle interrupts
+ * @param margin_percent Half-width of the window, as a percentage of the center reading
+ */
+osStatus_t sensor_set_threshold_mode(bool enabled, uint8_t margin_percent);
+
 /**
  * Change the state of the sensor read light sources.
  *
@@ -60,20 +206,152 @@ osStatus_t sensor_set_config(tsl2591_gain_t gain, tsl2591_time_t time);
  */
 osStatus_t sensor_set_light_mode(sensor_light_t light, bool next_cycle, uint8_t value);
 
+/**
+ * Run an ordered list of sensor control operations as a single request.
+ *
+ * All the operations are handed to the sensor task together, and are
+ * run back to back without returning to the caller in between. This
+ * saves the queue round trip and context switches that would otherwise
+ * come with each individual control call.
+ *
+ * Operations are run in order, stopping at the first one that fails.
+ * The result field of each operation is set, with any operations that
+ * were not run set to osErrorResource.
+ *
+ * @param ops Operations to run, which also receive their results
+ * @param op_count Number of operations, up to SENSOR_BATCH_MAX_OPS
+ * @return osOK if all operations succeeded, otherwise the first failure
+ */
+osStatus_t sensor_control_batch(sensor_op_t *ops, uint8_t op_count);
+
+/**
+ * Submit an ordered list of sensor control operations without waiting.
+ *
+ * This behaves like sensor_control_batch(), except that it returns as
+ * soon as the batch has been queued. Completion is signaled by setting
+ * the provided thread flags on the thread that submitted the batch,
+ * which can then be waited for with osThreadFlagsWait().
+ *
+ * The operations array must remain valid until completion is signaled,
+ * and the results should not be read until then.
+ *
+ * @param ops Operations to run, which also receive their results
+ * @param op_count Number of operations, up to SENSOR_BATCH_MAX_OPS
+ * @param notify_flags Thread flags to set on completion
+ * @return osOK if the batch was queued
+ */
+osStatus_t sensor_control_batch_async(sensor_op_t *ops, uint8_t op_count, uint32_t notify_flags);
+
+/**
+ * Run a sequence of per-cycle sensor actions, and collect the readings.
+ *
+ * The program is stepped through by the sensor interrupt and the sensor
+ * task, so light changes land exactly on integration cycle boundaries
+ * and the caller is not woken until the whole program has finished.
+ * The sensor must already be running. The program starts at the end
+ * of the current integration cycle, and the lights are left in the
+ * state set by the last step.
+ *
+ * Readings taken during the program are still published to the
+ * sensor readers as usual.
+ *
+ * If a reading collected by any step is saturated, the program ends
+ * immediately at that cycle and the remaining steps are not run.
+ * The saturated flag is set in the result of that step.
+ *
+ * @param steps Program steps to run
+ * @param step_count Number of program steps, up to SENSOR_PROGRAM_MAX_STEPS
+ * @param results Array of step_count results to populate
+ * @param timeout Amount of time to wait for the program to finish
+ * @return osOK on success, osErrorResource if the sensor was stopped before
+ *         the program finished, osErrorTimeout if the program did not finish in time
+ */
+osStatus_t sensor_run_program(const sensor_program_step_t *steps, uint8_t step_count,
+    sensor_program_result_t *results, uint32_t timeout);
+
 /**
  * Get the next reading from the sensor.
  * If no reading is currently available, then this function will block
  * until the completion of the next sensor integration cycle.
  *
+ * This is a shortcut for reading as SENSOR_READER_MEASUREMENT.
+ *
  * @param reading Sensor reading data
  * @param timeout Amount of time to wait for a reading to become available
  * @return osOK on success, osErrorTimeout on timeout
  */
 osStatus_t sensor_get_next_reading(sensor_reading_t *reading, uint32_t timeout);
 
+/**
+ * Get the next unread sensor reading for a particular reader.
+ *
+ * Readings are returned in the order they were taken. If the reader has
+ * fallen far enough behind that unread readings were overwritten, then
+ * it will skip ahead to the oldest reading still available and the
+ * skipped readings will be added to its overrun count.
+ *
+ * Readings taken before the sensor was last started, or before its
+ * configuration was last changed, are discarded and never returned.
+ *
+ * If no reading is currently available, then this function will block
+ * until the completion of the next sensor integration cycle.
+ *
+ * @param reader The reader requesting the reading
+ * @param reading Sensor reading data
+ * @param timeout Amount of time to wait for a reading to become available
+ * @return osOK on success, osErrorTimeout on timeout
+ */
+osStatus_t sensor_reader_get_next(sensor_reader_t reader, sensor_reading_t *reading, uint32_t timeout);
+
+/**
+ * Discard all readings that a reader has not yet consumed.
+ *
+ * This is intended for readers that leave the sensor running while they
+ * are not consuming readings, so that stale readings can be dropped
+ * without counting them as overruns.
+ *
+ * @param reader The reader to flush
+ */
+void sensor_reader_flush(sensor_reader_t reader);
+
+/**
+ * Get the number of readings a reader has missed because it fell behind.
+ *
+ * @param reader The reader to query
+ * @return Total number of readings skipped over by the reader
+ */
+uint32_t sensor_reader_get_overruns(sensor_reader_t reader);
+
+/**
+ * Get a snapshot of the sensor pipeline statistics.
+ *
+ * The overwritten count is the total of the overrun counts of all
+ * readers, so a reading missed by more than one reader is counted once
+ * for each of them.
+ *
+ * @param stats Structure to populate
+ */
+void sensor_get_stats(sensor_stats_t *stats);
+
+/**
+ * Reset all the sensor pipeline statistics to zero, including the
+ * overrun counts of all readers.
+ */
+void sensor_reset_stats();
+
 /**
  * Sensor interrupt handler.
  */
 void sensor_int_handler();
 
+/**
+ * Sensor I2C transfer completion handler.
+ *
+ * This should be called from the HAL I2C callbacks when an
+ * interrupt-driven transfer on the sensor's I2C bus has finished.
+ *
+ * @param result HAL_OK if the transfer completed, or an error otherwise
+ */
+void sensor_i2c_completion_handler(HAL_StatusTypeDef result);
+
 #endif /* TASK_SENSOR_H */
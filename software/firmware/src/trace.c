@@ -0,0 +1,80 @@
+#include "trace.h"
+
+#ifdef EVENT_TRACE
+
+#include <stdbool.h>
+
+#include "stm32l0xx_hal.h"
+#include "util.h"
+
+typedef struct {
+    uint32_t timestamp;
+    uint8_t type;
+    uint8_t id;
+    uint16_t arg;
+} trace_event_t;
+
+_Static_assert((TRACE_BUFFER_EVENTS & (TRACE_BUFFER_EVENTS - 1)) == 0, "TRACE_BUFFER_EVENTS must be a power of two");
+
+static trace_event_t trace_buffer[TRACE_BUFFER_EVENTS];
+static volatile uint32_t trace_count = 0;
+static volatile bool trace_paused = false;
+
+void trace_record(trace_event_type_t type, uint8_t id, uint16_t arg)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (!trace_paused) {
+        trace_event_t *event = &trace_buffer[trace_count & (TRACE_BUFFER_EVENTS - 1)];
+        event->timestamp = timestamp_us_get();
+        event->type = (uint8_t)type;
+        event->id = id;
+        event->arg = arg;
+        trace_count++;
+    }
+
+    if (!primask) {
+        __enable_irq();
+    }
+}
+
+void trace_task_switched_in(uint32_t task_number)
+{
+    trace_record(TRACE_EVENT_TASK_SWITCH, (uint8_t)task_number, 0);
+}
+
+void trace_pause()
+{
+    trace_paused = true;
+}
+
+void trace_resume()
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    trace_count = 0;
+    trace_paused = false;
+
+    if (!primask) {
+        __enable_irq();
+    }
+}
+
+bool trace_get_record(size_t index, uint8_t *record)
+{
+    const uint32_t count = trace_count;
+    const uint32_t available = (count < TRACE_BUFFER_EVENTS) ? count : TRACE_BUFFER_EVENTS;
+
+    if (!record || index >= available) { return false; }
+
+    const trace_event_t *event = &trace_buffer[(count - available + index) & (TRACE_BUFFER_EVENTS - 1)];
+    copy_from_u32(record, event->timestamp);
+    record[4] = event->type;
+    record[5] = event->id;
+    copy_from_u16(record + 6, event->arg);
+    return true;
+}
+
+#endif /* EVENT_TRACE */
@@ -0,0 +1,116 @@
+/*
+ * Event trace recorder, for building a timeline of what the firmware is
+ * doing while chasing down latency problems.
+ *
+ * When the firmware is built with EVENT_TRACE defined, events are written
+ * as compact binary records into a ring buffer in RAM, where the oldest
+ * events are overwritten by new ones. The buffer can then be dumped over
+ * USB CDC and converted into a trace viewer format on the host.
+ *
+ * Without EVENT_TRACE, the trace macros compile to nothing.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Trace event types.
+ *
+ * Events with a begin and end pair mark a span of time within the task
+ * that was running when they were recorded.
+ */
+typedef enum {
+    TRACE_EVENT_NONE = 0,
+    TRACE_EVENT_TASK_SWITCH,     /*!< Task switched in, id is the task number */
+    TRACE_EVENT_SENSOR_ISR,      /*!< Sensor interrupt, arg is the reading count */
+    TRACE_EVENT_SENSOR_CONTROL_BEGIN, /*!< Sensor task started handling a control event, id is the event type */
+    TRACE_EVENT_SENSOR_CONTROL_END,   /*!< Sensor task finished handling a control event, arg is the result */
+    TRACE_EVENT_I2C_BEGIN,       /*!< Sensor I2C read started */
+    TRACE_EVENT_I2C_END,         /*!< Sensor I2C read finished, arg is the HAL result */
+    TRACE_EVENT_CDC_WRITE,       /*!< Data written to the CDC device, arg is the length */
+    TRACE_EVENT_DISPLAY_BEGIN,   /*!< Display buffer flush started */
+    TRACE_EVENT_DISPLAY_END,     /*!< Display buffer flush finished */
+    TRACE_EVENT_MAX
+} trace_event_type_t;
+
+/**
+ * Size of an encoded trace record, in bytes.
+ */
+#define TRACE_RECORD_SIZE 8
+
+#ifdef EVENT_TRACE
+
+/**
+ * Number of events held in the trace ring buffer.
+ *
+ * This must be a power of two, and can be overridden from the build
+ * settings. Each event takes 8 bytes of RAM.
+ *
+ * Every task switch is recorded, so while the firmware is busy the buffer
+ * fills at several events per millisecond. At the default size, that means
+ * a dump only covers the last few milliseconds of activity leading up to
+ * it, and a larger buffer is needed to capture a whole measurement.
+ * While the firmware is idle, the same buffer covers a much longer span.
+ */
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS 128
+#endif
+
+/**
+ * Record a trace event.
+ *
+ * This is safe to call from any context, including interrupt handlers
+ * and the RTOS scheduler.
+ *
+ * @param type Event type
+ * @param id Event specific identifier
+ * @param arg Event specific argument
+ */
+void trace_record(trace_event_type_t type, uint8_t id, uint16_t arg);
+
+/**
+ * Record a task switch.
+ *
+ * This is called from the scheduler through the traceTASK_SWITCHED_IN()
+ * hook in FreeRTOSConfig.h.
+ *
+ * @param task_number RTOS task number of the task being switched in
+ */
+void trace_task_switched_in(uint32_t task_number);
+
+/**
+ * Stop recording events, so the buffer can be read out consistently.
+ */
+void trace_pause();
+
+/**
+ * Clear the trace buffer and resume recording events.
+ */
+void trace_resume();
+
+/**
+ * Copy the next recorded event out of the buffer, oldest first.
+ *
+ * Recording should be paused while events are being read out.
+ * Each record is encoded as a big-endian timestamp in microseconds
+ * (4 bytes), followed by the type (1 byte), id (1 byte), and
+ * big-endian argument (2 bytes).
+ *
+ * @param index Index of the event, starting from the oldest
+ * @param record Buffer of TRACE_RECORD_SIZE bytes to encode the event into
+ * @return True if an event was copied, false if the index is past the end
+ */
+bool trace_get_record(size_t index, uint8_t *record);
+
+#define TRACE_EVENT(type, id, arg) trace_record((type), (id), (arg))
+
+#else
+
+#define TRACE_EVENT(type, id, arg)
+
+#endif /* EVENT_TRACE */
+
+#endif /* TRACE_H */
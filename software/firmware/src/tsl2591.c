@@ -6,6 +6,15 @@
 
 #include <elog.h>
 
+#ifdef SENSOR_SIMULATION
+/* Route all sensor bus traffic to the simulated device */
+#include "tsl2591_sim.h"
+#define HAL_I2C_Mem_Read tsl2591_sim_mem_read
+#define HAL_I2C_Mem_Write tsl2591_sim_mem_write
+#define HAL_I2C_Mem_Read_IT tsl2591_sim_mem_read_it
+#define HAL_I2C_Master_Transmit tsl2591_sim_master_transmit
+#endif
+
 /* I2C device address */
 static const uint8_t TSL2591_ADDRESS = 0x29 << 1; // Use 8-bit address
 
@@ -124,6 +133,13 @@ HAL_StatusTypeDef tsl2591_clear_als_int(I2C_HandleTypeDef *hi2c)
     return ret;
 }
 
+HAL_StatusTypeDef tsl2591_clear_all_int(I2C_HandleTypeDef *hi2c)
+{
+    uint8_t data = TSL2591_CMD_INT_CLEAR_ALS_NO_PERSIST;
+    HAL_StatusTypeDef ret = HAL_I2C_Master_Transmit(hi2c, TSL2591_ADDRESS, &data, 1, HAL_MAX_DELAY);
+    return ret;
+}
+
 HAL_StatusTypeDef tsl2591_set_config(I2C_HandleTypeDef *hi2c, tsl2591_gain_t gain, tsl2591_time_t time)
 {
     if (gain < TSL2591_GAIN_LOW || gain > TSL2591_GAIN_MAXIMUM) {
@@ -189,6 +205,21 @@ HAL_StatusTypeDef tsl2591_set_als_high_int_threshold(I2C_HandleTypeDef *hi2c, ui
     return ret;
 }
 
+HAL_StatusTypeDef tsl2591_set_no_persist_int_thresholds(I2C_HandleTypeDef *hi2c, uint16_t low, uint16_t high)
+{
+    uint8_t data[4];
+    data[0] = low & 0x00FF;
+    data[1] = (low & 0xFF00) >> 8;
+    data[2] = high & 0x00FF;
+    data[3] = (high & 0xFF00) >> 8;
+
+    HAL_StatusTypeDef ret = HAL_I2C_Mem_Write(hi2c, TSL2591_ADDRESS,
+        TSL2591_CMD_NORMAL | TSL2591_NPAILTL, I2C_MEMADD_SIZE_8BIT,
+        data, sizeof(data), HAL_MAX_DELAY);
+
+    return ret;
+}
+
 HAL_StatusTypeDef tsl2591_set_persist(I2C_HandleTypeDef *hi2c, tsl2591_persist_t value)
 {
     uint8_t data = value & 0x0F;
@@ -259,6 +290,53 @@ HAL_StatusTypeDef tsl2591_get_full_channel_data(I2C_HandleTypeDef *hi2c, uint16_
     return HAL_OK;
 }
 
+HAL_StatusTypeDef tsl2591_get_status_channel_data(I2C_HandleTypeDef *hi2c, uint8_t *status, uint16_t *ch0_val, uint16_t *ch1_val)
+{
+    HAL_StatusTypeDef ret;
+    uint8_t data[TSL2591_STATUS_CHANNEL_DATA_SIZE];
+
+    ret = HAL_I2C_Mem_Read(hi2c, TSL2591_ADDRESS,
+        TSL2591_CMD_NORMAL | TSL2591_STATUS, I2C_MEMADD_SIZE_8BIT,
+        data, sizeof(data), HAL_MAX_DELAY);
+    if (ret != HAL_OK) {
+        return ret;
+    }
+
+    tsl2591_parse_status_channel_data(data, status, ch0_val, ch1_val);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef tsl2591_get_status_channel_data_it(I2C_HandleTypeDef *hi2c, uint8_t *buf)
+{
+    if (!buf) {
+        return HAL_ERROR;
+    }
+
+    return HAL_I2C_Mem_Read_IT(hi2c, TSL2591_ADDRESS,
+        TSL2591_CMD_NORMAL | TSL2591_STATUS, I2C_MEMADD_SIZE_8BIT,
+        buf, TSL2591_STATUS_CHANNEL_DATA_SIZE);
+}
+
+void tsl2591_parse_status_channel_data(const uint8_t *buf, uint8_t *status, uint16_t *ch0_val, uint16_t *ch1_val)
+{
+    if (!buf) { return; }
+
+    if (status) {
+        *status = buf[0];
+    }
+
+    /* Channel 0 - visible + infrared */
+    if (ch0_val) {
+        *ch0_val = buf[1] | buf[2] << 8;
+    }
+
+    /* Channel 1 - infrared only */
+    if (ch1_val) {
+        *ch1_val = buf[3] | buf[4] << 8;
+    }
+}
+
 uint16_t tsl2591_get_time_value_ms(tsl2591_time_t time)
 {
     switch (time) {
@@ -97,6 +97,9 @@ typedef enum {
 #define TSL2591_STATUS_AINT   0x10 /*!< ALS interrupt */
 #define TSL2591_STATUS_AVALID 0x01 /*!< ALS valid */
 
+/* Size of the buffer for a combined status and channel data read */
+#define TSL2591_STATUS_CHANNEL_DATA_SIZE 5
+
 HAL_StatusTypeDef tsl2591_init(I2C_HandleTypeDef *hi2c);
 
 HAL_StatusTypeDef tsl2591_set_enable(I2C_HandleTypeDef *hi2c, uint8_t value);
@@ -105,12 +108,26 @@ HAL_StatusTypeDef tsl2591_disable(I2C_HandleTypeDef *hi2c);
 
 HAL_StatusTypeDef tsl2591_clear_als_int(I2C_HandleTypeDef *hi2c);
 
+/**
+ * Clear both the ALS and no-persist ALS interrupts.
+ */
+HAL_StatusTypeDef tsl2591_clear_all_int(I2C_HandleTypeDef *hi2c);
+
 HAL_StatusTypeDef tsl2591_set_config(I2C_HandleTypeDef *hi2c, tsl2591_gain_t gain, tsl2591_time_t time);
 HAL_StatusTypeDef tsl2591_get_config(I2C_HandleTypeDef *hi2c, tsl2591_gain_t *gain, tsl2591_time_t *time);
 
 HAL_StatusTypeDef tsl2591_set_als_low_int_threshold(I2C_HandleTypeDef *hi2c, uint16_t value);
 HAL_StatusTypeDef tsl2591_set_als_high_int_threshold(I2C_HandleTypeDef *hi2c, uint16_t value);
 
+/**
+ * Set the no-persist ALS interrupt thresholds.
+ *
+ * The no-persist interrupt is raised at the end of any integration cycle
+ * where CH0 is below the low threshold or above the high threshold,
+ * regardless of the persistence filter setting.
+ */
+HAL_StatusTypeDef tsl2591_set_no_persist_int_thresholds(I2C_HandleTypeDef *hi2c, uint16_t low, uint16_t high);
+
 HAL_StatusTypeDef tsl2591_set_persist(I2C_HandleTypeDef *hi2c, tsl2591_persist_t value);
 
 HAL_StatusTypeDef tsl2591_get_status(I2C_HandleTypeDef *hi2c, uint8_t *value);
@@ -118,6 +135,31 @@ HAL_StatusTypeDef tsl2591_get_status_valid(I2C_HandleTypeDef *hi2c, bool *valid)
 
 HAL_StatusTypeDef tsl2591_get_full_channel_data(I2C_HandleTypeDef *hi2c, uint16_t *ch0_val, uint16_t *ch1_val);
 
+/**
+ * Read the status register and full channel data in a single transaction.
+ *
+ * The status register is immediately followed by the channel data
+ * registers, so this reads all of them with one auto-increment read.
+ */
+HAL_StatusTypeDef tsl2591_get_status_channel_data(I2C_HandleTypeDef *hi2c, uint8_t *status, uint16_t *ch0_val, uint16_t *ch1_val);
+
+/**
+ * Start an interrupt-driven read of the status register and full channel data.
+ *
+ * Completion is reported through the HAL I2C memory read complete and
+ * error callbacks, after which the buffer should be passed to
+ * tsl2591_parse_status_channel_data().
+ *
+ * @param buf Buffer of TSL2591_STATUS_CHANNEL_DATA_SIZE bytes, which must
+ *            remain valid until the read has completed
+ */
+HAL_StatusTypeDef tsl2591_get_status_channel_data_it(I2C_HandleTypeDef *hi2c, uint8_t *buf);
+
+/**
+ * Parse the result of a combined status and channel data read.
+ */
+void tsl2591_parse_status_channel_data(const uint8_t *buf, uint8_t *status, uint16_t *ch0_val, uint16_t *ch1_val);
+
 uint16_t tsl2591_get_time_value_ms(tsl2591_time_t time);
 
 #endif /* TSL2591_H */
@@ -0,0 +1,337 @@
+#include "tsl2591_sim.h"
+
+#ifdef SENSOR_SIMULATION
+
+#define LOG_TAG "tsl2591_sim"
+
+#include <elog.h>
+
+#include <math.h>
+#include <string.h>
+#include <cmsis_os.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "tsl2591.h"
+#include "task_sensor.h"
+#include "light.h"
+
+/* Registers */
+#define SIM_ENABLE  0x00
+#define SIM_CONFIG  0x01
+#define SIM_AILTL   0x04
+#define SIM_AIHTL   0x06
+#define SIM_NPAILTL 0x08
+#define SIM_NPAIHTL 0x0A
+#define SIM_PERSIST 0x0C
+#define SIM_PID     0x11
+#define SIM_ID      0x12
+#define SIM_STATUS  0x13
+#define SIM_C0DATAL 0x14
+#define SIM_C1DATAL 0x16
+#define SIM_REG_MAX 0x20
+
+/* Command register fields */
+#define SIM_CMD_TRANSACTION    0x60
+#define SIM_CMD_SPECIAL        0x60
+#define SIM_CMD_ADDR           0x1F
+#define SIM_CMD_INT_FORCE      0x04
+#define SIM_CMD_INT_CLEAR_ALS  0x06
+#define SIM_CMD_INT_CLEAR_ALL  0x07
+#define SIM_CMD_INT_CLEAR_NP   0x0A
+
+static uint8_t sim_regs[SIM_REG_MAX] = {
+    [SIM_ID] = 0x50
+};
+static uint8_t sim_persist_count = 0;
+static uint32_t sim_random_state = 0x2545F491UL;
+
+static tsl2591_sim_params_t sim_params = {
+    .target_d = 0.0F,
+    .noise = 0.002F,
+    .light_scale = 0.1F,
+    .ch1_ratio = 0.25F
+};
+
+static osTimerId_t sim_timer = NULL;
+static const osTimerAttr_t sim_timer_attrs = {
+    .name = "tsl2591_sim"
+};
+
+static void sim_write_register(uint8_t reg, uint8_t value);
+static void sim_update_timer();
+static void sim_timer_callback(void *argument);
+static uint16_t sim_generate_count(float basic, float noise, float gain, float atime_ms, uint16_t limit);
+static float sim_random_normal();
+static uint16_t sim_get_u16(uint8_t reg);
+static void sim_set_u16(uint8_t reg, uint16_t value);
+
+void tsl2591_sim_set_params(const tsl2591_sim_params_t *params)
+{
+    if (!params) { return; }
+    taskENTER_CRITICAL();
+    memcpy(&sim_params, params, sizeof(tsl2591_sim_params_t));
+    taskEXIT_CRITICAL();
+}
+
+void tsl2591_sim_get_params(tsl2591_sim_params_t *params)
+{
+    if (!params) { return; }
+    taskENTER_CRITICAL();
+    memcpy(params, &sim_params, sizeof(tsl2591_sim_params_t));
+    taskEXIT_CRITICAL();
+}
+
+HAL_StatusTypeDef tsl2591_sim_mem_read(I2C_HandleTypeDef *hi2c, uint16_t dev_address,
+    uint16_t mem_address, uint16_t mem_add_size, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    uint8_t reg = mem_address & SIM_CMD_ADDR;
+
+    if (!data || reg + size > SIM_REG_MAX) {
+        return HAL_ERROR;
+    }
+
+    taskENTER_CRITICAL();
+    memcpy(data, &sim_regs[reg], size);
+    taskEXIT_CRITICAL();
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef tsl2591_sim_mem_write(I2C_HandleTypeDef *hi2c, uint16_t dev_address,
+    uint16_t mem_address, uint16_t mem_add_size, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    uint8_t reg = mem_address & SIM_CMD_ADDR;
+
+    if (!data || reg + size > SIM_REG_MAX) {
+        return HAL_ERROR;
+    }
+
+    for (uint16_t i = 0; i < size; i++) {
+        sim_write_register(reg + i, data[i]);
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef tsl2591_sim_mem_read_it(I2C_HandleTypeDef *hi2c, uint16_t dev_address,
+    uint16_t mem_address, uint16_t mem_add_size, uint8_t *data, uint16_t size)
+{
+    HAL_StatusTypeDef ret = tsl2591_sim_mem_read(hi2c, dev_address,
+        mem_address, mem_add_size, data, size, 0);
+
+    /* The simulated transfer completes immediately */
+    if (ret == HAL_OK) {
+        HAL_I2C_MemRxCpltCallback(hi2c);
+    }
+
+    return ret;
+}
+
+HAL_StatusTypeDef tsl2591_sim_master_transmit(I2C_HandleTypeDef *hi2c, uint16_t dev_address,
+    uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    bool raise_interrupt = false;
+
+    if (!data || size != 1 || (data[0] & SIM_CMD_TRANSACTION) != SIM_CMD_SPECIAL) {
+        return HAL_ERROR;
+    }
+
+    taskENTER_CRITICAL();
+    switch (data[0] & SIM_CMD_ADDR) {
+    case SIM_CMD_INT_FORCE:
+        raise_interrupt = (sim_regs[SIM_STATUS] & (TSL2591_STATUS_AINT | TSL2591_STATUS_NPINTR)) == 0;
+        sim_regs[SIM_STATUS] |= TSL2591_STATUS_AINT;
+        break;
+    case SIM_CMD_INT_CLEAR_ALS:
+        sim_regs[SIM_STATUS] &= ~TSL2591_STATUS_AINT;
+        break;
+    case SIM_CMD_INT_CLEAR_ALL:
+        sim_regs[SIM_STATUS] &= ~(TSL2591_STATUS_AINT | TSL2591_STATUS_NPINTR);
+        break;
+    case SIM_CMD_INT_CLEAR_NP:
+        sim_regs[SIM_STATUS] &= ~TSL2591_STATUS_NPINTR;
+        break;
+    default:
+        break;
+    }
+    taskEXIT_CRITICAL();
+
+    if (raise_interrupt) {
+        sensor_int_handler();
+    }
+
+    return HAL_OK;
+}
+
+void sim_write_register(uint8_t reg, uint8_t value)
+{
+    switch (reg) {
+    case SIM_PID:
+    case SIM_ID:
+    case SIM_STATUS:
+    case SIM_C0DATAL:
+    case SIM_C0DATAL + 1:
+    case SIM_C1DATAL:
+    case SIM_C1DATAL + 1:
+        /* Read-only registers */
+        return;
+    default:
+        break;
+    }
+
+    taskENTER_CRITICAL();
+    sim_regs[reg] = value;
+    if (reg == SIM_ENABLE && (value & TSL2591_ENABLE_AEN) == 0) {
+        sim_regs[SIM_STATUS] &= ~TSL2591_STATUS_AVALID;
+    }
+    if (reg == SIM_ENABLE || reg == SIM_PERSIST) {
+        sim_persist_count = 0;
+    }
+    taskEXIT_CRITICAL();
+
+    if (reg == SIM_ENABLE || reg == SIM_CONFIG) {
+        sim_update_timer();
+    }
+}
+
+/**
+ * Start, stop, or restart the integration cycle timer to match the
+ * current enable and configuration register values.
+ */
+void sim_update_timer()
+{
+    if (!sim_timer) {
+        sim_timer = osTimerNew(sim_timer_callback, osTimerPeriodic, NULL, &sim_timer_attrs);
+        if (!sim_timer) {
+            log_e("Unable to create simulation timer");
+            return;
+        }
+    }
+
+    const uint8_t enable = sim_regs[SIM_ENABLE];
+    if ((enable & (TSL2591_ENABLE_PON | TSL2591_ENABLE_AEN)) == (TSL2591_ENABLE_PON | TSL2591_ENABLE_AEN)) {
+        uint32_t atime_ms = tsl2591_get_time_value_ms(sim_regs[SIM_CONFIG] & 0x07);
+        if (atime_ms == 0) { atime_ms = 600; }
+        osTimerStart(sim_timer, atime_ms);
+    } else if (osTimerIsRunning(sim_timer)) {
+        osTimerStop(sim_timer);
+    }
+}
+
+/**
+ * Complete an integration cycle, updating the channel data and
+ * raising any interrupts the real sensor would.
+ */
+void sim_timer_callback(void *argument)
+{
+    static const uint8_t persist_cycles[] = {
+        0, 1, 2, 3, 5, 10, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60
+    };
+    static const float gain_values[] = {
+        1.0F, TSL2591_GAIN_MEDIUM_TYP, TSL2591_GAIN_HIGH_TYP, TSL2591_GAIN_MAXIMUM_CH0_TYP
+    };
+    tsl2591_sim_params_t params;
+    bool raise_interrupt = false;
+
+    tsl2591_sim_get_params(&params);
+
+    const uint8_t config = sim_regs[SIM_CONFIG];
+    const tsl2591_time_t time = config & 0x07;
+    const float gain = gain_values[(config & 0x30) >> 4];
+    const float atime_ms = tsl2591_get_time_value_ms(time);
+    const uint16_t limit = (time == TSL2591_TIME_100MS) ? TSL2591_ANALOG_SATURATION : TSL2591_DIGITAL_SATURATION;
+
+    /* Light reaching the sensor, in basic counts */
+    const uint16_t brightness = (uint16_t)light_get_reflection() + (uint16_t)light_get_transmission();
+    const float basic = params.light_scale * (float)brightness * powf(10.0F, -params.target_d);
+
+    const uint16_t ch0_val = sim_generate_count(basic, params.noise, gain, atime_ms, limit);
+    const uint16_t ch1_val = sim_generate_count(basic * params.ch1_ratio, params.noise, gain, atime_ms, limit);
+
+    taskENTER_CRITICAL();
+    const uint8_t enable = sim_regs[SIM_ENABLE];
+    const uint8_t prev_status = sim_regs[SIM_STATUS];
+
+    sim_set_u16(SIM_C0DATAL, ch0_val);
+    sim_set_u16(SIM_C1DATAL, ch1_val);
+    sim_regs[SIM_STATUS] |= TSL2591_STATUS_AVALID;
+
+    /* Persistence filtered interrupt, based on CH0 */
+    const uint8_t persist = sim_regs[SIM_PERSIST] & 0x0F;
+    if (persist == TSL2591_PERSIST_EVERY) {
+        sim_regs[SIM_STATUS] |= TSL2591_STATUS_AINT;
+    } else if (ch0_val < sim_get_u16(SIM_AILTL) || ch0_val > sim_get_u16(SIM_AIHTL)) {
+        if (sim_persist_count < UINT8_MAX) { sim_persist_count++; }
+        if (sim_persist_count >= persist_cycles[persist]) {
+            sim_regs[SIM_STATUS] |= TSL2591_STATUS_AINT;
+        }
+    } else {
+        sim_persist_count = 0;
+    }
+
+    /* No-persist interrupt, based on CH0 */
+    if (ch0_val < sim_get_u16(SIM_NPAILTL) || ch0_val > sim_get_u16(SIM_NPAIHTL)) {
+        sim_regs[SIM_STATUS] |= TSL2591_STATUS_NPINTR;
+    }
+
+    /* The interrupt pin is level triggered, so only a new interrupt causes an edge */
+    const bool prev_asserted =
+        ((enable & TSL2591_ENABLE_AIEN) && (prev_status & TSL2591_STATUS_AINT))
+        || ((enable & TSL2591_ENABLE_NPIEN) && (prev_status & TSL2591_STATUS_NPINTR));
+    const bool asserted =
+        ((enable & TSL2591_ENABLE_AIEN) && (sim_regs[SIM_STATUS] & TSL2591_STATUS_AINT))
+        || ((enable & TSL2591_ENABLE_NPIEN) && (sim_regs[SIM_STATUS] & TSL2591_STATUS_NPINTR));
+    raise_interrupt = asserted && !prev_asserted;
+    taskEXIT_CRITICAL();
+
+    if (raise_interrupt) {
+        sensor_int_handler();
+    }
+}
+
+uint16_t sim_generate_count(float basic, float noise, float gain, float atime_ms, uint16_t limit)
+{
+    float count = basic * (atime_ms * gain) / (TSL2591_LUX_GA * TSL2591_LUX_DF);
+    count += count * noise * sim_random_normal();
+
+    if (count <= 0.0F) {
+        return 0;
+    } else if (count >= (float)limit) {
+        return limit;
+    } else {
+        return (uint16_t)lroundf(count);
+    }
+}
+
+/**
+ * Approximate a standard normal random value, as the sum of
+ * several uniform random values.
+ */
+float sim_random_normal()
+{
+    float sum = 0.0F;
+    for (int i = 0; i < 4; i++) {
+        /* xorshift32 */
+        sim_random_state ^= sim_random_state << 13;
+        sim_random_state ^= sim_random_state >> 17;
+        sim_random_state ^= sim_random_state << 5;
+        sum += (float)(sim_random_state >> 8) / (float)(1UL << 24);
+    }
+
+    /* Sum of 4 uniform values has a mean of 2 and a variance of 1/3 */
+    return (sum - 2.0F) * 1.7320508F;
+}
+
+uint16_t sim_get_u16(uint8_t reg)
+{
+    return sim_regs[reg] | (sim_regs[reg + 1] << 8);
+}
+
+void sim_set_u16(uint8_t reg, uint16_t value)
+{
+    sim_regs[reg] = value & 0x00FF;
+    sim_regs[reg + 1] = (value & 0xFF00) >> 8;
+}
+
+#endif /* SENSOR_SIMULATION */
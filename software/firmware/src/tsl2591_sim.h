@@ -0,0 +1,60 @@
+/*
+ * Simulated TSL2591 light sensor, for running the measurement code
+ * without a sensor attached.
+ *
+ * When the firmware is built with SENSOR_SIMULATION defined, all I2C
+ * traffic from the TSL2591 driver is routed to a register-level model
+ * of the device instead of the I2C peripheral. The model runs its
+ * integration cycles from an RTOS timer, raises the same interrupt the
+ * real sensor would, and produces channel counts from the current LED
+ * brightness, a configurable target density, and random noise.
+ *
+ * This only replaces the sensor. The rest of the firmware still runs on
+ * the board, with its real HAL, EEPROM and LED PWM. There is no host
+ * build of the firmware against the FreeRTOS POSIX port, since neither
+ * that port nor HAL stubs are part of this tree. The code that can be
+ * run on a host is exercised by the benchmarks in software/tools.
+ */
+#ifndef TSL2591_SIM_H
+#define TSL2591_SIM_H
+
+#ifdef SENSOR_SIMULATION
+
+#include <stdint.h>
+
+#include "stm32l0xx_hal.h"
+
+/**
+ * Simulated measurement scene parameters.
+ */
+typedef struct {
+    float target_d;      /*!< Density of the target between the LED and the sensor */
+    float noise;         /*!< Relative standard deviation of the channel counts */
+    float light_scale;   /*!< Basic counts per unit of LED brightness with no target */
+    float ch1_ratio;     /*!< Ratio of infrared-only to full spectrum light */
+} tsl2591_sim_params_t;
+
+/**
+ * Set the parameters used to generate simulated sensor readings.
+ * Changes take effect at the end of the next integration cycle.
+ */
+void tsl2591_sim_set_params(const tsl2591_sim_params_t *params);
+
+/**
+ * Get the parameters used to generate simulated sensor readings.
+ */
+void tsl2591_sim_get_params(tsl2591_sim_params_t *params);
+
+/* Replacements for the HAL I2C functions used by the TSL2591 driver */
+HAL_StatusTypeDef tsl2591_sim_mem_read(I2C_HandleTypeDef *hi2c, uint16_t dev_address,
+    uint16_t mem_address, uint16_t mem_add_size, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef tsl2591_sim_mem_write(I2C_HandleTypeDef *hi2c, uint16_t dev_address,
+    uint16_t mem_address, uint16_t mem_add_size, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef tsl2591_sim_mem_read_it(I2C_HandleTypeDef *hi2c, uint16_t dev_address,
+    uint16_t mem_address, uint16_t mem_add_size, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef tsl2591_sim_master_transmit(I2C_HandleTypeDef *hi2c, uint16_t dev_address,
+    uint8_t *data, uint16_t size, uint32_t timeout);
+
+#endif /* SENSOR_SIMULATION */
+
+#endif /* TSL2591_SIM_H */
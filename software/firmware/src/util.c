@@ -2,12 +2,17 @@
 
 #include <string.h>
 #include <math.h>
+#include <FreeRTOS.h>
+#include <task.h>
 #include "stm32l0xx_hal.h"
 
 #ifdef HAL_IWDG_MODULE_ENABLED
 extern IWDG_HandleTypeDef hiwdg;
 #endif
 
+/* Overflows of the 16-bit timestamp counter, counted by its update interrupt */
+static volatile uint32_t timestamp_overflow_count = 0;
+
 void watchdog_refresh()
 {
 #ifdef HAL_IWDG_MODULE_ENABLED
@@ -66,6 +71,18 @@ HAL_StatusTypeDef os_to_hal_status(osStatus_t os_status)
     }
 }
 
+void copy_from_u16(uint8_t *buf, uint16_t val)
+{
+    buf[0] = (val >> 8) & 0xFF;
+    buf[1] = val & 0xFF;
+}
+
+uint16_t copy_to_u16(const uint8_t *buf)
+{
+    return (uint16_t)buf[0] << 8
+        | (uint16_t)buf[1];
+}
+
 void copy_from_u32(uint8_t *buf, uint32_t val)
 {
     buf[0] = (val >> 24) & 0xFF;
@@ -101,3 +118,137 @@ bool is_valid_number(float num)
 {
     return isnormal(num) || fpclassify(num) == FP_ZERO;
 }
+
+uint16_t crc16_ccitt(const uint8_t *buf, size_t len)
+{
+    return crc16_ccitt_update(0xFFFF, buf, len);
+}
+
+uint16_t crc16_ccitt_update(uint16_t crc, const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)buf[i] << 8;
+        for (uint8_t j = 0; j < 8; j++) {
+            if (crc & 0x8000) {
+                crc = (crc << 1) ^ 0x1021;
+            } else {
+                crc = crc << 1;
+            }
+        }
+    }
+    return crc;
+}
+
+size_t cobs_encode(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t code_pos = 0;
+    size_t out_pos = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] == 0) {
+            dst[code_pos] = code;
+            code_pos = out_pos++;
+            code = 1;
+        } else {
+            dst[out_pos++] = src[i];
+            code++;
+            if (code == 0xFF) {
+                dst[code_pos] = code;
+                code_pos = out_pos++;
+                code = 1;
+            }
+        }
+    }
+    dst[code_pos] = code;
+
+    return out_pos;
+}
+
+size_t packbits_encode(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+
+    while (in_pos < len) {
+        size_t run = 1;
+        while (in_pos + run < len && run < 128 && src[in_pos + run] == src[in_pos]) {
+            run++;
+        }
+
+        if (run >= 3) {
+            dst[out_pos++] = (uint8_t)(257 - run);
+            dst[out_pos++] = src[in_pos];
+            in_pos += run;
+        } else {
+            /* Collect literal bytes until the next run worth encoding */
+            size_t start = in_pos;
+            size_t count = 0;
+            while (in_pos < len && count < 128) {
+                if (in_pos + 2 < len && src[in_pos] == src[in_pos + 1] && src[in_pos] == src[in_pos + 2]) {
+                    break;
+                }
+                in_pos++;
+                count++;
+            }
+            dst[out_pos++] = (uint8_t)(count - 1);
+            memcpy(dst + out_pos, src + start, count);
+            out_pos += count;
+        }
+    }
+
+    return out_pos;
+}
+
+uint32_t cycle_count_get()
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t ticks = xTaskGetTickCount();
+    uint32_t val = SysTick->VAL;
+
+    /* Account for a tick that has elapsed but has not been handled yet */
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        ticks++;
+        val = SysTick->VAL;
+    }
+
+    if (!primask) {
+        __enable_irq();
+    }
+
+    const uint32_t reload = SysTick->LOAD;
+    return (ticks * (reload + 1)) + (reload - val);
+}
+
+uint32_t cycle_count_to_us(uint32_t cycles)
+{
+    return (uint32_t)(((uint64_t)cycles * 1000000ULL) / SystemCoreClock);
+}
+
+void timestamp_us_overflow()
+{
+    timestamp_overflow_count++;
+}
+
+uint32_t timestamp_us_get()
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t high = timestamp_overflow_count;
+    uint32_t low = TIM7->CNT;
+
+    /* Account for an overflow that has happened but has not been handled yet */
+    if (TIM7->SR & TIM_SR_UIF) {
+        high++;
+        low = TIM7->CNT;
+    }
+
+    if (!primask) {
+        __enable_irq();
+    }
+
+    return (high << 16) | low;
+}
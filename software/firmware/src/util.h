@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <cmsis_os.h>
 #include "stm32l0xx_hal.h"
 
@@ -36,6 +37,8 @@ void watchdog_normal();
 osStatus_t hal_to_os_status(HAL_StatusTypeDef hal_status);
 HAL_StatusTypeDef os_to_hal_status(osStatus_t os_status);
 
+void copy_from_u16(uint8_t *buf, uint16_t val);
+uint16_t copy_to_u16(const uint8_t *buf);
 void copy_from_u32(uint8_t *buf, uint32_t val);
 uint32_t copy_to_u32(const uint8_t *buf);
 void copy_from_f32(uint8_t *buf, float val);
@@ -43,4 +46,83 @@ float copy_to_f32(const uint8_t *buf);
 
 bool is_valid_number(float num);
 
+/**
+ * Calculate a CRC-16/CCITT-FALSE checksum.
+ *
+ * This uses the polynomial 0x1021 with an initial value of 0xFFFF,
+ * and is intended for short messages sent to the host.
+ */
+uint16_t crc16_ccitt(const uint8_t *buf, size_t len);
+
+/**
+ * Continue a CRC-16/CCITT-FALSE checksum with additional data.
+ *
+ * This allows a checksum to be calculated over a message that is
+ * produced in pieces, starting from an initial value of 0xFFFF.
+ */
+uint16_t crc16_ccitt_update(uint16_t crc, const uint8_t *buf, size_t len);
+
+/**
+ * Encode a buffer using Consistent Overhead Byte Stuffing.
+ *
+ * The output will contain no zero bytes, and will be at most
+ * len + (len / 254) + 1 bytes long. It does not include a
+ * trailing frame delimiter.
+ *
+ * @param dst Buffer to write the encoded data into
+ * @param src Data to encode
+ * @param len Length of the data to encode
+ * @return Length of the encoded data
+ */
+size_t cobs_encode(uint8_t *dst, const uint8_t *src, size_t len);
+
+/**
+ * Run-length encode a buffer using the PackBits scheme.
+ *
+ * Each block starts with a header byte. Values from 0 to 127 are followed
+ * by that many plus one literal bytes, and values from 129 to 255 are
+ * followed by a single byte that is repeated 257 minus the header times.
+ * The output will be at most len + ((len + 127) / 128) bytes long.
+ *
+ * @param dst Buffer to write the encoded data into
+ * @param src Data to encode
+ * @param len Length of the data to encode
+ * @return Length of the encoded data
+ */
+size_t packbits_encode(uint8_t *dst, const uint8_t *src, size_t len);
+
+/**
+ * Get a free-running count of CPU clock cycles.
+ *
+ * This combines the RTOS tick count with the current SysTick counter value,
+ * giving cycle resolution for timing short sections of code. The count
+ * wraps around, so it should only be used to measure intervals shorter
+ * than a couple of minutes.
+ */
+uint32_t cycle_count_get();
+
+/**
+ * Convert an interval in CPU clock cycles into microseconds.
+ */
+uint32_t cycle_count_to_us(uint32_t cycles);
+
+/**
+ * Get a free-running timestamp in microseconds.
+ *
+ * This comes from TIM7, which counts at 1MHz independently of the RTOS
+ * tick, so it keeps advancing while the scheduler is suspended or
+ * interrupts are disabled. It wraps around at 2^32 microseconds
+ * (about 71 minutes), and differences between timestamps remain valid
+ * across the wrap. It is safe to call from interrupt handlers.
+ */
+uint32_t timestamp_us_get();
+
+/**
+ * Count an overflow of the timestamp timer.
+ *
+ * This is called from the timer update interrupt, and should not be
+ * called from anywhere else.
+ */
+void timestamp_us_overflow();
+
 #endif /* UTIL_H */
@@ -0,0 +1,331 @@
+/*
+ * Host-side comparison of CDC command throughput between the original
+ * chains of string comparisons in each command category handler, and
+ * the sorted command descriptor tables searched with a binary search.
+ *
+ * Build and run from this directory with:
+ *   cc -O2 -I../firmware/src -o cdc-dispatch-bench cdc-dispatch-bench.c ../firmware/src/cdc_command.c
+ *   ./cdc-dispatch-bench
+ *
+ * Each path parses the command line, then resolves it to a handler that
+ * does nothing beyond counting the call, so the results only reflect the
+ * parse and lookup cost that every command pays before any real work is
+ * done. The table path runs the firmware's own cdc_command_parse(),
+ * cdc_command_find() and command tables from cdc_command_tables.h, as
+ * built without any of the optional diagnostic features. The original
+ * parser and strcmp chains are kept here as the baseline they replaced.
+ *
+ * Timing results from the host are only useful as a relative comparison.
+ * The host compiler and C library are far better at short string
+ * comparisons than the firmware build, so the number of comparisons
+ * each lookup needs is also shown as a target-independent measure.
+ *
+ * This is a check that moving to the tables did not make dispatch
+ * slower, not a case for them being faster. For the polling mix, both
+ * lookups need about the same number of comparisons, and the speedup
+ * varies from run to run between roughly 1.0x and 1.2x.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <strings.h>
+
+#include "cdc_command.h"
+
+#define BENCH_ITERATIONS 2000000
+
+#ifndef MIN
+#define MIN(a, b)  (((a) < (b)) ? (a) : (b))
+#endif
+
+static volatile uint32_t bench_sink;
+static uint32_t bench_compares;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1.0e9) + ts.tv_nsec;
+}
+
+static bool bench_handler(const cdc_command_t *cmd)
+{
+    bench_sink += (uint8_t)cmd->action[0];
+    return true;
+}
+
+/* Command tables from the firmware, with every handler replaced by the bench one */
+#define CDC_COMMAND(action, type, args, flags, handler) { action, type, args, flags, bench_handler }
+#include "cdc_command_tables.h"
+#undef CDC_COMMAND
+
+/*
+ * Command mix representative of a host polling the device for
+ * readings and state, with an occasional setting change.
+ */
+static const char *bench_commands[] = {
+    "GM REFL",
+    "GM TRAN",
+    "GD STAT",
+    "GS ISEN",
+    "GM REFL",
+    "GM TRAN",
+    "GD STAT,LAT",
+    "GS RTOS",
+    "GC GAIN",
+    "GC TRAN",
+    "GS V",
+    "SM FORMAT,EXT",
+    "GD STAT,I2C",
+    "ID S,START",
+    "SC SLOPE,0,0,0",
+    "GX BOGUS"
+};
+
+#define BENCH_COMMAND_COUNT (sizeof(bench_commands) / sizeof(bench_commands[0]))
+
+/* Command parsing as done by the original implementation */
+static bool old_parse_command(cdc_command_t *cmd, const char *buf, size_t len)
+{
+    cmd_type_t type;
+    cmd_category_t category;
+
+    if (!cmd || !buf || len < 2 || buf[0] == '\0') {
+        return false;
+    }
+
+    switch (buf[0]) {
+    case 'S': type = CMD_TYPE_SET; break;
+    case 'G': type = CMD_TYPE_GET; break;
+    case 'I': type = CMD_TYPE_INVOKE; break;
+    default: return false;
+    }
+
+    switch (buf[1]) {
+    case 'S': category = CMD_CATEGORY_SYSTEM; break;
+    case 'M': category = CMD_CATEGORY_MEASUREMENT; break;
+    case 'C': category = CMD_CATEGORY_CALIBRATION; break;
+    case 'D': category = CMD_CATEGORY_DIAGNOSTICS; break;
+    default: return false;
+    }
+
+    if (len > 2 && buf[2] != ' ') {
+        return false;
+    }
+
+    cmd->type = type;
+    cmd->category = category;
+
+    if (len > 3) {
+        char *p = strchr(buf + 3, ',');
+        if (p) {
+            strncpy(cmd->action, buf + 3, MIN((size_t)(p - (buf + 3)), sizeof(cmd->action) - 1));
+            strncpy(cmd->args, p + 1, MIN(len - (size_t)((p + 1) - buf), sizeof(cmd->args) - 1));
+        } else {
+            strncpy(cmd->action, buf + 3, MIN(len - 3, sizeof(cmd->action) - 1));
+            bzero(cmd->args, sizeof(cmd->args));
+        }
+    } else {
+        bzero(cmd->action, sizeof(cmd->action));
+        bzero(cmd->args, sizeof(cmd->args));
+    }
+
+    return true;
+}
+
+#define OLD_MATCH(t, a) (cmd->type == (t) && (bench_compares++, strcmp(cmd->action, (a)) == 0))
+
+/* Action lookup as done by the original category handlers */
+static const char *old_lookup(const cdc_command_t *cmd)
+{
+    switch (cmd->category) {
+    case CMD_CATEGORY_SYSTEM:
+        if (OLD_MATCH(CMD_TYPE_GET, "V")) { return "V"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "B")) { return "B"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "DEV")) { return "DEV"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "RTOS")) { return "RTOS"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "TASKS")) { return "TASKS"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "UID")) { return "UID"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "ISEN")) { return "ISEN"; }
+        else if (OLD_MATCH(CMD_TYPE_INVOKE, "REMOTE")) { return "REMOTE"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "DISP")) { return "DISP"; }
+        break;
+    case CMD_CATEGORY_MEASUREMENT:
+        if (OLD_MATCH(CMD_TYPE_GET, "REFL")) { return "REFL"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "TRAN")) { return "TRAN"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "FORMAT")) { return "FORMAT"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "UNCAL")) { return "UNCAL"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "SAMPLES")) { return "SAMPLES"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "SAMPLES")) { return "SAMPLES"; }
+        break;
+    case CMD_CATEGORY_CALIBRATION:
+        if (OLD_MATCH(CMD_TYPE_INVOKE, "GAIN")) { return "GAIN"; }
+        else if (OLD_MATCH(CMD_TYPE_INVOKE, "LR")) { return "LR"; }
+        else if (OLD_MATCH(CMD_TYPE_INVOKE, "LT")) { return "LT"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "LIGHT")) { return "LIGHT"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "LIGHT")) { return "LIGHT"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "GAIN")) { return "GAIN"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "GAIN")) { return "GAIN"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "DRIFT")) { return "DRIFT"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "DRIFT")) { return "DRIFT"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "SLOPE")) { return "SLOPE"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "SLOPE")) { return "SLOPE"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "REFL")) { return "REFL"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "REFL")) { return "REFL"; }
+        else if (OLD_MATCH(CMD_TYPE_GET, "TRAN")) { return "TRAN"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "TRAN")) { return "TRAN"; }
+        break;
+    case CMD_CATEGORY_DIAGNOSTICS:
+        if (OLD_MATCH(CMD_TYPE_GET, "DISP")) { return "DISP"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "LR")) { return "LR"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "LT")) { return "LT"; }
+        else if (bench_compares++, strcmp(cmd->action, "S") == 0) { return "S"; }
+        else if (bench_compares++, strcmp(cmd->action, "STAT") == 0) { return "STAT"; }
+        else if (bench_compares++, strcmp(cmd->action, "READ") == 0) { return "READ"; }
+        else if (OLD_MATCH(CMD_TYPE_INVOKE, "WIPE")) { return "WIPE"; }
+        else if (OLD_MATCH(CMD_TYPE_SET, "LOG")) { return "LOG"; }
+        break;
+    default:
+        break;
+    }
+    return NULL;
+}
+
+static uint32_t old_process_command(const char *buf, size_t len)
+{
+    cdc_command_t cmd = {0};
+    if (old_parse_command(&cmd, buf, len)) {
+        const char *action = old_lookup(&cmd);
+        if (action && bench_handler(&cmd)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static const cdc_command_entry_t *new_lookup(const cdc_command_t *cmd)
+{
+    return cdc_command_find(
+        cdc_command_tables[cmd->category].table,
+        cdc_command_tables[cmd->category].count,
+        cmd);
+}
+
+static uint32_t new_process_command(const char *buf, size_t len)
+{
+    cdc_command_t cmd = {0};
+    if (cdc_command_parse(&cmd, buf, len)) {
+        const cdc_command_entry_t *entry = new_lookup(&cmd);
+        if (entry && entry->handler(&cmd)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Number of table entries a binary search probes to find a command */
+static uint32_t new_probes(const cdc_command_t *cmd)
+{
+    const cdc_command_entry_t *table = cdc_command_tables[cmd->category].table;
+    const cdc_command_entry_t *entry = new_lookup(cmd);
+    size_t lo = 0;
+    size_t hi = cdc_command_tables[cmd->category].count;
+    uint32_t probes = 0;
+
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) / 2);
+        probes++;
+        if (entry == &table[mid]) {
+            break;
+        } else if (!entry || strcmp(cmd->action, table[mid].action) < 0
+            || (strcmp(cmd->action, table[mid].action) == 0 && cmd->type < table[mid].type)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return probes;
+}
+
+/*
+ * Make sure both lookups resolve every command in the mix to the
+ * same action, so the timing comparison is a fair one.
+ */
+static int check_lookup(uint32_t *old_compares, uint32_t *new_compares)
+{
+    int failed = 0;
+
+    *old_compares = 0;
+    *new_compares = 0;
+
+    for (size_t i = 0; i < CMD_CATEGORY_MAX; i++) {
+        if (!cdc_command_table_sorted(cdc_command_tables[i].table, cdc_command_tables[i].count)) {
+            printf("Command table %zu is not sorted\n", i);
+            failed++;
+        }
+    }
+
+    for (size_t i = 0; i < BENCH_COMMAND_COUNT; i++) {
+        cdc_command_t cmd = {0};
+        if (!cdc_command_parse(&cmd, bench_commands[i], strlen(bench_commands[i]))) {
+            continue;
+        }
+        bench_compares = 0;
+        const char *old_action = old_lookup(&cmd);
+        const cdc_command_entry_t *entry = new_lookup(&cmd);
+        *old_compares += bench_compares;
+        *new_compares += new_probes(&cmd);
+        if ((old_action == NULL) != (entry == NULL)
+            || (old_action && strcmp(old_action, entry->action) != 0)) {
+            printf("Lookup mismatch: \"%s\"\n", bench_commands[i]);
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+static double run_bench(uint32_t (*process)(const char *, size_t), uint32_t *handled)
+{
+    size_t lengths[BENCH_COMMAND_COUNT];
+    for (size_t i = 0; i < BENCH_COMMAND_COUNT; i++) {
+        lengths[i] = strlen(bench_commands[i]);
+    }
+
+    *handled = 0;
+    const double start = now_ns();
+    for (uint32_t n = 0; n < BENCH_ITERATIONS; n++) {
+        const size_t i = n % BENCH_COMMAND_COUNT;
+        *handled += process(bench_commands[i], lengths[i]);
+    }
+    return now_ns() - start;
+}
+
+int main(void)
+{
+    uint32_t old_handled;
+    uint32_t new_handled;
+    uint32_t old_compares;
+    uint32_t new_compares;
+
+    if (check_lookup(&old_compares, &new_compares) > 0) {
+        return 1;
+    }
+
+    const double old_ns = run_bench(old_process_command, &old_handled);
+    const double new_ns = run_bench(new_process_command, &new_handled);
+
+    printf("Commands per run: %d (%zu command mix)\n", BENCH_ITERATIONS, BENCH_COMMAND_COUNT);
+    printf("strcmp chains: %10.0f commands/sec (%5.1f ns each, %u handled)\n",
+        BENCH_ITERATIONS / (old_ns / 1.0e9), old_ns / BENCH_ITERATIONS, old_handled);
+    printf("binary search: %10.0f commands/sec (%5.1f ns each, %u handled)\n",
+        BENCH_ITERATIONS / (new_ns / 1.0e9), new_ns / BENCH_ITERATIONS, new_handled);
+    printf("Speedup: %.2fx\n", old_ns / new_ns);
+    printf("\n");
+    printf("Action comparisons per command: strcmp chains=%.1f, binary search=%.1f\n",
+        (double)old_compares / BENCH_COMMAND_COUNT, (double)new_compares / BENCH_COMMAND_COUNT);
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * Host-side accuracy and timing comparison between the firmware's
+ * fixed-point log/exp functions and the standard float functions
+ * they replace in the density calculation path.
+ *
+ * Build and run from this directory with:
+ *   cc -O2 -I../firmware/src -o fixmath-bench fixmath-bench.c ../firmware/src/fixmath.c -lm
+ *   ./fixmath-bench
+ *
+ * Timing results from the host are only useful as a relative comparison.
+ * The Cortex-M0+ has no cycle counter, so on-target timing has to be done
+ * with a spare timer or by toggling a GPIO around the code of interest.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "fixmath.h"
+
+#define BENCH_ITERATIONS 2000000
+
+/* Largest acceptable error in a density result */
+#define MAX_DENSITY_ERROR 0.005
+
+static volatile float bench_sink;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1.0e9) + ts.tv_nsec;
+}
+
+/*
+ * Sweep over the full range of basic count values a reading can produce,
+ * and compare each function against its float equivalent.
+ */
+static int check_accuracy()
+{
+    double log10_max_err = 0;
+    double exp10_max_rel_err = 0;
+    double log2_u32_max_err = 0;
+    double slope_max_d_err = 0;
+    int failed = 0;
+
+    for (double x = 1.0e-3; x < 1.0e6; x *= 1.0001) {
+        double err = fabs((double)fixmath_log10f((float)x) - log10(x));
+        if (err > log10_max_err) { log10_max_err = err; }
+    }
+
+    for (double x = -8.0; x < 8.0; x += 0.0001) {
+        double ref = pow(10.0, x);
+        double err = fabs((double)fixmath_exp10f((float)x) - ref) / ref;
+        if (err > exp10_max_rel_err) { exp10_max_rel_err = err; }
+    }
+
+    for (uint32_t x = 1; x < 0x10000000UL; x += (x >> 6) + 1) {
+        double err = fabs((fixmath_log2_u32(x) / 65536.0) - log2((double)x));
+        if (err > log2_u32_max_err) { log2_u32_max_err = err; }
+    }
+
+    /*
+     * Chain the functions the same way as the slope calibration and
+     * density calculation, using typical slope coefficients, and compare
+     * the resulting density values.
+     */
+    const float b0 = 0.05F;
+    const float b1 = 1.02F;
+    const float b2 = -0.003F;
+    const float zero_value = 5000.0F;
+    for (double x = 0.01; x < 20000.0; x *= 1.001) {
+        float l_fix = fixmath_log10f((float)x);
+        float corr_fix = fixmath_exp10f(b0 + (b1 * l_fix) + (b2 * l_fix * l_fix));
+        float d_fix = -1.0F * fixmath_log10f(corr_fix / zero_value);
+
+        double l_ref = log10(x);
+        double corr_ref = pow(10.0, b0 + (b1 * l_ref) + (b2 * l_ref * l_ref));
+        double d_ref = -1.0 * log10(corr_ref / zero_value);
+
+        double err = fabs(d_fix - d_ref);
+        if (err > slope_max_d_err) { slope_max_d_err = err; }
+    }
+
+    printf("fixmath_log10f   max abs error: %.3g\n", log10_max_err);
+    printf("fixmath_exp10f   max rel error: %.3g\n", exp10_max_rel_err);
+    printf("fixmath_log2_u32 max abs error: %.3g\n", log2_u32_max_err);
+    printf("density pipeline max D error:   %.3g\n", slope_max_d_err);
+
+    if (slope_max_d_err >= MAX_DENSITY_ERROR) {
+        printf("FAILED: density error exceeds %.3f\n", MAX_DENSITY_ERROR);
+        failed = 1;
+    }
+
+    return failed;
+}
+
+static void check_timing()
+{
+    double start;
+    double elapsed_float;
+    double elapsed_fix;
+    float acc;
+
+    acc = 0;
+    start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        acc += log10f((float)(i + 1));
+    }
+    elapsed_float = now_ns() - start;
+    bench_sink = acc;
+
+    acc = 0;
+    start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        acc += fixmath_log10f((float)(i + 1));
+    }
+    elapsed_fix = now_ns() - start;
+    bench_sink = acc;
+
+    printf("log10f:          %6.2f ns/call, fixmath: %6.2f ns/call\n",
+        elapsed_float / BENCH_ITERATIONS, elapsed_fix / BENCH_ITERATIONS);
+
+    acc = 0;
+    start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        acc += powf(10.0F, (float)(i & 0xFFFF) / 16384.0F);
+    }
+    elapsed_float = now_ns() - start;
+    bench_sink = acc;
+
+    acc = 0;
+    start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        acc += fixmath_exp10f((float)(i & 0xFFFF) / 16384.0F);
+    }
+    elapsed_fix = now_ns() - start;
+    bench_sink = acc;
+
+    printf("powf(10, x):     %6.2f ns/call, fixmath: %6.2f ns/call\n",
+        elapsed_float / BENCH_ITERATIONS, elapsed_fix / BENCH_ITERATIONS);
+
+    acc = 0;
+    start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        acc += logf((float)((i & 0xFFFF) + 1));
+    }
+    elapsed_float = now_ns() - start;
+    bench_sink = acc;
+
+    int32_t iacc = 0;
+    start = now_ns();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        iacc += fixmath_log2_u32((uint32_t)((i & 0xFFFF) + 1));
+    }
+    elapsed_fix = now_ns() - start;
+    bench_sink = (float)iacc;
+
+    printf("logf(count):     %6.2f ns/call, fixmath: %6.2f ns/call\n",
+        elapsed_float / BENCH_ITERATIONS, elapsed_fix / BENCH_ITERATIONS);
+}
+
+int main(int argc, char *argv[])
+{
+    int failed = check_accuracy();
+    check_timing();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
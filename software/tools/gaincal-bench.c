@@ -0,0 +1,221 @@
+/*
+ * Host-side comparison of the total sensor gain calibration time between
+ * the original linear brightness sweep with fixed cooldown delays, and
+ * the search-based brightness selection with thermal model cooldowns.
+ *
+ * Build and run from this directory with:
+ *   cc -O2 -I../firmware/src -o gaincal-bench gaincal-bench.c ../firmware/src/gaincal.c -lm
+ *   ./gaincal-bench
+ *
+ * The sensor is modeled as an ideal linear response to LED brightness,
+ * with the sensitivity swept across a range of values to cover the
+ * variation between units. Time is tracked on a virtual clock, counting
+ * sensor integration cycles and delays the same way the firmware does.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "gaincal.h"
+
+/* Constants mirrored from sensor.c */
+#define LIGHT_CAL_CH0_TARGET_FACTOR   (0.98F)
+#define GAIN_CAL_CH0_TARGET_FACTOR    (0.75F)
+#define GAIN_CAL_BRIGHTNESS_LOW_MED   128
+#define GAIN_CAL_READ_ITERATIONS      5
+#define GAIN_LED_CHECK_READ_ITERATIONS 2
+#define DIGITAL_SATURATION            65535
+
+/* Nominal high gain counts per unit of brightness at 200ms */
+#define NOMINAL_HIGH_SCALE            (550.0F)
+
+/* Ratio between maximum and high gain */
+#define MAX_HIGH_RATIO                (23.0F)
+
+typedef struct {
+    float scale;
+    uint32_t ticks;
+    int tests;
+    gaincal_thermal_t thermal;
+} bench_sim_t;
+
+static float sim_read(float scale, uint8_t brightness)
+{
+    const float value = scale * brightness;
+    return (value >= DIGITAL_SATURATION) ? NAN : value;
+}
+
+/*
+ * Account for one brightness test program, which switches sensor
+ * settings (one extra cycle), waits the cooldown cycles, then lets the
+ * LED settle for a cycle before collecting the readings.
+ */
+static void sim_test_program(bench_sim_t *sim, uint32_t cooldown_cycles, uint8_t brightness)
+{
+    sim->ticks += (1 + cooldown_cycles) * 200;
+    const uint32_t on_ms = (1 + GAIN_LED_CHECK_READ_ITERATIONS) * 200;
+    sim->ticks += on_ms;
+    gaincal_thermal_add(&sim->thermal, sim->ticks, brightness, on_ms);
+    sim->tests++;
+}
+
+static void sim_gain_loop(bench_sim_t *sim, uint16_t time_ms, uint8_t brightness, bool thermal)
+{
+    const uint32_t on_ms = GAIN_CAL_READ_ITERATIONS * time_ms;
+    for (int i = 0; i < 2; i++) {
+        if (i > 0) {
+            if (thermal) {
+                sim->ticks += gaincal_thermal_cooldown_ms(&sim->thermal, sim->ticks, GAINCAL_THERMAL_PHASE_LIMIT);
+            } else {
+                sim->ticks += 5000;
+            }
+        }
+        sim->ticks += time_ms;
+        sim->ticks += on_ms;
+        gaincal_thermal_add(&sim->thermal, sim->ticks, brightness, on_ms);
+    }
+}
+
+static void sim_phase_cooldown(bench_sim_t *sim, bool thermal)
+{
+    if (thermal) {
+        sim->ticks += gaincal_thermal_cooldown_ms(&sim->thermal, sim->ticks, GAINCAL_THERMAL_PHASE_LIMIT);
+    } else {
+        sim->ticks += 5000;
+    }
+}
+
+/* Brightness sweep as done by the original implementation */
+static uint8_t old_find_brightness(bench_sim_t *sim, float scale,
+    uint8_t start, uint8_t end, float target)
+{
+    const bool upward = start < end;
+    uint32_t cooldown_cycles = 0;
+    float closest = NAN;
+    uint8_t closest_led = 0;
+
+    for (uint8_t i = start; i != end; ) {
+        sim_test_program(sim, cooldown_cycles, i);
+        const float value = sim_read(scale, i);
+
+        if (upward) {
+            if (isnanf(value)) { break; }
+            if (closest_led == 0 || fabsf(target - value) < fabsf(target - closest)) {
+                closest = value;
+                closest_led = i;
+            } else {
+                break;
+            }
+            i++;
+        } else {
+            if (!isnanf(value) && value <= target) {
+                closest_led = i;
+                break;
+            }
+            i--;
+        }
+        cooldown_cycles = ((i < 64) ? 1000 : 2000) / 200;
+    }
+    return closest_led;
+}
+
+typedef struct {
+    bench_sim_t *sim;
+    float scale;
+} new_measure_context_t;
+
+static bool new_measure(uint8_t brightness, float *ch0_value, void *user_data)
+{
+    new_measure_context_t *context = user_data;
+    bench_sim_t *sim = context->sim;
+    const uint32_t cooldown_ms = gaincal_thermal_cooldown_ms(&sim->thermal, sim->ticks, GAINCAL_THERMAL_TEST_LIMIT);
+
+    sim_test_program(sim, (cooldown_ms + 199) / 200, brightness);
+    *ch0_value = sim_read(context->scale, brightness);
+    return true;
+}
+
+/* Brightness search as done by the current implementation */
+static uint8_t new_find_brightness(bench_sim_t *sim, float scale,
+    uint8_t start, uint8_t end, float target)
+{
+    new_measure_context_t context = { .sim = sim, .scale = scale };
+    uint8_t result = 0;
+
+    if (start < end) {
+        gaincal_search_brightness(start, end - 1, false, target, false, new_measure, &context, &result);
+    } else {
+        gaincal_search_brightness(end + 1, start, true, target, true, new_measure, &context, &result);
+    }
+    return result;
+}
+
+static void run_calibration(bench_sim_t *sim, bool use_new, uint8_t *high_led, uint8_t *max_led)
+{
+    const float high_target = DIGITAL_SATURATION * LIGHT_CAL_CH0_TARGET_FACTOR;
+    const float max_target = DIGITAL_SATURATION * GAIN_CAL_CH0_TARGET_FACTOR;
+
+    gaincal_thermal_init(&sim->thermal, 0);
+    sim->ticks = 1000;
+    sim->tests = 0;
+
+    if (use_new) {
+        *high_led = new_find_brightness(sim, sim->scale, 128, 64, high_target);
+    } else {
+        *high_led = old_find_brightness(sim, sim->scale, 128, 64, high_target);
+    }
+    sim_phase_cooldown(sim, use_new);
+    sim_gain_loop(sim, 600, GAIN_CAL_BRIGHTNESS_LOW_MED, use_new);
+    sim_phase_cooldown(sim, use_new);
+    sim_gain_loop(sim, 200, *high_led, use_new);
+    sim_phase_cooldown(sim, use_new);
+
+    if (use_new) {
+        *max_led = new_find_brightness(sim, sim->scale * MAX_HIGH_RATIO, 4, 16, max_target);
+    } else {
+        *max_led = old_find_brightness(sim, sim->scale * MAX_HIGH_RATIO, 4, 16, max_target);
+    }
+    sim_phase_cooldown(sim, use_new);
+    sim_gain_loop(sim, 200, *max_led, use_new);
+}
+
+int main(int argc, char *argv[])
+{
+    double old_total = 0;
+    double new_total = 0;
+    int mismatches = 0;
+    int count = 0;
+
+    printf("scale  | old: tests  time(s)  high max | new: tests  time(s)  high max\n");
+    printf("-------+----------------------------------+---------------------------------\n");
+
+    for (float factor = 0.50F; factor <= 1.501F; factor += 0.05F) {
+        bench_sim_t old_sim = { .scale = NOMINAL_HIGH_SCALE * factor };
+        bench_sim_t new_sim = { .scale = NOMINAL_HIGH_SCALE * factor };
+        uint8_t old_high, old_max;
+        uint8_t new_high, new_max;
+
+        run_calibration(&old_sim, false, &old_high, &old_max);
+        run_calibration(&new_sim, true, &new_high, &new_max);
+
+        printf("%6.1f | %10d %8.1f %5d %3d | %10d %8.1f %5d %3d%s\n",
+            old_sim.scale,
+            old_sim.tests, old_sim.ticks / 1000.0, old_high, old_max,
+            new_sim.tests, new_sim.ticks / 1000.0, new_high, new_max,
+            (old_high != new_high || old_max != new_max) ? "  *" : "");
+
+        old_total += old_sim.ticks;
+        new_total += new_sim.ticks;
+        if (old_high != new_high || old_max != new_max) { mismatches++; }
+        count++;
+    }
+
+    printf("\n");
+    printf("Average time: old=%.1fs, new=%.1fs (%.0f%% faster)\n",
+        old_total / count / 1000.0, new_total / count / 1000.0,
+        100.0 * (1.0 - (new_total / old_total)));
+    printf("Brightness selections that differ: %d of %d\n", mismatches, count);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Host-side comparison of the number of sensor cycles taken by the target
+ * read, between the original fixed two reading average and the converging
+ * read loop at a range of convergence thresholds.
+ *
+ * Build and run from this directory with:
+ *   cc -O2 -o target-read-bench target-read-bench.c -lm
+ *   ./target-read-bench
+ *
+ * Each reading is modeled as the true value with normally distributed
+ * relative noise, swept across a range of noise levels. The read loop
+ * is mirrored from sensor_read_target(), and only counts the readings
+ * taken after the probe and any configuration change, since those are
+ * the same for every method.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+/* Constants mirrored from sensor.c and settings.h */
+#define SENSOR_TARGET_READ_ITERATIONS       2
+#define SENSOR_TARGET_READ_EXTRA_ITERATIONS 3
+#define SETTING_SAMPLING_COUNT_DEFAULT      2
+
+#define BENCH_TRIALS 100000
+
+static uint32_t bench_random_state = 0x2545F491UL;
+
+static float bench_random_uniform()
+{
+    /* xorshift32 */
+    bench_random_state ^= bench_random_state << 13;
+    bench_random_state ^= bench_random_state >> 17;
+    bench_random_state ^= bench_random_state << 5;
+    return ((float)(bench_random_state >> 8) + 0.5F) / (float)(1UL << 24);
+}
+
+static float bench_random_normal()
+{
+    /* Box-Muller transform */
+    const float u1 = bench_random_uniform();
+    const float u2 = bench_random_uniform();
+    return sqrtf(-2.0F * logf(u1)) * cosf(6.2831853F * u2);
+}
+
+/*
+ * Run the read loop once, returning the number of readings taken.
+ */
+static int bench_read(float noise, float convergence, float *result)
+{
+    const int min_count = SETTING_SAMPLING_COUNT_DEFAULT;
+    const int max_count = min_count + SENSOR_TARGET_READ_EXTRA_ITERATIONS;
+    float mean = 0;
+    float m2 = 0;
+    int count;
+
+    for (count = 0; count < max_count; ) {
+        const float value = 1.0F + noise * bench_random_normal();
+
+        count++;
+        float delta = value - mean;
+        mean += delta / (float)count;
+        m2 += delta * (value - mean);
+
+        if (count >= min_count) {
+            float sem = sqrtf(m2 / (float)((count - 1) * count));
+            if (sem <= mean * convergence) {
+                break;
+            }
+        }
+    }
+
+    *result = mean;
+    return count;
+}
+
+static void bench_run(const char *name, float noise, float convergence)
+{
+    long total = 0;
+    long capped = 0;
+    double err2 = 0;
+
+    for (int i = 0; i < BENCH_TRIALS; i++) {
+        float result;
+        const int count = bench_read(noise, convergence, &result);
+        total += count;
+        if (count == SETTING_SAMPLING_COUNT_DEFAULT + SENSOR_TARGET_READ_EXTRA_ITERATIONS) {
+            capped++;
+        }
+        /* Error in the density that would be reported */
+        const double density_err = log10((double)result);
+        err2 += density_err * density_err;
+    }
+
+    printf("  %-16s %6.2f cycles  %5.1f%% capped  %.4fD rms\n",
+        name,
+        (double)total / BENCH_TRIALS,
+        100.0 * (double)capped / BENCH_TRIALS,
+        sqrt(err2 / BENCH_TRIALS));
+}
+
+int main(void)
+{
+    static const float noise_levels[] = { 0.001F, 0.002F, 0.005F, 0.010F, 0.020F };
+
+    for (size_t i = 0; i < sizeof(noise_levels) / sizeof(noise_levels[0]); i++) {
+        const float noise = noise_levels[i];
+        printf("Noise %.1f%%:\n", noise * 100.0F);
+        bench_run("fixed (2)", noise, INFINITY);
+        bench_run("SEM <= 0.05%", noise, 0.0005F);
+        bench_run("SEM <= 0.5%", noise, 0.005F);
+        bench_run("SEM <= 1%", noise, 0.010F);
+    }
+
+    return 0;
+}